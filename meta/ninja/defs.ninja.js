@@ -58,6 +58,32 @@ for (const suffix of ["HOST", "TARGET"]) {
     declareOrAppend(`LDFLAGS_${suffix}`, "-flto");
   }
 
+  // Use 8-byte NaN-boxed JSValues on 64-bit hosts (always the case on
+  // 32-bit hosts). All code including quickjs.h must be built with the same
+  // setting, so shared library modules must be compiled with it too.
+  //
+  // NaN boxing requires the heap pointers to be below 2^48: the runtime
+  // reports the memory above that limit as out of memory. Targets whose
+  // allocator can return such addresses (57-bit virtual address spaces,
+  // tagged pointers) opt out with NAN_BOXING_<suffix> = "n", which takes
+  // precedence over CONFIG_NAN_BOXING=1.
+  if (
+    getVar(`NAN_BOXING_${suffix}`) !== "n" &&
+    (getVar(`NAN_BOXING_${suffix}`) === "y" ||
+      process.env.CONFIG_NAN_BOXING === "1")
+  ) {
+    declareOrAppend(`DEFINES_${suffix}`, "-DCONFIG_NAN_BOXING");
+  }
+
+  // Count the executed opcodes and opcode pairs, for profiling the
+  // interpreter. See getOpcodeStats in quickjs:engine.
+  if (
+    getVar(`OPCODE_STATS_${suffix}`) === "y" ||
+    process.env.CONFIG_OPCODE_STATS === "1"
+  ) {
+    declareOrAppend(`DEFINES_${suffix}`, "-DCONFIG_OPCODE_STATS");
+  }
+
   // qjsc searchdir for quickjs.h
   declareOrAppend(`DEFINES_${suffix}`, '-DCONFIG_PREFIX="\\"/usr/local\\""');
 
@@ -0,0 +1,5 @@
+// Target: linux (same arch as host), with 8-byte NaN-boxed JSValues
+
+require("./linux.ninja");
+
+declare("NAN_BOXING_TARGET", "y");
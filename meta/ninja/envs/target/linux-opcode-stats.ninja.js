@@ -0,0 +1,5 @@
+// Target: linux (same arch as host), counting the executed opcodes
+
+require("./linux.ninja");
+
+declare("OPCODE_STATS_TARGET", "y");
@@ -466,6 +466,139 @@ static JSValue js_engine_gc(JSContext *ctx, JSValueConst this_val,
     return JS_UNDEFINED;
 }
 
+static JSValue js_engine_getMallocArenaStats(JSContext *ctx, JSValueConst this_val,
+                                             int argc, JSValueConst *argv)
+{
+    JSMallocArenaStats stats[64];
+    JSValue ret, obj;
+    int i, count;
+
+    count = JS_GetMallocArenaStats(JS_GetRuntime(ctx), stats, (int)countof(stats));
+    if (count > (int)countof(stats))
+        count = (int)countof(stats);
+
+    ret = JS_NewArray(ctx);
+    if (JS_IsException(ret))
+        return JS_EXCEPTION;
+
+    for (i = 0; i < count; i++) {
+        JSMallocArenaStats *st = &stats[i];
+
+        obj = JS_NewObject(ctx);
+        if (JS_IsException(obj))
+            goto fail;
+        if (JS_SetPropertyUint32(ctx, ret, i, obj) < 0)
+            goto fail;
+
+        if (JS_SetPropertyStr(ctx, obj, "blockSize", JS_NewInt64(ctx, st->block_size)) < 0 ||
+            JS_SetPropertyStr(ctx, obj, "arenaCount", JS_NewInt64(ctx, st->arena_count)) < 0 ||
+            JS_SetPropertyStr(ctx, obj, "emptyArenaCount", JS_NewInt64(ctx, st->empty_arena_count)) < 0 ||
+            JS_SetPropertyStr(ctx, obj, "blockCount", JS_NewInt64(ctx, st->block_count)) < 0 ||
+            JS_SetPropertyStr(ctx, obj, "usedBlockCount", JS_NewInt64(ctx, st->used_block_count)) < 0 ||
+            JS_SetPropertyStr(ctx, obj, "fragmentation",
+                              JS_NewFloat64(ctx, st->block_count == 0 ? 0 :
+                                            1.0 - (double)st->used_block_count / st->block_count)) < 0) {
+            goto fail;
+        }
+    }
+    return ret;
+
+fail:
+    JS_FreeValue(ctx, ret);
+    return JS_EXCEPTION;
+}
+
+static JSValue js_engine_getOpcodeStats(JSContext *ctx, JSValueConst this_val,
+                                        int argc, JSValueConst *argv)
+{
+    return JS_GetOpcodeStats(ctx);
+}
+
+static JSValue js_engine_resetOpcodeStats(JSContext *ctx, JSValueConst this_val,
+                                          int argc, JSValueConst *argv)
+{
+    JS_ResetOpcodeStats(JS_GetRuntime(ctx));
+    return JS_UNDEFINED;
+}
+
+static JSValue js_engine_startCPUProfile(JSContext *ctx, JSValueConst this_val,
+                                         int argc, JSValueConst *argv)
+{
+    int32_t interval = 0;
+
+    if (argc >= 1 && !JS_IsUndefined(argv[0])) {
+        if (JS_ToInt32(ctx, &interval, argv[0]))
+            return JS_EXCEPTION;
+        if (interval <= 0) {
+            return JS_ThrowRangeError(ctx, "<internal>/quickjs-engine.c", __LINE__,
+                                      "startCPUProfile: interval must be a positive number of microseconds");
+        }
+    }
+    if (JS_StartCPUProfile(JS_GetRuntime(ctx), interval))
+        return JS_ThrowOutOfMemory(ctx);
+    return JS_UNDEFINED;
+}
+
+static JSValue js_engine_stopCPUProfile(JSContext *ctx, JSValueConst this_val,
+                                        int argc, JSValueConst *argv)
+{
+    int format = JS_CPU_PROFILE_FORMAT_CPUPROFILE;
+
+    if (argc >= 1 && !JS_IsUndefined(argv[0])) {
+        const char *str = JS_ToCString(ctx, argv[0]);
+        if (!str)
+            return JS_EXCEPTION;
+        if (!strcmp(str, "collapsed")) {
+            format = JS_CPU_PROFILE_FORMAT_COLLAPSED;
+        } else if (strcmp(str, "cpuprofile") != 0) {
+            JS_FreeCString(ctx, str);
+            return JS_ThrowTypeError(ctx, "<internal>/quickjs-engine.c", __LINE__,
+                                     "stopCPUProfile: format must be \"cpuprofile\" or \"collapsed\"");
+        }
+        JS_FreeCString(ctx, str);
+    }
+    return JS_StopCPUProfile(ctx, format);
+}
+
+static JSValue js_engine_startHeapSampling(JSContext *ctx, JSValueConst this_val,
+                                           int argc, JSValueConst *argv)
+{
+    int32_t interval = 0;
+
+    if (argc >= 1 && !JS_IsUndefined(argv[0])) {
+        if (JS_ToInt32(ctx, &interval, argv[0]))
+            return JS_EXCEPTION;
+        if (interval <= 0) {
+            return JS_ThrowRangeError(ctx, "<internal>/quickjs-engine.c", __LINE__,
+                                      "startHeapSampling: interval must be a positive number of bytes");
+        }
+    }
+    if (JS_StartHeapSampling(JS_GetRuntime(ctx), interval))
+        return JS_ThrowOutOfMemory(ctx);
+    return JS_UNDEFINED;
+}
+
+static JSValue js_engine_stopHeapSampling(JSContext *ctx, JSValueConst this_val,
+                                          int argc, JSValueConst *argv)
+{
+    int format = JS_HEAP_SAMPLING_FORMAT_HEAPPROFILE;
+
+    if (argc >= 1 && !JS_IsUndefined(argv[0])) {
+        const char *str = JS_ToCString(ctx, argv[0]);
+        if (!str)
+            return JS_EXCEPTION;
+        if (!strcmp(str, "collapsed")) {
+            format = JS_HEAP_SAMPLING_FORMAT_COLLAPSED;
+        } else if (strcmp(str, "heapprofile") != 0) {
+            JS_FreeCString(ctx, str);
+            return JS_ThrowTypeError(ctx, "<internal>/quickjs-engine.c", __LINE__,
+                                     "stopHeapSampling: format must be \"heapprofile\" or \"collapsed\"");
+        }
+        JS_FreeCString(ctx, str);
+    }
+    return JS_StopHeapSampling(ctx, format);
+}
+
 static JSValue js_engine_setStackFrameMapper(JSContext *ctx, JSValueConst this_val,
                                              int argc, JSValueConst *argv)
 {
@@ -625,6 +758,35 @@ static JSValue js_engine_printObject(JSContext *ctx, JSValueConst this_val,
     return JS_UNDEFINED;
 }
 
+static JSValue js_engine_writeHeapSnapshot(JSContext *ctx, JSValueConst this_val,
+                                           int argc, JSValueConst *argv)
+{
+    const char *filename;
+    FILE *f;
+    int ret, err;
+
+    filename = JS_ToCString(ctx, argv[0]);
+    if (!filename)
+        return JS_EXCEPTION;
+    f = fopen(filename, "w");
+    if (!f)
+        goto fail;
+    ret = JS_WriteHeapSnapshot(ctx, js_engine_print_value_write, f);
+    err = ferror(f);
+    if (fclose(f) || err) {
+        if (ret == 0)
+            goto fail;
+    }
+    JS_FreeCString(ctx, filename);
+    return ret < 0 ? JS_EXCEPTION : JS_UNDEFINED;
+
+fail:
+    JS_ThrowError(ctx, "<internal>/quickjs-engine.c", __LINE__, "%s (errno = %d, filename = %s)", strerror(errno), errno, filename);
+    JS_AddPropertyToException(ctx, "errno", JS_NewInt32(ctx, errno));
+    JS_FreeCString(ctx, filename);
+    return JS_EXCEPTION;
+}
+
 static const JSCFunctionListEntry js_engine_funcs[] = {
   JS_CFUNC_DEF("isMainModule", 1, js_engine_isMainModule ),
   JS_CFUNC_DEF("setMainModule", 1, js_engine_setMainModule ),
@@ -636,6 +798,14 @@ static const JSCFunctionListEntry js_engine_funcs[] = {
   JS_CFUNC_DEF("isModuleNamespace", 1, js_engine_isModuleNamespace ),
   JS_CFUNC_DEF("defineBuiltinModule", 2, js_engine_defineBuiltinModule ),
   JS_CFUNC_DEF("gc", 0, js_engine_gc ),
+  JS_CFUNC_DEF("getMallocArenaStats", 0, js_engine_getMallocArenaStats ),
+  JS_CFUNC_DEF("getOpcodeStats", 0, js_engine_getOpcodeStats ),
+  JS_CFUNC_DEF("resetOpcodeStats", 0, js_engine_resetOpcodeStats ),
+  JS_CFUNC_DEF("startCPUProfile", 1, js_engine_startCPUProfile ),
+  JS_CFUNC_DEF("stopCPUProfile", 1, js_engine_stopCPUProfile ),
+  JS_CFUNC_DEF("startHeapSampling", 1, js_engine_startHeapSampling ),
+  JS_CFUNC_DEF("stopHeapSampling", 1, js_engine_stopHeapSampling ),
+  JS_CFUNC_DEF("writeHeapSnapshot", 1, js_engine_writeHeapSnapshot ),
   JS_CFUNC_DEF("setStackFrameMapper", 1, js_engine_setStackFrameMapper ),
   JS_CFUNC_DEF("getStackFrameMapper", 0, js_engine_getStackFrameMapper ),
   JS_CFUNC_DEF("formatValue", 2, js_engine_formatValue ),
@@ -110,6 +110,125 @@ declare module "quickjs:engine" {
    */
   export function gc(): void;
 
+  /**
+   * Statistics of the engine's small block allocator for one block size.
+   */
+  export type MallocArenaStats = {
+    /** Size in bytes of the blocks, including the block header. */
+    blockSize: number;
+    /** Number of arenas (groups of blocks) currently allocated. */
+    arenaCount: number;
+    /** Number of allocated arenas without any used block. */
+    emptyArenaCount: number;
+    /** Number of blocks in the allocated arenas. */
+    blockCount: number;
+    /** Number of blocks in use. */
+    usedBlockCount: number;
+    /** Fraction of the blocks which are not in use, between 0 and 1. */
+    fragmentation: number;
+  };
+
+  /**
+   * Return the statistics of the engine's small block allocator, one entry
+   * per block size.
+   *
+   * Empty arenas are kept for reuse until the next full garbage collection,
+   * which returns them to the system allocator.
+   */
+  export function getMallocArenaStats(): Array<MallocArenaStats>;
+
+  /**
+   * Opcode execution counts of the runtime, keyed by opcode name.
+   */
+  export type OpcodeStats = {
+    /** Number of executions of each opcode. */
+    opcodes: { [name: string]: number };
+    /**
+     * Number of times the opcode `next` was executed right after the opcode
+     * `prev` in the same function call: `pairs[prev][next]`.
+     */
+    pairs: { [prev: string]: { [next: string]: number } };
+  };
+
+  /**
+   * Return the number of executions of each opcode and of each pair of
+   * consecutive opcodes since the runtime was created or
+   * {@link resetOpcodeStats} was called. Opcodes which were not executed
+   * are omitted.
+   *
+   * The counts are only collected when the engine is built with
+   * `CONFIG_OPCODE_STATS` (see the `linux-opcode-stats` target); otherwise
+   * this function returns `null`. Such builds also write the statistics as
+   * one line of JSON when the runtime is freed, appended to the file named
+   * by the `QUICKJS_OPCODE_STATS` environment variable, or to stderr if it
+   * is not set.
+   */
+  export function getOpcodeStats(): OpcodeStats | null;
+
+  /**
+   * Reset the counts returned by {@link getOpcodeStats} to zero.
+   */
+  export function resetOpcodeStats(): void;
+
+  /**
+   * Start the sampling CPU profiler. The JavaScript stack is sampled every
+   * `interval` microseconds of CPU time (1000 by default). The samples are
+   * taken when the engine polls for interrupts (on backward jumps and
+   * function calls), so the time spent in a native function is attributed
+   * to the JavaScript code that runs after it.
+   *
+   * A profile which is already running is discarded.
+   */
+  export function startCPUProfile(interval?: number): void;
+
+  /**
+   * Stop the CPU profiler and return the profile, or `null` if the profiler
+   * is not running.
+   *
+   * - `"cpuprofile"` (the default) returns the JSON text of a Chrome DevTools
+   *   `.cpuprofile` file.
+   * - `"collapsed"` returns one line per stack (`outer;inner count`), as used
+   *   by flame graph tools.
+   */
+  export function stopCPUProfile(
+    format?: "cpuprofile" | "collapsed"
+  ): string | null;
+
+  /**
+   * Start sampling the allocations. The JavaScript stack is recorded after
+   * every `interval` bytes allocated on average (32768 by default). Each
+   * sample stands for all the bytes allocated since the previous one, so
+   * the profile shows where the memory is allocated, not which allocations
+   * are still alive.
+   *
+   * A sampling which is already running is discarded.
+   */
+  export function startHeapSampling(interval?: number): void;
+
+  /**
+   * Stop sampling the allocations and return the profile, or `null` if the
+   * sampling is not running.
+   *
+   * - `"heapprofile"` (the default) returns the JSON text of a Chrome
+   *   DevTools `.heapprofile` file.
+   * - `"collapsed"` returns one line per stack (`outer;inner bytes`), as used
+   *   by flame graph tools.
+   */
+  export function stopHeapSampling(
+    format?: "heapprofile" | "collapsed"
+  ): string | null;
+
+  /**
+   * Run the garbage collector, then write a snapshot of the heap to the file
+   * `filename` in the Chrome DevTools `.heapsnapshot` format. It can be
+   * loaded in the "Memory" tab of the DevTools.
+   *
+   * The snapshot lists the objects, functions, bytecode, shapes and strings
+   * reachable from the contexts or from native code, with the references
+   * between them.
+   */
+  export function writeHeapSnapshot(filename: string): void;
+
   /**
    * A callback that translates the location of a stack frame as an error's
    * backtrace is built. See {@link setStackFrameMapper} for details.
@@ -135,6 +135,8 @@ typedef struct {
     JSWorkerMessagePipe *error_send_pipe; /* worker's write end of the error pipe */
     JSWorkerDoneSignal *worker_done_signal; /* signaling channel to wake the main thread on completion */
     int strip_flags;
+    BOOL lazy_functions;
+    char *code_cache_dir; /* NULL when the parent has no code cache */
 } WorkerFuncArgs;
 #endif
 
@@ -3657,9 +3659,11 @@ static void *worker_func(void *opaque)
         exit(1);
     }
     JS_SetStripInfo(rt, args->strip_flags);
+    JS_SetLazyFunctions(rt, args->lazy_functions);
     js_eventloop_init(rt);
 
     QJMS_InitState(rt);
+    QJMS_SetCodeCacheDir(rt, args->code_cache_dir);
 
     /* set the pipes to communicate with the parent */
     ts = JS_GetRuntimeOpaque(rt);
@@ -3742,6 +3746,7 @@ static void *worker_func(void *opaque)
     free(args->filename);
     free(args->basename);
     free(args->override_code);
+    free(args->code_cache_dir);
     free(args);
 
     js_eventloop_run(ctx);
@@ -3974,6 +3979,12 @@ static JSValue js_worker_ctor(JSContext *ctx, JSValueConst new_target,
         goto oom_fail;
 
     args->strip_flags = JS_GetStripInfo(rt);
+    args->lazy_functions = JS_GetLazyFunctions(rt);
+    if (QJMS_GetCodeCacheDir(rt)) {
+        args->code_cache_dir = strdup(QJMS_GetCodeCacheDir(rt));
+        if (!args->code_cache_dir)
+            goto oom_fail;
+    }
 
     obj = js_worker_ctor_internal(ctx, new_target,
                                   args->send_pipe, args->recv_pipe,
@@ -4027,6 +4038,7 @@ static JSValue js_worker_ctor(JSContext *ctx, JSValueConst new_target,
         free(args->filename);
         free(args->basename);
         free(args->override_code);
+        free(args->code_cache_dir);
         /* Release the initialData SABs we refcounted above (mirrors
            js_free_message), then free the serialized payload. */
         {
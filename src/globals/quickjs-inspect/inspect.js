@@ -19,6 +19,8 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
 (function () {
+  "use strict";
+
   /** @typedef {String|Symbol} Key */
 
   /**
@@ -775,5 +777,7 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 
   inspect.custom = Symbol("inspect.custom");
 
-  globalThis.inspect = inspect;
+  // the completion value of this script is the value of the 'inspect'
+  // global, see quickjs-inspect.c
+  return inspect;
 })();
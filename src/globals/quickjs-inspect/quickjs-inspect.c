@@ -1,17 +1,50 @@
 #include "quickjs-inspect.h"
-#include "quickjs-modulesys.h"
 
 extern const uint8_t qjsc_inspect[];
 extern const uint32_t qjsc_inspect_size;
 
-int js_inspect_add_inspect_global(JSContext *ctx)
+/* inspect.js is only evaluated the first time the 'inspect' global is
+   accessed: its completion value is the inspect function. Most short-lived
+   programs never use it, and it is the most expensive part of the
+   context initialization. */
+static JSValue js_inspect_autoinit(JSContext *ctx, JSValueConst this_obj,
+                                   JSAtom prop)
 {
-  int ret;
+  JSValue func_val, ret;
   JSSyntheticStackFrame *ssf;
 
-  ssf = JS_PushSyntheticStackFrame(ctx, "js_inspect_add_inspect_global", "quickjs-inspect.c", __LINE__, 0);
+  ssf = JS_PushSyntheticStackFrame(ctx, "js_inspect_autoinit", "quickjs-inspect.c", __LINE__, 0);
+
+  func_val = JS_ReadObject(ctx, qjsc_inspect, qjsc_inspect_size,
+                           JS_READ_OBJ_BYTECODE);
+  if (JS_IsException(func_val)) {
+    ret = JS_EXCEPTION;
+  } else {
+    ret = JS_EvalFunction(ctx, func_val);
+  }
 
-  ret = QJMS_EvalBinary(ctx, qjsc_inspect, qjsc_inspect_size, 0, NULL);
   JS_PopSyntheticStackFrame(ctx, ssf);
   return ret;
 }
+
+int js_inspect_add_inspect_global(JSContext *ctx)
+{
+  JSValue global_obj;
+  JSAtom inspect_atom;
+  int ret;
+
+  global_obj = JS_GetGlobalObject(ctx);
+  inspect_atom = JS_NewAtom(ctx, "inspect");
+  if (inspect_atom == JS_ATOM_NULL) {
+    JS_FreeValue(ctx, global_obj);
+    return -1;
+  }
+
+  ret = JS_DefinePropertyAutoInit(ctx, global_obj, inspect_atom,
+                                  js_inspect_autoinit,
+                                  JS_PROP_WRITABLE | JS_PROP_ENUMERABLE |
+                                  JS_PROP_CONFIGURABLE);
+  JS_FreeAtom(ctx, inspect_atom);
+  JS_FreeValue(ctx, global_obj);
+  return ret < 0 ? -1 : 0;
+}
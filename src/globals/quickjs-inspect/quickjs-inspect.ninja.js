@@ -17,7 +17,7 @@ const inspect_c = build({
   rule: "qjsc-minimal",
   inputs: [rel("inspect.js")],
   ruleVariables: {
-    qjsc_args: `-c -m`,
+    qjsc_args: `-c`,
   },
 });
 
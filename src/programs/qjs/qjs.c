@@ -232,6 +232,46 @@ static size_t get_suffixed_size(const char *str)
     return v;
 }
 
+/* stop the CPU profiler started by --cpu-prof and write its result */
+static int write_cpu_profile(JSContext *ctx, const char *filename)
+{
+    size_t len = strlen(filename);
+    int format = JS_CPU_PROFILE_FORMAT_COLLAPSED;
+    const char *str;
+    size_t str_len;
+    JSValue val;
+    FILE *f;
+    int ret = -1;
+
+    if ((len >= 11 && !strcmp(filename + len - 11, ".cpuprofile")) ||
+        (len >= 5 && !strcmp(filename + len - 5, ".json")))
+        format = JS_CPU_PROFILE_FORMAT_CPUPROFILE;
+    val = JS_StopCPUProfile(ctx, format);
+    if (JS_IsException(val)) {
+        QJU_PrintException(ctx, stderr);
+        return -1;
+    }
+    str = JS_ToCStringLen(ctx, &str_len, val);
+    JS_FreeValue(ctx, val);
+    if (!str) {
+        QJU_PrintException(ctx, stderr);
+        return -1;
+    }
+    f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "qjs: cannot open '%s': %s\n", filename, strerror(errno));
+    } else {
+        if (fwrite(str, 1, str_len, f) == str_len)
+            ret = 0;
+        if (fclose(f) != 0)
+            ret = -1;
+        if (ret)
+            fprintf(stderr, "qjs: cannot write '%s'\n", filename);
+    }
+    JS_FreeCString(ctx, str);
+    return ret;
+}
+
 #define PROG_NAME "qjs"
 
 void help(void)
@@ -251,8 +291,14 @@ void help(void)
            "    --memory-limit n  limit the memory usage to 'n' bytes (SI suffixes allowed)\n"
            "    --stack-size n    limit the stack size to 'n' bytes (SI suffixes allowed)\n"
            "    --no-unhandled-rejection  ignore unhandled promise rejections\n"
+           "    --cpu-prof file   write a CPU profile to 'file' (Chrome .cpuprofile\n"
+           "                      if it ends with .cpuprofile or .json, collapsed\n"
+           "                      stacks otherwise)\n"
+           "    --cpu-prof-interval n  CPU profile sampling interval in microseconds\n"
            "-s                    strip all the debug info\n"
            "    --strip-source    strip the source code\n"
+           "    --lazy-functions  compile the inner functions at their first call\n"
+           "    --code-cache dir  cache the bytecode of imported modules in 'dir'\n"
            "-q  --quit         just instantiate the interpreter and quit\n");
     exit(1);
 }
@@ -277,7 +323,11 @@ int main(int argc, char **argv)
     int i, include_count = 0;
     size_t stack_size = 0;
     int strip_flags = 0;
+    int lazy_functions = 0;
+    const char *code_cache_dir = NULL;
     int exit_status = 0;
+    const char *cpu_prof_filename = NULL;
+    int cpu_prof_interval = 0;
 
     /* cannot use getopt because we want to pass the command line to
        the script */
@@ -372,6 +422,22 @@ int main(int argc, char **argv)
                 memory_limit = get_suffixed_size(argv[optind++]);
                 continue;
             }
+            if (!strcmp(longopt, "cpu-prof")) {
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting filename");
+                    exit(1);
+                }
+                cpu_prof_filename = argv[optind++];
+                continue;
+            }
+            if (!strcmp(longopt, "cpu-prof-interval")) {
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting sampling interval");
+                    exit(1);
+                }
+                cpu_prof_interval = atoi(argv[optind++]);
+                continue;
+            }
             if (!strcmp(longopt, "stack-size")) {
                 if (optind >= argc) {
                     fprintf(stderr, "expecting stack size");
@@ -388,6 +454,18 @@ int main(int argc, char **argv)
                 strip_flags = JS_STRIP_SOURCE;
                 continue;
             }
+            if (!strcmp(longopt, "lazy-functions")) {
+                lazy_functions = 1;
+                continue;
+            }
+            if (!strcmp(longopt, "code-cache")) {
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting directory");
+                    exit(1);
+                }
+                code_cache_dir = argv[optind++];
+                continue;
+            }
             if (opt) {
                 fprintf(stderr, "qjs: unknown option '-%c'\n", opt);
             } else {
@@ -412,6 +490,7 @@ int main(int argc, char **argv)
     if (stack_size != 0)
         JS_SetMaxStackSize(rt, stack_size);
     JS_SetStripInfo(rt, strip_flags);
+    JS_SetLazyFunctions(rt, lazy_functions);
     js_os_set_worker_new_context_func(JS_NewCustomContext);
     js_eventloop_init(rt);
     JS_SetCanBlock(rt, TRUE);
@@ -423,11 +502,20 @@ int main(int argc, char **argv)
 
     /* loader for ES6 modules */
     QJMS_InitState(rt);
+    if (code_cache_dir)
+        QJMS_SetCodeCacheDir(rt, code_cache_dir);
 
     if (dump_unhandled_promise_rejection) {
         JS_SetHostPromiseRejectionTracker(rt, qju_eventloop_promise_rejection_tracker, NULL);
     }
 
+    if (cpu_prof_filename) {
+        if (JS_StartCPUProfile(rt, cpu_prof_interval)) {
+            fprintf(stderr, "qjs: cannot start the CPU profiler\n");
+            exit(2);
+        }
+    }
+
     if (!empty_run) {
         js_cmdline_add_scriptArgs(ctx, argc, argv);
         if (QJMS_InitContext(ctx, TRUE)) {
@@ -494,11 +582,20 @@ int main(int argc, char **argv)
         }
     }
 
+    if (cpu_prof_filename) {
+        if (write_cpu_profile(ctx, cpu_prof_filename) && exit_status == 0)
+            exit_status = 1;
+    }
+
     if (dump_memory) {
         JSMemoryUsage stats;
         JS_ComputeMemoryUsage(rt, &stats);
         JS_DumpMemoryUsage(stdout, &stats, rt);
     }
+    /* the process exits next: release the runtime memory in bulk
+       unless the memory usage is being inspected */
+    if (!trace_memory && !dump_memory)
+        JS_SetFastTeardown(rt, TRUE);
     js_eventloop_free(rt);
     QJMS_FreeState(rt);
     JS_FreeContext(ctx);
@@ -530,6 +627,10 @@ int main(int argc, char **argv)
     }
     return exit_status;
  fail:
+    if (cpu_prof_filename)
+        write_cpu_profile(ctx, cpu_prof_filename);
+    if (!trace_memory && !dump_memory)
+        JS_SetFastTeardown(rt, TRUE);
     js_eventloop_free(rt);
     QJMS_FreeState(rt);
     JS_FreeContext(ctx);
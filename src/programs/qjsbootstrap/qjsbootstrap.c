@@ -29,6 +29,12 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
+#if defined(CONFIG_BYTECODE) && !defined(_WIN32) && !defined(__wasi__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#define USE_MMAP
+#endif
 #include "execpath.h"
 #include "cutils.h"
 #include "quickjs-utils.h"
@@ -109,6 +115,44 @@ static uint8_t *read_section(char *filename, off_t offset, off_t len)
   return data;
 }
 
+#ifdef USE_MMAP
+/* Map the appended bytecode instead of reading it, so that the loaded
+   functions reference their bytecode in place. The mapping is private
+   and writable because JS_ReadObject relocates the atoms of the
+   bytecode in it: only the pages it writes are copied, the others stay
+   shared with the page cache. Returns NULL if the file could not be
+   mapped. */
+static uint8_t *map_section(char *filename, off_t offset, off_t len,
+                            void **map_base, size_t *map_len)
+{
+  int fd;
+  long page_size;
+  off_t map_offset;
+  void *ptr;
+
+  page_size = sysconf(_SC_PAGESIZE);
+  if (page_size <= 0) {
+    return NULL;
+  }
+  map_offset = offset - (offset % page_size);
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  ptr = mmap(NULL, len + (offset - map_offset), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE, fd, map_offset);
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    return NULL;
+  }
+
+  *map_base = ptr;
+  *map_len = len + (offset - map_offset);
+  return (uint8_t *)ptr + (offset - map_offset);
+}
+#endif
+
 static void define_qjsbootstrap_offset(JSContext *ctx)
 {
   JSValue global;
@@ -141,7 +185,12 @@ int main(int argc, char **argv)
   off_t base_len;
   off_t file_len;
   off_t appended_code_len;
-  uint8_t *appended_code;
+  uint8_t *appended_code = NULL;
+  BOOL appended_code_mapped = FALSE;
+#ifdef USE_MMAP
+  void *map_base;
+  size_t map_len;
+#endif
   char execpath_error[2048];
   int exit_status;
 
@@ -171,7 +220,14 @@ int main(int argc, char **argv)
     return 0;
   }
 
-  appended_code = read_section(self_binary_path, base_len, appended_code_len);
+#ifdef USE_MMAP
+  appended_code = map_section(self_binary_path, base_len, appended_code_len,
+                              &map_base, &map_len);
+  appended_code_mapped = appended_code != NULL;
+#endif
+  if (appended_code == NULL) {
+    appended_code = read_section(self_binary_path, base_len, appended_code_len);
+  }
   if (appended_code == NULL) {
     printf("failed to read appended code: %s\n", strerror(errno));
     return 1;
@@ -205,9 +261,18 @@ int main(int argc, char **argv)
      Without this, imports in the bytecoded module would resolve
      relative to whatever filename was baked in at compile time
      (typically just the source's basename), and `./foo` / `../bar`
-     style imports would fail. */
-  if (QJMS_EvalBinaryAsync(ctx, appended_code, appended_code_len, 0,
-                           self_binary_path)) {
+     style imports would fail.
+
+     When the bytecode is mapped, the mapping outlives the runtime so the
+     functions can reference their bytecode in place. */
+  if (appended_code_mapped) {
+    exit_status = QJMS_EvalROMBinaryAsync(ctx, appended_code, appended_code_len,
+                                          0, self_binary_path);
+  } else {
+    exit_status = QJMS_EvalBinaryAsync(ctx, appended_code, appended_code_len,
+                                       0, self_binary_path);
+  }
+  if (exit_status) {
     free(self_binary_path);
     return 1;
   }
@@ -226,10 +291,19 @@ int main(int argc, char **argv)
     exit_status = 1;
   }
 
+  /* the process exits next: release the runtime memory in bulk */
+  JS_SetFastTeardown(rt, TRUE);
   QJMS_FreeState(rt);
   JS_FreeContext(ctx);
   js_eventloop_free(rt);
   JS_FreeRuntime(rt);
+  if (appended_code_mapped) {
+#ifdef USE_MMAP
+    munmap(map_base, map_len);
+#endif
+  } else {
+    free(appended_code);
+  }
   free(self_binary_path);
 
   return exit_status;
@@ -104,6 +104,8 @@ int main(int argc, char **argv)
     exit_status = 1;
   }
 cleanup:
+  /* the process exits next: release the runtime memory in bulk */
+  JS_SetFastTeardown(rt, TRUE);
   QJMS_FreeState(rt);
   js_eventloop_free(rt);
   JS_FreeContext(ctx);
@@ -42,6 +42,10 @@
 #endif
 #include "quickjs-utils.h"
 
+/* maximum duration of the cycle collection done at each loop
+   iteration */
+#define JS_EVENTLOOP_GC_STEP_US 1000
+
 /* Global state */
 uint64_t js_pending_signals = 0;
 int (*js_poll_func)(JSContext *ctx) = NULL;
@@ -539,6 +543,10 @@ int js_eventloop_run(JSContext *ctx)
 
         js_eventloop_promise_rejection_check(ctx);
 
+        /* look for garbage cycles between two event handlers instead
+           of in a single long pause */
+        JS_RunGCStep(rt, JS_EVENTLOOP_GC_STEP_US);
+
         if (!js_poll_func || js_poll_func(ctx))
             break;
     }
@@ -1,7 +1,13 @@
+#include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <assert.h>
 #include <string.h>
 #include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
 #if !defined(_WIN32) && defined(CONFIG_SHARED_LIBRARY_MODULES)
 #include <dlfcn.h>
 #endif
@@ -33,6 +39,9 @@ typedef struct QJMS_State {
      qjs/quickjs-run exit-code propagation stays intact for callers that
      never register a custom callback. */
   void (*entry_module_rejection_callback)(JSContext *ctx, JSValueConst reason);
+  /* Directory of the on-disk compiled-module cache, or NULL when the
+     cache is disabled. See QJMS_SetCodeCacheDir. */
+  char *code_cache_dir;
 } QJMS_State;
 
 static char *QJMS_NormalizeModuleName(JSContext *ctx, const char *base_name,
@@ -66,12 +75,15 @@ void QJMS_InitState(JSRuntime *rt)
   state->main_module = main_module;
   state->entry_module_rejected = FALSE;
   state->entry_module_rejection_callback = NULL;
+  state->code_cache_dir = NULL;
 
   JS_SetModuleLoaderFunc2(rt,
                           (JSModuleNormalizeFunc2 *) QJMS_NormalizeModuleName,
                           (JSModuleLoaderFunc2 *) QJMS_ModuleLoader,
                           qjms_module_check_attributes,
                           (void *) state);
+
+  QJMS_SetCodeCacheDir(rt, getenv("QUICKJS_CODE_CACHE"));
 }
 
 void QJMS_FreeState(JSRuntime *rt)
@@ -86,6 +98,9 @@ void QJMS_FreeState(JSRuntime *rt)
   if (state->main_module != NULL) {
     js_free_rt(rt, state->main_module);
   }
+  if (state->code_cache_dir != NULL) {
+    js_free_rt(rt, state->code_cache_dir);
+  }
   js_free_rt(rt, state);
 }
 
@@ -113,6 +128,44 @@ void QJMS_SetTopLevelRejectionCallback(
   state->entry_module_rejection_callback = cb;
 }
 
+int QJMS_SetCodeCacheDir(JSRuntime *rt, const char *dir)
+{
+  QJMS_State *state;
+  char *new_dir = NULL;
+  size_t len;
+
+  state = (QJMS_State *) JS_GetModuleLoaderOpaque(rt);
+  if (state == NULL) {
+    return -1;
+  }
+
+  if (dir != NULL && dir[0] != '\0') {
+    len = strlen(dir);
+    new_dir = js_malloc_rt(rt, len + 1);
+    if (new_dir == NULL) {
+      return -1;
+    }
+    memcpy(new_dir, dir, len + 1);
+  }
+
+  if (state->code_cache_dir != NULL) {
+    js_free_rt(rt, state->code_cache_dir);
+  }
+  state->code_cache_dir = new_dir;
+  return 0;
+}
+
+const char *QJMS_GetCodeCacheDir(JSRuntime *rt)
+{
+  QJMS_State *state;
+
+  state = (QJMS_State *) JS_GetModuleLoaderOpaque(rt);
+  if (state == NULL) {
+    return NULL;
+  }
+  return state->code_cache_dir;
+}
+
 JSValue QJMS_GetModuleLoaderInternals(JSContext *ctx)
 {
   JSValue ctx_opaque_val, internals;
@@ -467,6 +520,279 @@ static JSModuleDef *QJMS_ModuleLoader_so(JSContext *ctx,
 #endif /* _WIN32 or CONFIG_SHARED_LIBRARY_MODULES */
 }
 
+/* On-disk compiled-module cache.
+
+   Each module gets one file in the cache directory, named after a hash
+   of its module name. The file holds:
+
+     magic (8 bytes)
+     key length (u32) and key
+     bytecode length (u64) and bytecode hash (u64)
+     bytecode (JS_WriteObject output)
+
+   The key records everything the bytecode depends on: the bytecode
+   version and build id of the engine, the runtime's strip and
+   lazy-function settings, the module name, the mtime and size of the
+   module file and a hash of the source text. An entry is only used
+   when its key is byte-for-byte equal to the one computed for the
+   current load; anything else (including a truncated or corrupted
+   file) falls back to a normal parse, and the entry is rewritten after
+   it. Cache errors are never reported: the cache is purely an
+   optimization. */
+
+#define QJMS_CODE_CACHE_MAGIC "QJMSCC01"
+#define QJMS_CODE_CACHE_MAGIC_LEN 8
+
+/* 64 bit FNV-1a */
+static uint64_t qjms_hash64(uint64_t h, const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+#define QJMS_HASH64_INIT 0xcbf29ce484222325ULL
+
+static char *qjms_code_cache_path(JSContext *ctx, QJMS_State *state,
+                                  const char *module_name)
+{
+  uint64_t h;
+  size_t dir_len;
+  char *path;
+
+  h = qjms_hash64(QJMS_HASH64_INIT, module_name, strlen(module_name));
+  dir_len = strlen(state->code_cache_dir);
+  /* dir + '/' + 16 hex digits + ".qjbc" + '\0' */
+  path = js_malloc(ctx, dir_len + 1 + 16 + 5 + 1);
+  if (!path) {
+    return NULL;
+  }
+  snprintf(path, dir_len + 1 + 16 + 5 + 1, "%s/%016" PRIx64 ".qjbc",
+           state->code_cache_dir, h);
+  return path;
+}
+
+static int qjms_code_cache_key(JSContext *ctx, DynBuf *key,
+                               const char *module_name,
+                               const char *buf, size_t buf_len)
+{
+  JSRuntime *rt = JS_GetRuntime(ctx);
+  struct stat st;
+  int64_t mtime = -1, size = -1;
+
+  if (stat(module_name, &st) == 0) {
+    mtime = st.st_mtime;
+    size = st.st_size;
+  }
+
+  dbuf_put_u32(key, JS_GetBytecodeVersion());
+  dbuf_putstr(key, JS_GetBuildId());
+  dbuf_putc(key, '\0');
+  dbuf_put_u32(key, JS_GetStripInfo(rt));
+  dbuf_putc(key, JS_GetLazyFunctions(rt));
+  dbuf_putstr(key, module_name);
+  dbuf_putc(key, '\0');
+  dbuf_put_u64(key, mtime);
+  dbuf_put_u64(key, size);
+  dbuf_put_u64(key, buf_len);
+  dbuf_put_u64(key, qjms_hash64(QJMS_HASH64_INIT, buf, buf_len));
+  return key->error ? -1 : 0;
+}
+
+/* Returns the module function read from the cache, or JS_UNDEFINED if
+   there is no usable entry. Never throws. */
+static JSValue qjms_code_cache_read(JSContext *ctx, const char *path,
+                                    const DynBuf *key)
+{
+  uint8_t *data;
+  size_t data_len, pos;
+  uint32_t key_len;
+  uint64_t bc_len, bc_hash;
+  JSValue func_val = JS_UNDEFINED;
+
+  data = QJU_ReadFile(ctx, &data_len, path);
+  if (!data) {
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    return JS_UNDEFINED;
+  }
+
+  pos = QJMS_CODE_CACHE_MAGIC_LEN;
+  if (data_len < pos + sizeof(key_len) ||
+      memcmp(data, QJMS_CODE_CACHE_MAGIC, QJMS_CODE_CACHE_MAGIC_LEN)) {
+    goto done;
+  }
+  memcpy(&key_len, data + pos, sizeof(key_len));
+  pos += sizeof(key_len);
+  if (key_len != key->size || data_len - pos < key_len ||
+      memcmp(data + pos, key->buf, key_len)) {
+    goto done;
+  }
+  pos += key_len;
+  if (data_len - pos < sizeof(bc_len) + sizeof(bc_hash)) {
+    goto done;
+  }
+  memcpy(&bc_len, data + pos, sizeof(bc_len));
+  pos += sizeof(bc_len);
+  memcpy(&bc_hash, data + pos, sizeof(bc_hash));
+  pos += sizeof(bc_hash);
+  if (bc_len != data_len - pos ||
+      bc_hash != qjms_hash64(QJMS_HASH64_INIT, data + pos, bc_len)) {
+    goto done;
+  }
+
+  func_val = JS_ReadObject(ctx, data + pos, bc_len, JS_READ_OBJ_BYTECODE);
+  if (JS_IsException(func_val)) {
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    func_val = JS_UNDEFINED;
+  } else if (JS_VALUE_GET_TAG(func_val) != JS_TAG_MODULE) {
+    JS_FreeValue(ctx, func_val);
+    func_val = JS_UNDEFINED;
+  }
+ done:
+  js_free(ctx, data);
+  return func_val;
+}
+
+/* Create and open a new file named after 'path' with a unique suffix.
+   The name is returned in 'tmp_path'. */
+static FILE *qjms_code_cache_open_tmp(char *tmp_path, size_t tmp_path_len,
+                                      const char *path)
+{
+  FILE *f;
+  int fd;
+
+  snprintf(tmp_path, tmp_path_len, "%s.XXXXXX", path);
+#if defined(_WIN32)
+  if (_mktemp(tmp_path) == NULL) {
+    return NULL;
+  }
+  fd = _open(tmp_path, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY,
+             _S_IREAD | _S_IWRITE);
+#else
+  fd = mkstemp(tmp_path);
+#endif
+  if (fd < 0) {
+    return NULL;
+  }
+  f = fdopen(fd, "wb");
+  if (!f) {
+    close(fd);
+    remove(tmp_path);
+  }
+  return f;
+}
+
+static void qjms_code_cache_write(JSContext *ctx, QJMS_State *state,
+                                  const char *path, const DynBuf *key,
+                                  JSValueConst func_val)
+{
+  uint8_t *bc;
+  size_t bc_len, tmp_path_len;
+  uint32_t key_len;
+  uint64_t bc_len64, bc_hash;
+  char *tmp_path;
+  FILE *f;
+  BOOL ok;
+
+  bc = JS_WriteObject(ctx, &bc_len, func_val, JS_WRITE_OBJ_BYTECODE);
+  if (!bc) {
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    return;
+  }
+
+  /* write to a temporary file then rename it, so that concurrent
+     processes and threads never see a partially written entry */
+  tmp_path_len = strlen(path) + 8;
+  tmp_path = js_malloc(ctx, tmp_path_len);
+  if (!tmp_path) {
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    js_free(ctx, bc);
+    return;
+  }
+
+  f = qjms_code_cache_open_tmp(tmp_path, tmp_path_len, path);
+  if (!f) {
+    /* the cache directory may not exist yet */
+#if defined(_WIN32)
+    mkdir(state->code_cache_dir);
+#else
+    mkdir(state->code_cache_dir, 0777);
+#endif
+    f = qjms_code_cache_open_tmp(tmp_path, tmp_path_len, path);
+  }
+  if (f) {
+    key_len = key->size;
+    bc_len64 = bc_len;
+    bc_hash = qjms_hash64(QJMS_HASH64_INIT, bc, bc_len);
+    ok = fwrite(QJMS_CODE_CACHE_MAGIC, 1, QJMS_CODE_CACHE_MAGIC_LEN, f) ==
+           QJMS_CODE_CACHE_MAGIC_LEN &&
+      fwrite(&key_len, sizeof(key_len), 1, f) == 1 &&
+      fwrite(key->buf, 1, key->size, f) == key->size &&
+      fwrite(&bc_len64, sizeof(bc_len64), 1, f) == 1 &&
+      fwrite(&bc_hash, sizeof(bc_hash), 1, f) == 1 &&
+      fwrite(bc, 1, bc_len, f) == bc_len;
+    if (fclose(f) != 0) {
+      ok = FALSE;
+    }
+#if defined(_WIN32)
+    /* rename() does not replace an existing file on windows */
+    if (ok) {
+      remove(path);
+    }
+#endif
+    if (!ok || rename(tmp_path, path) != 0) {
+      remove(tmp_path);
+    }
+  }
+  js_free(ctx, tmp_path);
+  js_free(ctx, bc);
+}
+
+/* Compile the source of a module, going through the code cache when it
+   is enabled. */
+static JSValue qjms_compile_module(JSContext *ctx, QJMS_State *state,
+                                   const char *module_name,
+                                   const char *buf, size_t buf_len)
+{
+  JSValue func_val;
+  DynBuf key;
+  char *path;
+
+  if (state->code_cache_dir == NULL) {
+    return JS_Eval(ctx, buf, buf_len, module_name,
+                   JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+  }
+
+  path = qjms_code_cache_path(ctx, state, module_name);
+  if (!path) {
+    return JS_EXCEPTION;
+  }
+  dbuf_init(&key);
+  if (qjms_code_cache_key(ctx, &key, module_name, buf, buf_len)) {
+    dbuf_free(&key);
+    js_free(ctx, path);
+    return JS_ThrowOutOfMemory(ctx);
+  }
+
+  func_val = qjms_code_cache_read(ctx, path, &key);
+  if (JS_IsUndefined(func_val)) {
+    func_val = JS_Eval(ctx, buf, buf_len, module_name,
+                       JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+    if (!JS_IsException(func_val)) {
+      qjms_code_cache_write(ctx, state, path, &key, func_val);
+    }
+  }
+
+  dbuf_free(&key);
+  js_free(ctx, path);
+  return func_val;
+}
+
 static JSModuleDef *QJMS_ModuleLoader(JSContext *ctx, const char *module_name,
                                       QJMS_State *state,
                                       JSValueConst attributes)
@@ -541,8 +867,7 @@ static JSModuleDef *QJMS_ModuleLoader(JSContext *ctx, const char *module_name,
       }
 
       /* compile the module */
-      func_val = JS_Eval(ctx, buf, buf_len, module_name,
-                         JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+      func_val = qjms_compile_module(ctx, state, module_name, buf, buf_len);
 
       JS_FreeCString(ctx, buf);
       JS_FreeValue(ctx, result);
@@ -561,8 +886,7 @@ static JSModuleDef *QJMS_ModuleLoader(JSContext *ctx, const char *module_name,
       }
 
       /* compile the module */
-      func_val = JS_Eval(ctx, buf, buf_len, module_name,
-                         JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+      func_val = qjms_compile_module(ctx, state, module_name, buf, buf_len);
 
       js_free(ctx, buf);
     }
@@ -789,14 +1113,17 @@ int QJMS_EvalFileAsync(JSContext *ctx, const char *filename, int module, int str
    is a module, replace the module's stored name with filename_override
    before resolving its imports. Used by embedders (e.g. qjsbootstrap-bytecode)
    that need relative-import resolution anchored at a runtime path
-   rather than the name baked in at compile time. */
+   rather than the name baked in at compile time.
+
+   read_flags are passed to JS_ReadObject in addition to
+   JS_READ_OBJ_BYTECODE. */
 static int qjms_eval_binary_impl(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                                  int load_only, BOOL is_async,
-                                 const char *filename_override)
+                                 const char *filename_override, int read_flags)
 {
     JSValue obj, val;
     BOOL attach_handler = FALSE;
-    obj = JS_ReadObject(ctx, buf, buf_len, JS_READ_OBJ_BYTECODE);
+    obj = JS_ReadObject(ctx, buf, buf_len, JS_READ_OBJ_BYTECODE | read_flags);
     if (JS_IsException(obj)) {
       goto exception;
     }
@@ -849,14 +1176,22 @@ int QJMS_EvalBinary(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                     int load_only, const char *filename_override)
 {
     return qjms_eval_binary_impl(ctx, buf, buf_len, load_only,
-                                 /*is_async=*/FALSE, filename_override);
+                                 /*is_async=*/FALSE, filename_override, 0);
 }
 
 int QJMS_EvalBinaryAsync(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                          int load_only, const char *filename_override)
 {
     return qjms_eval_binary_impl(ctx, buf, buf_len, load_only,
-                                 /*is_async=*/TRUE, filename_override);
+                                 /*is_async=*/TRUE, filename_override, 0);
+}
+
+int QJMS_EvalROMBinaryAsync(JSContext *ctx, const uint8_t *buf, size_t buf_len,
+                            int load_only, const char *filename_override)
+{
+    return qjms_eval_binary_impl(ctx, buf, buf_len, load_only,
+                                 /*is_async=*/TRUE, filename_override,
+                                 JS_READ_OBJ_ROM_DATA | JS_READ_OBJ_IN_PLACE);
 }
 
 /*
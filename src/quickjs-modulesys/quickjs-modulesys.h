@@ -22,6 +22,25 @@ int QJMS_InitContext(JSContext *ctx, int set_require_global);
 /* free resources allocated by the module loader system */
 void QJMS_FreeState(JSRuntime *rt);
 
+/*
+  Enable the on-disk compiled-module cache: modules loaded through the
+  module loader are compiled once, and their bytecode is written to a file
+  in `dir` (created if missing). Later loads of the same module read the
+  bytecode back instead of parsing the source, as long as the engine
+  version, the strip/lazy-function settings, the module file's mtime and
+  size, and the source text are unchanged.
+
+  Pass NULL to disable the cache. QJMS_InitState initializes it from the
+  QUICKJS_CODE_CACHE environment variable.
+
+  Returns -1 if the module loader system is not initialized or on
+  allocation failure.
+*/
+int QJMS_SetCodeCacheDir(JSRuntime *rt, const char *dir);
+
+/* the directory set by QJMS_SetCodeCacheDir, or NULL */
+const char *QJMS_GetCodeCacheDir(JSRuntime *rt);
+
 /*
   Affects the value of import.meta.main.
 */
@@ -120,6 +139,17 @@ int QJMS_EvalBinary(JSContext *ctx, const uint8_t *buf, size_t buf_len,
 int QJMS_EvalBinaryAsync(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                          int load_only, const char *filename_override);
 
+/*
+  Like QJMS_EvalBinaryAsync, but the bytecode is read with
+  JS_READ_OBJ_ROM_DATA | JS_READ_OBJ_IN_PLACE: functions reference their
+  bytecode in `buf` instead of copying it, and its atoms are relocated
+  in `buf`. `buf` must therefore be writable, must stay valid until the
+  runtime is freed (for example a private mapping of the file holding
+  it), and can only be evaluated once.
+*/
+int QJMS_EvalROMBinaryAsync(JSContext *ctx, const uint8_t *buf, size_t buf_len,
+                            int load_only, const char *filename_override);
+
 /* the internal behavior of the 'require' function, exposed as a C API.
    `attributes` is the import-attributes object (may be JS_UNDEFINED). */
 JSValue QJMS_Require(JSContext *ctx, JSValueConst specifier,
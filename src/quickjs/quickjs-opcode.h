@@ -365,6 +365,23 @@ DEF(typeof_is_undefined, 1, 1, 1, none)
 DEF( typeof_is_function, 1, 1, 1, none)
 #endif
 
+/* quickened opcodes: the interpreter rewrites the generic opcode of
+   the same size in place after observing the operand types, and
+   reverts it on a type miss. Never present in serialized bytecode. */
+DEF(    add_float64, 1, 2, 1, none)
+DEF(    sub_float64, 1, 2, 1, none)
+DEF(    mul_float64, 1, 2, 1, none)
+DEF(    div_float64, 1, 2, 1, none)
+
+/* superinstructions: emitted by resolve_labels() in place of frequent
+   opcode sequences */
+DEF(  inc_loc_check, 3, 0, 0, loc) /* get_loc_check post_inc put_loc_check drop */
+DEF(  dec_loc_check, 3, 0, 0, loc) /* get_loc_check post_dec put_loc_check drop */
+DEF(  add_loc_check, 3, 1, 0, loc) /* get_loc_check x add dup put_loc_check drop */
+DEF(    lt_if_false, 5, 2, 0, label) /* lt if_false */
+DEF(   lt_if_false8, 2, 2, 0, label8) /* lt if_false8 */
+DEF(get_loc_get_field2, 7, 0, 2, atom_u16) /* get_loc(n) get_field2(atom) */
+
 #undef DEF
 #undef def
 #endif  /* DEF */
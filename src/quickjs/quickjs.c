@@ -40,6 +40,14 @@
 #include <malloc_np.h>
 #endif
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_neon.h>
+#endif
+
 #include "cutils.h"
 #include "list.h"
 #include "quickjs.h"
@@ -109,6 +117,8 @@
 //#define DUMP_ROPE_REBALANCE
 /* add asm labels to each opcode so that it is easier to see the generated code */
 //#define OPCODE_ASM_LABEL
+/* count the executed opcodes and opcode pairs, see JS_GetOpcodeStats() */
+//#define CONFIG_OPCODE_STATS
 
 /* test the GC by forcing it before each object allocation */
 //#define FORCE_GC_AT_MALLOC
@@ -168,6 +178,25 @@ typedef enum {
     JS_GC_PHASE_REMOVE_CYCLES,
 } JSGCPhaseEnum;
 
+/* maximum size allocated between two young collections */
+#define JS_GC_YOUNG_SIZE (4 * 1024 * 1024)
+/* number of old GC objects examined at once by JS_RunGCStep() */
+#define JS_GC_STEP_WINDOW 1024
+/* minimum size of a JSGCStack. It is never freed so that the GC
+   always progresses when the host allocator fails */
+#define JS_GC_STACK_MIN_SIZE 256
+
+/* array of GC objects allocated with the host malloc so that the
+   arenas are not modified when it is used */
+typedef struct {
+    JSGCObjectHeader **tab;
+    uint32_t count;
+    uint32_t size;
+    /* TRUE if an object could not be pushed because the stack could
+       not be enlarged. The objects must then be searched in the heap. */
+    BOOL overflow;
+} JSGCStack;
+
 typedef enum OPCodeEnum OPCodeEnum;
 
 /* JS malloc */
@@ -177,6 +206,12 @@ typedef enum OPCodeEnum OPCodeEnum;
 #define JS_MALLOC_BLOCK_SIZE_COUNT 31
 #define JS_MALLOC_MIN_SMALL_SIZE 16
 #define JS_MALLOC_MAX_SMALL_SIZE 512
+/* maximum number of empty arenas kept per block size between two full
+   GC cycles */
+#define JS_MALLOC_MAX_EMPTY_ARENAS 2
+/* a full GC cycle asks the host malloc() to return its free pages to
+   the OS once at least this amount of arena memory was released */
+#define JS_MALLOC_TRIM_THRESHOLD (1024 * 1024)
 #if defined(__SANITIZE_ADDRESS__)
 /* use the host malloc() for all allocations */
 #define JS_MALLOC_LARGE_BLOCKS_ONLY 1
@@ -184,10 +219,6 @@ typedef enum OPCodeEnum OPCodeEnum;
 #define JS_MALLOC_LARGE_BLOCKS_ONLY 0
 #endif
 
-/* allow iteration among the allocated blocks. Currently not used. May
-   be used to suppress the memory overhead of JSGCObjectHeader */
-//#define JS_MALLOC_USE_ITER
-
 #define FREE_NIL 0xffff
 
 /* 8 byte header */
@@ -205,15 +236,18 @@ typedef struct JSMallocBlockHeader {
         uint16_t free_next; /* FREE_NIL if none */
     } u;
     uint8_t block_size_idx;
-    uint8_t gc_obj_type : 7;
+    uint8_t gc_obj_type : 5; /* JS_GC_OBJ_TYPE_NONE if not a GC object */
+    uint8_t gc_young : 1; /* young GC object, see gc_promote_young() */
+    uint8_t gc_step_parity : 1; /* large blocks only, see JS_RunGCStep() */
     uint8_t mark : 1;
     int ref_count;
     __attribute__((aligned(JS_MALLOC_ALIGN))) uint8_t user_data[];
 } JSMallocBlockHeader;
 
 typedef struct JSMallocLargeBlockHeader {
-#ifdef JS_MALLOC_USE_ITER
-    struct list_head link;
+    struct list_head link; /* JSMallocContext.large_block_list or young_large_block_list */
+#if defined(JS_NAN_BOXING) && defined(JS_PTR64)
+    size_t size; /* user size, needed to move the block in __js_realloc() */
 #endif
     JSMallocBlockHeader header;
 } JSMallocLargeBlockHeader;
@@ -221,14 +255,16 @@ typedef struct JSMallocLargeBlockHeader {
 typedef struct {
     struct list_head free_link;
     struct list_head link;
+    struct list_head young_link; /* JSMallocContext.young_arena_list if young = 1 */
     uint8_t block_size_idx;
+    uint8_t young : 1; /* may contain young GC objects */
+    uint8_t gc_step_parity : 1; /* see JS_RunGCStep() */
     uint16_t n_used_blocks; /* number of allocated blocks */
     uint16_t n_blocks; /* total number of blocks */
     uint16_t first_free_block; /* FREE_NIL if none */
-#ifdef JS_MALLOC_USE_ITER
-    /* bit set to 1 for allocated block */
+    /* bit set to 1 for the blocks containing a GC object (gc_obj_type
+       != JS_GC_OBJ_TYPE_NONE). Used to enumerate them. */
     uint32_t bitmap[((JS_MALLOC_ARENA_SIZE / JS_MALLOC_MIN_SMALL_SIZE) + 31) / 32];
-#endif
     /* n_blocks memory blocks of identical size */
     __attribute__((aligned(JS_MALLOC_ALIGN))) uint8_t blocks[];
 } JSMallocArena;
@@ -236,9 +272,18 @@ typedef struct {
 typedef struct {
     struct list_head arena_list[JS_MALLOC_BLOCK_SIZE_COUNT]; /* list of JSMallocArena.link (all arenas) */
     struct list_head free_arena_list[JS_MALLOC_BLOCK_SIZE_COUNT]; /* list of JSMallocArena.free_link (arenas where n_used_blocks < n_blocks) */
-#ifdef JS_MALLOC_USE_ITER
+    uint8_t n_empty_arenas[JS_MALLOC_BLOCK_SIZE_COUNT]; /* number of arenas where n_used_blocks = 0 */
     struct list_head large_block_list; /* list of JSMallocLargeBlockHeader.link */
-#endif
+    /* list of JSMallocArena.young_link. Arenas containing young GC objects */
+    struct list_head young_arena_list;
+    /* list of JSMallocLargeBlockHeader.link. Large blocks containing a
+       young GC object */
+    struct list_head young_large_block_list;
+    /* value of gc_step_parity given to the new arenas and large blocks */
+    uint8_t gc_step_parity;
+    /* arena memory returned to the host allocator since the last
+       malloc_trim() */
+    size_t released_arena_size;
     __attribute__((aligned(JS_MALLOC_ALIGN))) uint8_t zero_size_block[sizeof(JSMallocBlockHeader)];
 
     /* callbacks to the host malloc */
@@ -264,14 +309,24 @@ struct JSRuntime {
     JSClass *class_array;
 
     struct list_head context_list; /* list of JSContext.link */
-    /* list of JSGCObjectHeader.link. List of allocated GC objects (used
-       by the garbage collector) */
-    struct list_head gc_obj_list;
-    /* list of JSGCObjectHeader.link. Used during JS_FreeValueRT() */
-    struct list_head gc_zero_ref_count_list;
-    struct list_head tmp_obj_list; /* used during GC */
+    /* The GC objects are enumerated from the malloc arenas (see
+       JSGCObjectIter) so they are not linked together. */
+    /* GC objects whose freeing is deferred. Used during JS_FreeValueRT() */
+    JSGCStack gc_zero_ref_stack;
+    JSGCStack gc_work_stack; /* used during GC */
     JSGCPhaseEnum gc_phase : 8;
+    /* TRUE if only the young GC objects are collected */
+    BOOL gc_young_only : 8;
     size_t malloc_gc_threshold;
+    /* a full collection is done when the malloc size exceeds it */
+    size_t malloc_gc_full_threshold;
+    /* an incremental round is started by JS_RunGCStep() when the
+       malloc size exceeds it */
+    size_t malloc_gc_step_threshold;
+    BOOL gc_step_active : 8; /* TRUE if an incremental round is running */
+    /* TRUE if JS_FreeRuntime() releases the memory in bulk, see
+       JS_SetFastTeardown() */
+    BOOL fast_teardown : 8;
     struct list_head weakref_list; /* list of JSWeakRefHeader.link */
 #ifdef DUMP_LEAKS
     struct list_head string_list; /* list of JSString.link */
@@ -315,14 +370,31 @@ struct JSRuntime {
     JSSharedArrayBufferFunctions sab_funcs;
     /* see JS_SetStripInfo() */
     uint8_t strip_flags;
+    /* see JS_SetLazyFunctions() */
+    BOOL lazy_functions : 8;
 
     /* Shape hash table */
     int shape_hash_bits;
     int shape_hash_size;
     int shape_hash_count; /* number of hashed shapes */
     JSShape **shape_hash;
+    uint32_t shape_id_counter; /* last allocated JSShape.id */
     void *user_opaque;
     JSValue user_opaque_val;
+#ifdef CONFIG_OPCODE_STATS
+    /* number of executions of each opcode of the final bytecode */
+    uint64_t opcode_counts[256];
+    /* [prev][op]: number of times 'op' was executed right after 'prev'
+       in the same stack frame. prev = OP_invalid for the first opcode
+       executed by JS_CallInternal(). */
+    uint64_t opcode_pair_counts[256][256];
+#endif
+    /* see JS_StartCPUProfile(), NULL if not running */
+    struct JSCPUProfile *cpu_profile;
+    /* see JS_StartHeapSampling(), NULL if not running */
+    struct JSHeapSampling *heap_sampling;
+    /* state of JS_WriteHeapSnapshot() */
+    struct JSHeapSnapshot *heap_snapshot;
 };
 
 struct JSClass {
@@ -374,6 +446,7 @@ struct JSSyntheticStackFrame {
 };
 
 typedef enum {
+    JS_GC_OBJ_TYPE_NONE, /* not a GC object */
     JS_GC_OBJ_TYPE_JS_OBJECT,
     JS_GC_OBJ_TYPE_FUNCTION_BYTECODE,
     JS_GC_OBJ_TYPE_SHAPE,
@@ -381,13 +454,17 @@ typedef enum {
     JS_GC_OBJ_TYPE_ASYNC_FUNCTION,
     JS_GC_OBJ_TYPE_JS_CONTEXT,
     JS_GC_OBJ_TYPE_MODULE,
+    /* structures freed by gc_free_cycles() once all the cycles are
+       removed because they may still be referenced */
+    JS_GC_OBJ_TYPE_ZOMBIE_JS_OBJECT,
+    JS_GC_OBJ_TYPE_ZOMBIE,
 } JSGCObjectTypeEnum;
 
 /* header for GC objects. GC objects are C data structures with a
    reference count that can reference other GC objects. JS Objects are
-   a particular type of GC object. */
+   a particular type of GC object. The GC data (type, mark, reference
+   count) is stored in the malloc block header, so it is empty. */
 struct JSGCObjectHeader {
-    struct list_head link;
 };
 
 typedef enum {
@@ -455,15 +532,24 @@ typedef struct {
     js_limb_t tab[(64 + JS_LIMB_BITS - 1) / JS_LIMB_BITS];
 } JSBigIntBuf;
 
+/* The id is stored in the 2 low bits of the realm pointer of the
+   property (see JSProperty.u.init), so there can be at most 4 ids and
+   JS_AUTOINIT_ID_FUNC takes the last one. New kinds of autoinit
+   properties should use JS_AUTOINIT_ID_FUNC with their own callback:
+   another id would need a wider field or more alignment of JSContext. */
 typedef enum {
     JS_AUTOINIT_ID_PROTOTYPE,
     JS_AUTOINIT_ID_MODULE_NS,
     JS_AUTOINIT_ID_PROP,
+    JS_AUTOINIT_ID_FUNC, /* 'opaque' is a JSAutoInitPropertyFunc */
 } JSAutoInitIDEnum;
 
 /* must be large enough to have a negligible runtime cost and small
    enough to call the interrupt callback often. */
 #define JS_INTERRUPT_COUNTER_INIT 10000
+/* used while the CPU profiler is running so that the samples are taken
+   close to their due time */
+#define JS_INTERRUPT_COUNTER_PROFILE 1000
 
 struct JSContext {
     JSGCObjectHeader header; /* must come first */
@@ -492,6 +578,13 @@ struct JSContext {
     JSValue throw_type_error;
     JSValue eval_obj;
 
+    /* JS_LAZY_INTRINSIC_x bits of the intrinsics which are only created
+       when first used */
+    uint8_t lazy_intrinsics;
+    /* global bindings of the lazily created intrinsics, read by the
+       autoinit properties of the global object */
+    JSValue lazy_intrinsic_globals;
+
     JSValue global_obj; /* global object */
     JSValue global_var_obj; /* contains the global let/const definitions */
 
@@ -643,6 +736,48 @@ typedef enum JSFunctionKindEnum {
     JS_FUNC_ASYNC_GENERATOR = (JS_FUNC_GENERATOR | JS_FUNC_ASYNC),
 } JSFunctionKindEnum;
 
+/* Inline caches for the property access opcodes (get_field,
+   get_field2, get_length, put_field). Own properties are already
+   found with a single hash lookup, so the caches only remember what
+   is expensive to recompute: the prototype holding a property
+   (get_field) and the shape transition of a property addition
+   (put_field). Shapes are identified by JSShape.id which changes
+   each time a shape is modified in place, so a cache entry never
+   needs to be invalidated explicitly. */
+#define JS_IC_WAYS 4 /* number of shapes cached per access site */
+#define JS_IC_MAX_DEPTH 3 /* maximum number of traversed prototypes */
+
+typedef struct JSInlineCacheEntry {
+    uint32_t shape_id; /* id of the object shape, 0 if unused */
+    uint32_t prop_idx; /* get_field: property index in the prototype */
+    /* ids of the shapes of the traversed prototypes, 0 terminated
+       if less than JS_IC_MAX_DEPTH. get_field: up to the prototype
+       holding the property. put_field: the whole prototype chain. */
+    uint32_t proto_shape_ids[JS_IC_MAX_DEPTH];
+    /* put_field only: the object shape and its shape after the
+       property addition. Both are referenced. */
+    JSShape *shape;
+    JSShape *new_shape;
+} JSInlineCacheEntry;
+
+typedef struct JSInlineCacheSite {
+    uint32_t pc_pos; /* offset of the opcode operand, 0 if empty slot */
+    uint32_t next_way; /* next entry to replace when the site is full */
+    JSInlineCacheEntry entries[JS_IC_WAYS];
+} JSInlineCacheSite;
+
+typedef struct JSInlineCache {
+    int hash_bits;
+    int site_count;
+    /* open addressing hash table indexed by pc_pos. All the sites are
+       inserted when the cache is created so a lookup always succeeds */
+    JSInlineCacheSite sites[];
+} JSInlineCache;
+
+/* a function stops quickening its opcodes after this many type misses
+   so that polymorphic sites do not keep rewriting the bytecode */
+#define JS_QUICKEN_MAX_MISSES 16
+
 typedef struct JSFunctionBytecode {
     JSGCObjectHeader header; /* must come first */
     uint8_t js_mode;
@@ -659,7 +794,15 @@ typedef struct JSFunctionBytecode {
     uint8_t has_debug : 1;
     uint8_t read_only_bytecode : 1;
     uint8_t is_direct_or_indirect_eval : 1; /* used by JS_GetScriptOrModuleName() */
-    /* XXX: 5 bits available */
+    /* the body is compiled at the first call from debug.source. The
+       last cpool entry holds the compiled function or JS_UNDEFINED */
+    uint8_t is_lazy : 1;
+    uint8_t lazy_is_func_expr : 1;
+    uint8_t lazy_is_module : 1;
+    /* XXX: 2 bits available */
+    /* number of quickened opcodes reverted to their generic opcode.
+       Set to JS_QUICKEN_MAX_MISSES for read-only bytecode. */
+    uint8_t quicken_misses;
     uint8_t *byte_code_buf; /* (self pointer) */
     int byte_code_len;
     JSAtom func_name;
@@ -674,6 +817,9 @@ typedef struct JSFunctionBytecode {
     JSValue *cpool; /* constant pool (self pointer) */
     int cpool_count;
     int closure_var_count;
+    /* allocated at the first cacheable property access, NULL if
+       none. Not saved by JS_WriteObject() */
+    JSInlineCache *ic;
     struct {
         /* debug info, move to separate structure to save memory? */
         JSAtom filename;
@@ -939,6 +1085,11 @@ typedef struct JSProperty {
 
 #define JS_PROP_INITIAL_SIZE 2
 #define JS_PROP_INITIAL_HASH_SIZE 4 /* must be a power of two */
+/* an object whose shape has more properties is switched to dictionary
+   mode when adding a new property would clone a shared shape that was
+   itself obtained by at least JS_SHAPE_DICT_CLONE_COUNT such clones */
+#define JS_SHAPE_DICT_PROP_COUNT 64
+#define JS_SHAPE_DICT_CLONE_COUNT 16
 
 typedef struct JSShapeProperty {
     uint32_t hash_next : 26; /* 0 if last in list */
@@ -951,6 +1102,18 @@ struct JSShape {
     /* true if the shape is inserted in the shape hash table. If not,
        JSShape.hash is not valid */
     uint8_t is_hashed;
+    /* true if the object is used as a dictionary: the shape is no
+       longer hashed because some properties were deleted or because
+       new properties kept being added to a shared shape with many
+       properties. It is hashed again if few properties remain after
+       compact_properties(). */
+    uint8_t is_dict;
+    /* number of times the shared shapes this shape derives from were
+       cloned by add_property() (saturated) */
+    uint8_t clone_count;
+    /* unique identifier used by the inline caches. A new one is
+       allocated each time the shape is modified in place */
+    uint32_t id;
     uint32_t hash; /* current hash value */
     uint32_t prop_hash_mask; /* >= 2 */
     int prop_size; /* allocated properties */
@@ -962,6 +1125,16 @@ struct JSShape {
     /* followed by JSShapeProperty prop[prop_size]; */
 };
 
+/* storage of the elements of the JS_CLASS_ARRAY fast arrays. The
+   arrays holding only numbers store them unboxed. The first store of
+   another kind of value converts the elements (INT32 -> FLOAT64 ->
+   VALUE). */
+typedef enum {
+    JS_ARRAY_KIND_VALUE,   /* u.array.u.values */
+    JS_ARRAY_KIND_INT32,   /* u.array.u.int32_ptr */
+    JS_ARRAY_KIND_FLOAT64, /* u.array.u.double_ptr */
+} JSArrayKindEnum;
+
 struct JSObject {
     JSGCObjectHeader header;
     /* TRUE if the array prototype is "normal":
@@ -971,6 +1144,7 @@ struct JSObject {
        - the prototype of Object.prototype is null (always true as it is immutable)
     */
     uint8_t is_std_array_prototype : 1;
+    uint8_t array_kind : 2; /* JS_CLASS_ARRAY: see JSArrayKindEnum */
 
     uint8_t extensible : 1;
     uint8_t free_mark : 1; /* only used when freeing objects with cycles */
@@ -1029,6 +1203,8 @@ struct JSObject {
             } u1;
             union {
                 JSValue *values;        /* JS_CLASS_ARRAY, JS_CLASS_ARGUMENTS */
+                /* also int32_ptr and double_ptr for JS_CLASS_ARRAY
+                   depending on array_kind */
                 JSVarRef **var_refs;     /* JS_CLASS_MAPPED_ARGUMENTS */
                 void *ptr;              /* JS_CLASS_UINT8C_ARRAY..JS_CLASS_FLOAT64_ARRAY */
                 int8_t *int8_ptr;       /* JS_CLASS_INT8_ARRAY */
@@ -1051,27 +1227,49 @@ struct JSObject {
     } u;
 };
 
+/* The records are stored in insertion order in a dense array. The hash
+   table contains the index of the first record of each hash chain and
+   the chains are linked by record index. A deleted record stays in
+   place with an uninitialized key until the array is compacted. */
 typedef struct JSMapRecord {
-    int ref_count; /* used during enumeration to avoid freeing the record */
-    BOOL empty : 8; /* TRUE if the record is deleted */
-    struct list_head link;
-    struct JSMapRecord *hash_next;
-    JSValue key;
+    JSValue key; /* JS_UNINITIALIZED if the record is deleted */
     JSValue value;
+    uint32_t hash; /* map_hash_key(key, 32) */
+    uint32_t hash_next; /* index of the next record in the hash chain
+                           or MAP_RECORD_NONE */
 } JSMapRecord;
 
+/* position of an iterator or of forEach() in the records. It is
+   updated when the records are compacted or cleared. */
+typedef struct JSMapCursor {
+    struct list_head link; /* JSMapState.cursors */
+    uint32_t pos; /* index of the next record to visit */
+} JSMapCursor;
+
 typedef struct JSMapState {
     BOOL is_weak; /* TRUE if WeakSet/WeakMap */
-    struct list_head records; /* list of JSMapRecord.link */
-    uint32_t record_count;
-    JSMapRecord **hash_table;
+    uint32_t record_count; /* number of live records */
+    uint32_t record_end; /* number of used records, including the
+                            deleted ones */
+    uint32_t record_size; /* allocated records = 2 * hash_size */
+    JSMapRecord *records;
+    uint32_t *hash_table; /* allocated after the records, NULL if
+                             there are no records */
     int hash_bits;
     uint32_t hash_size; /* = 2 ^ hash_bits */
-    uint32_t record_count_threshold; /* count at which a hash table
-                                        resize is needed */
+    struct list_head cursors; /* list of JSMapCursor.link */
     JSWeakRefHeader weakref_header; /* only used if is_weak = TRUE */
 } JSMapState;
 
+#define MAP_RECORD_NONE UINT32_MAX
+#define MAP_MIN_RECORD_SIZE 4
+#define MAP_MAX_RECORD_SIZE (1U << 30)
+
+static inline BOOL map_record_is_empty(const JSMapRecord *mr)
+{
+    return JS_VALUE_GET_TAG(mr->key) == JS_TAG_UNINITIALIZED;
+}
+
 enum {
     __JS_ATOM_NULL = JS_ATOM_NULL,
 #define DEF(name, str) JS_ATOM_ ## name,
@@ -1133,6 +1331,21 @@ static JSAtom __JS_NewAtomInit(JSRuntime *rt, const char *str, int len,
                                int atom_type);
 static void JS_FreeAtomStruct(JSRuntime *rt, JSAtomStruct *p);
 static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b);
+static void js_ic_free(JSRuntime *rt, JSInlineCache *ic);
+static void js_ic_mark(JSRuntime *rt, JSInlineCache *ic,
+                       JS_MarkFunc *mark_func);
+static void js_ic_reset_all(JSRuntime *rt);
+static void js_cpu_profile_free(JSRuntime *rt);
+static void js_heap_sampling_free(JSRuntime *rt);
+static no_inline void js_heap_sampling_alloc(JSRuntime *rt, size_t size);
+#ifdef CONFIG_OPCODE_STATS
+static void js_dump_opcode_stats(JSRuntime *rt);
+#endif
+static void js_ic_add_get(JSRuntime *rt, JSFunctionBytecode *b,
+                          uint32_t pc_pos, JSObject *p, JSAtom atom);
+static void js_ic_add_put(JSRuntime *rt, JSFunctionBytecode *b,
+                          uint32_t pc_pos, JSObject *p, JSShape *sh,
+                          JSAtom atom);
 static JSValue js_call_c_function(JSContext *ctx, JSValueConst func_obj,
                                   JSValueConst this_obj,
                                   int argc, JSValueConst *argv, int flags);
@@ -1321,6 +1534,7 @@ static void js_free_module_def(JSRuntime *rt, JSModuleDef *m);
 static void js_mark_module_def(JSRuntime *rt, JSModuleDef *m,
                                JS_MarkFunc *mark_func);
 static JSValue js_import_meta(JSContext *ctx);
+static int js_lazy_function_compile(JSContext *ctx, JSObject *p);
 JSValue JS_DynamicImportAsync(JSContext *ctx, JSValueConst specifier, JSValueConst attributes);
 JSValue JS_DynamicImportSync(JSContext *ctx, JSValueConst specifier, JSValueConst attributes);
 JSValue JS_DynamicImportSync2(JSContext *ctx, JSValueConst specifier, JSValueConst basename, JSValueConst attributes);
@@ -1352,6 +1566,10 @@ static int JS_GetOwnPropertyInternal(JSContext *ctx, JSPropertyDescriptor *desc,
                                      JSObject *p, JSAtom prop);
 static void js_free_desc(JSContext *ctx, JSPropertyDescriptor *desc);
 static int JS_AddIntrinsicBasicObjects(JSContext *ctx);
+static int JS_InitIntrinsicDate(JSContext *ctx);
+static int JS_InitIntrinsicRegExp(JSContext *ctx);
+static int JS_InitIntrinsicMapSet(JSContext *ctx);
+static int JS_InitIntrinsicTypedArrays(JSContext *ctx);
 static void js_free_shape(JSRuntime *rt, JSShape *sh);
 static void js_free_shape_null(JSRuntime *rt, JSShape *sh);
 static int js_shape_prepare_update(JSContext *ctx, JSObject *p,
@@ -1364,8 +1582,7 @@ static __exception int js_get_length64(JSContext *ctx, int64_t *pres,
 static void free_arg_list(JSContext *ctx, JSValue *tab, uint32_t len);
 static JSValue *build_arg_list(JSContext *ctx, uint32_t *plen,
                                JSValueConst array_arg);
-static BOOL js_get_fast_array(JSContext *ctx, JSValueConst obj,
-                              JSValue **arrpp, uint32_t *countp);
+static JSObject *js_get_fast_array_obj(JSValueConst obj);
 static JSValue JS_CreateAsyncFromSyncIterator(JSContext *ctx,
                                               JSValueConst sync_iter);
 static void js_c_function_data_finalizer(JSRuntime *rt, JSValue val);
@@ -1378,6 +1595,8 @@ static JSAtom js_symbol_to_atom(JSContext *ctx, JSValue val);
 static void add_gc_object(JSRuntime *rt, JSGCObjectHeader *h,
                           JSGCObjectTypeEnum type);
 static void remove_gc_object(JSGCObjectHeader *h);
+static void gc_add_zombie(JSRuntime *rt, JSGCObjectHeader *h,
+                          JSGCObjectTypeEnum type);
 static JSValue js_instantiate_prototype(JSContext *ctx, JSObject *p, JSAtom atom, void *opaque);
 static JSValue js_module_ns_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
                                  void *opaque);
@@ -1388,7 +1607,8 @@ static JSValue js_object_groupBy(JSContext *ctx, JSValueConst this_val,
 static void map_delete_weakrefs(JSRuntime *rt, JSWeakRefHeader *wh);
 static void weakref_delete_weakref(JSRuntime *rt, JSWeakRefHeader *wh);
 static void finrec_delete_weakref(JSRuntime *rt, JSWeakRefHeader *wh);
-static void JS_RunGCInternal(JSRuntime *rt, BOOL remove_weak_objects);
+static void JS_RunGCInternal(JSRuntime *rt, BOOL remove_weak_objects,
+                             BOOL young_only);
 static JSValue js_array_from_iterator(JSContext *ctx, uint32_t *plen,
                                       JSValueConst obj, JSValueConst method);
 static int js_string_find_invalid_codepoint(JSString *p);
@@ -1477,9 +1697,9 @@ static void js_malloc_init(JSMallocContext *s)
         init_list_head(&s->arena_list[i]);
         init_list_head(&s->free_arena_list[i]);
     }
-#ifdef JS_MALLOC_USE_ITER
     init_list_head(&s->large_block_list);
-#endif
+    init_list_head(&s->young_arena_list);
+    init_list_head(&s->young_large_block_list);
 }
 
 static void *get_arena_block(JSMallocArena *ar, unsigned int idx, unsigned int block_size)
@@ -1492,6 +1712,34 @@ static inline JSMallocBlockHeader *js_rc(void *ptr)
     return container_of(ptr, JSMallocBlockHeader, user_data);
 }
 
+/* 'b' must not be a large block */
+static inline JSMallocArena *js_malloc_get_arena(JSMallocBlockHeader *b)
+{
+    unsigned int block_size = js_malloc_block_sizes[b->block_size_idx];
+    return (JSMallocArena *)((uint8_t *)b - block_size * b->u.block_idx - sizeof(JSMallocArena));
+}
+
+#if defined(JS_NAN_BOXING) && defined(JS_PTR64)
+/* The NaN boxed JSValues can only hold the pointers below 2^48 (see
+   JS_MKPTR()). Some hosts can return higher addresses (57 bit virtual
+   address spaces, tagged pointers), so the memory given by the host
+   allocator is checked: return 'ptr' if it can be stored in a JSValue.
+   Otherwise it is freed and NULL is returned. */
+static no_inline void *js_malloc_check_ptr(JSMallocContext *s, void *ptr)
+{
+    if (((uintptr_t)ptr >> 48) != 0) {
+        s->mf.js_free(&s->malloc_state, ptr);
+        return NULL;
+    }
+    return ptr;
+}
+#else
+static inline void *js_malloc_check_ptr(JSMallocContext *s, void *ptr)
+{
+    return ptr;
+}
+#endif
+
 static no_inline JSMallocArena *js_malloc_new_arena(JSMallocContext *s, int block_size_idx)
 {
     JSMallocBlockHeader *b;
@@ -1500,21 +1748,21 @@ static no_inline JSMallocArena *js_malloc_new_arena(JSMallocContext *s, int bloc
 
     block_size = js_malloc_block_sizes[block_size_idx];
     n_blocks = (JS_MALLOC_ARENA_SIZE - sizeof(JSMallocArena)) / block_size;
-    ar = s->mf.js_malloc(&s->malloc_state, sizeof(JSMallocArena) + n_blocks * block_size);
+    ar = js_malloc_check_ptr(s, s->mf.js_malloc(&s->malloc_state, sizeof(JSMallocArena) + n_blocks * block_size));
     if (!ar)
         return NULL;
 
     ar->block_size_idx = block_size_idx;
+    ar->young = 0;
+    ar->gc_step_parity = s->gc_step_parity;
     ar->n_blocks = n_blocks;
     ar->n_used_blocks = 0;
     ar->first_free_block = 0;
-#ifdef JS_MALLOC_USE_ITER
     {
         int n_bitmap_words = (n_blocks + 31) / 32;
         for(i = 0; i < n_bitmap_words; i++)
             ar->bitmap[i] = 0;
     }
-#endif
     for(i = 0; i < n_blocks - 1; i++) {
         b = get_arena_block(ar, i, block_size);
         b->u.free_next = i + 1;
@@ -1524,8 +1772,9 @@ static no_inline JSMallocArena *js_malloc_new_arena(JSMallocContext *s, int bloc
     b->u.free_next = FREE_NIL;
     b->block_size_idx = block_size_idx;
 
-    /* add to the head */
-    list_add(&ar->link, &s->arena_list[block_size_idx]);
+    /* add to the tail so that the arenas not yet examined by the
+       current JS_RunGCStep() round stay at the head */
+    list_add_tail(&ar->link, &s->arena_list[block_size_idx]);
     list_add(&ar->free_link, &s->free_arena_list[block_size_idx]);
     return ar;
 }
@@ -1533,14 +1782,18 @@ static no_inline JSMallocArena *js_malloc_new_arena(JSMallocContext *s, int bloc
 static no_inline void *js_malloc_large(JSMallocContext *s, size_t size)
 {
     JSMallocLargeBlockHeader *b;
-    b = s->mf.js_malloc(&s->malloc_state, sizeof(JSMallocLargeBlockHeader) + size);
+    b = js_malloc_check_ptr(s, s->mf.js_malloc(&s->malloc_state, sizeof(JSMallocLargeBlockHeader) + size));
     if (!b)
         return NULL;
+#if defined(JS_NAN_BOXING) && defined(JS_PTR64)
+    b->size = size;
+#endif
     b->header.u.block_idx = FREE_NIL;
     b->header.block_size_idx = 0xff; /* fail safe */
-#ifdef JS_MALLOC_USE_ITER
+    b->header.gc_obj_type = JS_GC_OBJ_TYPE_NONE;
+    b->header.gc_young = 0;
+    b->header.gc_step_parity = s->gc_step_parity;
     list_add_tail(&b->link, &s->large_block_list);
-#endif
     return b->header.user_data;
 }
 
@@ -1571,18 +1824,18 @@ static void *__js_malloc(JSMallocContext *s, size_t size)
                     return NULL;
             } else {
                 ar = list_entry(el, JSMallocArena, free_link);
+                if (unlikely(ar->n_used_blocks == 0))
+                    s->n_empty_arenas[block_size_idx]--;
             }
             block_idx = ar->first_free_block;
             b = get_arena_block(ar, ar->first_free_block, block_size);
             ar->first_free_block = b->u.free_next;
             b->u.block_idx = block_idx;
+            b->gc_obj_type = JS_GC_OBJ_TYPE_NONE;
             ar->n_used_blocks++;
             if (unlikely(ar->n_used_blocks == ar->n_blocks)) {
                 list_del(&ar->free_link);
             }
-#ifdef JS_MALLOC_USE_ITER
-            ar->bitmap[block_idx / 32] |= 1 << (block_idx % 32);
-#endif
             return b->user_data;
         } else {
             return js_malloc_large(s, size);
@@ -1590,6 +1843,16 @@ static void *__js_malloc(JSMallocContext *s, size_t size)
     }
 }
 
+static void js_malloc_free_arena(JSMallocContext *s, JSMallocArena *ar)
+{
+    list_del(&ar->link);
+    list_del(&ar->free_link);
+    if (ar->young)
+        list_del(&ar->young_link);
+    s->mf.js_free(&s->malloc_state, ar);
+    s->released_arena_size += JS_MALLOC_ARENA_SIZE;
+}
+
 static void __js_free(JSMallocContext *s, void *ptr)
 {
     JSMallocBlockHeader *b;
@@ -1603,30 +1866,32 @@ static void __js_free(JSMallocContext *s, void *ptr)
             /* nothing to do */
         } else {
             JSMallocLargeBlockHeader *lb = container_of(ptr, JSMallocLargeBlockHeader, header.user_data);
-#ifdef JS_MALLOC_USE_ITER
             list_del(&lb->link);
-#endif
             s->mf.js_free(&s->malloc_state, lb);
         }
     } else {
         unsigned int block_idx = b->u.block_idx;
         unsigned int block_size_idx = b->block_size_idx;
-        unsigned int block_size = js_malloc_block_sizes[block_size_idx];
-        JSMallocArena *ar = (JSMallocArena *)((uint8_t *)b - block_size * block_idx - sizeof(JSMallocArena));
+        JSMallocArena *ar = js_malloc_get_arena(b);
         b->u.free_next = ar->first_free_block;
         ar->first_free_block = block_idx;
-#ifdef JS_MALLOC_USE_ITER
-        ar->bitmap[block_idx / 32] &= ~(1 << (block_idx % 32));
-#endif
+        /* fail safe: a freed block is never enumerated as a GC object */
+        ar->bitmap[block_idx / 32] &= ~(1U << (block_idx % 32));
         /* add back to the free list if needed */
         if (unlikely(ar->n_used_blocks == ar->n_blocks)) {
             list_add(&ar->free_link, &s->free_arena_list[block_size_idx]);
         }
         ar->n_used_blocks--;
         if (unlikely(ar->n_used_blocks == 0)) {
-            list_del(&ar->link);
-            list_del(&ar->free_link);
-            s->mf.js_free(&s->malloc_state, ar);
+            /* keep a few empty arenas so that an allocation pattern
+               crossing an arena boundary does not allocate and free an
+               arena each time. They are freed by
+               js_malloc_free_empty_arenas(). */
+            if (s->n_empty_arenas[block_size_idx] < JS_MALLOC_MAX_EMPTY_ARENAS) {
+                s->n_empty_arenas[block_size_idx]++;
+            } else {
+                js_malloc_free_arena(s, ar);
+            }
         }
     }
 }
@@ -1646,23 +1911,49 @@ static void *__js_realloc(JSMallocContext *s, void *ptr, size_t size)
             return __js_malloc(s, size);
         } else {
             JSMallocLargeBlockHeader *lb, *new_lb;
+            struct list_head *head;
+#if defined(JS_NAN_BOXING) && defined(JS_PTR64)
+            size_t old_size;
+#endif
             lb = container_of(ptr, JSMallocLargeBlockHeader, header.user_data);
-#ifdef JS_MALLOC_USE_ITER
+            if (lb->header.gc_obj_type != JS_GC_OBJ_TYPE_NONE && lb->header.gc_young)
+                head = &s->young_large_block_list;
+            else
+                head = &s->large_block_list;
             list_del(&lb->link);
-#endif
+#if defined(JS_NAN_BOXING) && defined(JS_PTR64)
+            /* the host realloc() could return an address that cannot
+               be stored in a JSValue after freeing the old block, so
+               the block is moved by hand */
+            new_lb = js_malloc_check_ptr(s, s->mf.js_malloc(&s->malloc_state, sizeof(JSMallocLargeBlockHeader) + size));
+            if (!new_lb) {
+                /* add again in the list */
+                list_add_tail(&lb->link, head);
+                return NULL;
+            }
+            /* the callers may use the whole usable size of the block */
+            old_size = lb->size;
+            if (s->mf.js_malloc_usable_size) {
+                size_t usable_size = s->mf.js_malloc_usable_size(lb);
+                if (usable_size > sizeof(JSMallocLargeBlockHeader) + old_size)
+                    old_size = usable_size - sizeof(JSMallocLargeBlockHeader);
+            }
+            if (old_size > size)
+                old_size = size;
+            memcpy(new_lb, lb, sizeof(JSMallocLargeBlockHeader) + old_size);
+            s->mf.js_free(&s->malloc_state, lb);
+            new_lb->size = size;
+#else
             new_lb = s->mf.js_realloc(&s->malloc_state, lb, sizeof(JSMallocLargeBlockHeader) + size);
             if (!new_lb) {
-#ifdef JS_MALLOC_USE_ITER
                 /* add again in the list */
-                list_add_tail(&lb->link, &s->large_block_list);
-#endif
+                list_add_tail(&lb->link, head);
                 return NULL;
             }
+#endif
             new_lb->header.u.block_idx = FREE_NIL;
             new_lb->header.block_size_idx = 0xff; /* fail safe */
-#ifdef JS_MALLOC_USE_ITER
-            list_add_tail(&new_lb->link, &s->large_block_list);
-#endif
+            list_add_tail(&new_lb->link, head);
             return new_lb->header.user_data;
         }
     } else {
@@ -1682,6 +1973,8 @@ static void *__js_realloc(JSMallocContext *s, void *ptr, size_t size)
         new_b = container_of(new_ptr, JSMallocBlockHeader, user_data);
         /* copy the GC data */
         new_b->gc_obj_type = b->gc_obj_type;
+        new_b->gc_young = b->gc_young;
+        new_b->gc_step_parity = b->gc_step_parity;
         new_b->mark = b->mark;
         new_b->ref_count = b->ref_count;
         /* copy the data */
@@ -1722,6 +2015,54 @@ static size_t __js_malloc_usable_size(JSMallocContext *s, const char *ptr)
     }
 }
 
+/* return the empty arenas to the host allocator */
+static void js_malloc_free_empty_arenas(JSMallocContext *s)
+{
+    struct list_head *el, *el1;
+    int block_size_idx;
+
+    for(block_size_idx = 0; block_size_idx < JS_MALLOC_BLOCK_SIZE_COUNT; block_size_idx++) {
+        if (s->n_empty_arenas[block_size_idx] == 0)
+            continue;
+        list_for_each_safe(el, el1, &s->free_arena_list[block_size_idx]) {
+            JSMallocArena *ar = list_entry(el, JSMallocArena, free_link);
+            if (ar->n_used_blocks == 0) {
+                js_malloc_free_arena(s, ar);
+            }
+        }
+        s->n_empty_arenas[block_size_idx] = 0;
+    }
+}
+
+/* return all the memory to the host allocator, whether the blocks are
+   allocated or not. Used by the fast runtime teardown. */
+static void js_malloc_free_all(JSMallocContext *s)
+{
+    struct list_head *el, *el1;
+    int block_size_idx;
+
+    for(block_size_idx = 0; block_size_idx < JS_MALLOC_BLOCK_SIZE_COUNT; block_size_idx++) {
+        list_for_each_safe(el, el1, &s->arena_list[block_size_idx]) {
+            JSMallocArena *ar = list_entry(el, JSMallocArena, link);
+            s->mf.js_free(&s->malloc_state, ar);
+        }
+        init_list_head(&s->arena_list[block_size_idx]);
+        init_list_head(&s->free_arena_list[block_size_idx]);
+        s->n_empty_arenas[block_size_idx] = 0;
+    }
+    init_list_head(&s->young_arena_list);
+    list_for_each_safe(el, el1, &s->large_block_list) {
+        JSMallocLargeBlockHeader *lb = list_entry(el, JSMallocLargeBlockHeader, link);
+        s->mf.js_free(&s->malloc_state, lb);
+    }
+    init_list_head(&s->large_block_list);
+    list_for_each_safe(el, el1, &s->young_large_block_list) {
+        JSMallocLargeBlockHeader *lb = list_entry(el, JSMallocLargeBlockHeader, link);
+        s->mf.js_free(&s->malloc_state, lb);
+    }
+    init_list_head(&s->young_large_block_list);
+}
+
 static __maybe_unused void js_malloc_dump_arenas(JSMallocContext *s)
 {
     struct list_head *el;
@@ -1739,45 +2080,233 @@ static __maybe_unused void js_malloc_dump_arenas(JSMallocContext *s)
     }
 }
 
-#ifdef JS_MALLOC_USE_ITER
-typedef void JSMallocIterFunc(void *opaque, void *ptr);
+/* set the GC object type of the block 'b' */
+static void js_malloc_set_gc_obj_type(JSMallocBlockHeader *b,
+                                      JSGCObjectTypeEnum type)
+{
+    b->gc_obj_type = type;
+    if (b->u.block_idx != FREE_NIL) {
+        JSMallocArena *ar = js_malloc_get_arena(b);
+        unsigned int block_idx = b->u.block_idx;
+        if (type != JS_GC_OBJ_TYPE_NONE)
+            ar->bitmap[block_idx / 32] |= 1U << (block_idx % 32);
+        else
+            ar->bitmap[block_idx / 32] &= ~(1U << (block_idx % 32));
+    }
+}
 
-/* iterate thru allocated blocks. The allocated block list should not
-   be modified while iterating. */
-static __maybe_unused void js_malloc_iter(JSMallocContext *s, JSMallocIterFunc *iter_func, void *iter_opaque)
+/* add the arena or large block of the GC object 'b' to the young
+   ones */
+static void js_malloc_set_young(JSMallocContext *s, JSMallocBlockHeader *b)
 {
-    struct list_head *el;
-    int block_size_idx;
-    int i, j, n_words;
+    if (b->u.block_idx == FREE_NIL) {
+        JSMallocLargeBlockHeader *lb = container_of(b, JSMallocLargeBlockHeader, header);
+        list_del(&lb->link);
+        list_add_tail(&lb->link, &s->young_large_block_list);
+    } else {
+        JSMallocArena *ar = js_malloc_get_arena(b);
+        if (!ar->young) {
+            ar->young = 1;
+            list_add_tail(&ar->young_link, &s->young_arena_list);
+        }
+    }
+}
+
+/* Enumeration of the GC objects thru the arena bitmaps and the large
+   block lists. If 'young_only' is TRUE, only the young GC objects are
+   returned. The caller may allocate or free blocks while iterating,
+   provided the last returned block is not freed. */
+typedef struct {
+    JSMallocContext *s;
+    BOOL young_only;
+    BOOL is_arena_list; /* TRUE if 'head' is a list of arenas */
+    int list_idx; /* index of the list being scanned */
+    struct list_head *head;
+    struct list_head *el; /* current arena or large block */
+    JSMallocArena *ar; /* current arena or NULL */
+    unsigned int block_size;
+    unsigned int word_idx; /* current word of ar->bitmap */
+    uint32_t mask; /* bits of the current word not yet examined */
+    BOOL large_block_done; /* TRUE if 'el' was examined */
+} JSGCObjectIter;
+
+/* select the list of index 'it->list_idx'. Return FALSE if none. */
+static BOOL js_gc_iter_set_list(JSGCObjectIter *it)
+{
+    JSMallocContext *s = it->s;
+    int n_arena_lists, idx;
+
+    n_arena_lists = it->young_only ? 1 : JS_MALLOC_BLOCK_SIZE_COUNT;
+    idx = it->list_idx;
+    if (idx < n_arena_lists) {
+        if (it->young_only)
+            it->head = &s->young_arena_list;
+        else
+            it->head = &s->arena_list[idx];
+        it->is_arena_list = TRUE;
+    } else {
+        idx -= n_arena_lists;
+        if (idx == 0)
+            it->head = &s->young_large_block_list;
+        else if (idx == 1 && !it->young_only)
+            it->head = &s->large_block_list;
+        else
+            return FALSE;
+        it->is_arena_list = FALSE;
+    }
+    it->el = it->head->next;
+    it->large_block_done = FALSE;
+    return TRUE;
+}
+
+static void js_gc_iter_init(JSRuntime *rt, JSGCObjectIter *it, BOOL young_only)
+{
+    it->s = &rt->malloc_ctx;
+    it->young_only = young_only;
+    it->ar = NULL;
+    it->list_idx = 0;
+    js_gc_iter_set_list(it);
+}
+
+static no_inline JSGCObjectHeader *js_gc_iter_next_slow(JSGCObjectIter *it)
+{
+    JSMallocBlockHeader *b;
     uint32_t bmp;
 
-    for(block_size_idx = 0; block_size_idx < JS_MALLOC_BLOCK_SIZE_COUNT; block_size_idx++) {
-        unsigned int block_size = js_malloc_block_sizes[block_size_idx];
-        list_for_each(el, &s->arena_list[block_size_idx]) {
-            JSMallocArena *ar = list_entry(el, JSMallocArena, link);
-            n_words = (ar->n_blocks + 31) / 32;
-            for(i = 0; i < n_words; i++) {
-                bmp = ar->bitmap[i];
-                while (bmp != 0) {
-                    j = ctz32(bmp);
-                    bmp &= ~(1 << j);
-                    iter_func(iter_opaque, get_arena_block(ar, i * 32+ j, block_size));
+    for(;;) {
+        if (it->ar) {
+            JSMallocArena *ar = it->ar;
+            /* the bitmap is read again at each call because it may
+               have been modified */
+            bmp = ar->bitmap[it->word_idx] & it->mask;
+            if (bmp == 0) {
+                it->word_idx++;
+                it->mask = ~0U;
+                if (it->word_idx >= (ar->n_blocks + 31) / 32) {
+                    it->ar = NULL;
+                    it->el = it->el->next;
                 }
+                continue;
             }
+            it->mask = ~1U << ctz32(bmp);
+            b = get_arena_block(ar, it->word_idx * 32 + ctz32(bmp), it->block_size);
+            if (!it->young_only || b->gc_young)
+                return (JSGCObjectHeader *)b->user_data;
+        } else if (it->el == it->head) {
+            it->list_idx++;
+            if (!js_gc_iter_set_list(it))
+                return NULL;
+        } else if (it->is_arena_list) {
+            if (it->young_only)
+                it->ar = list_entry(it->el, JSMallocArena, young_link);
+            else
+                it->ar = list_entry(it->el, JSMallocArena, link);
+            it->block_size = js_malloc_block_sizes[it->ar->block_size_idx];
+            it->word_idx = 0;
+            it->mask = ~0U;
+        } else if (it->large_block_done) {
+            it->el = it->el->next;
+            it->large_block_done = FALSE;
+        } else {
+            b = &list_entry(it->el, JSMallocLargeBlockHeader, link)->header;
+            it->large_block_done = TRUE;
+            if (b->gc_obj_type != JS_GC_OBJ_TYPE_NONE &&
+                (!it->young_only || b->gc_young))
+                return (JSGCObjectHeader *)b->user_data;
         }
     }
-    list_for_each(el, &s->large_block_list) {
-        JSMallocLargeBlockHeader *lb = list_entry(el, JSMallocLargeBlockHeader, link);
-        iter_func(iter_opaque, lb->header.user_data);
+}
+
+/* return NULL at the end of the enumeration */
+static inline JSGCObjectHeader *js_gc_iter_next(JSGCObjectIter *it)
+{
+    JSMallocArena *ar = it->ar;
+    JSMallocBlockHeader *b;
+    uint32_t bmp;
+    int j;
+
+    /* fast case: next GC object in the current bitmap word */
+    if (likely(ar != NULL)) {
+        bmp = ar->bitmap[it->word_idx] & it->mask;
+        if (likely(bmp != 0)) {
+            j = ctz32(bmp);
+            it->mask = ~1U << j;
+            b = get_arena_block(ar, it->word_idx * 32 + j, it->block_size);
+            if (likely(!it->young_only || b->gc_young))
+                return (JSGCObjectHeader *)b->user_data;
+        }
     }
+    return js_gc_iter_next_slow(it);
+}
+
+static int gc_stack_resize(JSRuntime *rt, JSGCStack *st, uint32_t new_size)
+{
+    JSMallocContext *s = &rt->malloc_ctx;
+    JSGCObjectHeader **new_tab;
+
+    new_tab = s->mf.js_realloc(&s->malloc_state, st->tab,
+                               sizeof(st->tab[0]) * new_size);
+    if (!new_tab)
+        return -1;
+    st->tab = new_tab;
+    st->size = new_size;
+    return 0;
+}
+
+static int gc_stack_init(JSRuntime *rt, JSGCStack *st)
+{
+    st->tab = NULL;
+    st->count = 0;
+    st->size = 0;
+    st->overflow = FALSE;
+    return gc_stack_resize(rt, st, JS_GC_STACK_MIN_SIZE);
+}
+
+static void gc_stack_free(JSRuntime *rt, JSGCStack *st)
+{
+    JSMallocContext *s = &rt->malloc_ctx;
+    if (st->tab)
+        s->mf.js_free(&s->malloc_state, st->tab);
+    st->tab = NULL;
+    st->size = 0;
+}
+
+/* release the memory used by a large collection */
+static void gc_stack_shrink(JSRuntime *rt, JSGCStack *st)
+{
+    if (st->size > JS_GC_STACK_MIN_SIZE && st->count <= JS_GC_STACK_MIN_SIZE)
+        gc_stack_resize(rt, st, JS_GC_STACK_MIN_SIZE);
+}
+
+/* return -1 and set 'st->overflow' if the stack cannot be enlarged */
+static no_inline int gc_stack_push_slow(JSRuntime *rt, JSGCStack *st,
+                                        JSGCObjectHeader *p)
+{
+    if (st->size >= UINT32_MAX / 2 ||
+        gc_stack_resize(rt, st, max_uint32(st->size + st->size / 2,
+                                           JS_GC_STACK_MIN_SIZE))) {
+        st->overflow = TRUE;
+        return -1;
+    }
+    st->tab[st->count++] = p;
+    return 0;
+}
+
+static inline int gc_stack_push(JSRuntime *rt, JSGCStack *st,
+                                JSGCObjectHeader *p)
+{
+    if (unlikely(st->count >= st->size))
+        return gc_stack_push_slow(rt, st, p);
+    st->tab[st->count++] = p;
+    return 0;
 }
-#endif
 
 /* end JS malloc */
 
 static void js_trigger_gc(JSRuntime *rt, size_t size)
 {
     BOOL force_gc;
+    size_t young_size;
 #ifdef FORCE_GC_AT_MALLOC
     force_gc = TRUE;
 #else
@@ -1789,15 +2318,33 @@ static void js_trigger_gc(JSRuntime *rt, size_t size)
         printf("GC: size=%" PRIu64 "\n",
                (uint64_t)rt->malloc_ctx.malloc_state.malloc_size);
 #endif
-        JS_RunGC(rt);
+        if (rt->malloc_ctx.malloc_state.malloc_size + size >
+            rt->malloc_gc_full_threshold) {
+            JS_RunGC(rt);
+            rt->malloc_gc_full_threshold =
+                rt->malloc_ctx.malloc_state.malloc_size +
+                (rt->malloc_ctx.malloc_state.malloc_size >> 1);
+        } else {
+            JS_RunGCInternal(rt, TRUE, TRUE);
+        }
+        /* the young collections scan at most JS_GC_YOUNG_SIZE bytes
+           of new objects so that their duration does not depend on
+           the heap size */
+        young_size = rt->malloc_ctx.malloc_state.malloc_size >> 1;
+        if (young_size > JS_GC_YOUNG_SIZE)
+            young_size = JS_GC_YOUNG_SIZE;
         rt->malloc_gc_threshold = rt->malloc_ctx.malloc_state.malloc_size +
-            (rt->malloc_ctx.malloc_state.malloc_size >> 1);
+            young_size;
     }
 }
 
 void *js_malloc_rt(JSRuntime *rt, size_t size)
 {
-    return __js_malloc(&rt->malloc_ctx, size);
+    void *ptr;
+    ptr = __js_malloc(&rt->malloc_ctx, size);
+    if (unlikely(rt->heap_sampling) && ptr)
+        js_heap_sampling_alloc(rt, size);
+    return ptr;
 }
 
 void js_free_rt(JSRuntime *rt, void *ptr)
@@ -1807,7 +2354,16 @@ void js_free_rt(JSRuntime *rt, void *ptr)
 
 void *js_realloc_rt(JSRuntime *rt, void *ptr, size_t size)
 {
-    return __js_realloc(&rt->malloc_ctx, ptr, size);
+    size_t old_size;
+
+    if (likely(!rt->heap_sampling))
+        return __js_realloc(&rt->malloc_ctx, ptr, size);
+    /* only the growth of the block is counted */
+    old_size = ptr ? __js_malloc_usable_size(&rt->malloc_ctx, ptr) : 0;
+    ptr = __js_realloc(&rt->malloc_ctx, ptr, size);
+    if (ptr && size > old_size)
+        js_heap_sampling_alloc(rt, size - old_size);
+    return ptr;
 }
 
 size_t js_malloc_usable_size_rt(JSRuntime *rt, const void *ptr)
@@ -2079,10 +2635,10 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     rt->malloc_ctx.mf = *mf;
     rt->malloc_ctx.malloc_state = ms;
     rt->malloc_gc_threshold = 256 * 1024;
+    rt->malloc_gc_full_threshold = 256 * 1024;
+    rt->malloc_gc_step_threshold = 256 * 1024;
 
     init_list_head(&rt->context_list);
-    init_list_head(&rt->gc_obj_list);
-    init_list_head(&rt->gc_zero_ref_count_list);
     rt->gc_phase = JS_GC_PHASE_NONE;
     init_list_head(&rt->weakref_list);
 
@@ -2091,6 +2647,10 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
 #endif
     init_list_head(&rt->job_list);
 
+    if (gc_stack_init(rt, &rt->gc_zero_ref_stack) ||
+        gc_stack_init(rt, &rt->gc_work_stack))
+        goto fail;
+
     if (JS_InitAtoms(rt))
         goto fail;
 
@@ -2239,6 +2799,11 @@ void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold)
     rt->malloc_gc_threshold = gc_threshold;
 }
 
+void JS_SetFastTeardown(JSRuntime *rt, BOOL enable)
+{
+    rt->fast_teardown = enable;
+}
+
 #define malloc(s) malloc_is_forbidden(s)
 #define free(p) free_is_forbidden(p)
 #define realloc(p,s) realloc_is_forbidden(p,s)
@@ -2270,6 +2835,16 @@ int JS_GetStripInfo(JSRuntime *rt)
     return rt->strip_flags;
 }
 
+void JS_SetLazyFunctions(JSRuntime *rt, BOOL enabled)
+{
+    rt->lazy_functions = enabled;
+}
+
+BOOL JS_GetLazyFunctions(JSRuntime *rt)
+{
+    return rt->lazy_functions;
+}
+
 static int JS_EnqueueJob2(JSContext *ctx, JSJobFunc *job_func,
                           int argc, JSValueConst *argv, BOOL no_exception)
 {
@@ -2412,11 +2987,78 @@ void JS_SetRuntimeInfo(JSRuntime *rt, const char *s)
         rt->rt_info = s;
 }
 
+/* Fast teardown: only the finalizers which may have an effect outside
+   of the runtime memory are called, then all the arenas and large
+   blocks are returned to the host allocator without freeing each
+   object, string and shape. */
+static BOOL js_class_has_external_finalizer(JSRuntime *rt, JSObject *p)
+{
+    JSArrayBuffer *abuf;
+
+    switch(p->class_id) {
+    case JS_CLASS_ARRAY_BUFFER:
+    case JS_CLASS_SHARED_ARRAY_BUFFER:
+        /* the data may be owned by the host or shared with other
+           runtimes */
+        abuf = p->u.array_buffer;
+        return abuf && ((abuf->shared && rt->sab_funcs.sab_free) ||
+                        (abuf->free_func &&
+                         abuf->free_func != js_array_buffer_free));
+    default:
+        /* classes defined with JS_NewClass() */
+        return p->class_id >= JS_CLASS_INIT_COUNT &&
+            rt->class_array[p->class_id].finalizer != NULL;
+    }
+}
+
+static void js_free_runtime_fast(JSRuntime *rt)
+{
+    JSGCObjectIter it;
+    JSGCObjectHeader *gp;
+    JSObject *p;
+
+    /* the finalizers may free values: the objects must stay valid, so
+       they are ignored as during the removal of the cycles. The
+       other values are freed normally. */
+    rt->gc_phase = JS_GC_PHASE_REMOVE_CYCLES;
+    js_gc_iter_init(rt, &it, FALSE);
+    while ((gp = js_gc_iter_next(&it)) != NULL) {
+        if (js_rc(gp)->gc_obj_type != JS_GC_OBJ_TYPE_JS_OBJECT)
+            continue;
+        p = (JSObject *)gp;
+        if (js_class_has_external_finalizer(rt, p)) {
+            rt->class_array[p->class_id].finalizer(rt, JS_MKPTR(JS_TAG_OBJECT, p));
+            p->class_id = 0;
+            p->u.opaque = NULL;
+        }
+    }
+    rt->gc_phase = JS_GC_PHASE_NONE;
+
+    gc_stack_free(rt, &rt->gc_zero_ref_stack);
+    gc_stack_free(rt, &rt->gc_work_stack);
+    js_malloc_free_all(&rt->malloc_ctx);
+    {
+        JSMallocState ms = rt->malloc_ctx.malloc_state;
+        rt->malloc_ctx.mf.js_free(&ms, rt);
+    }
+}
+
 void JS_FreeRuntime(JSRuntime *rt)
 {
     struct list_head *el, *el1;
     int i;
 
+#ifdef CONFIG_OPCODE_STATS
+    js_dump_opcode_stats(rt);
+#endif
+    js_cpu_profile_free(rt);
+    js_heap_sampling_free(rt);
+
+    if (rt->fast_teardown) {
+        js_free_runtime_fast(rt);
+        return;
+    }
+
     JS_FreeValueRT(rt, rt->current_exception);
     JS_FreeValueRT(rt, rt->user_opaque_val);
 
@@ -2431,26 +3073,23 @@ void JS_FreeRuntime(JSRuntime *rt)
 
     /* don't remove the weak objects to avoid create new jobs with
        FinalizationRegistry */
-    JS_RunGCInternal(rt, FALSE);
+    JS_RunGCInternal(rt, FALSE, FALSE);
 
 #ifdef DUMP_LEAKS
     /* leaking objects */
     {
         BOOL header_done;
+        JSGCObjectIter it;
         JSGCObjectHeader *p;
         int count;
 
         /* remove the internal refcounts to display only the object
            referenced externally */
-        list_for_each(el, &rt->gc_obj_list) {
-            p = list_entry(el, JSGCObjectHeader, link);
-            js_rc(p)->mark = 0;
-        }
         gc_decref(rt);
 
         header_done = FALSE;
-        list_for_each(el, &rt->gc_obj_list) {
-            p = list_entry(el, JSGCObjectHeader, link);
+        js_gc_iter_init(rt, &it, FALSE);
+        while ((p = js_gc_iter_next(&it)) != NULL) {
             if (js_rc(p)->ref_count != 0) {
                 if (!header_done) {
                     printf("Object leaks:\n");
@@ -2462,8 +3101,8 @@ void JS_FreeRuntime(JSRuntime *rt)
         }
 
         count = 0;
-        list_for_each(el, &rt->gc_obj_list) {
-            p = list_entry(el, JSGCObjectHeader, link);
+        js_gc_iter_init(rt, &it, FALSE);
+        while ((p = js_gc_iter_next(&it)) != NULL) {
             if (js_rc(p)->ref_count == 0) {
                 count++;
             }
@@ -2472,7 +3111,11 @@ void JS_FreeRuntime(JSRuntime *rt)
             printf("Secondary object leaks: %d\n", count);
     }
 #endif
-    assert(list_empty(&rt->gc_obj_list));
+    {
+        JSGCObjectIter it;
+        js_gc_iter_init(rt, &it, FALSE);
+        assert(js_gc_iter_next(&it) == NULL);
+    }
     assert(list_empty(&rt->weakref_list));
 
     /* free the classes */
@@ -2555,6 +3198,7 @@ void JS_FreeRuntime(JSRuntime *rt)
     js_free_rt(rt, rt->atom_array);
     js_free_rt(rt, rt->atom_hash);
     js_free_rt(rt, rt->shape_hash);
+
 #ifdef DUMP_LEAKS
     if (!list_empty(&rt->string_list)) {
         if (rt->rt_info) {
@@ -2583,6 +3227,13 @@ void JS_FreeRuntime(JSRuntime *rt)
         if (rt->rt_info)
             printf("\n");
     }
+#endif
+
+    gc_stack_free(rt, &rt->gc_zero_ref_stack);
+    gc_stack_free(rt, &rt->gc_work_stack);
+    js_malloc_free_empty_arenas(&rt->malloc_ctx);
+
+#ifdef DUMP_LEAKS
     {
         JSMallocState *s = &rt->malloc_ctx.malloc_state;
         if (s->malloc_count > 1) {
@@ -2601,6 +3252,31 @@ void JS_FreeRuntime(JSRuntime *rt)
     }
 }
 
+int JS_GetMallocArenaStats(JSRuntime *rt, JSMallocArenaStats *stats,
+                           int stats_count)
+{
+    JSMallocContext *s = &rt->malloc_ctx;
+    struct list_head *el;
+    JSMallocArenaStats *st;
+    int block_size_idx;
+
+    if (JS_MALLOC_LARGE_BLOCKS_ONLY)
+        return 0;
+    for(block_size_idx = 0; block_size_idx < min_int(stats_count, JS_MALLOC_BLOCK_SIZE_COUNT); block_size_idx++) {
+        st = &stats[block_size_idx];
+        memset(st, 0, sizeof(*st));
+        st->block_size = js_malloc_block_sizes[block_size_idx];
+        st->empty_arena_count = s->n_empty_arenas[block_size_idx];
+        list_for_each(el, &s->arena_list[block_size_idx]) {
+            JSMallocArena *ar = list_entry(el, JSMallocArena, link);
+            st->arena_count++;
+            st->block_count += ar->n_blocks;
+            st->used_block_count += ar->n_used_blocks;
+        }
+    }
+    return JS_MALLOC_BLOCK_SIZE_COUNT;
+}
+
 JSContext *JS_NewContextRaw(JSRuntime *rt)
 {
     JSContext *ctx;
@@ -2626,6 +3302,7 @@ JSContext *JS_NewContextRaw(JSRuntime *rt)
     ctx->iterator_ctor = JS_NULL;
     ctx->regexp_ctor = JS_NULL;
     ctx->promise_ctor = JS_NULL;
+    ctx->lazy_intrinsic_globals = JS_UNDEFINED;
     ctx->user_opaque_val = JS_NULL;
     ctx->stack_frame_mapper = JS_NULL;
     ctx->in_stack_frame_mapper = FALSE;
@@ -2721,11 +3398,134 @@ void JS_SetClassProto(JSContext *ctx, JSClassID class_id, JSValue obj)
     set_value(ctx, &ctx->class_proto[class_id], obj);
 }
 
+/* The constructors and prototypes of these intrinsics are only created
+   when one of their global bindings is first accessed or when an object
+   of one of their classes is created (see js_get_class_proto()), so that
+   creating a context stays cheap. */
+typedef enum {
+    JS_LAZY_INTRINSIC_DATE,
+    JS_LAZY_INTRINSIC_REGEXP,
+    JS_LAZY_INTRINSIC_MAP_SET,
+    JS_LAZY_INTRINSIC_TYPED_ARRAYS,
+} JSLazyIntrinsicEnum;
+
+typedef struct JSLazyIntrinsicDef {
+    int (*init)(JSContext *ctx);
+    /* the global bindings are the atoms from first_atom to last_atom */
+    uint16_t first_atom;
+    uint16_t last_atom;
+} JSLazyIntrinsicDef;
+
+static const JSLazyIntrinsicDef js_lazy_intrinsic_defs[] = {
+    { JS_InitIntrinsicDate, JS_ATOM_Date, JS_ATOM_Date },
+    { JS_InitIntrinsicRegExp, JS_ATOM_RegExp, JS_ATOM_RegExp },
+    { JS_InitIntrinsicMapSet, JS_ATOM_Map, JS_ATOM_WeakSet },
+    { JS_InitIntrinsicTypedArrays, JS_ATOM_ArrayBuffer, JS_ATOM_DataView },
+};
+
+static int js_init_lazy_intrinsic(JSContext *ctx, JSLazyIntrinsicEnum id)
+{
+    if (!(ctx->lazy_intrinsics & (1 << id)))
+        return 0;
+    ctx->lazy_intrinsics &= ~(1 << id);
+    return js_lazy_intrinsic_defs[id].init(ctx);
+}
+
+static JSValue js_lazy_intrinsic_global_autoinit(JSContext *ctx,
+                                                 JSValueConst this_obj,
+                                                 JSAtom prop)
+{
+    int id;
+
+    for(id = 0; id < countof(js_lazy_intrinsic_defs); id++) {
+        if (prop >= js_lazy_intrinsic_defs[id].first_atom &&
+            prop <= js_lazy_intrinsic_defs[id].last_atom)
+            break;
+    }
+    assert(id < countof(js_lazy_intrinsic_defs));
+    if (js_init_lazy_intrinsic(ctx, id))
+        return JS_EXCEPTION;
+    return JS_GetProperty(ctx, ctx->lazy_intrinsic_globals, prop);
+}
+
+static int js_add_lazy_intrinsic(JSContext *ctx, JSLazyIntrinsicEnum id)
+{
+    const JSLazyIntrinsicDef *d = &js_lazy_intrinsic_defs[id];
+    JSAtom atom;
+
+    if (JS_IsUndefined(ctx->lazy_intrinsic_globals)) {
+        JSValue obj = JS_NewObjectProto(ctx, JS_NULL);
+        if (JS_IsException(obj))
+            return -1;
+        ctx->lazy_intrinsic_globals = obj;
+    }
+    ctx->lazy_intrinsics |= 1 << id;
+    for(atom = d->first_atom; atom <= d->last_atom; atom++) {
+        if (JS_DefinePropertyAutoInit(ctx, ctx->global_obj, atom,
+                                      js_lazy_intrinsic_global_autoinit,
+                                      JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* return the lazy intrinsic defining the prototype of 'class_id' or -1 */
+static int js_class_lazy_intrinsic(int class_id)
+{
+    switch(class_id) {
+    case JS_CLASS_DATE:
+        return JS_LAZY_INTRINSIC_DATE;
+    case JS_CLASS_REGEXP:
+    case JS_CLASS_REGEXP_STRING_ITERATOR:
+        return JS_LAZY_INTRINSIC_REGEXP;
+    case JS_CLASS_MAP:
+    case JS_CLASS_SET:
+    case JS_CLASS_WEAKMAP:
+    case JS_CLASS_WEAKSET:
+    case JS_CLASS_MAP_ITERATOR:
+    case JS_CLASS_SET_ITERATOR:
+        return JS_LAZY_INTRINSIC_MAP_SET;
+    case JS_CLASS_ARRAY_BUFFER:
+    case JS_CLASS_SHARED_ARRAY_BUFFER:
+    case JS_CLASS_UINT8C_ARRAY:
+    case JS_CLASS_INT8_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+    case JS_CLASS_INT16_ARRAY:
+    case JS_CLASS_UINT16_ARRAY:
+    case JS_CLASS_INT32_ARRAY:
+    case JS_CLASS_UINT32_ARRAY:
+    case JS_CLASS_BIG_INT64_ARRAY:
+    case JS_CLASS_BIG_UINT64_ARRAY:
+    case JS_CLASS_FLOAT16_ARRAY:
+    case JS_CLASS_FLOAT32_ARRAY:
+    case JS_CLASS_FLOAT64_ARRAY:
+    case JS_CLASS_DATAVIEW:
+        return JS_LAZY_INTRINSIC_TYPED_ARRAYS;
+    default:
+        return -1;
+    }
+}
+
+/* return ctx->class_proto[class_id] after creating the corresponding
+   lazy intrinsic if needed, or JS_EXCEPTION */
+static JSValueConst js_get_class_proto(JSContext *ctx, int class_id)
+{
+    int id;
+
+    if (unlikely(JS_IsNull(ctx->class_proto[class_id]) &&
+                 ctx->lazy_intrinsics != 0)) {
+        id = js_class_lazy_intrinsic(class_id);
+        if (id >= 0 && js_init_lazy_intrinsic(ctx, id))
+            return JS_EXCEPTION;
+    }
+    return ctx->class_proto[class_id];
+}
+
 JSValue JS_GetClassProto(JSContext *ctx, JSClassID class_id)
 {
     JSRuntime *rt = ctx->rt;
     assert(class_id < rt->class_count);
-    return JS_DupValue(ctx, ctx->class_proto[class_id]);
+    return JS_DupValue(ctx, js_get_class_proto(ctx, class_id));
 }
 
 typedef enum JSFreeModuleEnum {
@@ -2782,6 +3582,7 @@ static void JS_MarkContextChildren(JSRuntime *rt, JSContext *ctx,
 
     JS_MarkValue(rt, ctx->throw_type_error, mark_func);
     JS_MarkValue(rt, ctx->eval_obj, mark_func);
+    JS_MarkValue(rt, ctx->lazy_intrinsic_globals, mark_func);
 
     JS_MarkValue(rt, ctx->array_proto_values, mark_func);
     for(i = 0; i < JS_NATIVE_ERROR_COUNT; i++) {
@@ -2825,6 +3626,9 @@ void JS_FreeContext(JSContext *ctx)
     if (--js_rc(ctx)->ref_count > 0)
         return;
     assert(js_rc(ctx)->ref_count == 0);
+    /* the context memory is released with the runtime */
+    if (rt->fast_teardown)
+        return;
 
 #ifdef DUMP_ATOMS
     JS_DumpAtoms(ctx->rt);
@@ -2834,12 +3638,12 @@ void JS_FreeContext(JSContext *ctx)
 #endif
 #ifdef DUMP_OBJECTS
     {
-        struct list_head *el;
+        JSGCObjectIter it;
         JSGCObjectHeader *p;
         printf("JSObjects: {\n");
         JS_DumpObjectHeader(ctx->rt);
-        list_for_each(el, &rt->gc_obj_list) {
-            p = list_entry(el, JSGCObjectHeader, link);
+        js_gc_iter_init(rt, &it, FALSE);
+        while ((p = js_gc_iter_next(&it)) != NULL) {
             JS_DumpGCObject(rt, p);
         }
         printf("}\n");
@@ -2860,6 +3664,7 @@ void JS_FreeContext(JSContext *ctx)
 
     JS_FreeValue(ctx, ctx->throw_type_error);
     JS_FreeValue(ctx, ctx->eval_obj);
+    JS_FreeValue(ctx, ctx->lazy_intrinsic_globals);
 
     JS_FreeValue(ctx, ctx->array_proto_values);
     for(i = 0; i < JS_NATIVE_ERROR_COUNT; i++) {
@@ -4738,8 +5543,11 @@ static BOOL JS_ConcatStringInPlace(JSContext *ctx, JSString *p1, JSValueConst op
 
         if (p2->len == 0)
             return TRUE;
-        if (js_rc(p1)->ref_count != 1)
+        /* atoms are never modified */
+        if (js_rc(p1)->ref_count != 1 || p1->atom_type != 0)
             return FALSE;
+        /* invalidate the cached hash (see map_hash_string()) */
+        p1->hash = 0;
         size1 = js_malloc_usable_size(ctx, p1);
         if (p1->is_wide_char) {
             if (size1 >= sizeof(*p1) + ((p1->len + p2->len) << 1)) {
@@ -4783,25 +5591,6 @@ static JSValue JS_ConcatString2(JSContext *ctx, JSValue op1, JSValue op2)
     return ret;
 }
 
-/* Return the character at position 'idx'. 'val' must be a string or rope */
-static int string_rope_get(JSValueConst val, uint32_t idx)
-{
-    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING) {
-        return string_get(JS_VALUE_GET_STRING(val), idx);
-    } else {
-        JSStringRope *r = JS_VALUE_GET_STRING_ROPE(val);
-        uint32_t len;
-        if (JS_VALUE_GET_TAG(r->left) == JS_TAG_STRING)
-            len = JS_VALUE_GET_STRING(r->left)->len;
-        else
-            len = JS_VALUE_GET_STRING_ROPE(r->left)->len;
-        if (idx < len)
-            return string_rope_get(r->left, idx);
-        else
-            return string_rope_get(r->right, idx - len);
-    }
-}
-
 typedef struct {
     JSValueConst stack[JS_STRING_ROPE_MAX_DEPTH];
     int stack_len;
@@ -5273,6 +6062,32 @@ static void js_shape_hash_unlink(JSRuntime *rt, JSShape *sh)
     rt->shape_hash_count--;
 }
 
+static no_inline void js_shape_ids_wrap(JSRuntime *rt)
+{
+    JSGCObjectIter it;
+    JSGCObjectHeader *gp;
+    uint32_t id;
+
+    /* the identifiers could be reused: renumber the live shapes and
+       flush the inline caches */
+    id = 0;
+    js_gc_iter_init(rt, &it, FALSE);
+    while ((gp = js_gc_iter_next(&it)) != NULL) {
+        if (js_rc(gp)->gc_obj_type == JS_GC_OBJ_TYPE_SHAPE)
+            ((JSShape *)gp)->id = ++id;
+    }
+    rt->shape_id_counter = id;
+    js_ic_reset_all(rt);
+}
+
+/* must be called when a shape is created or modified in place */
+static inline void js_shape_new_id(JSRuntime *rt, JSShape *sh)
+{
+    if (unlikely(rt->shape_id_counter == UINT32_MAX))
+        js_shape_ids_wrap(rt);
+    sh->id = ++rt->shape_id_counter;
+}
+
 /* create a new empty shape with prototype 'proto'. It is not hashed */
 static inline JSShape *js_new_shape_nohash(JSContext *ctx, JSObject *proto,
                                            int hash_size, int prop_size)
@@ -5294,6 +6109,9 @@ static inline JSShape *js_new_shape_nohash(JSContext *ctx, JSObject *proto,
     sh->prop_count = 0;
     sh->deleted_prop_count = 0;
     sh->is_hashed = FALSE;
+    sh->is_dict = FALSE;
+    sh->clone_count = 0;
+    js_shape_new_id(rt, sh);
     return sh;
 }
 
@@ -5345,6 +6163,7 @@ static JSShape *js_clone_shape(JSContext *ctx, JSShape *sh1)
     js_rc(sh)->ref_count = 1;
     add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
     sh->is_hashed = FALSE;
+    js_shape_new_id(ctx->rt, sh);
     if (sh->proto) {
         JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, sh->proto));
     }
@@ -5460,6 +6279,28 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
     return 0;
 }
 
+/* insert a non hashed shape without deleted properties in the shape
+   hash table */
+static void js_shape_rehash(JSRuntime *rt, JSShape *sh)
+{
+    JSShapeProperty *pr;
+    uint32_t h;
+    int i;
+
+    assert(!sh->is_hashed && sh->deleted_prop_count == 0);
+    if (2 * (rt->shape_hash_count + 1) > rt->shape_hash_size) {
+        resize_shape_hash(rt, rt->shape_hash_bits + 1);
+    }
+    h = shape_initial_hash(sh->proto);
+    for(i = 0, pr = get_shape_prop(sh); i < sh->prop_count; i++, pr++) {
+        h = shape_hash(shape_hash(h, pr->atom), pr->flags);
+    }
+    sh->hash = h;
+    sh->is_hashed = TRUE;
+    sh->is_dict = FALSE;
+    js_shape_hash_link(rt, sh);
+}
+
 /* remove the deleted properties. */
 static int compact_properties(JSContext *ctx, JSObject *p)
 {
@@ -5496,6 +6337,8 @@ static int compact_properties(JSContext *ctx, JSObject *p)
 
     memset(sh->hash_table, 0, sizeof(sh->hash_table[0]) * new_hash_size);
     sh->prop_hash_mask = new_hash_mask;
+    /* the property indexes change */
+    js_shape_new_id(ctx->rt, sh);
 
     j = 0;
     old_pr = get_shape_prop(old_sh);
@@ -5522,6 +6365,12 @@ static int compact_properties(JSContext *ctx, JSObject *p)
     p->shape = sh;
     js_free(ctx, old_sh);
 
+    if (sh->is_dict && sh->prop_count <= JS_SHAPE_DICT_PROP_COUNT / 2) {
+        /* leave the dictionary mode so that the shape can be shared
+           and cached again */
+        js_shape_rehash(ctx->rt, sh);
+    }
+
     /* reduce the size of the object properties */
     new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
     if (new_prop)
@@ -5558,6 +6407,7 @@ static int add_shape_property(JSContext *ctx, JSShape **psh,
         sh->hash = new_shape_hash;
         js_shape_hash_link(rt, sh);
     }
+    js_shape_new_id(rt, sh);
     /* Initialize the new shape property.
        The object property at p->prop[sh->prop_count] is uninitialized */
     prop = get_shape_prop(sh);
@@ -5646,7 +6496,7 @@ static __maybe_unused void JS_DumpShapes(JSRuntime *rt)
 {
     int i;
     JSShape *sh;
-    struct list_head *el;
+    JSGCObjectIter it;
     JSObject *p;
     JSGCObjectHeader *gp;
 
@@ -5659,8 +6509,8 @@ static __maybe_unused void JS_DumpShapes(JSRuntime *rt)
         }
     }
     /* dump non-hashed shapes */
-    list_for_each(el, &rt->gc_obj_list) {
-        gp = list_entry(el, JSGCObjectHeader, link);
+    js_gc_iter_init(rt, &it, FALSE);
+    while ((gp = js_gc_iter_next(&it)) != NULL) {
         if (js_rc(gp)->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT) {
             p = (JSObject *)gp;
             if (!p->shape->is_hashed) {
@@ -5685,6 +6535,7 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
         goto fail;
     p->class_id = class_id;
     p->is_std_array_prototype = 0;
+    p->array_kind = JS_ARRAY_KIND_VALUE;
     p->extensible = TRUE;
     p->free_mark = 0;
     p->is_exotic = 0;
@@ -5893,7 +6744,10 @@ static int JS_SetObjectData(JSContext *ctx, JSValueConst obj, JSValue val)
 
 JSValue JS_NewObjectClass(JSContext *ctx, int class_id)
 {
-    return JS_NewObjectProtoClass(ctx, ctx->class_proto[class_id], class_id);
+    JSValueConst proto = js_get_class_proto(ctx, class_id);
+    if (JS_IsException(proto))
+        return JS_EXCEPTION;
+    return JS_NewObjectProtoClass(ctx, proto, class_id);
 }
 
 JSValue JS_NewObjectProto(JSContext *ctx, JSValueConst proto)
@@ -6246,13 +7100,141 @@ static void free_var_ref(JSRuntime *rt, JSVarRef *var_ref)
     }
 }
 
+static const uint8_t js_array_kind_size[3] = {
+    sizeof(JSValue), sizeof(int32_t), sizeof(double),
+};
+
+/* return the element 'idx' of a fast array (JS_CLASS_ARRAY or
+   JS_CLASS_ARGUMENTS). The value is not duplicated. */
+static inline JSValueConst js_fast_array_peek(JSObject *p, uint32_t idx)
+{
+    switch(p->array_kind) {
+    case JS_ARRAY_KIND_VALUE:
+        return p->u.array.u.values[idx];
+    case JS_ARRAY_KIND_INT32:
+        return JS_MKVAL(JS_TAG_INT, p->u.array.u.int32_ptr[idx]);
+    default:
+        return JS_NewFloat64(NULL, p->u.array.u.double_ptr[idx]);
+    }
+}
+
+/* TRUE if 'val' can be stored without changing the array kind */
+static inline BOOL js_array_kind_accepts(JSObject *p, JSValueConst val)
+{
+    uint32_t tag = JS_VALUE_GET_TAG(val);
+    switch(p->array_kind) {
+    case JS_ARRAY_KIND_VALUE:
+        return TRUE;
+    case JS_ARRAY_KIND_INT32:
+        return tag == JS_TAG_INT;
+    default:
+        return tag == JS_TAG_INT || JS_TAG_IS_FLOAT64(tag);
+    }
+}
+
+/* store 'val' in the element 'idx' of a fast array without freeing
+   the previous value. The array kind must accept 'val'. */
+static inline void js_fast_array_store(JSObject *p, uint32_t idx, JSValue val)
+{
+    switch(p->array_kind) {
+    case JS_ARRAY_KIND_VALUE:
+        p->u.array.u.values[idx] = val;
+        break;
+    case JS_ARRAY_KIND_INT32:
+        p->u.array.u.int32_ptr[idx] = JS_VALUE_GET_INT(val);
+        break;
+    default:
+        if (JS_VALUE_GET_TAG(val) == JS_TAG_INT)
+            p->u.array.u.double_ptr[idx] = JS_VALUE_GET_INT(val);
+        else
+            p->u.array.u.double_ptr[idx] = JS_VALUE_GET_FLOAT64(val);
+        break;
+    }
+}
+
+/* convert the elements of a fast array to the more general kind
+   'kind'. Return -1 if not enough memory. No exception is raised. */
+static no_inline int js_array_convert_kind(JSContext *ctx, JSObject *p,
+                                           JSArrayKindEnum kind)
+{
+    uint32_t i, len, size;
+    void *tab;
+
+    assert(kind != JS_ARRAY_KIND_INT32 && kind != p->array_kind);
+    len = p->u.array.count;
+    size = p->u.array.u1.size;
+    tab = js_malloc_rt(ctx->rt, (size_t)size * js_array_kind_size[kind]);
+    if (!tab && size != 0)
+        return -1;
+    if (kind == JS_ARRAY_KIND_VALUE) {
+        JSValue *values = tab;
+        for(i = 0; i < len; i++)
+            values[i] = js_fast_array_peek(p, i);
+    } else {
+        double *d = tab;
+        for(i = 0; i < len; i++)
+            d[i] = p->u.array.u.int32_ptr[i];
+    }
+    js_free_rt(ctx->rt, p->u.array.u.ptr);
+    p->u.array.u.ptr = tab;
+    p->array_kind = kind;
+    return 0;
+}
+
+/* convert the elements of a fast array to JSValues so that
+   u.array.u.values can be used. Return -1 if not enough memory. No
+   exception is raised. */
+static inline int js_array_box_elements(JSContext *ctx, JSObject *p)
+{
+    if (likely(p->array_kind == JS_ARRAY_KIND_VALUE))
+        return 0;
+    return js_array_convert_kind(ctx, p, JS_ARRAY_KIND_VALUE);
+}
+
+/* convert the elements so that 'val' can be stored. Return -1 if not
+   enough memory. No exception is raised. */
+static int js_array_widen_kind(JSContext *ctx, JSObject *p, JSValueConst val)
+{
+    if (p->array_kind == JS_ARRAY_KIND_INT32 &&
+        JS_TAG_IS_FLOAT64(JS_VALUE_GET_TAG(val)))
+        return js_array_convert_kind(ctx, p, JS_ARRAY_KIND_FLOAT64);
+    else
+        return js_array_convert_kind(ctx, p, JS_ARRAY_KIND_VALUE);
+}
+
+/* set the existing element 'idx' of a fast array. 'val' is freed in
+   any case. Return -1 if exception. */
+static inline int js_fast_array_set(JSContext *ctx, JSObject *p,
+                                    uint32_t idx, JSValue val)
+{
+    if (likely(p->array_kind == JS_ARRAY_KIND_VALUE)) {
+        set_value(ctx, &p->u.array.u.values[idx], val);
+        return 0;
+    }
+    if (unlikely(!js_array_kind_accepts(p, val))) {
+        if (js_array_widen_kind(ctx, p, val)) {
+            JS_FreeValue(ctx, val);
+            JS_ThrowOutOfMemory(ctx);
+            return -1;
+        }
+        if (p->array_kind == JS_ARRAY_KIND_VALUE) {
+            set_value(ctx, &p->u.array.u.values[idx], val);
+            return 0;
+        }
+    }
+    js_fast_array_store(p, idx, val);
+    return 0;
+}
+
 static void js_array_finalizer(JSRuntime *rt, JSValue val)
 {
     JSObject *p = JS_VALUE_GET_OBJ(val);
     int i;
 
-    for(i = 0; i < p->u.array.count; i++) {
-        JS_FreeValueRT(rt, p->u.array.u.values[i]);
+    if (p->array_kind == JS_ARRAY_KIND_VALUE) {
+        for(i = 0; i < p->u.array.count; i++) {
+            JS_FreeValueRT(rt, p->u.array.u.values[i]);
+        }
     }
     js_free_rt(rt, p->u.array.u.values);
 }
@@ -6263,6 +7245,8 @@ static void js_array_mark(JSRuntime *rt, JSValueConst val,
     JSObject *p = JS_VALUE_GET_OBJ(val);
     int i;
 
+    if (p->array_kind != JS_ARRAY_KIND_VALUE)
+        return;
     for(i = 0; i < p->u.array.count; i++) {
         JS_MarkValue(rt, p->u.array.u.values[i], mark_func);
     }
@@ -6418,7 +7402,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
     }
     js_free_rt(rt, p->prop);
     /* as an optimization we destroy the shape immediately without
-       putting it in gc_zero_ref_count_list */
+       putting it in gc_zero_ref_stack */
     js_free_shape(rt, sh);
 
     /* fail safe */
@@ -6442,7 +7426,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
         } else {
             /* keep the object structure because there are may be
                references to it */
-            list_add_tail(&p->header.link, &rt->gc_zero_ref_count_list);
+            gc_add_zombie(rt, &p->header, JS_GC_OBJ_TYPE_ZOMBIE_JS_OBJECT);
         }
     } else {
         /* keep the object structure in case there are weak references to it */
@@ -6474,19 +7458,38 @@ static void free_gc_object(JSRuntime *rt, JSGCObjectHeader *gp)
     }
 }
 
+/* queue 'p' whose reference count reached zero */
+static void gc_add_zero_refcount(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    js_rc(p)->mark = 1; /* indicate that the object is about to be freed */
+    gc_stack_push(rt, &rt->gc_zero_ref_stack, p);
+}
+
 static void free_zero_refcount(JSRuntime *rt)
 {
-    struct list_head *el;
+    JSGCStack *st = &rt->gc_zero_ref_stack;
+    JSGCObjectIter it;
     JSGCObjectHeader *p;
 
     rt->gc_phase = JS_GC_PHASE_DECREF;
     for(;;) {
-        el = rt->gc_zero_ref_count_list.next;
-        if (el == &rt->gc_zero_ref_count_list)
+        while (st->count != 0) {
+            p = st->tab[--st->count];
+            assert(js_rc(p)->ref_count == 0);
+            free_gc_object(rt, p);
+        }
+        if (likely(!st->overflow))
             break;
-        p = list_entry(el, JSGCObjectHeader, link);
-        assert(js_rc(p)->ref_count == 0);
-        free_gc_object(rt, p);
+        /* some objects could not be queued: look for them in the
+           heap. The stack is empty so at least JS_GC_STACK_MIN_SIZE
+           objects are found at each pass. */
+        st->overflow = FALSE;
+        js_gc_iter_init(rt, &it, FALSE);
+        while ((p = js_gc_iter_next(&it)) != NULL) {
+            if (js_rc(p)->mark == 1 && js_rc(p)->ref_count == 0 &&
+                js_rc(p)->gc_obj_type < JS_GC_OBJ_TYPE_ZOMBIE_JS_OBJECT)
+                gc_stack_push(rt, st, p);
+        }
     }
     rt->gc_phase = JS_GC_PHASE_NONE;
 }
@@ -6537,9 +7540,7 @@ void __JS_FreeValueRT(JSRuntime *rt, JSValue v)
         {
             JSGCObjectHeader *p = JS_VALUE_GET_PTR(v);
             if (rt->gc_phase != JS_GC_PHASE_REMOVE_CYCLES) {
-                list_del(&p->link);
-                list_add(&p->link, &rt->gc_zero_ref_count_list);
-                js_rc(p)->mark = 1; /* indicate that the object is about to be freed */
+                gc_add_zero_refcount(rt, p);
                 if (rt->gc_phase == JS_GC_PHASE_NONE) {
                     free_zero_refcount(rt);
                 }
@@ -6574,7 +7575,7 @@ static void gc_remove_weak_objects(JSRuntime *rt)
 {
     struct list_head *el;
 
-    /* add the freed objects to rt->gc_zero_ref_count_list so that
+    /* add the freed objects to rt->gc_zero_ref_stack so that
        rt->weakref_list is not modified while we traverse it */
     rt->gc_phase = JS_GC_PHASE_DECREF;
 
@@ -6604,13 +7605,25 @@ static void add_gc_object(JSRuntime *rt, JSGCObjectHeader *h,
                           JSGCObjectTypeEnum type)
 {
     js_rc(h)->mark = 0;
-    js_rc(h)->gc_obj_type = type;
-    list_add_tail(&h->link, &rt->gc_obj_list);
+    js_rc(h)->gc_young = 1;
+    js_malloc_set_gc_obj_type(js_rc(h), type);
+    js_malloc_set_young(&rt->malloc_ctx, js_rc(h));
 }
 
+/* the structure is no longer enumerated by the GC */
 static void remove_gc_object(JSGCObjectHeader *h)
 {
-    list_del(&h->link);
+    js_malloc_set_gc_obj_type(js_rc(h), JS_GC_OBJ_TYPE_NONE);
+}
+
+/* called in JS_GC_PHASE_REMOVE_CYCLES instead of freeing the structure
+   of 'h' because it may still be referenced. It is freed at the end
+   of gc_free_cycles(). */
+static void gc_add_zombie(JSRuntime *rt, JSGCObjectHeader *h,
+                          JSGCObjectTypeEnum type)
+{
+    js_malloc_set_gc_obj_type(js_rc(h), type);
+    gc_stack_push(rt, &rt->gc_zero_ref_stack, h);
 }
 
 void JS_MarkValue(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
@@ -6681,6 +7694,8 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
             for(i = 0; i < b->cpool_count; i++) {
                 JS_MarkValue(rt, b->cpool[i], mark_func);
             }
+            if (b->ic)
+                js_ic_mark(rt, b->ic, mark_func);
             if (b->realm)
                 mark_func(rt, &b->realm->header);
         }
@@ -6747,98 +7762,163 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
     }
 }
 
+/* Generational collection: the new GC objects are young and their
+   arena or large block is in the young lists of the allocator. A
+   young collection only looks for cycles among them: the references
+   from the old objects are counted as external references so the
+   young objects they reference are kept. The survivors then become
+   old. The cycles including old objects are only freed by a full
+   collection.
+
+   The GC objects are not moved during a collection: 'mark' tells
+   whether they may be in a cycle (mark = 1 after gc_decref()) or
+   are live (mark = 0 after gc_scan()). */
+
+/* return TRUE if 'p' is not examined by the current collection */
+static inline BOOL gc_is_skipped(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    return rt->gc_young_only && !js_rc(p)->gc_young;
+}
+
+/* the young GC objects become old */
+static void gc_promote_young(JSRuntime *rt)
+{
+    JSMallocContext *s = &rt->malloc_ctx;
+    struct list_head *el, *el1;
+    unsigned int i, block_size;
+
+    list_for_each_safe(el, el1, &s->young_arena_list) {
+        JSMallocArena *ar = list_entry(el, JSMallocArena, young_link);
+        block_size = js_malloc_block_sizes[ar->block_size_idx];
+        /* the free blocks are not GC objects so their flag is not
+           relevant */
+        for(i = 0; i < ar->n_blocks; i++)
+            ((JSMallocBlockHeader *)get_arena_block(ar, i, block_size))->gc_young = 0;
+        ar->young = 0;
+        list_del(&ar->young_link);
+    }
+    list_for_each_safe(el, el1, &s->young_large_block_list) {
+        JSMallocLargeBlockHeader *lb = list_entry(el, JSMallocLargeBlockHeader, link);
+        lb->header.gc_young = 0;
+        /* not examined again by the current JS_RunGCStep() round */
+        lb->header.gc_step_parity = s->gc_step_parity;
+        list_del(&lb->link);
+        list_add_tail(&lb->link, &s->large_block_list);
+    }
+}
+
 static void gc_decref_child(JSRuntime *rt, JSGCObjectHeader *p)
 {
+    if (gc_is_skipped(rt, p))
+        return;
     assert(js_rc(p)->ref_count > 0);
     js_rc(p)->ref_count--;
-    if (js_rc(p)->ref_count == 0 && js_rc(p)->mark == 1) {
-        list_del(&p->link);
-        list_add_tail(&p->link, &rt->tmp_obj_list);
-    }
 }
 
 static void gc_decref(JSRuntime *rt)
 {
-    struct list_head *el, *el1;
+    JSGCObjectIter it;
     JSGCObjectHeader *p;
 
-    init_list_head(&rt->tmp_obj_list);
-
     /* decrement the refcount of all the children of all the GC
-       objects and move the GC objects with zero refcount to
-       tmp_obj_list */
-    list_for_each_safe(el, el1, &rt->gc_obj_list) {
-        p = list_entry(el, JSGCObjectHeader, link);
+       objects. The GC objects with zero refcount may be in a cycle. */
+    js_gc_iter_init(rt, &it, rt->gc_young_only);
+    while ((p = js_gc_iter_next(&it)) != NULL) {
         assert(js_rc(p)->mark == 0);
         mark_children(rt, p, gc_decref_child);
         js_rc(p)->mark = 1;
-        if (js_rc(p)->ref_count == 0) {
-            list_del(&p->link);
-            list_add_tail(&p->link, &rt->tmp_obj_list);
-        }
     }
 }
 
 static void gc_scan_incref_child(JSRuntime *rt, JSGCObjectHeader *p)
 {
+    if (gc_is_skipped(rt, p))
+        return;
     js_rc(p)->ref_count++;
     if (js_rc(p)->ref_count == 1) {
-        /* ref_count was 0: remove from tmp_obj_list and add at the
-           end of gc_obj_list */
-        list_del(&p->link);
-        list_add_tail(&p->link, &rt->gc_obj_list);
-        js_rc(p)->mark = 0; /* reset the mark for the next GC call */
+        /* ref_count was 0: the object is live and its children must
+           be scanned. If the stack is full, it is found by the next
+           pass of gc_scan(). */
+        if (gc_stack_push(rt, &rt->gc_work_stack, p) == 0)
+            js_rc(p)->mark = 0; /* reset the mark for the next GC call */
     }
 }
 
 static void gc_scan_incref_child2(JSRuntime *rt, JSGCObjectHeader *p)
 {
+    if (gc_is_skipped(rt, p))
+        return;
     js_rc(p)->ref_count++;
 }
 
 static void gc_scan(JSRuntime *rt)
 {
-    struct list_head *el;
+    JSGCStack *st = &rt->gc_work_stack;
+    JSGCObjectIter it;
     JSGCObjectHeader *p;
 
     /* keep the objects with a refcount > 0 and their children. */
-    list_for_each(el, &rt->gc_obj_list) {
-        p = list_entry(el, JSGCObjectHeader, link);
-        assert(js_rc(p)->ref_count > 0);
-        js_rc(p)->mark = 0; /* reset the mark for the next GC call */
-        mark_children(rt, p, gc_scan_incref_child);
-    }
-
-    /* restore the refcount of the objects to be deleted. */
-    list_for_each(el, &rt->tmp_obj_list) {
-        p = list_entry(el, JSGCObjectHeader, link);
-        mark_children(rt, p, gc_scan_incref_child2);
-    }
+    do {
+        st->overflow = FALSE;
+        js_gc_iter_init(rt, &it, rt->gc_young_only);
+        while ((p = js_gc_iter_next(&it)) != NULL) {
+            if (js_rc(p)->ref_count == 0 || js_rc(p)->mark == 0)
+                continue;
+            js_rc(p)->mark = 0; /* reset the mark for the next GC call */
+            for(;;) {
+                mark_children(rt, p, gc_scan_incref_child);
+                if (st->count == 0)
+                    break;
+                p = st->tab[--st->count];
+            }
+        }
+    } while (st->overflow);
 }
 
 static void gc_free_cycles(JSRuntime *rt)
 {
-    struct list_head *el, *el1;
+    JSGCStack *st = &rt->gc_work_stack;
+    JSGCStack *zombies = &rt->gc_zero_ref_stack;
+    JSGCObjectIter it;
     JSGCObjectHeader *p;
+    BOOL first_pass;
+    uint32_t i;
 #ifdef DUMP_GC_FREE
     BOOL header_done = FALSE;
 #endif
 
     rt->gc_phase = JS_GC_PHASE_REMOVE_CYCLES;
 
-    for(;;) {
-        el = rt->tmp_obj_list.next;
-        if (el == &rt->tmp_obj_list)
-            break;
-        p = list_entry(el, JSGCObjectHeader, link);
-        /* Only need to free the GC object associated with JS values
-           or async functions. The rest will be automatically removed
-           because they must be referenced by them. */
-        switch(js_rc(p)->gc_obj_type) {
-        case JS_GC_OBJ_TYPE_JS_OBJECT:
-        case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
-        case JS_GC_OBJ_TYPE_ASYNC_FUNCTION:
-        case JS_GC_OBJ_TYPE_MODULE:
+    /* the objects are listed before being freed because freeing them
+       modifies the heap */
+    first_pass = TRUE;
+    do {
+        st->overflow = FALSE;
+        js_gc_iter_init(rt, &it, rt->gc_young_only);
+        while ((p = js_gc_iter_next(&it)) != NULL) {
+            if (js_rc(p)->mark == 0 ||
+                js_rc(p)->gc_obj_type >= JS_GC_OBJ_TYPE_ZOMBIE_JS_OBJECT)
+                continue;
+            /* restore the refcount of the objects to be deleted. */
+            if (first_pass)
+                mark_children(rt, p, gc_scan_incref_child2);
+            /* Only need to free the GC object associated with JS values
+               or async functions. The rest will be automatically removed
+               because they must be referenced by them. */
+            switch(js_rc(p)->gc_obj_type) {
+            case JS_GC_OBJ_TYPE_JS_OBJECT:
+            case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+            case JS_GC_OBJ_TYPE_ASYNC_FUNCTION:
+            case JS_GC_OBJ_TYPE_MODULE:
+                gc_stack_push(rt, st, p);
+                break;
+            default:
+                break;
+            }
+        }
+        first_pass = FALSE;
+        for(i = 0; i < st->count; i++) {
+            p = st->tab[i];
 #ifdef DUMP_GC_FREE
             if (!header_done) {
                 printf("Freeing cycles:\n");
@@ -6848,35 +7928,49 @@ static void gc_free_cycles(JSRuntime *rt)
             JS_DumpGCObject(rt, p);
 #endif
             free_gc_object(rt, p);
-            break;
-        default:
-            list_del(&p->link);
-            list_add_tail(&p->link, &rt->gc_zero_ref_count_list);
-            break;
         }
-    }
+        st->count = 0;
+    } while (st->overflow);
     rt->gc_phase = JS_GC_PHASE_NONE;
 
-    list_for_each_safe(el, el1, &rt->gc_zero_ref_count_list) {
-        p = list_entry(el, JSGCObjectHeader, link);
-        assert(js_rc(p)->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT ||
-               js_rc(p)->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE ||
-               js_rc(p)->gc_obj_type == JS_GC_OBJ_TYPE_ASYNC_FUNCTION ||
-               js_rc(p)->gc_obj_type == JS_GC_OBJ_TYPE_MODULE);
-        if (js_rc(p)->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT &&
-            ((JSObject *)p)->weakref_count != 0) {
-            /* keep the object because there are weak references to it */
-            js_rc(p)->mark = 0;
-        } else {
-            js_free_rt(rt, p);
+    /* free the structures which were kept because they could still be
+       referenced (see gc_add_zombie()) */
+    for(;;) {
+        while (zombies->count != 0) {
+            p = zombies->tab[--zombies->count];
+            if (js_rc(p)->gc_obj_type == JS_GC_OBJ_TYPE_ZOMBIE_JS_OBJECT &&
+                ((JSObject *)p)->weakref_count != 0) {
+                /* keep the object because there are weak references to it */
+                js_rc(p)->mark = 0;
+                remove_gc_object(p);
+            } else {
+                remove_gc_object(p);
+                js_free_rt(rt, p);
+            }
+        }
+        if (likely(!zombies->overflow))
+            break;
+        zombies->overflow = FALSE;
+        js_gc_iter_init(rt, &it, rt->gc_young_only);
+        while ((p = js_gc_iter_next(&it)) != NULL) {
+            if (js_rc(p)->gc_obj_type >= JS_GC_OBJ_TYPE_ZOMBIE_JS_OBJECT)
+                gc_stack_push(rt, zombies, p);
         }
     }
-
-    init_list_head(&rt->gc_zero_ref_count_list);
 }
 
-static void JS_RunGCInternal(JSRuntime *rt, BOOL remove_weak_objects)
+static void JS_RunGCInternal(JSRuntime *rt, BOOL remove_weak_objects,
+                             BOOL young_only)
 {
+#ifdef DUMP_GC
+    printf("GC: %s collection\n", young_only ? "young" : "full");
+#endif
+    if (!young_only) {
+        /* a full collection makes the current round useless */
+        rt->gc_step_active = FALSE;
+    }
+    rt->gc_young_only = young_only;
+
     if (remove_weak_objects) {
         /* free the weakly referenced object or symbol structures, delete
            the associated Map/Set entries and queue the finalization
@@ -6893,11 +7987,140 @@ static void JS_RunGCInternal(JSRuntime *rt, BOOL remove_weak_objects)
 
     /* free the GC objects in a cycle */
     gc_free_cycles(rt);
+
+    /* the remaining young objects survived the collection */
+    rt->gc_young_only = FALSE;
+    gc_promote_young(rt);
+
+    gc_stack_shrink(rt, &rt->gc_work_stack);
+    gc_stack_shrink(rt, &rt->gc_zero_ref_stack);
+
+    if (!young_only) {
+        js_malloc_free_empty_arenas(&rt->malloc_ctx);
+#if defined(__GLIBC__)
+        /* the freed arenas are usually not at the top of the heap, so
+           glibc would not return their pages to the OS. malloc_trim()
+           walks the whole heap, so it is only done when enough memory
+           was released. */
+        if (rt->malloc_ctx.mf.js_free == js_def_free &&
+            rt->malloc_ctx.released_arena_size >= JS_MALLOC_TRIM_THRESHOLD) {
+            rt->malloc_ctx.released_arena_size = 0;
+            malloc_trim(0);
+        }
+#endif
+        /* start the next incremental round before the next full
+           collection */
+        rt->malloc_gc_step_threshold =
+            rt->malloc_ctx.malloc_state.malloc_size +
+            (rt->malloc_ctx.malloc_state.malloc_size >> 2);
+    }
 }
 
 void JS_RunGC(JSRuntime *rt)
 {
-    JS_RunGCInternal(rt, TRUE);
+    JS_RunGCInternal(rt, TRUE, FALSE);
+}
+
+static int64_t js_gc_get_time_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Incremental collection: the old GC objects are examined by windows
+   of about JS_GC_STEP_WINDOW objects made of the arenas and large
+   blocks taken at the head of their list. Each window is collected
+   together with the young objects, so the cycles contained in it are
+   freed, and its arenas and large blocks are moved to the end of
+   their list. The cycles spanning several windows are only freed by
+   a full collection. A round ends when the heads of the lists were
+   already examined during the round (their gc_step_parity is then
+   equal to the current one). */
+
+/* make the GC objects of the next window young. Return FALSE if the
+   round is finished. */
+static BOOL gc_step_take_window(JSRuntime *rt)
+{
+    JSMallocContext *s = &rt->malloc_ctx;
+    struct list_head *head;
+    JSMallocBlockHeader *b;
+    unsigned int i, block_size;
+    int block_size_idx, n;
+    BOOL taken;
+
+    n = 0;
+    taken = FALSE;
+    for(block_size_idx = 0; block_size_idx < JS_MALLOC_BLOCK_SIZE_COUNT &&
+            n < JS_GC_STEP_WINDOW; block_size_idx++) {
+        head = &s->arena_list[block_size_idx];
+        block_size = js_malloc_block_sizes[block_size_idx];
+        while (n < JS_GC_STEP_WINDOW && !list_empty(head)) {
+            JSMallocArena *ar = list_entry(head->next, JSMallocArena, link);
+            if (ar->gc_step_parity == s->gc_step_parity)
+                break;
+            ar->gc_step_parity = s->gc_step_parity;
+            list_del(&ar->link);
+            list_add_tail(&ar->link, head);
+            taken = TRUE;
+            for(i = 0; i < ar->n_blocks; i++) {
+                if ((ar->bitmap[i / 32] >> (i % 32)) & 1) {
+                    b = get_arena_block(ar, i, block_size);
+                    b->gc_young = 1;
+                    n++;
+                    if (!ar->young) {
+                        ar->young = 1;
+                        list_add_tail(&ar->young_link, &s->young_arena_list);
+                    }
+                }
+            }
+        }
+    }
+
+    head = &s->large_block_list;
+    while (n < JS_GC_STEP_WINDOW && !list_empty(head)) {
+        JSMallocLargeBlockHeader *lb = list_entry(head->next, JSMallocLargeBlockHeader, link);
+        if (lb->header.gc_step_parity == s->gc_step_parity)
+            break;
+        lb->header.gc_step_parity = s->gc_step_parity;
+        list_del(&lb->link);
+        taken = TRUE;
+        if (lb->header.gc_obj_type != JS_GC_OBJ_TYPE_NONE) {
+            lb->header.gc_young = 1;
+            list_add_tail(&lb->link, &s->young_large_block_list);
+            n++;
+        } else {
+            list_add_tail(&lb->link, head);
+        }
+    }
+    return taken;
+}
+
+/* Return TRUE if the round is not finished. */
+BOOL JS_RunGCStep(JSRuntime *rt, int64_t budget_us)
+{
+    int64_t start_time;
+
+    if (!rt->gc_step_active) {
+        if (rt->malloc_ctx.malloc_state.malloc_size <=
+            rt->malloc_gc_step_threshold)
+            return FALSE;
+        rt->gc_step_active = TRUE;
+        rt->malloc_ctx.gc_step_parity ^= 1;
+    }
+    start_time = js_gc_get_time_us();
+    for(;;) {
+        if (!gc_step_take_window(rt)) {
+            rt->gc_step_active = FALSE;
+            rt->malloc_gc_step_threshold =
+                rt->malloc_ctx.malloc_state.malloc_size +
+                (rt->malloc_ctx.malloc_state.malloc_size >> 2);
+            return FALSE;
+        }
+        JS_RunGCInternal(rt, TRUE, TRUE);
+        if (js_gc_get_time_us() - start_time >= budget_us)
+            return TRUE;
+    }
 }
 
 /* Return false if not an object or if the object has already been
@@ -6956,6 +8179,11 @@ static void compute_bytecode_size(JSFunctionBytecode *b, JSMemoryUsage_helper *h
     if (b->closure_var) {
         js_func_size += b->closure_var_count * sizeof(*b->closure_var);
     }
+    if (b->ic) {
+        memory_used_count++;
+        js_func_size += sizeof(JSInlineCache) +
+            (sizeof(JSInlineCacheSite) << b->ic->hash_bits);
+    }
     if (!b->read_only_bytecode && b->byte_code_buf) {
         hp->js_func_code_size += b->byte_code_len;
     }
@@ -6991,6 +8219,8 @@ static void compute_value_size(JSValueConst val, JSMemoryUsage_helper *hp)
 void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
 {
     struct list_head *el, *el1;
+    JSGCObjectIter it;
+    JSGCObjectHeader *gp;
     int i;
     JSMemoryUsage_helper mem = { 0 }, *hp = &mem;
 
@@ -7050,8 +8280,8 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
         }
     }
 
-    list_for_each(el, &rt->gc_obj_list) {
-        JSGCObjectHeader *gp = list_entry(el, JSGCObjectHeader, link);
+    js_gc_iter_init(rt, &it, FALSE);
+    while ((gp = js_gc_iter_next(&it)) != NULL) {
         JSObject *p;
         JSShape *sh;
         JSShapeProperty *prs;
@@ -7095,10 +8325,12 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
                 if (p->u.array.u.values) {
                     s->memory_used_count++;
                     s->memory_used_size += p->u.array.count *
-                        sizeof(*p->u.array.u.values);
+                        js_array_kind_size[p->array_kind];
                     s->fast_array_elements += p->u.array.count;
-                    for (i = 0; i < p->u.array.count; i++) {
-                        compute_value_size(p->u.array.u.values[i], hp);
+                    if (p->array_kind == JS_ARRAY_KIND_VALUE) {
+                        for (i = 0; i < p->u.array.count; i++) {
+                            compute_value_size(p->u.array.u.values[i], hp);
+                        }
                     }
                 }
             }
@@ -7321,9 +8553,10 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
         {
             int obj_classes[JS_CLASS_INIT_COUNT + 1] = { 0 };
             int class_id;
-            struct list_head *el;
-            list_for_each(el, &rt->gc_obj_list) {
-                JSGCObjectHeader *gp = list_entry(el, JSGCObjectHeader, link);
+            JSGCObjectIter it;
+            JSGCObjectHeader *gp;
+            js_gc_iter_init(rt, &it, FALSE);
+            while ((gp = js_gc_iter_next(&it)) != NULL) {
                 JSObject *p;
                 if (js_rc(gp)->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT) {
                     p = (JSObject *)gp;
@@ -8200,10 +9433,1545 @@ static void JS_ThrowInterrupted(JSContext *ctx)
     JS_SetUncatchableException(ctx, TRUE);
 }
 
+/* Sampling profilers: the JS stack is sampled by the interrupt poll for
+   the CPU profiler and by js_malloc_rt() for the heap sampling. The
+   samples are accumulated in a call tree whose nodes are identified by
+   the function name and source position. */
+
+typedef struct JSProfileLineTicks {
+    int line_num;
+    uint32_t ticks;
+} JSProfileLineTicks;
+
+typedef struct JSProfileNode {
+    JSAtom func_name; /* JS_ATOM_NULL if anonymous or native */
+    JSString *native_name; /* name of a native function, or NULL */
+    JSAtom filename; /* JS_ATOM_NULL for native functions */
+    int line_num; /* function definition, 0 if unknown */
+    int col_num;
+    int parent; /* -1 for the root node */
+    int first_child; /* -1 if none */
+    int next_sibling; /* -1 if none */
+    /* samples (CPU profiler) or bytes (heap sampling) with this node
+       at the top of the stack */
+    uint64_t self_value;
+    /* self_value split by the line executed in the function */
+    JSProfileLineTicks *line_ticks;
+    int line_ticks_count;
+    int line_ticks_size;
+} JSProfileNode;
+
+typedef struct JSProfileFrame {
+    JSAtom func_name;
+    JSString *native_name;
+    JSAtom filename;
+    int line_num;
+    int col_num;
+    int cur_line_num; /* line being executed, 0 if unknown */
+} JSProfileFrame;
+
+typedef struct JSProfileTree {
+    JSProfileNode *nodes; /* nodes[0] is the root */
+    int node_count;
+    int node_size;
+    JSProfileFrame *frames; /* temporary stack copy */
+    int frame_size;
+} JSProfileTree;
+
+typedef struct JSCPUProfile {
+    int64_t interval; /* in us */
+    int64_t start_time;
+    int64_t last_sample_time;
+    JSProfileTree tree;
+    /* node of the top of the stack and time elapsed since the previous
+       sample, for each sample */
+    uint32_t *samples;
+    uint32_t *time_deltas;
+    int sample_count;
+    int sample_size;
+} JSCPUProfile;
+
+typedef struct JSHeapSampling {
+    int64_t interval; /* mean number of bytes between two samples */
+    int64_t bytes_until_sample;
+    int64_t bytes_since_sample;
+    uint32_t random_state;
+    BOOL in_sample; /* the profiler allocates memory too */
+    JSProfileTree tree;
+    /* node of the top of the stack and estimated allocated size, for
+       each sample */
+    uint32_t *samples;
+    uint64_t *sample_sizes;
+    int sample_count;
+    int sample_size;
+} JSHeapSampling;
+
+/* no exception is raised on memory error: the profilers must not change
+   the behavior of the program */
+static int js_profile_resize(JSRuntime *rt, void **parray, int elem_size,
+                             int *psize, int req_size)
+{
+    int new_size;
+    void *new_array;
+
+    if (likely(req_size <= *psize))
+        return 0;
+    new_size = max_int(req_size, *psize * 3 / 2);
+    new_array = js_realloc_rt(rt, *parray, (size_t)new_size * elem_size);
+    if (!new_array)
+        return -1;
+    *psize = new_size;
+    *parray = new_array;
+    return 0;
+}
+
+static void js_profile_tree_free(JSRuntime *rt, JSProfileTree *tree)
+{
+    int i;
+
+    for(i = 0; i < tree->node_count; i++) {
+        JSProfileNode *n = &tree->nodes[i];
+        JS_FreeAtomRT(rt, n->func_name);
+        JS_FreeAtomRT(rt, n->filename);
+        if (n->native_name)
+            JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, n->native_name));
+        js_free_rt(rt, n->line_ticks);
+    }
+    js_free_rt(rt, tree->nodes);
+    js_free_rt(rt, tree->frames);
+    tree->nodes = NULL;
+    tree->frames = NULL;
+    tree->node_count = tree->node_size = tree->frame_size = 0;
+}
+
+static int js_profile_new_node(JSRuntime *rt, JSProfileTree *tree,
+                               int parent, const JSProfileFrame *fr)
+{
+    JSProfileNode *n;
+    int idx;
+
+    if (js_profile_resize(rt, (void **)&tree->nodes, sizeof(tree->nodes[0]),
+                          &tree->node_size, tree->node_count + 1))
+        return -1;
+    idx = tree->node_count++;
+    n = &tree->nodes[idx];
+    memset(n, 0, sizeof(*n));
+    n->func_name = JS_DupAtomRT(rt, fr->func_name);
+    n->filename = JS_DupAtomRT(rt, fr->filename);
+    if (fr->native_name) {
+        n->native_name = fr->native_name;
+        JS_DupValueRT(rt, JS_MKPTR(JS_TAG_STRING, fr->native_name));
+    }
+    n->line_num = fr->line_num;
+    n->col_num = fr->col_num;
+    n->parent = parent;
+    n->first_child = -1;
+    n->next_sibling = -1;
+    if (parent >= 0) {
+        n->next_sibling = tree->nodes[parent].first_child;
+        tree->nodes[parent].first_child = idx;
+    }
+    return idx;
+}
+
+static int js_profile_tree_init(JSRuntime *rt, JSProfileTree *tree)
+{
+    JSProfileFrame root;
+
+    memset(tree, 0, sizeof(*tree));
+    memset(&root, 0, sizeof(root));
+    return js_profile_new_node(rt, tree, -1, &root);
+}
+
+static int js_profile_get_child(JSRuntime *rt, JSProfileTree *tree,
+                                int parent, const JSProfileFrame *fr)
+{
+    JSProfileNode *n;
+    int idx;
+
+    for(idx = tree->nodes[parent].first_child; idx >= 0; idx = n->next_sibling) {
+        n = &tree->nodes[idx];
+        if (n->func_name == fr->func_name && n->native_name == fr->native_name &&
+            n->filename == fr->filename &&
+            n->line_num == fr->line_num && n->col_num == fr->col_num)
+            return idx;
+    }
+    return js_profile_new_node(rt, tree, parent, fr);
+}
+
+static int js_profile_add_line_tick(JSRuntime *rt, JSProfileNode *n,
+                                    int line_num)
+{
+    int i;
+
+    for(i = 0; i < n->line_ticks_count; i++) {
+        if (n->line_ticks[i].line_num == line_num) {
+            n->line_ticks[i].ticks++;
+            return 0;
+        }
+    }
+    if (js_profile_resize(rt, (void **)&n->line_ticks, sizeof(n->line_ticks[0]),
+                          &n->line_ticks_size, n->line_ticks_count + 1))
+        return -1;
+    n->line_ticks[n->line_ticks_count].line_num = line_num;
+    n->line_ticks[n->line_ticks_count].ticks = 1;
+    n->line_ticks_count++;
+    return 0;
+}
+
+/* Return the name of a native function without side effects nor
+   memory allocation: only a string data property is used. */
+static JSString *js_profile_native_name(JSObject *p)
+{
+    JSShapeProperty *prs;
+    JSProperty *pr;
+
+    prs = find_own_property(&pr, p, JS_ATOM_name);
+    if (!prs || (prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
+        return NULL;
+    if (JS_VALUE_GET_TAG(pr->u.value) != JS_TAG_STRING)
+        return NULL;
+    return JS_VALUE_GET_STRING(pr->u.value);
+}
+
+/* Add the current stack to the tree and return the node of its top, or
+   -1 if out of memory. The only memory allocated is the one of the
+   tree. */
+static int js_profile_add_stack(JSRuntime *rt, JSProfileTree *tree,
+                                int *pcur_line_num)
+{
+    JSStackFrame *sf;
+    JSProfileFrame *fr;
+    JSObject *p;
+    int i, depth, node, col_num;
+
+    /* copy the stack, top first. The frames only reference values
+       which are kept alive by the stack itself. */
+    depth = 0;
+    for(sf = rt->current_stack_frame; sf != NULL; sf = sf->prev_frame) {
+        if (JS_VALUE_GET_TAG(sf->cur_func) != JS_TAG_OBJECT)
+            continue; /* synthetic or detached frame */
+        if (js_profile_resize(rt, (void **)&tree->frames, sizeof(tree->frames[0]),
+                              &tree->frame_size, depth + 1))
+            return -1;
+        fr = &tree->frames[depth++];
+        memset(fr, 0, sizeof(*fr));
+        p = JS_VALUE_GET_OBJ(sf->cur_func);
+        if (js_class_has_bytecode(p->class_id)) {
+            JSFunctionBytecode *b = p->u.func.function_bytecode;
+            fr->func_name = b->func_name;
+            if (b->has_debug) {
+                fr->filename = b->debug.filename;
+                fr->line_num = find_line_num(b->realm, b, -1, &fr->col_num);
+                if (sf->cur_pc) {
+                    fr->cur_line_num = find_line_num(b->realm, b,
+                                                     sf->cur_pc - b->byte_code_buf - 1,
+                                                     &col_num);
+                }
+            }
+        } else {
+            fr->native_name = js_profile_native_name(p);
+        }
+    }
+
+    node = 0;
+    for(i = depth - 1; i >= 0; i--) {
+        node = js_profile_get_child(rt, tree, node, &tree->frames[i]);
+        if (node < 0)
+            return -1;
+    }
+    *pcur_line_num = depth > 0 ? tree->frames[0].cur_line_num : 0;
+    return node;
+}
+
+/* the samples measure the CPU time of the thread running the runtime
+   when available */
+static int64_t js_cpu_profile_get_time_us(void)
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+}
+
+static void js_cpu_profile_free(JSRuntime *rt)
+{
+    JSCPUProfile *prof = rt->cpu_profile;
+
+    if (!prof)
+        return;
+    js_profile_tree_free(rt, &prof->tree);
+    js_free_rt(rt, prof->samples);
+    js_free_rt(rt, prof->time_deltas);
+    js_free_rt(rt, prof);
+    rt->cpu_profile = NULL;
+}
+
+static void js_cpu_profile_sample(JSRuntime *rt, JSCPUProfile *prof,
+                                  int64_t now)
+{
+    JSProfileNode *n;
+    int node, line_num;
+    uint32_t time_delta;
+
+    /* on memory error, the sample is lost */
+    time_delta = now - prof->last_sample_time;
+    prof->last_sample_time = now;
+    node = js_profile_add_stack(rt, &prof->tree, &line_num);
+    if (node < 0)
+        return;
+    n = &prof->tree.nodes[node];
+    n->self_value++;
+    if (line_num > 0 && js_profile_add_line_tick(rt, n, line_num))
+        return;
+    if (prof->sample_count >= prof->sample_size) {
+        int new_size = max_int(256, prof->sample_size * 3 / 2);
+        uint32_t *new_buf;
+        new_buf = js_realloc_rt(rt, prof->samples, sizeof(prof->samples[0]) * new_size);
+        if (!new_buf)
+            return;
+        prof->samples = new_buf;
+        new_buf = js_realloc_rt(rt, prof->time_deltas, sizeof(prof->time_deltas[0]) * new_size);
+        if (!new_buf)
+            return;
+        prof->time_deltas = new_buf;
+        prof->sample_size = new_size;
+    }
+    prof->samples[prof->sample_count] = node;
+    prof->time_deltas[prof->sample_count] = time_delta;
+    prof->sample_count++;
+}
+
+static void js_heap_sampling_free(JSRuntime *rt)
+{
+    JSHeapSampling *hs = rt->heap_sampling;
+
+    if (!hs)
+        return;
+    rt->heap_sampling = NULL;
+    js_profile_tree_free(rt, &hs->tree);
+    js_free_rt(rt, hs->samples);
+    js_free_rt(rt, hs->sample_sizes);
+    js_free_rt(rt, hs);
+}
+
+/* the distance between two samples is randomized so that periodic
+   allocation patterns do not bias the samples */
+static int64_t js_heap_sampling_next_interval(JSHeapSampling *hs)
+{
+    uint32_t x = hs->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    hs->random_state = x;
+    return hs->interval / 2 + (int64_t)((uint64_t)x * hs->interval >> 32);
+}
+
+/* called by js_malloc_rt() after 'size' bytes were allocated */
+static no_inline void js_heap_sampling_alloc(JSRuntime *rt, size_t size)
+{
+    JSHeapSampling *hs = rt->heap_sampling;
+    int node, line_num;
+    uint64_t sample_size;
+
+    if (hs->in_sample)
+        return;
+    hs->bytes_since_sample += size;
+    hs->bytes_until_sample -= size;
+    if (hs->bytes_until_sample > 0)
+        return;
+    /* the sample stands for all the bytes allocated since the previous
+       one */
+    sample_size = hs->bytes_since_sample;
+    hs->bytes_since_sample = 0;
+    hs->bytes_until_sample = js_heap_sampling_next_interval(hs);
+
+    hs->in_sample = TRUE;
+    node = js_profile_add_stack(rt, &hs->tree, &line_num);
+    if (node < 0)
+        goto done;
+    hs->tree.nodes[node].self_value += sample_size;
+    if (hs->sample_count >= hs->sample_size) {
+        int new_size = max_int(256, hs->sample_size * 3 / 2);
+        void *new_buf;
+        new_buf = js_realloc_rt(rt, hs->samples, sizeof(hs->samples[0]) * new_size);
+        if (!new_buf)
+            goto done;
+        hs->samples = new_buf;
+        new_buf = js_realloc_rt(rt, hs->sample_sizes, sizeof(hs->sample_sizes[0]) * new_size);
+        if (!new_buf)
+            goto done;
+        hs->sample_sizes = new_buf;
+        hs->sample_size = new_size;
+    }
+    hs->samples[hs->sample_count] = node;
+    hs->sample_sizes[hs->sample_count] = sample_size;
+    hs->sample_count++;
+ done:
+    hs->in_sample = FALSE;
+}
+
+int JS_StartCPUProfile(JSRuntime *rt, int interval)
+{
+    JSCPUProfile *prof;
+
+    js_cpu_profile_free(rt);
+    prof = js_mallocz_rt(rt, sizeof(*prof));
+    if (!prof)
+        return -1;
+    if (js_profile_tree_init(rt, &prof->tree) < 0) {
+        js_free_rt(rt, prof);
+        return -1;
+    }
+    prof->interval = interval > 0 ? interval : JS_CPU_PROFILE_DEFAULT_INTERVAL;
+    prof->start_time = js_cpu_profile_get_time_us();
+    prof->last_sample_time = prof->start_time;
+    rt->cpu_profile = prof;
+    return 0;
+}
+
+int JS_StartHeapSampling(JSRuntime *rt, int interval)
+{
+    JSHeapSampling *hs;
+
+    js_heap_sampling_free(rt);
+    hs = js_mallocz_rt(rt, sizeof(*hs));
+    if (!hs)
+        return -1;
+    if (js_profile_tree_init(rt, &hs->tree) < 0) {
+        js_free_rt(rt, hs);
+        return -1;
+    }
+    hs->interval = interval > 0 ? interval : JS_HEAP_SAMPLING_DEFAULT_INTERVAL;
+    hs->random_state = 0x9e3779b9;
+    hs->bytes_until_sample = js_heap_sampling_next_interval(hs);
+    rt->heap_sampling = hs;
+    return 0;
+}
+
+static void dbuf_put_json_str(DynBuf *s, const char *str)
+{
+    int c;
+
+    dbuf_putc(s, '"');
+    while ((c = (uint8_t)*str++) != '\0') {
+        if (c == '"' || c == '\\') {
+            dbuf_putc(s, '\\');
+            dbuf_putc(s, c);
+        } else if (c < 0x20) {
+            dbuf_printf(s, "\\u%04x", c);
+        } else {
+            dbuf_putc(s, c);
+        }
+    }
+    dbuf_putc(s, '"');
+}
+
+/* frame names of the collapsed stack format cannot contain ';' or
+   line breaks */
+static void dbuf_put_collapsed_str(DynBuf *s, const char *str)
+{
+    int c;
+
+    while ((c = (uint8_t)*str++) != '\0') {
+        if (c == ';')
+            c = ':';
+        else if (c < 0x20)
+            c = ' ';
+        dbuf_putc(s, c);
+    }
+}
+
+/* return the name of the function of a node as a C string to be freed
+   with JS_FreeCString(), or NULL if anonymous */
+static const char *js_profile_node_name(JSContext *ctx, JSProfileNode *n)
+{
+    const char *str = NULL;
+
+    if (n->native_name)
+        str = JS_ToCString(ctx, JS_MKPTR(JS_TAG_STRING, n->native_name));
+    else if (n->func_name != JS_ATOM_NULL)
+        str = JS_AtomToCString(ctx, n->func_name);
+    if (str && str[0] == '\0') {
+        JS_FreeCString(ctx, str);
+        str = NULL;
+    }
+    return str;
+}
+
+/* "callFrame" of the Chrome DevTools profiles: the line and column
+   numbers are 0 based */
+static void js_profile_put_call_frame(JSContext *ctx, DynBuf *dbuf,
+                                      JSProfileTree *tree, int idx)
+{
+    JSProfileNode *n = &tree->nodes[idx];
+    const char *str;
+
+    dbuf_putstr(dbuf, "\"callFrame\":{\"functionName\":");
+    if (idx == 0) {
+        dbuf_putstr(dbuf, "\"(root)\"");
+    } else {
+        str = js_profile_node_name(ctx, n);
+        dbuf_put_json_str(dbuf, str ? str : "");
+        JS_FreeCString(ctx, str);
+    }
+    dbuf_printf(dbuf, ",\"scriptId\":\"%u\",\"url\":", n->filename);
+    str = NULL;
+    if (n->filename != JS_ATOM_NULL)
+        str = JS_AtomToCString(ctx, n->filename);
+    dbuf_put_json_str(dbuf, str ? str : "");
+    JS_FreeCString(ctx, str);
+    dbuf_printf(dbuf, ",\"lineNumber\":%d,\"columnNumber\":%d}",
+                n->line_num - 1, n->col_num - 1);
+}
+
+/* Chrome DevTools .cpuprofile */
+static void js_cpu_profile_to_cpuprofile(JSContext *ctx, JSCPUProfile *prof,
+                                         DynBuf *dbuf, int64_t end_time)
+{
+    JSProfileTree *tree = &prof->tree;
+    JSProfileNode *n;
+    int i, j, child;
+
+    dbuf_putstr(dbuf, "{\"nodes\":[");
+    for(i = 0; i < tree->node_count; i++) {
+        n = &tree->nodes[i];
+        if (i != 0)
+            dbuf_putc(dbuf, ',');
+        dbuf_printf(dbuf, "{\"id\":%d,", i + 1);
+        js_profile_put_call_frame(ctx, dbuf, tree, i);
+        dbuf_printf(dbuf, ",\"hitCount\":%" PRIu64, n->self_value);
+        if (n->first_child >= 0) {
+            dbuf_putstr(dbuf, ",\"children\":[");
+            for(child = n->first_child; child >= 0; child = tree->nodes[child].next_sibling) {
+                dbuf_printf(dbuf, "%s%d", child == n->first_child ? "" : ",", child + 1);
+            }
+            dbuf_putc(dbuf, ']');
+        }
+        if (n->line_ticks_count > 0) {
+            dbuf_putstr(dbuf, ",\"positionTicks\":[");
+            for(j = 0; j < n->line_ticks_count; j++) {
+                dbuf_printf(dbuf, "%s{\"line\":%d,\"ticks\":%u}", j == 0 ? "" : ",",
+                            n->line_ticks[j].line_num, n->line_ticks[j].ticks);
+            }
+            dbuf_putc(dbuf, ']');
+        }
+        dbuf_putc(dbuf, '}');
+    }
+    dbuf_printf(dbuf, "],\"startTime\":%" PRId64 ",\"endTime\":%" PRId64 ",\"samples\":[",
+                prof->start_time, end_time);
+    for(i = 0; i < prof->sample_count; i++)
+        dbuf_printf(dbuf, "%s%u", i == 0 ? "" : ",", prof->samples[i] + 1);
+    dbuf_putstr(dbuf, "],\"timeDeltas\":[");
+    for(i = 0; i < prof->sample_count; i++)
+        dbuf_printf(dbuf, "%s%u", i == 0 ? "" : ",", prof->time_deltas[i]);
+    dbuf_putstr(dbuf, "]}");
+}
+
+static void js_heap_sampling_put_node(JSContext *ctx, DynBuf *dbuf,
+                                      JSProfileTree *tree, int idx)
+{
+    JSProfileNode *n = &tree->nodes[idx];
+    int child;
+
+    dbuf_putc(dbuf, '{');
+    js_profile_put_call_frame(ctx, dbuf, tree, idx);
+    dbuf_printf(dbuf, ",\"selfSize\":%" PRIu64 ",\"id\":%d,\"children\":[",
+                n->self_value, idx + 1);
+    for(child = n->first_child; child >= 0; child = tree->nodes[child].next_sibling) {
+        if (child != n->first_child)
+            dbuf_putc(dbuf, ',');
+        js_heap_sampling_put_node(ctx, dbuf, tree, child);
+    }
+    dbuf_putstr(dbuf, "]}");
+}
+
+/* Chrome DevTools .heapprofile */
+static void js_heap_sampling_to_heapprofile(JSContext *ctx, JSHeapSampling *hs,
+                                            DynBuf *dbuf)
+{
+    int i;
+
+    dbuf_putstr(dbuf, "{\"head\":");
+    js_heap_sampling_put_node(ctx, dbuf, &hs->tree, 0);
+    dbuf_putstr(dbuf, ",\"samples\":[");
+    for(i = 0; i < hs->sample_count; i++) {
+        dbuf_printf(dbuf, "%s{\"size\":%" PRIu64 ",\"nodeId\":%u,\"ordinal\":%d}",
+                    i == 0 ? "" : ",", hs->sample_sizes[i], hs->samples[i] + 1, i + 1);
+    }
+    dbuf_putstr(dbuf, "]}");
+}
+
+/* Brendan Gregg's collapsed stacks: one line per stack with its
+   self_value */
+static void js_profile_to_collapsed(JSContext *ctx, JSProfileTree *tree,
+                                    DynBuf *dbuf)
+{
+    JSProfileNode *n;
+    const char *str;
+    int i, j, depth, idx, *path;
+
+    path = js_malloc(ctx, sizeof(path[0]) * max_int(tree->node_count, 1));
+    if (!path) {
+        dbuf->error = TRUE;
+        return;
+    }
+    for(i = 1; i < tree->node_count; i++) {
+        if (tree->nodes[i].self_value == 0)
+            continue;
+        depth = 0;
+        for(idx = i; idx > 0; idx = tree->nodes[idx].parent)
+            path[depth++] = idx;
+        for(j = depth - 1; j >= 0; j--) {
+            n = &tree->nodes[path[j]];
+            str = js_profile_node_name(ctx, n);
+            dbuf_put_collapsed_str(dbuf, str ? str : "(anonymous)");
+            JS_FreeCString(ctx, str);
+            if (n->filename != JS_ATOM_NULL) {
+                str = JS_AtomToCString(ctx, n->filename);
+                dbuf_putstr(dbuf, " (");
+                dbuf_put_collapsed_str(dbuf, str ? str : "");
+                dbuf_printf(dbuf, ":%d)", n->line_num);
+                JS_FreeCString(ctx, str);
+            }
+            if (j != 0)
+                dbuf_putc(dbuf, ';');
+        }
+        dbuf_printf(dbuf, " %" PRIu64 "\n", tree->nodes[i].self_value);
+    }
+    js_free(ctx, path);
+}
+
+static JSValue js_profile_dbuf_to_string(JSContext *ctx, DynBuf *dbuf)
+{
+    JSValue ret;
+
+    if (dbuf_error(dbuf)) {
+        dbuf_free(dbuf);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    ret = JS_NewStringLen(ctx, (const char *)dbuf->buf, dbuf->size);
+    dbuf_free(dbuf);
+    return ret;
+}
+
+JSValue JS_StopCPUProfile(JSContext *ctx, int format)
+{
+    JSRuntime *rt = ctx->rt;
+    JSCPUProfile *prof = rt->cpu_profile;
+    int64_t end_time;
+    DynBuf dbuf;
+
+    if (!prof)
+        return JS_NULL;
+    end_time = js_cpu_profile_get_time_us();
+    /* no more samples while the profile is converted */
+    rt->cpu_profile = NULL;
+    js_dbuf_init(ctx, &dbuf);
+    if (format == JS_CPU_PROFILE_FORMAT_COLLAPSED)
+        js_profile_to_collapsed(ctx, &prof->tree, &dbuf);
+    else
+        js_cpu_profile_to_cpuprofile(ctx, prof, &dbuf, end_time);
+    rt->cpu_profile = prof;
+    js_cpu_profile_free(rt);
+    return js_profile_dbuf_to_string(ctx, &dbuf);
+}
+
+JSValue JS_StopHeapSampling(JSContext *ctx, int format)
+{
+    JSRuntime *rt = ctx->rt;
+    JSHeapSampling *hs = rt->heap_sampling;
+    DynBuf dbuf;
+
+    if (!hs)
+        return JS_NULL;
+    /* no more samples while the profile is converted */
+    rt->heap_sampling = NULL;
+    js_dbuf_init(ctx, &dbuf);
+    if (format == JS_HEAP_SAMPLING_FORMAT_COLLAPSED)
+        js_profile_to_collapsed(ctx, &hs->tree, &dbuf);
+    else
+        js_heap_sampling_to_heapprofile(ctx, hs, &dbuf);
+    rt->heap_sampling = hs;
+    js_heap_sampling_free(rt);
+    return js_profile_dbuf_to_string(ctx, &dbuf);
+}
+
+
+/* Heap snapshot in the Chrome DevTools format (.heapsnapshot). The
+   nodes are the GC objects and the strings they reference. The edges
+   are found with the same functions as the cycle collector. The
+   named edges (properties, array elements, closure variables) are
+   computed here, the other references are listed as "hidden"
+   edges. */
+
+typedef enum {
+    JS_HS_NODE_HIDDEN,
+    JS_HS_NODE_ARRAY,
+    JS_HS_NODE_STRING,
+    JS_HS_NODE_OBJECT,
+    JS_HS_NODE_CODE,
+    JS_HS_NODE_CLOSURE,
+    JS_HS_NODE_REGEXP,
+    JS_HS_NODE_NUMBER,
+    JS_HS_NODE_NATIVE,
+    JS_HS_NODE_SYNTHETIC,
+    JS_HS_NODE_CONCATENATED_STRING,
+    JS_HS_NODE_SLICED_STRING,
+    JS_HS_NODE_SYMBOL,
+    JS_HS_NODE_BIGINT,
+    JS_HS_NODE_OBJECT_SHAPE,
+} JSHeapSnapshotNodeTypeEnum;
+
+typedef enum {
+    JS_HS_EDGE_CONTEXT,
+    JS_HS_EDGE_ELEMENT,
+    JS_HS_EDGE_PROPERTY,
+    JS_HS_EDGE_INTERNAL,
+    JS_HS_EDGE_HIDDEN,
+    JS_HS_EDGE_SHORTCUT,
+    JS_HS_EDGE_WEAK,
+} JSHeapSnapshotEdgeTypeEnum;
+
+/* names which are not atoms */
+typedef enum {
+    JS_HS_STR_EMPTY, /* must be first */
+    JS_HS_STR_ROOT,
+    JS_HS_STR_MAP,
+    JS_HS_STR_PROTO,
+    JS_HS_STR_PROTOTYPE,
+    JS_HS_STR_SHARED,
+    JS_HS_STR_HOME_OBJECT,
+    JS_HS_STR_VALUE,
+    JS_HS_STR_GLOBAL,
+    JS_HS_STR_FIRST,
+    JS_HS_STR_SECOND,
+    JS_HS_STR_SHAPE,
+    JS_HS_STR_VAR_REF,
+    JS_HS_STR_ASYNC_FUNCTION,
+    JS_HS_STR_CONTEXT,
+    JS_HS_STR_CONCATENATED_STRING,
+    JS_HS_STR_COUNT,
+} JSHeapSnapshotStringEnum;
+
+static const char * const js_hs_const_strings[JS_HS_STR_COUNT] = {
+    "",
+    "(GC roots)",
+    "map",
+    "__proto__",
+    "prototype",
+    "shared",
+    "home_object",
+    "value",
+    "global",
+    "first",
+    "second",
+    "(shape)",
+    "(closure variable)",
+    "(async function state)",
+    "(context)",
+    "(concatenated string)",
+};
+
+typedef struct JSHeapSnapshotNode {
+    void *ptr; /* GC object, JSString or JSStringRope */
+    uint8_t type; /* JSHeapSnapshotNodeTypeEnum */
+    uint8_t is_string : 1;
+    uint8_t is_rope : 1;
+    uint8_t is_retained : 1; /* TRUE if there is an edge to the node */
+    uint32_t name; /* index in the string table */
+    uint32_t edge_count;
+    size_t self_size;
+} JSHeapSnapshotNode;
+
+typedef struct JSHeapSnapshotEdge {
+    uint8_t type; /* JSHeapSnapshotEdgeTypeEnum */
+    uint32_t name_or_index; /* string index or element index */
+    uint32_t to; /* node index */
+} JSHeapSnapshotEdge;
+
+typedef struct JSHeapSnapshotEdgeKey {
+    uint32_t from; /* node index */
+    uint32_t to; /* node index */
+} JSHeapSnapshotEdgeKey;
+
+typedef struct JSHeapSnapshot {
+    JSRuntime *rt;
+    /* node 0 is the root */
+    JSHeapSnapshotNode *nodes;
+    int node_count;
+    int node_size;
+    /* the edges are sorted by source node */
+    JSHeapSnapshotEdge *edges;
+    int edge_count;
+    int edge_size;
+    /* open addressing hash table: node pointer -> node index (0 if free) */
+    uint32_t *hash;
+    uint32_t hash_size; /* power of two */
+    /* open addressing hash set of the named (from, to) edges of the
+       nodes which also have hidden edges (from = 0 if free) */
+    JSHeapSnapshotEdgeKey *edge_set;
+    uint32_t edge_set_size; /* power of two */
+    uint32_t edge_set_count;
+    /* string table */
+    DynBuf strings; /* JSON strings separated by commas */
+    uint32_t string_count;
+    uint32_t *atom_strings; /* atom -> string index + 1, 0 if none */
+    uint32_t const_strings[JS_HS_STR_COUNT]; /* string index + 1 */
+    /* edges added by js_heap_snapshot_mark() */
+    int cur_node;
+    int cur_first_edge; /* first edge of cur_node */
+    uint32_t cur_hidden_index;
+    BOOL oom;
+} JSHeapSnapshot;
+
+/* JSON string of the first 'max_len' characters of 'p' */
+static void dbuf_put_json_jsstring(DynBuf *s, const JSString *p,
+                                   uint32_t max_len)
+{
+    uint8_t buf[UTF8_CHAR_LEN_MAX];
+    uint32_t i, len;
+    int c;
+
+    len = min_uint32(p->len, max_len);
+    dbuf_putc(s, '"');
+    for(i = 0; i < len; i++) {
+        c = string_get(p, i);
+        if (c == '"' || c == '\\') {
+            dbuf_putc(s, '\\');
+            dbuf_putc(s, c);
+        } else if (c < 0x20 || is_surrogate(c)) {
+            /* surrogates are kept as escapes so that the pairs are
+               decoded by the JSON parser */
+            dbuf_printf(s, "\\u%04x", c);
+        } else if (c < 0x80) {
+            dbuf_putc(s, c);
+        } else {
+            dbuf_put(s, buf, unicode_to_utf8(buf, c));
+        }
+    }
+    if (len < p->len)
+        dbuf_putstr(s, "...");
+    dbuf_putc(s, '"');
+}
+
+static uint32_t js_hs_new_string(JSHeapSnapshot *hs)
+{
+    if (hs->string_count != 0)
+        dbuf_putc(&hs->strings, ',');
+    return hs->string_count++;
+}
+
+static uint32_t js_hs_const_string(JSHeapSnapshot *hs, JSHeapSnapshotStringEnum idx)
+{
+    if (hs->const_strings[idx] == 0) {
+        hs->const_strings[idx] = js_hs_new_string(hs) + 1;
+        dbuf_put_json_str(&hs->strings, js_hs_const_strings[idx]);
+    }
+    return hs->const_strings[idx] - 1;
+}
+
+/* the string nodes are named by their content */
+static uint32_t js_hs_jsstring(JSHeapSnapshot *hs, const JSString *p)
+{
+    uint32_t idx = js_hs_new_string(hs);
+    dbuf_put_json_jsstring(&hs->strings, p, 1024);
+    return idx;
+}
+
+static uint32_t js_hs_atom_string(JSHeapSnapshot *hs, JSAtom atom)
+{
+    uint32_t idx;
+
+    if (__JS_AtomIsTaggedInt(atom)) {
+        idx = js_hs_new_string(hs);
+        dbuf_printf(&hs->strings, "\"%u\"", __JS_AtomToUInt32(atom));
+        return idx;
+    }
+    if (atom == JS_ATOM_NULL)
+        return js_hs_const_string(hs, JS_HS_STR_EMPTY);
+    if (hs->atom_strings[atom] == 0) {
+        idx = js_hs_jsstring(hs, hs->rt->atom_array[atom]);
+        hs->atom_strings[atom] = idx + 1;
+    }
+    return hs->atom_strings[atom] - 1;
+}
+
+static uint32_t js_hs_hash_ptr(void *ptr, uint32_t hash_size)
+{
+    return (uint32_t)(((uintptr_t)ptr >> 3) * 0x9e3779b1) & (hash_size - 1);
+}
+
+static int js_hs_find_node(JSHeapSnapshot *hs, void *ptr)
+{
+    uint32_t h, idx;
+
+    h = js_hs_hash_ptr(ptr, hs->hash_size);
+    while ((idx = hs->hash[h]) != 0) {
+        if (hs->nodes[idx].ptr == ptr)
+            return idx;
+        h = (h + 1) & (hs->hash_size - 1);
+    }
+    return -1;
+}
+
+static int js_hs_resize_hash(JSHeapSnapshot *hs, uint32_t new_size)
+{
+    uint32_t *new_hash, h;
+    int i;
+
+    new_hash = js_mallocz_rt(hs->rt, sizeof(new_hash[0]) * new_size);
+    if (!new_hash)
+        return -1;
+    for(i = 1; i < hs->node_count; i++) {
+        h = js_hs_hash_ptr(hs->nodes[i].ptr, new_size);
+        while (new_hash[h] != 0)
+            h = (h + 1) & (new_size - 1);
+        new_hash[h] = i;
+    }
+    js_free_rt(hs->rt, hs->hash);
+    hs->hash = new_hash;
+    hs->hash_size = new_size;
+    return 0;
+}
+
+/* return the node index or -1 if out of memory */
+static int js_hs_add_node(JSHeapSnapshot *hs, void *ptr, int type,
+                          uint32_t name, size_t self_size)
+{
+    JSHeapSnapshotNode *n;
+    uint32_t h;
+    int idx;
+
+    if (js_profile_resize(hs->rt, (void **)&hs->nodes, sizeof(hs->nodes[0]),
+                          &hs->node_size, hs->node_count + 1))
+        goto fail;
+    if (2 * (hs->node_count + 1) > hs->hash_size &&
+        js_hs_resize_hash(hs, hs->hash_size * 2))
+        goto fail;
+    idx = hs->node_count++;
+    n = &hs->nodes[idx];
+    memset(n, 0, sizeof(*n));
+    n->ptr = ptr;
+    n->type = type;
+    n->name = name;
+    n->self_size = self_size;
+    h = js_hs_hash_ptr(ptr, hs->hash_size);
+    while (hs->hash[h] != 0)
+        h = (h + 1) & (hs->hash_size - 1);
+    hs->hash[h] = idx;
+    return idx;
+ fail:
+    hs->oom = TRUE;
+    return -1;
+}
+
+static void js_hs_add_edge(JSHeapSnapshot *hs, int type,
+                           uint32_t name_or_index, int to)
+{
+    JSHeapSnapshotEdge *e;
+
+    if (to < 0)
+        return;
+    if (js_profile_resize(hs->rt, (void **)&hs->edges, sizeof(hs->edges[0]),
+                          &hs->edge_size, hs->edge_count + 1)) {
+        hs->oom = TRUE;
+        return;
+    }
+    e = &hs->edges[hs->edge_count++];
+    e->type = type;
+    e->name_or_index = name_or_index;
+    e->to = to;
+    hs->nodes[hs->cur_node].edge_count++;
+    hs->nodes[to].is_retained = TRUE;
+}
+
+static uint32_t js_hs_hash_edge(uint32_t from, uint32_t to, uint32_t hash_size)
+{
+    return (uint32_t)(((((uint64_t)from << 32) | to) *
+                       0x9e3779b97f4a7c15) >> 32) & (hash_size - 1);
+}
+
+static BOOL js_hs_find_edge(JSHeapSnapshot *hs, uint32_t from, uint32_t to)
+{
+    JSHeapSnapshotEdgeKey *k;
+    uint32_t h;
+
+    if (hs->edge_set_count == 0)
+        return FALSE;
+    h = js_hs_hash_edge(from, to, hs->edge_set_size);
+    for(;;) {
+        k = &hs->edge_set[h];
+        if (k->from == 0)
+            return FALSE;
+        if (k->from == from && k->to == to)
+            return TRUE;
+        h = (h + 1) & (hs->edge_set_size - 1);
+    }
+}
+
+static int js_hs_resize_edge_set(JSHeapSnapshot *hs, uint32_t new_size)
+{
+    JSHeapSnapshotEdgeKey *new_set, *k;
+    uint32_t i, h;
+
+    new_set = js_mallocz_rt(hs->rt, sizeof(new_set[0]) * new_size);
+    if (!new_set)
+        return -1;
+    for(i = 0; i < hs->edge_set_size; i++) {
+        k = &hs->edge_set[i];
+        if (k->from == 0)
+            continue;
+        h = js_hs_hash_edge(k->from, k->to, new_size);
+        while (new_set[h].from != 0)
+            h = (h + 1) & (new_size - 1);
+        new_set[h] = *k;
+    }
+    js_free_rt(hs->rt, hs->edge_set);
+    hs->edge_set = new_set;
+    hs->edge_set_size = new_size;
+    return 0;
+}
+
+/* the next edges of the current node are hidden: record its named
+   edges so that js_heap_snapshot_mark() skips the same references */
+static void js_hs_end_named_edges(JSHeapSnapshot *hs)
+{
+    JSHeapSnapshotEdgeKey *k;
+    uint32_t from = hs->cur_node, to, h;
+    int i;
+
+    for(i = hs->cur_first_edge; i < hs->edge_count; i++) {
+        to = hs->edges[i].to;
+        if (js_hs_find_edge(hs, from, to))
+            continue;
+        if (2 * (hs->edge_set_count + 1) > hs->edge_set_size &&
+            js_hs_resize_edge_set(hs, max_int(hs->edge_set_size * 2, 256))) {
+            hs->oom = TRUE;
+            return;
+        }
+        h = js_hs_hash_edge(from, to, hs->edge_set_size);
+        while (hs->edge_set[h].from != 0)
+            h = (h + 1) & (hs->edge_set_size - 1);
+        k = &hs->edge_set[h];
+        k->from = from;
+        k->to = to;
+        hs->edge_set_count++;
+    }
+}
+
+/* node of a heap value, or -1 if it is not in the snapshot */
+static int js_hs_value_node(JSHeapSnapshot *hs, JSValueConst val)
+{
+    JSHeapSnapshotNode *n;
+    void *ptr;
+    int idx;
+
+    switch(JS_VALUE_GET_TAG(val)) {
+    case JS_TAG_OBJECT:
+    case JS_TAG_FUNCTION_BYTECODE:
+    case JS_TAG_MODULE:
+        return js_hs_find_node(hs, JS_VALUE_GET_PTR(val));
+    case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
+        ptr = JS_VALUE_GET_PTR(val);
+        idx = js_hs_find_node(hs, ptr);
+        if (idx >= 0)
+            return idx;
+        if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING) {
+            JSString *p = ptr;
+            idx = js_hs_add_node(hs, ptr, JS_HS_NODE_STRING, js_hs_jsstring(hs, p),
+                                 sizeof(JSString) + (p->len << p->is_wide_char) +
+                                 1 - p->is_wide_char);
+            if (idx >= 0)
+                hs->nodes[idx].is_string = TRUE;
+        } else {
+            idx = js_hs_add_node(hs, ptr, JS_HS_NODE_CONCATENATED_STRING,
+                                 js_hs_const_string(hs, JS_HS_STR_CONCATENATED_STRING),
+                                 sizeof(JSStringRope));
+            if (idx >= 0) {
+                n = &hs->nodes[idx];
+                n->is_string = TRUE;
+                n->is_rope = TRUE;
+            }
+        }
+        return idx;
+    default:
+        return -1;
+    }
+}
+
+static void js_hs_add_value_edge(JSHeapSnapshot *hs, int type,
+                                 uint32_t name_or_index, JSValueConst val)
+{
+    js_hs_add_edge(hs, type, name_or_index, js_hs_value_node(hs, val));
+}
+
+static void js_hs_add_ptr_edge(JSHeapSnapshot *hs, int type,
+                               uint32_t name_or_index, void *ptr)
+{
+    if (ptr)
+        js_hs_add_edge(hs, type, name_or_index, js_hs_find_node(hs, ptr));
+}
+
+/* mark function: the references which are not named are hidden edges */
+static void js_heap_snapshot_mark(JSRuntime *rt, JSGCObjectHeader *gp)
+{
+    JSHeapSnapshot *hs = rt->heap_snapshot;
+    int to;
+
+    to = js_hs_find_node(hs, gp);
+    if (to < 0 || js_hs_find_edge(hs, hs->cur_node, to))
+        return;
+    js_hs_add_edge(hs, JS_HS_EDGE_HIDDEN, hs->cur_hidden_index++, to);
+}
+
+/* string index of the name of a function object, 0 if none */
+static uint32_t js_hs_function_name(JSHeapSnapshot *hs, JSObject *p)
+{
+    JSString *str;
+
+    if (p->class_id == JS_CLASS_BYTECODE_FUNCTION) {
+        JSAtom name = p->u.func.function_bytecode->func_name;
+        if (name != JS_ATOM_NULL && name != JS_ATOM_empty_string)
+            return js_hs_atom_string(hs, name);
+    } else if (p->class_id != JS_CLASS_C_FUNCTION &&
+               p->class_id != JS_CLASS_C_FUNCTION_DATA &&
+               p->class_id != JS_CLASS_BOUND_FUNCTION) {
+        return 0;
+    }
+    /* the class constructors are only named by their "name" property */
+    str = js_profile_native_name(p);
+    if (str && str->len != 0)
+        return js_hs_jsstring(hs, str);
+    return 0;
+}
+
+static void js_hs_describe_object(JSHeapSnapshot *hs, JSObject *p,
+                                  int *ptype, uint32_t *pname, size_t *psize)
+{
+    JSRuntime *rt = hs->rt;
+    JSShape *sh = p->shape;
+    uint32_t name = 0;
+    size_t size;
+    int type = JS_HS_NODE_OBJECT;
+
+    size = sizeof(JSObject);
+    if (p->prop)
+        size += sh->prop_size * sizeof(*p->prop);
+    switch(p->class_id) {
+    case JS_CLASS_ARRAY:
+    case JS_CLASS_ARGUMENTS:
+        if (p->fast_array)
+            size += p->u.array.count * js_array_kind_size[p->array_kind];
+        break;
+    case JS_CLASS_MAPPED_ARGUMENTS:
+        if (p->fast_array)
+            size += p->u.array.count * sizeof(*p->u.array.u.var_refs);
+        break;
+    case JS_CLASS_ARRAY_BUFFER:
+        if (!p->u.array_buffer->shared)
+            size += p->u.array_buffer->byte_length;
+        break;
+    case JS_CLASS_REGEXP:
+        type = JS_HS_NODE_REGEXP;
+        if (p->u.regexp.pattern)
+            name = js_hs_jsstring(hs, p->u.regexp.pattern);
+        break;
+    case JS_CLASS_BYTECODE_FUNCTION:
+        if (p->u.func.var_refs)
+            size += p->u.func.function_bytecode->closure_var_count *
+                sizeof(*p->u.func.var_refs);
+        /* fall thru */
+    case JS_CLASS_C_FUNCTION:
+    case JS_CLASS_C_FUNCTION_DATA:
+    case JS_CLASS_BOUND_FUNCTION:
+        type = JS_HS_NODE_CLOSURE;
+        name = js_hs_function_name(hs, p);
+        break;
+    case JS_CLASS_OBJECT:
+        /* name the plain objects by their constructor */
+        if (sh->proto) {
+            JSShapeProperty *prs;
+            JSProperty *pr;
+            prs = find_own_property(&pr, sh->proto, JS_ATOM_constructor);
+            if (prs && (prs->flags & JS_PROP_TMASK) == JS_PROP_NORMAL &&
+                JS_VALUE_GET_TAG(pr->u.value) == JS_TAG_OBJECT)
+                name = js_hs_function_name(hs, JS_VALUE_GET_OBJ(pr->u.value));
+        }
+        break;
+    default:
+        break;
+    }
+    if (name == 0 && type != JS_HS_NODE_CLOSURE)
+        name = js_hs_atom_string(hs, rt->class_array[p->class_id].class_name);
+    *ptype = type;
+    *pname = name;
+    *psize = size;
+}
+
+static int js_hs_add_gc_node(JSHeapSnapshot *hs, JSGCObjectHeader *gp)
+{
+    JSMemoryUsage_helper mem;
+    uint32_t name;
+    size_t size;
+    int type;
+
+    switch(js_rc(gp)->gc_obj_type) {
+    case JS_GC_OBJ_TYPE_JS_OBJECT:
+        js_hs_describe_object(hs, (JSObject *)gp, &type, &name, &size);
+        break;
+    case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+        {
+            JSFunctionBytecode *b = (JSFunctionBytecode *)gp;
+            memset(&mem, 0, sizeof(mem));
+            compute_bytecode_size(b, &mem);
+            type = JS_HS_NODE_CODE;
+            name = js_hs_atom_string(hs, b->func_name);
+            size = mem.js_func_size + mem.js_func_code_size +
+                mem.js_func_pc2line_size;
+        }
+        break;
+    case JS_GC_OBJ_TYPE_SHAPE:
+        {
+            JSShape *sh = (JSShape *)gp;
+            type = JS_HS_NODE_OBJECT_SHAPE;
+            name = js_hs_const_string(hs, JS_HS_STR_SHAPE);
+            size = get_shape_size(sh->prop_hash_mask + 1, sh->prop_size);
+        }
+        break;
+    case JS_GC_OBJ_TYPE_VAR_REF:
+        type = JS_HS_NODE_HIDDEN;
+        name = js_hs_const_string(hs, JS_HS_STR_VAR_REF);
+        size = sizeof(JSVarRef);
+        break;
+    case JS_GC_OBJ_TYPE_ASYNC_FUNCTION:
+        type = JS_HS_NODE_HIDDEN;
+        name = js_hs_const_string(hs, JS_HS_STR_ASYNC_FUNCTION);
+        size = sizeof(JSAsyncFunctionState);
+        break;
+    case JS_GC_OBJ_TYPE_JS_CONTEXT:
+        type = JS_HS_NODE_SYNTHETIC;
+        name = js_hs_const_string(hs, JS_HS_STR_CONTEXT);
+        size = sizeof(JSContext) + hs->rt->class_count * sizeof(JSValue);
+        break;
+    case JS_GC_OBJ_TYPE_MODULE:
+        type = JS_HS_NODE_HIDDEN;
+        name = js_hs_atom_string(hs, ((JSModuleDef *)gp)->module_name);
+        size = sizeof(JSModuleDef);
+        break;
+    default:
+        abort();
+    }
+    return js_hs_add_node(hs, gp, type, name, size);
+}
+
+static void js_hs_object_edges(JSHeapSnapshot *hs, JSObject *p)
+{
+    JSRuntime *rt = hs->rt;
+    JSShape *sh = p->shape;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    uint32_t name;
+    int i, type;
+
+    js_hs_add_ptr_edge(hs, JS_HS_EDGE_INTERNAL,
+                       js_hs_const_string(hs, JS_HS_STR_MAP), sh);
+    js_hs_add_ptr_edge(hs, JS_HS_EDGE_PROPERTY,
+                       js_hs_const_string(hs, JS_HS_STR_PROTO), sh->proto);
+    prs = get_shape_prop(sh);
+    for(i = 0; i < sh->prop_count; i++, prs++) {
+        pr = &p->prop[i];
+        if (prs->atom == JS_ATOM_NULL)
+            continue;
+        if (__JS_AtomIsTaggedInt(prs->atom)) {
+            type = JS_HS_EDGE_ELEMENT;
+            name = __JS_AtomToUInt32(prs->atom);
+        } else {
+            type = JS_HS_EDGE_PROPERTY;
+            name = js_hs_atom_string(hs, prs->atom);
+        }
+        switch(prs->flags & JS_PROP_TMASK) {
+        case JS_PROP_NORMAL:
+            js_hs_add_value_edge(hs, type, name, pr->u.value);
+            break;
+        case JS_PROP_GETSET:
+            js_hs_add_ptr_edge(hs, type, name, pr->u.getset.getter);
+            js_hs_add_ptr_edge(hs, type, name, pr->u.getset.setter);
+            break;
+        case JS_PROP_VARREF:
+            js_hs_add_ptr_edge(hs, type, name, pr->u.var_ref);
+            break;
+        default:
+            break;
+        }
+    }
+
+    switch(p->class_id) {
+    case JS_CLASS_OBJECT:
+        break;
+    case JS_CLASS_ARRAY:
+    case JS_CLASS_ARGUMENTS:
+        if (p->fast_array && p->array_kind == JS_ARRAY_KIND_VALUE) {
+            for(i = 0; i < p->u.array.count; i++)
+                js_hs_add_value_edge(hs, JS_HS_EDGE_ELEMENT, i,
+                                     p->u.array.u.values[i]);
+        }
+        break;
+    case JS_CLASS_NUMBER:
+    case JS_CLASS_STRING:
+    case JS_CLASS_BOOLEAN:
+    case JS_CLASS_SYMBOL:
+    case JS_CLASS_DATE:
+    case JS_CLASS_BIG_INT:
+        js_hs_add_value_edge(hs, JS_HS_EDGE_INTERNAL,
+                             js_hs_const_string(hs, JS_HS_STR_VALUE),
+                             p->u.object_data);
+        break;
+    case JS_CLASS_BYTECODE_FUNCTION:
+        {
+            JSFunctionBytecode *b = p->u.func.function_bytecode;
+            js_hs_add_ptr_edge(hs, JS_HS_EDGE_INTERNAL,
+                               js_hs_const_string(hs, JS_HS_STR_SHARED), b);
+            js_hs_add_ptr_edge(hs, JS_HS_EDGE_INTERNAL,
+                               js_hs_const_string(hs, JS_HS_STR_HOME_OBJECT),
+                               p->u.func.home_object);
+            if (p->u.func.var_refs) {
+                for(i = 0; i < b->closure_var_count; i++) {
+                    js_hs_add_ptr_edge(hs, JS_HS_EDGE_CONTEXT,
+                                       js_hs_atom_string(hs, b->closure_var[i].var_name),
+                                       p->u.func.var_refs[i]);
+                }
+            }
+        }
+        break;
+    default:
+        {
+            JSClassGCMark *gc_mark = rt->class_array[p->class_id].gc_mark;
+            if (gc_mark) {
+                js_hs_end_named_edges(hs);
+                gc_mark(rt, JS_MKPTR(JS_TAG_OBJECT, p), js_heap_snapshot_mark);
+            }
+        }
+        break;
+    }
+}
+
+static void js_hs_node_edges(JSHeapSnapshot *hs, int idx)
+{
+    JSRuntime *rt = hs->rt;
+    JSHeapSnapshotNode *n = &hs->nodes[idx];
+    JSGCObjectHeader *gp;
+
+    hs->cur_node = idx;
+    hs->cur_first_edge = hs->edge_count;
+    hs->cur_hidden_index = 0;
+    if (n->is_string) {
+        if (n->is_rope) {
+            JSStringRope *r = n->ptr;
+            js_hs_add_value_edge(hs, JS_HS_EDGE_INTERNAL,
+                                 js_hs_const_string(hs, JS_HS_STR_FIRST), r->left);
+            js_hs_add_value_edge(hs, JS_HS_EDGE_INTERNAL,
+                                 js_hs_const_string(hs, JS_HS_STR_SECOND), r->right);
+        }
+        return;
+    }
+    gp = n->ptr;
+    switch(js_rc(gp)->gc_obj_type) {
+    case JS_GC_OBJ_TYPE_JS_OBJECT:
+        js_hs_object_edges(hs, (JSObject *)gp);
+        break;
+    case JS_GC_OBJ_TYPE_SHAPE:
+        js_hs_add_ptr_edge(hs, JS_HS_EDGE_INTERNAL,
+                           js_hs_const_string(hs, JS_HS_STR_PROTOTYPE),
+                           ((JSShape *)gp)->proto);
+        break;
+    case JS_GC_OBJ_TYPE_VAR_REF:
+        {
+            JSVarRef *var_ref = (JSVarRef *)gp;
+            if (var_ref->is_detached) {
+                js_hs_add_value_edge(hs, JS_HS_EDGE_INTERNAL,
+                                     js_hs_const_string(hs, JS_HS_STR_VALUE),
+                                     *var_ref->pvalue);
+            } else {
+                mark_children(rt, gp, js_heap_snapshot_mark);
+            }
+        }
+        break;
+    case JS_GC_OBJ_TYPE_JS_CONTEXT:
+        js_hs_add_value_edge(hs, JS_HS_EDGE_PROPERTY,
+                             js_hs_const_string(hs, JS_HS_STR_GLOBAL),
+                             ((JSContext *)gp)->global_obj);
+        js_hs_end_named_edges(hs);
+        mark_children(rt, gp, js_heap_snapshot_mark);
+        break;
+    default:
+        mark_children(rt, gp, js_heap_snapshot_mark);
+        break;
+    }
+}
+
+static void js_hs_flush(DynBuf *dbuf, void (*write_func)(void *opaque, const char *buf, size_t len),
+                        void *opaque)
+{
+    if (dbuf->size != 0 && !dbuf_error(dbuf)) {
+        write_func(opaque, (const char *)dbuf->buf, dbuf->size);
+        dbuf->size = 0;
+    }
+}
+
+static void js_hs_write(JSHeapSnapshot *hs, DynBuf *dbuf,
+                        void (*write_func)(void *opaque, const char *buf, size_t len),
+                        void *opaque)
+{
+    JSHeapSnapshotNode *n;
+    JSHeapSnapshotEdge *e;
+    int i, root_edge_count;
+
+    /* the root references the contexts and the objects which are only
+       referenced from outside of the heap */
+    root_edge_count = 0;
+    for(i = 1; i < hs->node_count; i++) {
+        n = &hs->nodes[i];
+        if (!n->is_retained ||
+            (!n->is_string &&
+             js_rc(n->ptr)->gc_obj_type == JS_GC_OBJ_TYPE_JS_CONTEXT))
+            root_edge_count++;
+    }
+
+    dbuf_putstr(dbuf, "{\"snapshot\":{\"meta\":{"
+                "\"node_fields\":[\"type\",\"name\",\"id\",\"self_size\","
+                "\"edge_count\",\"trace_node_id\",\"detachedness\"],"
+                "\"node_types\":[[\"hidden\",\"array\",\"string\",\"object\","
+                "\"code\",\"closure\",\"regexp\",\"number\",\"native\","
+                "\"synthetic\",\"concatenated string\",\"sliced string\","
+                "\"symbol\",\"bigint\",\"object shape\"],"
+                "\"string\",\"number\",\"number\",\"number\",\"number\",\"number\"],"
+                "\"edge_fields\":[\"type\",\"name_or_index\",\"to_node\"],"
+                "\"edge_types\":[[\"context\",\"element\",\"property\","
+                "\"internal\",\"hidden\",\"shortcut\",\"weak\"],"
+                "\"string_or_number\",\"node\"],"
+                "\"trace_function_info_fields\":[\"function_id\",\"name\","
+                "\"script_name\",\"script_id\",\"line\",\"column\"],"
+                "\"trace_node_fields\":[\"id\",\"function_info_index\",\"count\","
+                "\"size\",\"children\"],"
+                "\"sample_fields\":[\"timestamp_us\",\"last_assigned_id\"],"
+                "\"location_fields\":[\"object_index\",\"script_id\","
+                "\"line\",\"column\"]},");
+    dbuf_printf(dbuf, "\"node_count\":%d,\"edge_count\":%d,"
+                "\"trace_function_count\":0},\n\"nodes\":[",
+                hs->node_count, hs->edge_count + root_edge_count);
+    /* the node ids are the addresses (1 for the root) */
+    dbuf_printf(dbuf, "%d,%u,1,0,%d,0,0", JS_HS_NODE_SYNTHETIC,
+                js_hs_const_string(hs, JS_HS_STR_ROOT), root_edge_count);
+    for(i = 1; i < hs->node_count; i++) {
+        n = &hs->nodes[i];
+        dbuf_printf(dbuf, ",\n%d,%u,%" PRIu64 ",%" PRIu64 ",%u,0,0",
+                    n->type, n->name, (uint64_t)(uintptr_t)n->ptr,
+                    (uint64_t)n->self_size, n->edge_count);
+        if (dbuf->size >= 65536)
+            js_hs_flush(dbuf, write_func, opaque);
+    }
+    dbuf_putstr(dbuf, "],\n\"edges\":[");
+    root_edge_count = 0;
+    for(i = 1; i < hs->node_count; i++) {
+        n = &hs->nodes[i];
+        if (!n->is_retained ||
+            (!n->is_string &&
+             js_rc(n->ptr)->gc_obj_type == JS_GC_OBJ_TYPE_JS_CONTEXT)) {
+            dbuf_printf(dbuf, "%s%d,%d,%d", root_edge_count ? ",\n" : "",
+                        JS_HS_EDGE_ELEMENT, root_edge_count + 1, i * 7);
+            root_edge_count++;
+        }
+    }
+    for(i = 0; i < hs->edge_count; i++) {
+        e = &hs->edges[i];
+        dbuf_printf(dbuf, "%s%d,%u,%u", (i || root_edge_count) ? ",\n" : "",
+                    e->type, e->name_or_index, e->to * 7);
+        if (dbuf->size >= 65536)
+            js_hs_flush(dbuf, write_func, opaque);
+    }
+    dbuf_putstr(dbuf, "],\n\"trace_function_infos\":[],\"trace_tree\":[],"
+                "\"samples\":[],\"locations\":[],\n\"strings\":[");
+    js_hs_flush(dbuf, write_func, opaque);
+    js_hs_flush(&hs->strings, write_func, opaque);
+    dbuf_putstr(dbuf, "]}\n");
+}
+
+int JS_WriteHeapSnapshot(JSContext *ctx,
+                         void (*write_func)(void *opaque, const char *buf, size_t len),
+                         void *opaque)
+{
+    JSRuntime *rt = ctx->rt;
+    JSHeapSnapshot hs_s, *hs = &hs_s;
+    JSGCObjectIter it;
+    JSGCObjectHeader *gp;
+    DynBuf dbuf;
+    int i, ret;
+
+    /* only the live objects are listed */
+    JS_RunGC(rt);
+
+    memset(hs, 0, sizeof(*hs));
+    hs->rt = rt;
+    js_dbuf_init(ctx, &hs->strings);
+    js_dbuf_init(ctx, &dbuf);
+    hs->atom_strings = js_mallocz_rt(rt, sizeof(hs->atom_strings[0]) * rt->atom_size);
+    if (!hs->atom_strings || js_hs_resize_hash(hs, 1024))
+        goto fail;
+    js_hs_const_string(hs, JS_HS_STR_EMPTY); /* string 0 */
+    if (js_hs_add_node(hs, NULL, JS_HS_NODE_SYNTHETIC, 0, 0) < 0)
+        goto fail;
+    js_gc_iter_init(rt, &it, FALSE);
+    while ((gp = js_gc_iter_next(&it)) != NULL) {
+        if (js_hs_add_gc_node(hs, gp) < 0)
+            goto fail;
+    }
+    /* the string nodes are added while the edges are listed */
+    rt->heap_snapshot = hs;
+    for(i = 1; i < hs->node_count && !hs->oom; i++)
+        js_hs_node_edges(hs, i);
+    rt->heap_snapshot = NULL;
+    if (hs->oom)
+        goto fail;
+
+    js_hs_write(hs, &dbuf, write_func, opaque);
+    if (dbuf_error(&dbuf) || dbuf_error(&hs->strings))
+        goto fail;
+    js_hs_flush(&dbuf, write_func, opaque);
+    ret = 0;
+ done:
+    dbuf_free(&dbuf);
+    dbuf_free(&hs->strings);
+    js_free_rt(rt, hs->atom_strings);
+    js_free_rt(rt, hs->hash);
+    js_free_rt(rt, hs->edge_set);
+    js_free_rt(rt, hs->nodes);
+    js_free_rt(rt, hs->edges);
+    return ret;
+ fail:
+    JS_ThrowOutOfMemory(ctx);
+    ret = -1;
+    goto done;
+}
+
 static no_inline __exception int __js_poll_interrupts(JSContext *ctx)
 {
     JSRuntime *rt = ctx->rt;
     ctx->interrupt_counter = JS_INTERRUPT_COUNTER_INIT;
+    if (unlikely(rt->cpu_profile)) {
+        JSCPUProfile *prof = rt->cpu_profile;
+        int64_t now = js_cpu_profile_get_time_us();
+        if (now - prof->last_sample_time >= prof->interval)
+            js_cpu_profile_sample(rt, prof, now);
+        ctx->interrupt_counter = JS_INTERRUPT_COUNTER_PROFILE;
+    }
     if (rt->interrupt_handler) {
         if (rt->interrupt_handler(rt, rt->interrupt_opaque)) {
             JS_ThrowInterrupted(ctx);
@@ -8496,10 +11264,18 @@ int JS_IsInstanceOf(JSContext *ctx, JSValueConst val, JSValueConst obj)
 /* return the value associated to the autoinit property or an exception */
 typedef JSValue JSAutoInitFunc(JSContext *ctx, JSObject *p, JSAtom atom, void *opaque);
 
+static JSValue js_autoinit_call_func(JSContext *ctx, JSObject *p,
+                                     JSAtom atom, void *opaque)
+{
+    JSAutoInitPropertyFunc *func = (JSAutoInitPropertyFunc *)opaque;
+    return func(ctx, JS_MKPTR(JS_TAG_OBJECT, p), atom);
+}
+
 static JSAutoInitFunc *js_autoinit_func_table[] = {
     js_instantiate_prototype, /* JS_AUTOINIT_ID_PROTOTYPE */
     js_module_ns_autoinit, /* JS_AUTOINIT_ID_MODULE_NS */
     JS_InstantiateFunctionListItem2, /* JS_AUTOINIT_ID_PROP */
+    js_autoinit_call_func, /* JS_AUTOINIT_ID_FUNC */
 };
 
 /* warning: 'prs' is reallocated after it */
@@ -8585,7 +11361,15 @@ JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
                     uint32_t idx;
                     idx = __JS_AtomToUInt32(prop);
                     if (idx < p1->len) {
-                        return js_new_string_char(ctx, string_rope_get(obj, idx));
+                        JSValue str, ret;
+                        /* the rope is linearized in place so that the
+                           next indexed accesses are in constant time */
+                        str = js_linearize_string_rope(ctx, JS_DupValue(ctx, obj));
+                        if (JS_IsException(str))
+                            return JS_EXCEPTION;
+                        ret = js_new_string_char(ctx, string_get(JS_VALUE_GET_STRING(str), idx));
+                        JS_FreeValue(ctx, str);
+                        return ret;
                     }
                 } else if (prop == JS_ATOM_length) {
                     return JS_NewInt32(ctx, p1->len);
@@ -9382,7 +12166,7 @@ static JSValue JS_GetPropertyValue(JSContext *ctx, JSValueConst this_obj,
         case JS_CLASS_ARRAY:
         case JS_CLASS_ARGUMENTS:
             if (unlikely(idx >= p->u.array.count)) goto slow_path;
-            return JS_DupValue(ctx, p->u.array.u.values[idx]);
+            return JS_DupValue(ctx, js_fast_array_peek(p, idx));
         case JS_CLASS_MAPPED_ARGUMENTS:
             if (unlikely(idx >= p->u.array.count)) goto slow_path;
             return JS_DupValue(ctx, *p->u.array.u.var_refs[idx]->pvalue);
@@ -9562,15 +12346,29 @@ static JSProperty *add_property(JSContext *ctx,
             js_free_shape(ctx->rt, sh);
             return &p->prop[new_sh->prop_count - 1];
         } else if (js_rc(sh)->ref_count != 1) {
-            /* if the shape is shared, clone it */
-            new_sh = js_clone_shape(ctx, sh);
-            if (!new_sh)
-                return NULL;
-            /* hash the cloned shape */
-            new_sh->is_hashed = TRUE;
-            js_shape_hash_link(ctx->rt, new_sh);
-            js_free_shape(ctx->rt, p->shape);
-            p->shape = new_sh;
+            if (sh->prop_count >= JS_SHAPE_DICT_PROP_COUNT &&
+                sh->clone_count >= JS_SHAPE_DICT_CLONE_COUNT) {
+                /* the shape is cloned at each addition (e.g. keys
+                   added in lockstep to several objects): switch to
+                   dictionary mode so that the next properties are
+                   added in place without cloning or hashing the
+                   shape */
+                if (js_shape_prepare_update(ctx, p, NULL))
+                    return NULL;
+                p->shape->is_dict = TRUE;
+            } else {
+                /* if the shape is shared, clone it */
+                new_sh = js_clone_shape(ctx, sh);
+                if (!new_sh)
+                    return NULL;
+                if (new_sh->clone_count < 255)
+                    new_sh->clone_count++;
+                /* hash the cloned shape */
+                new_sh->is_hashed = TRUE;
+                js_shape_hash_link(ctx->rt, new_sh);
+                js_free_shape(ctx->rt, p->shape);
+                p->shape = new_sh;
+            }
         }
     }
     assert(js_rc(p->shape)->ref_count == 1);
@@ -9589,6 +12387,10 @@ static no_inline __exception int convert_fast_array_to_array(JSContext *ctx,
     JSShape *sh;
     uint32_t i, len, new_count;
 
+    if (js_array_box_elements(ctx, p)) {
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
     if (js_shape_prepare_update(ctx, p, NULL))
         return -1;
     len = p->u.array.count;
@@ -9623,6 +12425,7 @@ static no_inline __exception int convert_fast_array_to_array(JSContext *ctx,
     p->u.array.u1.size = 0;
     p->fast_array = 0;
     p->is_std_array_prototype = FALSE;
+    p->array_kind = JS_ARRAY_KIND_VALUE;
     return 0;
 }
 
@@ -9656,6 +12459,7 @@ static int delete_property(JSContext *ctx, JSObject *p, JSAtom atom)
     JSProperty *pr1;
     uint32_t lpr_idx;
     intptr_t h, h1;
+    BOOL is_hashed;
 
  redo:
     sh = p->shape;
@@ -9673,9 +12477,14 @@ static int delete_property(JSContext *ctx, JSObject *p, JSAtom atom)
             /* realloc the shape if needed */
             if (lpr)
                 lpr_idx = lpr - get_shape_prop(sh);
+            is_hashed = sh->is_hashed;
             if (js_shape_prepare_update(ctx, p, &pr))
                 return -1;
             sh = p->shape;
+            /* the objects whose properties are deleted are usually
+               used as dictionaries */
+            if (is_hashed)
+                sh->is_dict = TRUE;
             /* remove property */
             if (lpr) {
                 lpr = get_shape_prop(sh) + lpr_idx;
@@ -9721,7 +12530,7 @@ static int delete_property(JSContext *ctx, JSObject *p, JSAtom atom)
                     if (idx == p->u.array.count - 1) {
                         if (p->class_id == JS_CLASS_MAPPED_ARGUMENTS) {
                             free_var_ref(ctx->rt, p->u.array.u.var_refs[idx]);
-                        } else {
+                        } else if (p->array_kind == JS_ARRAY_KIND_VALUE) {
                             JS_FreeValue(ctx, p->u.array.u.values[idx]);
                         }
                         p->u.array.count = idx;
@@ -9788,8 +12597,10 @@ static int set_array_length(JSContext *ctx, JSObject *p, JSValue val,
     if (likely(p->fast_array)) {
         uint32_t old_len = p->u.array.count;
         if (len < old_len) {
-            for(i = len; i < old_len; i++) {
-                JS_FreeValue(ctx, p->u.array.u.values[i]);
+            if (p->array_kind == JS_ARRAY_KIND_VALUE) {
+                for(i = len; i < old_len; i++) {
+                    JS_FreeValue(ctx, p->u.array.u.values[i]);
+                }
             }
             p->u.array.count = len;
         }
@@ -9865,15 +12676,16 @@ static int set_array_length(JSContext *ctx, JSObject *p, JSValue val,
 static int expand_fast_array(JSContext *ctx, JSObject *p, uint32_t new_len)
 {
     uint32_t new_size;
-    size_t slack;
-    JSValue *new_array_prop;
+    size_t slack, elem_size;
+    void *new_array_prop;
     /* XXX: potential arithmetic overflow */
     new_size = max_int(new_len, p->u.array.u1.size * 3 / 2);
-    new_array_prop = js_realloc2(ctx, p->u.array.u.values, sizeof(JSValue) * new_size, &slack);
+    elem_size = js_array_kind_size[p->array_kind];
+    new_array_prop = js_realloc2(ctx, p->u.array.u.ptr, elem_size * new_size, &slack);
     if (!new_array_prop)
         return -1;
-    new_size += slack / sizeof(*new_array_prop);
-    p->u.array.u.values = new_array_prop;
+    new_size += slack / elem_size;
+    p->u.array.u.ptr = new_array_prop;
     p->u.array.u1.size = new_size;
     return 0;
 }
@@ -9899,13 +12711,20 @@ static inline int add_fast_array_element(JSContext *ctx, JSObject *p,
             p->prop[0].u.value = JS_NewInt32(ctx, new_len);
         }
     }
+    if (unlikely(!js_array_kind_accepts(p, val))) {
+        if (js_array_widen_kind(ctx, p, val)) {
+            JS_FreeValue(ctx, val);
+            JS_ThrowOutOfMemory(ctx);
+            return -1;
+        }
+    }
     if (unlikely(new_len > p->u.array.u1.size)) {
         if (expand_fast_array(ctx, p, new_len)) {
             JS_FreeValue(ctx, val);
             return -1;
         }
     }
-    p->u.array.u.values[new_len - 1] = val;
+    js_fast_array_store(p, new_len - 1, val);
     p->u.array.count = new_len;
     return TRUE;
 }
@@ -9913,7 +12732,11 @@ static inline int add_fast_array_element(JSContext *ctx, JSObject *p,
 /* Allocate a new fast array initialized to JS_UNDEFINED. Its maximum
    size is 2^31-1 elements. For convenience, 'len' is a 64 bit
    integer. */
-static JSValue js_allocate_fast_array(JSContext *ctx, int64_t len)
+/* allocate a fast array of 'len' elements of kind 'kind'. The
+   JSValue elements are set to undefined. The unboxed elements are not
+   initialized and must be set by the caller. */
+static JSValue js_allocate_fast_array_kind(JSContext *ctx, int64_t len,
+                                           JSArrayKindEnum kind)
 {
     JSValue arr;
     JSObject *p;
@@ -9924,21 +12747,29 @@ static JSValue js_allocate_fast_array(JSContext *ctx, int64_t len)
     arr = JS_NewArray(ctx);
     if (JS_IsException(arr))
         return arr;
+    p = JS_VALUE_GET_OBJ(arr);
+    p->array_kind = kind;
     if (len > 0) {
-        p = JS_VALUE_GET_OBJ(arr);
         if (expand_fast_array(ctx, p, len) < 0) {
             JS_FreeValue(ctx, arr);
             return JS_EXCEPTION;
         }
         p->u.array.count = len;
-        for(i = 0; i < len; i++)
-            p->u.array.u.values[i] = JS_UNDEFINED;
+        if (kind == JS_ARRAY_KIND_VALUE) {
+            for(i = 0; i < len; i++)
+                p->u.array.u.values[i] = JS_UNDEFINED;
+        }
         /* update the 'length' field */
         set_value(ctx, &p->prop[0].u.value, JS_NewInt32(ctx, len));
     }
     return arr;
 }
 
+static JSValue js_allocate_fast_array(JSContext *ctx, int64_t len)
+{
+    return js_allocate_fast_array_kind(ctx, len, JS_ARRAY_KIND_VALUE);
+}
+
 static JSValue js_create_array(JSContext *ctx, int len, JSValueConst *tab)
 {
     JSValue obj;
@@ -9963,6 +12794,80 @@ static JSValue js_create_array(JSContext *ctx, int len, JSValueConst *tab)
     return obj;
 }
 
+/* return the most specific array kind able to hold the values */
+static JSArrayKindEnum js_array_kind_of_values(int len, JSValueConst *tab)
+{
+    JSArrayKindEnum kind;
+    uint32_t tag;
+    int i;
+
+    kind = JS_ARRAY_KIND_INT32;
+    for(i = 0; i < len; i++) {
+        tag = JS_VALUE_GET_TAG(tab[i]);
+        if (tag == JS_TAG_INT)
+            continue;
+        if (!JS_TAG_IS_FLOAT64(tag))
+            return JS_ARRAY_KIND_VALUE;
+        kind = JS_ARRAY_KIND_FLOAT64;
+    }
+    return kind;
+}
+
+/* return the most specific array kind able to hold the values of the
+   kinds 'a' and 'b' */
+static inline JSArrayKindEnum js_array_kind_union(JSArrayKindEnum a,
+                                                  JSArrayKindEnum b)
+{
+    if (a == b)
+        return a;
+    if (a == JS_ARRAY_KIND_VALUE || b == JS_ARRAY_KIND_VALUE)
+        return JS_ARRAY_KIND_VALUE;
+    return JS_ARRAY_KIND_FLOAT64;
+}
+
+/* convert the elements of a fast array so that the 'len' values of
+   'tab' can be stored. Return -1 if not enough memory. No exception
+   is raised. */
+static int js_array_widen_kind_for_values(JSContext *ctx, JSObject *p,
+                                          int len, JSValueConst *tab)
+{
+    JSArrayKindEnum kind;
+
+    if (p->array_kind == JS_ARRAY_KIND_VALUE)
+        return 0;
+    kind = js_array_kind_union(p->array_kind, js_array_kind_of_values(len, tab));
+    if (kind == p->array_kind)
+        return 0;
+    return js_array_convert_kind(ctx, p, kind);
+}
+
+/* copy the elements [from, from + count) of the fast array 'src' to
+   the elements starting at 'to' of the fast array 'dst'. The kind of
+   'dst' must accept them and its previous elements are not freed. */
+static void js_fast_array_copy(JSContext *ctx, JSObject *dst, uint32_t to,
+                               JSObject *src, uint32_t from, uint32_t count)
+{
+    uint32_t i;
+
+    if (dst->array_kind == src->array_kind) {
+        if (src->array_kind == JS_ARRAY_KIND_VALUE) {
+            for(i = 0; i < count; i++)
+                dst->u.array.u.values[to + i] =
+                    JS_DupValue(ctx, src->u.array.u.values[from + i]);
+        } else {
+            size_t elem_size = js_array_kind_size[src->array_kind];
+            memcpy(dst->u.array.u.uint8_ptr + to * elem_size,
+                   src->u.array.u.uint8_ptr + from * elem_size,
+                   count * elem_size);
+        }
+    } else {
+        for(i = 0; i < count; i++)
+            js_fast_array_store(dst, to + i,
+                                JS_DupValue(ctx, js_fast_array_peek(src, from + i)));
+    }
+}
+
+/* used for the array literals: the elements are unboxed if possible */
 static JSValue js_create_array_free(JSContext *ctx, int len, JSValue *tab)
 {
     JSValue obj;
@@ -9972,8 +12877,9 @@ static JSValue js_create_array_free(JSContext *ctx, int len, JSValue *tab)
     obj = JS_NewArray(ctx);
     if (JS_IsException(obj))
         goto fail;
+    p = JS_VALUE_GET_OBJ(obj);
+    p->array_kind = js_array_kind_of_values(len, (JSValueConst *)tab);
     if (len > 0) {
-        p = JS_VALUE_GET_OBJ(obj);
         if (expand_fast_array(ctx, p, len) < 0) {
             JS_FreeValue(ctx, obj);
         fail:
@@ -9983,7 +12889,7 @@ static JSValue js_create_array_free(JSContext *ctx, int len, JSValue *tab)
         }
         p->u.array.count = len;
         for(i = 0; i < len; i++)
-            p->u.array.u.values[i] = tab[i];
+            js_fast_array_store(p, i, tab[i]);
         /* update the 'length' field */
         set_value(ctx, &p->prop[0].u.value, JS_NewInt32(ctx, len));
     }
@@ -10310,7 +13216,8 @@ int JS_SetPropertyValue(JSContext *ctx, JSValueConst this_obj,
                 /* add element */
                 return add_fast_array_element(ctx, p, val, flags);
             }
-            set_value(ctx, &p->u.array.u.values[idx], val);
+            if (js_fast_array_set(ctx, p, idx, val))
+                return -1;
             break;
         case JS_CLASS_ARGUMENTS:
             if (unlikely(idx >= (uint32_t)p->u.array.count))
@@ -10659,11 +13566,13 @@ static int js_shape_prepare_update(JSContext *ctx, JSObject *p,
             p->shape = sh;
             if (pprs)
                 *pprs = get_shape_prop(sh) + idx;
+            return 0;
         } else {
             js_shape_hash_unlink(ctx->rt, sh);
             sh->is_hashed = FALSE;
         }
     }
+    js_shape_new_id(ctx->rt, sh);
     return 0;
 }
 
@@ -10944,7 +13853,8 @@ int JS_DefineProperty(JSContext *ctx, JSValueConst this_obj,
                             goto redo_prop_update;
                     }
                     if (flags & JS_PROP_HAS_VALUE) {
-                        set_value(ctx, &p->u.array.u.values[idx], JS_DupValue(ctx, val));
+                        if (js_fast_array_set(ctx, p, idx, JS_DupValue(ctx, val)))
+                            return -1;
                     }
                     return TRUE;
                 }
@@ -11030,6 +13940,31 @@ static int JS_DefineAutoInitProperty(JSContext *ctx, JSValueConst this_obj,
     return TRUE;
 }
 
+int JS_DefinePropertyAutoInit(JSContext *ctx, JSValueConst this_obj,
+                              JSAtom prop, JSAutoInitPropertyFunc *func,
+                              int flags)
+{
+    JSObject *p;
+    JSProperty *pr;
+    JSValue val;
+
+    if (JS_VALUE_GET_TAG(this_obj) == JS_TAG_OBJECT) {
+        p = JS_VALUE_GET_OBJ(this_obj);
+        if (p->extensible && !p->is_exotic && !p->fast_array &&
+            !find_own_property(&pr, p, prop)) {
+            return JS_DefineAutoInitProperty(ctx, this_obj, prop,
+                                             JS_AUTOINIT_ID_FUNC,
+                                             (void *)func, flags);
+        }
+    }
+    /* otherwise the property is defined with the usual semantics */
+    val = func(ctx, this_obj, prop);
+    if (JS_IsException(val))
+        return -1;
+    return JS_DefinePropertyValue(ctx, this_obj, prop, val,
+                                  flags | JS_PROP_THROW);
+}
+
 /* shortcut to add or redefine a new property value */
 int JS_DefinePropertyValue(JSContext *ctx, JSValueConst this_obj,
                            JSAtom prop, JSValue val, int flags)
@@ -14435,7 +17370,7 @@ static void js_print_object(JSPrintValueState *s, JSObject *p)
             len1 = min_uint32(p->u.array.count, s->options.max_item_count);
             for(i = 0; i < len1; i++) {
                 js_print_comma(s, &comma_state);
-                js_print_value(s, p->u.array.u.values[i]);
+                js_print_value(s, js_fast_array_peek(p, i));
             }
             if (len1 < p->u.array.count)
                 js_print_more_items(s, &comma_state, p->u.array.count - len1);
@@ -14518,18 +17453,18 @@ static void js_print_object(JSPrintValueState *s, JSObject *p)
         comma_state = 2;
     } else if (p->class_id == JS_CLASS_MAP || p->class_id == JS_CLASS_SET) {
         JSMapState *ms = p->u.opaque;
-        struct list_head *el;
+        uint32_t j;
 
         if (!ms)
             goto default_obj;
         js_print_atom(s,rt->class_array[p->class_id].class_name);
         js_print_sink_printf(s,"(%u) { ", ms->record_count);
         i = 0;
-        list_for_each(el, &ms->records) {
-            JSMapRecord *mr = list_entry(el, JSMapRecord, link);
-            js_print_comma(s, &comma_state);
-            if (mr->empty)
+        for(j = 0; j < ms->record_end; j++) {
+            JSMapRecord *mr = &ms->records[j];
+            if (map_record_is_empty(mr))
                 continue;
+            js_print_comma(s, &comma_state);
             js_print_value(s, mr->key);
             if (p->class_id == JS_CLASS_MAP) {
                 js_print_sink_printf(s," => ");
@@ -17210,27 +20145,23 @@ static JSValue js_array_iterator_next(JSContext *ctx, JSValueConst this_val,
 static JSValue js_create_array_iterator(JSContext *ctx, JSValueConst this_val,
                                         int argc, JSValueConst *argv, int magic);
 
-/* Access an Array's internal JSValue array if available */
-static BOOL js_get_fast_array(JSContext *ctx, JSValueConst obj,
-                              JSValue **arrpp, uint32_t *countp)
+/* Return the object if 'obj' is a fast array. Its elements must be
+   read with js_fast_array_peek(). */
+static JSObject *js_get_fast_array_obj(JSValueConst obj)
 {
-    /* Try and handle fast arrays explicitly */
     if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) {
         JSObject *p = JS_VALUE_GET_OBJ(obj);
-        if (p->class_id == JS_CLASS_ARRAY && p->fast_array) {
-            *countp = p->u.array.count;
-            *arrpp = p->u.array.u.values;
-            return TRUE;
-        }
+        if (p->class_id == JS_CLASS_ARRAY && p->fast_array)
+            return p;
     }
-    return FALSE;
+    return NULL;
 }
 
 static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
 {
     JSValue iterator, enumobj, method, value;
     int is_array_iterator;
-    JSValue *arrp;
+    JSObject *p;
     uint32_t i, count32, pos;
     JSCFunctionType ft;
 
@@ -17267,8 +20198,9 @@ static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
     ft.iterator_next = js_array_iterator_next;
     if (is_array_iterator
     &&  JS_IsCFunction(ctx, method, ft.generic, 0)
-    &&  js_get_fast_array(ctx, sp[-1], &arrp, &count32)) {
+    &&  (p = js_get_fast_array_obj(sp[-1])) != NULL) {
         uint32_t len;
+        count32 = p->u.array.count;
         if (js_get_length32(ctx, &len, sp[-1]))
             goto exception;
         /* if len > count32, the elements >= count32 might be read in
@@ -17278,7 +20210,7 @@ static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
         /* Handle fast arrays explicitly */
         for (i = 0; i < count32; i++) {
             if (JS_DefinePropertyValueUint32(ctx, sp[-3], pos++,
-                                             JS_DupValue(ctx, arrp[i]), JS_PROP_C_W_E) < 0)
+                                             JS_DupValue(ctx, js_fast_array_peek(p, i)), JS_PROP_C_W_E) < 0)
                 goto exception;
         }
     } else {
@@ -17598,6 +20530,7 @@ static JSVarRef *js_closure_define_global_var(JSContext *ctx, JSClosureVar *cv,
             }
             if (cv->var_kind == JS_VAR_GLOBAL_FUNCTION_DECL &&
                 (prs->flags & JS_PROP_CONFIGURABLE)) {
+                js_shape_new_id(ctx->rt, p->shape);
                 /* update the property flags if possible when
                    declaring a global function */
                 if ((prs->flags & JS_PROP_TMASK) == JS_PROP_GETSET) {
@@ -18153,12 +21086,121 @@ typedef enum {
 #define FUNC_RET_YIELD_STAR    2
 #define FUNC_RET_INITIAL_YIELD 3
 
+static inline uint32_t js_ic_hash(uint32_t pc_pos, int hash_bits)
+{
+    return (pc_pos * 0x9e370001) >> (32 - hash_bits);
+}
+
+static force_inline JSInlineCacheSite *js_ic_find_site(JSInlineCache *ic,
+                                                       uint32_t pc_pos)
+{
+    JSInlineCacheSite *site;
+    uint32_t h, mask;
+
+    mask = (1 << ic->hash_bits) - 1;
+    h = js_ic_hash(pc_pos, ic->hash_bits);
+    for(;;) {
+        site = &ic->sites[h];
+        if (likely(site->pc_pos == pc_pos))
+            return site;
+        h = (h + 1) & mask;
+    }
+}
+
+/* return the cache entry of the access site 'pc_pos' matching the
+   shapes of 'p' and of its prototypes, or NULL if none. If not NULL,
+   '*pholder' is set to the last traversed prototype. */
+static force_inline JSInlineCacheEntry *js_ic_find(JSInlineCache *ic,
+                                                   uint32_t pc_pos,
+                                                   JSObject *p,
+                                                   JSObject **pholder)
+{
+    JSInlineCacheSite *site;
+    JSInlineCacheEntry *e;
+    uint32_t shape_id;
+    int i, j;
+
+    site = js_ic_find_site(ic, pc_pos);
+    shape_id = p->shape->id;
+    for(i = 0; i < JS_IC_WAYS; i++) {
+        e = &site->entries[i];
+        if (e->shape_id == shape_id) {
+            for(j = 0; j < JS_IC_MAX_DEPTH && e->proto_shape_ids[j] != 0; j++) {
+                p = p->shape->proto;
+                if (p->shape->id != e->proto_shape_ids[j])
+                    return NULL;
+            }
+            *pholder = p;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* add the property cached in 'e' to 'p'. Return NULL if exception */
+static JSProperty *js_ic_add_property(JSContext *ctx, JSObject *p,
+                                      JSInlineCacheEntry *e)
+{
+    JSShape *sh = p->shape, *new_sh = e->new_shape;
+
+    /* the property array may need to be resized */
+    if (new_sh->prop_size != sh->prop_size) {
+        JSProperty *new_prop;
+        new_prop = js_realloc(ctx, p->prop, sizeof(p->prop[0]) *
+                              new_sh->prop_size);
+        if (!new_prop)
+            return NULL;
+        p->prop = new_prop;
+    }
+    p->shape = js_dup_shape(new_sh);
+    js_free_shape(ctx->rt, sh);
+    return &p->prop[new_sh->prop_count - 1];
+}
+
 #ifdef OPCODE_ASM_LABEL
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-label"
 #endif
 
 /* argv[] is modified if (flags & JS_CALL_FLAG_COPY_ARGV) = 0. */
+/* Return TRUE if 'op1' and 'op2' are numbers and at least one of them
+   is a float64. It is the case handled by the float64 quickened
+   opcodes. */
+static inline BOOL js_get_float64_operands(JSValueConst op1, JSValueConst op2,
+                                           double *pd1, double *pd2)
+{
+    int tag1, tag2;
+
+    tag1 = JS_VALUE_GET_TAG(op1);
+    tag2 = JS_VALUE_GET_TAG(op2);
+    if (JS_TAG_IS_FLOAT64(tag1)) {
+        *pd1 = JS_VALUE_GET_FLOAT64(op1);
+        if (JS_TAG_IS_FLOAT64(tag2))
+            *pd2 = JS_VALUE_GET_FLOAT64(op2);
+        else if (tag2 == JS_TAG_INT)
+            *pd2 = JS_VALUE_GET_INT(op2);
+        else
+            return FALSE;
+    } else if (tag1 == JS_TAG_INT && JS_TAG_IS_FLOAT64(tag2)) {
+        *pd1 = JS_VALUE_GET_INT(op1);
+        *pd2 = JS_VALUE_GET_FLOAT64(op2);
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+#ifdef CONFIG_OPCODE_STATS
+static inline int js_opcode_stats_update(JSRuntime *rt, int *pprev_opcode,
+                                         int opcode)
+{
+    rt->opcode_counts[opcode]++;
+    rt->opcode_pair_counts[*pprev_opcode][opcode]++;
+    *pprev_opcode = opcode;
+    return opcode;
+}
+#endif
+
 static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                                JSValueConst this_obj, JSValueConst new_target,
                                int argc, JSValue *argv, int flags)
@@ -18173,9 +21215,15 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     JSValue *local_buf, *stack_buf, *var_buf, *arg_buf, *sp, ret_val, *pval;
     JSVarRef **var_refs;
     size_t alloca_size;
+#ifdef CONFIG_OPCODE_STATS
+    int prev_opcode = OP_invalid;
+#define OPCODE_STATS(op) js_opcode_stats_update(rt, &prev_opcode, op)
+#else
+#define OPCODE_STATS(op) (op)
+#endif
 
 #if !DIRECT_DISPATCH
-#define SWITCH(pc)      switch (opcode = *pc++)
+#define SWITCH(pc)      switch (opcode = OPCODE_STATS(*pc++))
 #define CASE(op)        case op
 #define DEFAULT         default
 #define BREAK           break
@@ -18190,7 +21238,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 #include "quickjs-opcode.h"
         [ OP_COUNT ... 255 ] = &&case_default
     };
-#define SWITCH(pc)      goto *dispatch_table[opcode = *pc++];
+#define SWITCH(pc)      goto *dispatch_table[opcode = OPCODE_STATS(*pc++)];
 #ifdef OPCODE_ASM_LABEL
 #define CASE(op)        case_ ## op: asm volatile("label_" #op ":\n.globl label_" #op); dummy_case_ ## op
 #else
@@ -18200,6 +21248,27 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 #define BREAK           SWITCH(pc)
 #endif
 
+/* the current pc is saved in the slow path so that the interrupt
+   handler and the CPU profiler see the position in the function */
+#define POLL_INTERRUPTS()                                               \
+    (unlikely(--ctx->interrupt_counter <= 0) &&                         \
+     (sf->cur_pc = pc, __js_poll_interrupts(ctx)))
+
+/* Quickening: a generic opcode which observed the operand types of a
+   specialized opcode of the same size rewrites itself in place. The
+   specialized opcode reverts to the generic one when its guard fails. */
+#define QUICKEN(op)                                                     \
+    do {                                                                \
+        if (likely(b->quicken_misses < JS_QUICKEN_MAX_MISSES))          \
+            ((uint8_t *)pc)[-1] = (op);                                 \
+    } while (0)
+#define UNQUICKEN(op)                                                   \
+    do {                                                                \
+        ((uint8_t *)pc)[-1] = opcode = (op);                            \
+        if (b->quicken_misses < JS_QUICKEN_MAX_MISSES)                  \
+            b->quicken_misses++;                                        \
+    } while (0)
+
     if (js_poll_interrupts(caller_ctx))
         return JS_EXCEPTION;
     if (unlikely(JS_VALUE_GET_TAG(func_obj) != JS_TAG_OBJECT)) {
@@ -18240,6 +21309,11 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                          (JSValueConst *)argv, flags);
     }
     b = p->u.func.function_bytecode;
+    if (unlikely(b->is_lazy)) {
+        if (js_lazy_function_compile(caller_ctx, p))
+            return JS_EXCEPTION;
+        b = p->u.func.function_bytecode;
+    }
 
     if (unlikely(argc < b->arg_count || (flags & JS_CALL_FLAG_COPY_ARGV))) {
         arg_allocated_size = b->arg_count;
@@ -18282,6 +21356,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         sf->var_refs[i] = NULL;
     sp = stack_buf;
     pc = b->byte_code_buf;
+    sf->cur_pc = pc;
     sf->prev_frame = rt->current_stack_frame;
     rt->current_stack_frame = sf;
     ctx = b->realm; /* set the current realm */
@@ -18908,6 +21983,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
 
+        /* The global variables are resolved once when the closure is
+           created (js_closure_global_var()): 'var_refs[idx]' points to
+           the JSVarRef stored in the global object property, so the
+           fast path does not depend on the global object shape. The
+           property lookup is only done for uninitialized variables,
+           i.e. missing globals or accessor properties. */
         CASE(OP_get_var_undef):
         CASE(OP_get_var):
             {
@@ -19271,18 +22352,18 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 
         CASE(OP_goto):
             pc += (int32_t)get_u32(pc);
-            if (unlikely(js_poll_interrupts(ctx)))
+            if (POLL_INTERRUPTS())
                 goto exception;
             BREAK;
 #if SHORT_OPCODES
         CASE(OP_goto16):
             pc += (int16_t)get_u16(pc);
-            if (unlikely(js_poll_interrupts(ctx)))
+            if (POLL_INTERRUPTS())
                 goto exception;
             BREAK;
         CASE(OP_goto8):
             pc += (int8_t)pc[0];
-            if (unlikely(js_poll_interrupts(ctx)))
+            if (POLL_INTERRUPTS())
                 goto exception;
             BREAK;
 #endif
@@ -19302,7 +22383,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (res) {
                     pc += (int32_t)get_u32(pc - 4) - 4;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
+                if (POLL_INTERRUPTS())
                     goto exception;
             }
             BREAK;
@@ -19322,7 +22403,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (!res) {
                     pc += (int32_t)get_u32(pc - 4) - 4;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
+                if (POLL_INTERRUPTS())
                     goto exception;
             }
             BREAK;
@@ -19343,7 +22424,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (res) {
                     pc += (int8_t)pc[-1] - 1;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
+                if (POLL_INTERRUPTS())
                     goto exception;
             }
             BREAK;
@@ -19363,11 +22444,44 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (!res) {
                     pc += (int8_t)pc[-1] - 1;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
+                if (POLL_INTERRUPTS())
                     goto exception;
             }
             BREAK;
 #endif
+        CASE(OP_lt_if_false):
+        CASE(OP_lt_if_false8):
+            {
+                int res;
+                JSValue op1, op2;
+                double d1, d2;
+
+                op1 = sp[-2];
+                op2 = sp[-1];
+                if (likely(JS_VALUE_IS_BOTH_INT(op1, op2))) {
+                    res = JS_VALUE_GET_INT(op1) < JS_VALUE_GET_INT(op2);
+                } else if (js_get_float64_operands(op1, op2, &d1, &d2)) {
+                    res = d1 < d2;
+                } else {
+                    sf->cur_pc = pc;
+                    if (js_relational_slow(ctx, sp, OP_lt))
+                        goto exception;
+                    res = JS_VALUE_GET_BOOL(sp[-2]);
+                }
+                sp -= 2;
+                if (opcode == OP_lt_if_false8) {
+                    pc += 1;
+                    if (!res)
+                        pc += (int8_t)pc[-1] - 1;
+                } else {
+                    pc += 4;
+                    if (!res)
+                        pc += (int32_t)get_u32(pc - 4) - 4;
+                }
+                if (POLL_INTERRUPTS())
+                    goto exception;
+            }
+            BREAK;
         CASE(OP_catch):
             {
                 int32_t diff;
@@ -19557,10 +22671,13 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {                                                           \
                 JSValue val, obj;                                       \
                 JSAtom atom;                                            \
-                JSObject *p;                                            \
+                JSObject *p, *p1;                                       \
                 JSProperty *pr;                                         \
                 JSShapeProperty *prs;                                   \
+                JSInlineCacheEntry *e;                                  \
+                uint32_t pc_pos;                                        \
                                                                         \
+                pc_pos = pc - b->byte_code_buf;                         \
                 if (is_length) {                                        \
                     atom = JS_ATOM_length;                              \
                 } else {                                                \
@@ -19571,26 +22688,41 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 obj = sp[-1];                                           \
                 if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)) {   \
                     p = JS_VALUE_GET_OBJ(obj);                          \
-                    for(;;) {                                           \
-                        prs = find_own_property(&pr, p, atom);          \
-                        if (prs) {                                      \
-                            /* found */                                 \
-                            if (unlikely(prs->flags & JS_PROP_TMASK))   \
-                                    goto name ## _slow_path;            \
-                            val = JS_DupValue(ctx, pr->u.value);        \
-                            break;                                      \
-                        }                                               \
-                        if (unlikely(p->is_exotic)) {                   \
-                            /* XXX: should avoid the slow path for arrays \
-                               and typed arrays by ensuring that 'prop' is \
-                               not numeric */                           \
-                            obj = JS_MKPTR(JS_TAG_OBJECT, p);           \
+                    prs = find_own_property(&pr, p, atom);              \
+                    if (prs) {                                          \
+                        if (unlikely(prs->flags & JS_PROP_TMASK))       \
                             goto name ## _slow_path;                    \
-                        }                                               \
-                        p = p->shape->proto;                            \
-                        if (!p) {                                       \
-                            val = JS_UNDEFINED;                         \
-                            break;                                      \
+                        val = JS_DupValue(ctx, pr->u.value);            \
+                    } else if (likely(b->ic) &&                         \
+                               (!p->is_exotic ||                        \
+                                p->class_id == JS_CLASS_ARRAY) &&       \
+                               (e = js_ic_find(b->ic, pc_pos, p, &p1))) { \
+                        val = JS_DupValue(ctx, p1->prop[e->prop_idx].u.value); \
+                    } else {                                            \
+                        p1 = p;                                         \
+                        for(;;) {                                       \
+                            /* non numeric properties of arrays are     \
+                               ordinary properties */                   \
+                            if (unlikely(p1->is_exotic) &&              \
+                                (p1->class_id != JS_CLASS_ARRAY ||      \
+                                 __JS_AtomIsTaggedInt(atom))) {         \
+                                obj = JS_MKPTR(JS_TAG_OBJECT, p1);      \
+                                goto name ## _slow_path;                \
+                            }                                           \
+                            p1 = p1->shape->proto;                      \
+                            if (!p1) {                                  \
+                                val = JS_UNDEFINED;                     \
+                                break;                                  \
+                            }                                           \
+                            prs = find_own_property(&pr, p1, atom);     \
+                            if (prs) {                                  \
+                                /* found */                             \
+                                if (unlikely(prs->flags & JS_PROP_TMASK)) \
+                                    goto name ## _slow_path;            \
+                                val = JS_DupValue(ctx, pr->u.value);    \
+                                js_ic_add_get(rt, b, pc_pos, p, atom);  \
+                                break;                                  \
+                            }                                           \
                         }                                               \
                     }                                                   \
                 } else {                                                \
@@ -19617,6 +22749,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             GET_FIELD_INLINE(get_field2, 1, 0);
             BREAK;
 
+        CASE(OP_get_loc_get_field2):
+            *sp++ = JS_DupValue(ctx, var_buf[get_u16(pc + 4)]);
+            GET_FIELD_INLINE(get_loc_get_field2, 1, 0);
+            pc += 2;
+            BREAK;
+
 #if SHORT_OPCODES
         CASE(OP_get_length):
             GET_FIELD_INLINE(get_length, 0, 1);
@@ -19631,18 +22769,39 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 JSObject *p;
                 JSProperty *pr;
                 JSShapeProperty *prs;
+                JSShape *sh;
+                JSInlineCacheEntry *e;
+                JSObject *p1;
+                uint32_t pc_pos;
 
+                pc_pos = pc - b->byte_code_buf;
                 atom = get_u32(pc);
                 pc += 4;
 
                 obj = sp[-2];
+                sh = NULL;
                 if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)) {
                     p = JS_VALUE_GET_OBJ(obj);
                     prs = find_own_property(&pr, p, atom);
-                    if (!prs)
-                        goto put_field_slow_path;
-                    if (likely((prs->flags & (JS_PROP_TMASK | JS_PROP_WRITABLE |
-                                              JS_PROP_LENGTH)) == JS_PROP_WRITABLE)) {
+                    if (!prs) {
+                        if (p->class_id != JS_CLASS_OBJECT || !p->extensible)
+                            goto put_field_slow_path;
+                        if (likely(b->ic) &&
+                            (e = js_ic_find(b->ic, pc_pos, p, &p1))) {
+                            /* cached property addition */
+                            pr = js_ic_add_property(ctx, p, e);
+                            if (unlikely(!pr))
+                                goto exception;
+                            pr->u.value = sp[-1];
+                        } else {
+                            /* keep a reference to the shape so that
+                               the addition can be cached */
+                            if (p->shape->is_hashed)
+                                sh = js_dup_shape(p->shape);
+                            goto put_field_slow_path;
+                        }
+                    } else if (likely((prs->flags & (JS_PROP_TMASK | JS_PROP_WRITABLE |
+                                                     JS_PROP_LENGTH)) == JS_PROP_WRITABLE)) {
                         /* fast path */
                         set_value(ctx, &pr->u.value, sp[-1]);
                     } else {
@@ -19655,6 +22814,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     sf->cur_pc = pc;
                     ret = JS_SetPropertyInternal(ctx, obj, atom, sp[-1], obj,
                                                  JS_PROP_THROW_STRICT);
+                    if (sh) {
+                        if (ret >= 0)
+                            js_ic_add_put(rt, b, pc_pos, JS_VALUE_GET_OBJ(obj),
+                                          sh, atom);
+                        js_free_shape(rt, sh);
+                    }
                     JS_FreeValue(ctx, obj);
                     sp -= 2;
                     if (unlikely(ret < 0))
@@ -19858,7 +23023,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                         goto name ## _slow_path;                        \
                     if (unlikely(idx >= p->u.array.count))              \
                         goto name ## _slow_path;                        \
-                    val = JS_DupValue(ctx, p->u.array.u.values[idx]);   \
+                    val = JS_DupValue(ctx, js_fast_array_peek(p, idx)); \
                 } else {                                                \
                     name ## _slow_path:                                 \
                     sf->cur_pc = pc;                                    \
@@ -19902,7 +23067,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                         goto get_array_el3_slow_path;
                     if (unlikely(idx >= p->u.array.count))
                         goto get_array_el3_slow_path;
-                    val = JS_DupValue(ctx, p->u.array.u.values[idx]);
+                    val = JS_DupValue(ctx, js_fast_array_peek(p, idx));
                 } else {
                 get_array_el3_slow_path:
                     switch (JS_VALUE_GET_TAG(sp[-1])) {
@@ -20017,6 +23182,8 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                         new_len = idx + 1;
                         if (unlikely(new_len > p->u.array.u1.size))
                             goto put_array_el_slow_path;
+                        if (unlikely(!js_array_kind_accepts(p, sp[-1])))
+                            goto put_array_el_slow_path;
                         array_len = JS_VALUE_GET_INT(p->prop[0].u.value);
                         if (new_len > array_len) {
                             if (unlikely(!(get_shape_prop(p->shape)->flags & JS_PROP_WRITABLE)))
@@ -20024,9 +23191,13 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                             p->prop[0].u.value = JS_NewInt32(ctx, new_len);
                         }
                         p->u.array.count = new_len;
-                        p->u.array.u.values[idx] = sp[-1];
-                    } else {
+                        js_fast_array_store(p, idx, sp[-1]);
+                    } else if (likely(p->array_kind == JS_ARRAY_KIND_VALUE)) {
                         set_value(ctx, &p->u.array.u.values[idx], sp[-1]);
+                    } else {
+                        if (unlikely(!js_array_kind_accepts(p, sp[-1])))
+                            goto put_array_el_slow_path;
+                        js_fast_array_store(p, idx, sp[-1]);
                     }
                     JS_FreeValue(ctx, sp[-3]);
                     sp -= 3;
@@ -20143,6 +23314,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             BREAK;
 
         CASE(OP_add):
+        add_generic:
             {
                 JSValue op1, op2;
                 op1 = sp[-2];
@@ -20175,6 +23347,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     }
                     sp[-2] = __JS_NewFloat64(ctx, d1 + d2);
                     sp--;
+                    QUICKEN(OP_add_float64);
                 } else if (JS_IsString(op1) && JS_IsString(op2)) {
                     sp[-2] = JS_ConcatString(ctx, op1, op2);
                     sp--;
@@ -20190,12 +23363,22 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
         CASE(OP_add_loc):
+        CASE(OP_add_loc_check):
             {
                 JSValue op2;
                 JSValue *pv;
                 int idx;
-                idx = *pc;
-                pc += 1;
+                if (opcode == OP_add_loc) {
+                    idx = *pc;
+                    pc += 1;
+                } else {
+                    idx = get_u16(pc);
+                    pc += 2;
+                    if (unlikely(JS_IsUninitialized(var_buf[idx]))) {
+                        JS_ThrowReferenceErrorUninitialized2(ctx, b, idx, FALSE);
+                        goto exception;
+                    }
+                }
 
                 op2 = sp[-1];
                 pv = &var_buf[idx];
@@ -20239,6 +23422,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
         CASE(OP_sub):
+        sub_generic:
             {
                 JSValue op1, op2;
                 op1 = sp[-2];
@@ -20271,12 +23455,14 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     }
                     sp[-2] = __JS_NewFloat64(ctx, d1 - d2);
                     sp--;
+                    QUICKEN(OP_sub_float64);
                 } else {
                     goto binary_arith_slow;
                 }
             }
             BREAK;
         CASE(OP_mul):
+        mul_generic:
             {
                 JSValue op1, op2;
                 double d;
@@ -20317,6 +23503,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                         goto binary_arith_slow;
                     }
                     d = d1 * d2;
+                    QUICKEN(OP_mul_float64);
                 mul_fp_res:
                     sp[-2] = __JS_NewFloat64(ctx, d);
                     sp--;
@@ -20326,8 +23513,10 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
         CASE(OP_div):
+        div_generic:
             {
                 JSValue op1, op2;
+                double d1, d2;
                 op1 = sp[-2];
                 op2 = sp[-1];
                 if (likely(JS_VALUE_IS_BOTH_INT(op1, op2))) {
@@ -20336,6 +23525,10 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     v2 = JS_VALUE_GET_INT(op2);
                     sp[-2] = JS_NewFloat64(ctx, (double)v1 / (double)v2);
                     sp--;
+                } else if (js_get_float64_operands(op1, op2, &d1, &d2)) {
+                    sp[-2] = __JS_NewFloat64(ctx, d1 / d2);
+                    sp--;
+                    QUICKEN(OP_div_float64);
                 } else {
                     goto binary_arith_slow;
                 }
@@ -20362,6 +23555,26 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 }
             }
             BREAK;
+
+#define OP_FLOAT64_ARITH(name, binary_op)                               \
+            CASE(OP_ ## name ## _float64):                              \
+                {                                                       \
+                double d1, d2;                                          \
+                if (unlikely(!js_get_float64_operands(sp[-2], sp[-1],   \
+                                                      &d1, &d2))) {     \
+                    UNQUICKEN(OP_ ## name);                             \
+                    goto name ## _generic;                              \
+                }                                                       \
+                sp[-2] = __JS_NewFloat64(ctx, d1 binary_op d2);         \
+                sp--;                                                   \
+                }                                                       \
+            BREAK
+
+            OP_FLOAT64_ARITH(add, +);
+            OP_FLOAT64_ARITH(sub, -);
+            OP_FLOAT64_ARITH(mul, *);
+            OP_FLOAT64_ARITH(div, /);
+
         CASE(OP_pow):
         binary_arith_slow:
             sf->cur_pc = pc;
@@ -20545,6 +23758,45 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 }
             }
             BREAK;
+        CASE(OP_inc_loc_check):
+        CASE(OP_dec_loc_check):
+            {
+                JSValue op1;
+                int val;
+                int idx;
+                idx = get_u16(pc);
+                pc += 2;
+
+                op1 = var_buf[idx];
+                if (unlikely(JS_IsUninitialized(op1))) {
+                    JS_ThrowReferenceErrorUninitialized2(ctx, b, idx, FALSE);
+                    goto exception;
+                }
+                if (JS_VALUE_GET_TAG(op1) == JS_TAG_INT) {
+                    val = JS_VALUE_GET_INT(op1);
+                    if (opcode == OP_inc_loc_check) {
+                        if (unlikely(val == INT32_MAX))
+                            goto inc_dec_loc_check_slow;
+                        val++;
+                    } else {
+                        if (unlikely(val == INT32_MIN))
+                            goto inc_dec_loc_check_slow;
+                        val--;
+                    }
+                    var_buf[idx] = JS_NewInt32(ctx, val);
+                } else {
+                inc_dec_loc_check_slow:
+                    sf->cur_pc = pc;
+                    /* must duplicate otherwise the variable value may
+                       be destroyed before JS code accesses it */
+                    op1 = JS_DupValue(ctx, op1);
+                    if (js_unary_arith_slow(ctx, &op1 + 1,
+                                            opcode == OP_inc_loc_check ? OP_inc : OP_dec))
+                        goto exception;
+                    set_value(ctx, &var_buf[idx], op1);
+                }
+            }
+            BREAK;
         CASE(OP_not):
             {
                 JSValue op1;
@@ -21250,7 +24502,7 @@ static JSValue js_create_from_ctor(JSContext *ctx, JSValueConst ctor,
     JSContext *realm;
 
     if (JS_IsUndefined(ctor)) {
-        proto = JS_DupValue(ctx, ctx->class_proto[class_id]);
+        proto = JS_DupValue(ctx, js_get_class_proto(ctx, class_id));
     } else {
         proto = JS_GetProperty(ctx, ctor, JS_ATOM_prototype);
         if (JS_IsException(proto))
@@ -21260,9 +24512,11 @@ static JSValue js_create_from_ctor(JSContext *ctx, JSValueConst ctor,
             realm = JS_GetFunctionRealm(ctx, ctor);
             if (!realm)
                 return JS_EXCEPTION;
-            proto = JS_DupValue(ctx, realm->class_proto[class_id]);
+            proto = JS_DupValue(ctx, js_get_class_proto(realm, class_id));
         }
     }
+    if (JS_IsException(proto))
+        return proto;
     obj = JS_NewObjectProtoClass(ctx, proto, class_id);
     JS_FreeValue(ctx, proto);
     return obj;
@@ -21365,6 +24619,11 @@ static JSAsyncFunctionState *async_func_init(JSContext *ctx,
 
     p = JS_VALUE_GET_OBJ(func_obj);
     b = p->u.func.function_bytecode;
+    if (unlikely(b->is_lazy)) {
+        if (js_lazy_function_compile(ctx, p))
+            return NULL;
+        b = p->u.func.function_bytecode;
+    }
     arg_buf_len = max_int(b->arg_count, argc);
     s = js_malloc(ctx, sizeof(*s) + sizeof(JSValue) * (arg_buf_len + b->var_count + b->stack_size) + sizeof(JSVarRef *) * b->var_ref_count);
     if (!s)
@@ -21461,7 +24720,7 @@ static void __async_func_free(JSRuntime *rt, JSAsyncFunctionState *s)
 
     remove_gc_object(&s->header);
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && js_rc(s)->ref_count != 0) {
-        list_add_tail(&s->header.link, &rt->gc_zero_ref_count_list);
+        gc_add_zombie(rt, &s->header, JS_GC_OBJ_TYPE_ZOMBIE);
     } else {
         js_free_rt(rt, s);
     }
@@ -21471,8 +24730,7 @@ static void async_func_free(JSRuntime *rt, JSAsyncFunctionState *s)
 {
     if (--js_rc(s)->ref_count == 0) {
         if (rt->gc_phase != JS_GC_PHASE_REMOVE_CYCLES) {
-            list_del(&s->header.link);
-            list_add(&s->header.link, &rt->gc_zero_ref_count_list);
+            gc_add_zero_refcount(rt, &s->header);
             if (rt->gc_phase == JS_GC_PHASE_NONE) {
                 free_zero_refcount(rt);
             }
@@ -22425,6 +25683,7 @@ typedef struct {
     int line_num;
     int col_num;
     const uint8_t *buf_start;
+    int first_col_num; /* column number of buf_start */
 } GetLineColCache;
 
 typedef enum JSParseFunctionEnum {
@@ -22489,6 +25748,13 @@ typedef struct JSFunctionDef {
     BOOL is_global_var; /* TRUE if variables are not defined locally:
                            eval global, eval module or non strict eval */
     BOOL is_func_expr; /* TRUE if function expression */
+    BOOL is_lazy; /* TRUE if the body is only compiled at the first call */
+    BOOL lazy_is_module; /* TRUE if the lazy function is in module code */
+    BOOL is_lazy_wrapper; /* TRUE if compiling the body of a lazy function */
+    /* sorted identifiers used in the body of a lazy function. NULL if
+       all the variables of the enclosing functions are needed */
+    JSAtom *lazy_names;
+    int lazy_name_count;
     BOOL has_home_object; /* TRUE if the home object is available */
     BOOL has_prototype; /* true if a prototype field is necessary */
     BOOL has_simple_parameter_list;
@@ -22631,11 +25897,13 @@ typedef struct JSParseState {
     BOOL is_module; /* parsing a module */
     BOOL allow_html_comments;
     BOOL ext_json; /* JSON parsing: true if accepting JSON superset */
+    BOOL lazy_functions; /* see JS_SetLazyFunctions() */
+    BOOL lazy_checked; /* TRUE if the syntax of the source was already checked */
     GetLineColCache get_line_col_cache;
 } JSParseState;
 
 typedef struct JSOpCode {
-#ifdef DUMP_BYTECODE
+#if defined(DUMP_BYTECODE) || defined(CONFIG_OPCODE_STATS)
     const char *name;
 #endif
     uint8_t size; /* in bytes */
@@ -22648,7 +25916,7 @@ typedef struct JSOpCode {
 
 static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
 #define FMT(f)
-#ifdef DUMP_BYTECODE
+#if defined(DUMP_BYTECODE) || defined(CONFIG_OPCODE_STATS)
 #define DEF(id, size, n_pop, n_push, f) { #id, size, n_pop, n_push, OP_FMT_ ## f },
 #else
 #define DEF(id, size, n_pop, n_push, f) { size, n_pop, n_push, OP_FMT_ ## f },
@@ -22670,6 +25938,106 @@ static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
 #define short_opcode_info(op) opcode_info[op]
 #endif
 
+#ifdef CONFIG_OPCODE_STATS
+/* JSON object with the opcode counts ("opcodes": { name: count }) and
+   the opcode pair counts ("pairs": { prev_name: { name: count } }).
+   Only the non zero counts are present. */
+static void js_opcode_stats_to_json(JSRuntime *rt, DynBuf *dbuf)
+{
+    int op, prev;
+    BOOL first, first_prev;
+
+    dbuf_putstr(dbuf, "{\"opcodes\":{");
+    first = TRUE;
+    for(op = 0; op < OP_COUNT; op++) {
+        if (rt->opcode_counts[op] == 0)
+            continue;
+        dbuf_printf(dbuf, "%s\"%s\":%" PRIu64, first ? "" : ",",
+                    short_opcode_info(op).name, rt->opcode_counts[op]);
+        first = FALSE;
+    }
+    dbuf_putstr(dbuf, "},\"pairs\":{");
+    first_prev = TRUE;
+    for(prev = OP_invalid + 1; prev < OP_COUNT; prev++) {
+        first = TRUE;
+        for(op = 0; op < OP_COUNT; op++) {
+            if (rt->opcode_pair_counts[prev][op] == 0)
+                continue;
+            if (first) {
+                dbuf_printf(dbuf, "%s\"%s\":{", first_prev ? "" : ",",
+                            short_opcode_info(prev).name);
+                first_prev = FALSE;
+            }
+            dbuf_printf(dbuf, "%s\"%s\":%" PRIu64, first ? "" : ",",
+                        short_opcode_info(op).name,
+                        rt->opcode_pair_counts[prev][op]);
+            first = FALSE;
+        }
+        if (!first)
+            dbuf_putc(dbuf, '}');
+    }
+    dbuf_putstr(dbuf, "}}");
+}
+
+/* Append the statistics as one line of JSON to the file named by the
+   QUICKJS_OPCODE_STATS environment variable, or to stderr if it is
+   not set. */
+static void js_dump_opcode_stats(JSRuntime *rt)
+{
+    const char *filename;
+    DynBuf dbuf;
+    FILE *f;
+
+    dbuf_init(&dbuf);
+    js_opcode_stats_to_json(rt, &dbuf);
+    dbuf_putc(&dbuf, '\n');
+    if (!dbuf_error(&dbuf)) {
+        filename = getenv("QUICKJS_OPCODE_STATS");
+        if (filename && filename[0] != '\0') {
+            f = fopen(filename, "a");
+            if (f) {
+                fwrite(dbuf.buf, 1, dbuf.size, f);
+                fclose(f);
+            }
+        } else {
+            fwrite(dbuf.buf, 1, dbuf.size, stderr);
+        }
+    }
+    dbuf_free(&dbuf);
+}
+#endif
+
+JSValue JS_GetOpcodeStats(JSContext *ctx)
+{
+#ifdef CONFIG_OPCODE_STATS
+    DynBuf dbuf;
+    JSValue ret;
+
+    dbuf_init(&dbuf);
+    js_opcode_stats_to_json(ctx->rt, &dbuf);
+    if (dbuf_error(&dbuf)) {
+        dbuf_free(&dbuf);
+        return JS_ThrowOutOfMemory(ctx);
+    }
+    /* JS_ParseJSON() needs a nul terminated buffer */
+    dbuf_putc(&dbuf, '\0');
+    ret = JS_ParseJSON(ctx, (const char *)dbuf.buf, dbuf.size - 1,
+                       "<opcode stats>");
+    dbuf_free(&dbuf);
+    return ret;
+#else
+    return JS_NULL;
+#endif
+}
+
+void JS_ResetOpcodeStats(JSRuntime *rt)
+{
+#ifdef CONFIG_OPCODE_STATS
+    memset(rt->opcode_counts, 0, sizeof(rt->opcode_counts));
+    memset(rt->opcode_pair_counts, 0, sizeof(rt->opcode_pair_counts));
+#endif
+}
+
 static __exception int next_token(JSParseState *s);
 
 static void free_token(JSParseState *s, JSToken *token)
@@ -22812,6 +26180,8 @@ static int get_line_col_cached(GetLineColCache *s, int *pcol_num, const uint8_t
                     col_num++;
                 }
             }
+            if (p < s->buf_start)
+                col_num += s->first_col_num;
             s->col_num = col_num;
         }
     }
@@ -22825,7 +26195,7 @@ static int js_parse_error_v(JSParseState *s, const uint8_t *ptr, const char *fmt
 {
     JSContext *ctx = s->ctx;
     int line_num, col_num;
-    line_num = get_line_col(&col_num, s->buf_start, ptr - s->buf_start);
+    line_num = get_line_col_cached(&s->get_line_col_cache, &col_num, ptr);
     JS_ThrowErrorWithEnum2(ctx, JS_SYNTAX_ERROR, fmt, ap, FALSE);
     build_backtrace(ctx, ctx->rt->current_exception, s->filename,
                     line_num + 1, col_num + 1, 0);
@@ -30368,7 +33738,7 @@ static void js_free_module_def(JSRuntime *rt, JSModuleDef *m)
     }
     remove_gc_object(&m->header);
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && js_rc(m)->ref_count != 0) {
-        list_add_tail(&m->header.link, &rt->gc_zero_ref_count_list);
+        gc_add_zombie(rt, &m->header, JS_GC_OBJ_TYPE_ZOMBIE);
     } else {
         js_free_rt(rt, m);
     }
@@ -33352,6 +36722,267 @@ static void free_bytecode_atoms(JSRuntime *rt,
     }
 }
 
+/* inline caches */
+
+static JSInlineCache *js_ic_new(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    JSInlineCache *ic;
+    const uint8_t *bc_buf = b->byte_code_buf;
+    int pos, op, site_count, hash_bits;
+    uint32_t h, mask;
+
+    site_count = 0;
+    for(pos = 0; pos < b->byte_code_len; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        switch(op) {
+        case OP_get_field:
+        case OP_get_field2:
+        case OP_get_loc_get_field2:
+        case OP_put_field:
+#if SHORT_OPCODES
+        case OP_get_length:
+#endif
+            site_count++;
+            break;
+        default:
+            break;
+        }
+    }
+    /* keep the load factor below 1/2 */
+    hash_bits = 1;
+    while ((1 << hash_bits) < 2 * site_count)
+        hash_bits++;
+    ic = js_mallocz_rt(rt, sizeof(*ic) + (sizeof(ic->sites[0]) << hash_bits));
+    if (!ic)
+        return NULL;
+    ic->hash_bits = hash_bits;
+    ic->site_count = site_count;
+    mask = (1 << hash_bits) - 1;
+    for(pos = 0; pos < b->byte_code_len; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        switch(op) {
+        case OP_get_field:
+        case OP_get_field2:
+        case OP_get_loc_get_field2:
+        case OP_put_field:
+#if SHORT_OPCODES
+        case OP_get_length:
+#endif
+            /* the operand offset is never 0 */
+            h = js_ic_hash(pos + 1, hash_bits);
+            while (ic->sites[h].pc_pos != 0)
+                h = (h + 1) & mask;
+            ic->sites[h].pc_pos = pos + 1;
+            break;
+        default:
+            break;
+        }
+    }
+    return ic;
+}
+
+static void js_ic_clear_entry(JSRuntime *rt, JSInlineCacheEntry *e)
+{
+    js_free_shape_null(rt, e->shape);
+    js_free_shape_null(rt, e->new_shape);
+    memset(e, 0, sizeof(*e));
+}
+
+static void js_ic_free(JSRuntime *rt, JSInlineCache *ic)
+{
+    int i, j;
+
+    for(i = 0; i < (1 << ic->hash_bits); i++) {
+        for(j = 0; j < JS_IC_WAYS; j++)
+            js_ic_clear_entry(rt, &ic->sites[i].entries[j]);
+    }
+    js_free_rt(rt, ic);
+}
+
+static void js_ic_mark(JSRuntime *rt, JSInlineCache *ic,
+                       JS_MarkFunc *mark_func)
+{
+    JSInlineCacheEntry *e;
+    int i, j;
+
+    for(i = 0; i < (1 << ic->hash_bits); i++) {
+        for(j = 0; j < JS_IC_WAYS; j++) {
+            e = &ic->sites[i].entries[j];
+            if (e->shape)
+                mark_func(rt, &e->shape->header);
+            if (e->new_shape)
+                mark_func(rt, &e->new_shape->header);
+        }
+    }
+}
+
+/* invalidate all the cache entries. The referenced shapes are kept
+   until the entries are reused because freeing them could modify
+   the GC object list. */
+static void js_ic_reset_all(JSRuntime *rt)
+{
+    JSGCObjectIter it;
+    JSGCObjectHeader *gp;
+    JSInlineCache *ic;
+    int i, j;
+
+    js_gc_iter_init(rt, &it, FALSE);
+    while ((gp = js_gc_iter_next(&it)) != NULL) {
+        if (js_rc(gp)->gc_obj_type != JS_GC_OBJ_TYPE_FUNCTION_BYTECODE)
+            continue;
+        ic = ((JSFunctionBytecode *)gp)->ic;
+        if (!ic)
+            continue;
+        for(i = 0; i < (1 << ic->hash_bits); i++) {
+            for(j = 0; j < JS_IC_WAYS; j++)
+                ic->sites[i].entries[j].shape_id = 0;
+        }
+    }
+}
+
+/* return a free entry of the access site 'pc_pos' for the shape
+   'shape_id', allocating the cache if necessary. Return NULL if
+   memory error. */
+static JSInlineCacheEntry *js_ic_new_entry(JSRuntime *rt,
+                                           JSFunctionBytecode *b,
+                                           uint32_t pc_pos,
+                                           uint32_t shape_id)
+{
+    JSInlineCacheSite *site;
+    JSInlineCacheEntry *e;
+    int i;
+
+    if (!b->ic) {
+        b->ic = js_ic_new(rt, b);
+        if (!b->ic)
+            return NULL;
+    }
+    site = js_ic_find_site(b->ic, pc_pos);
+    /* reuse an entry with the same shape or an unused entry, otherwise
+       evict the entries in round robin order */
+    for(i = 0; i < JS_IC_WAYS; i++) {
+        e = &site->entries[i];
+        if (e->shape_id == shape_id || e->shape_id == 0)
+            goto done;
+    }
+    e = &site->entries[site->next_way];
+    site->next_way = (site->next_way + 1) % JS_IC_WAYS;
+ done:
+    js_ic_clear_entry(rt, e);
+    e->shape_id = shape_id;
+    return e;
+}
+
+/* collect the shape identifiers of the prototypes of 'sh' until the
+   one defining 'atom' or until the end of the prototype chain. Return
+   the number of prototypes, or -1 if they cannot be cached. '*pprs'
+   and '*pholder' are set to the found property if any. */
+static int js_ic_get_protos(JSShape *sh, JSAtom atom,
+                            uint32_t *proto_shape_ids,
+                            JSObject **pholder, JSShapeProperty **pprs)
+{
+    JSObject *p;
+    JSProperty *pr;
+    int depth;
+
+    *pprs = NULL;
+    depth = 0;
+    for(p = sh->proto; p != NULL; p = p->shape->proto) {
+        if (depth >= JS_IC_MAX_DEPTH)
+            return -1;
+        proto_shape_ids[depth++] = p->shape->id;
+        *pprs = find_own_property(&pr, p, atom);
+        if (*pprs) {
+            *pholder = p;
+            break;
+        }
+        /* non numeric properties of arrays are ordinary properties */
+        if (p->is_exotic && p->class_id != JS_CLASS_ARRAY)
+            return -1;
+    }
+    return depth;
+}
+
+/* cache the property 'atom' found in a prototype of 'p' */
+static void js_ic_add_get(JSRuntime *rt, JSFunctionBytecode *b,
+                          uint32_t pc_pos, JSObject *p, JSAtom atom)
+{
+    uint32_t proto_shape_ids[JS_IC_MAX_DEPTH];
+    JSInlineCacheEntry *e;
+    JSShapeProperty *prs;
+    JSObject *holder;
+    int depth;
+
+    /* objects with a non hashed shape are typically used as
+       dictionaries: their shape changes too often to be cached */
+    if (!p->shape->is_hashed || __JS_AtomIsTaggedInt(atom))
+        return;
+    depth = js_ic_get_protos(p->shape, atom, proto_shape_ids, &holder, &prs);
+    if (depth <= 0 || !prs || (prs->flags & JS_PROP_TMASK))
+        return;
+    e = js_ic_new_entry(rt, b, pc_pos, p->shape->id);
+    if (!e)
+        return;
+    memcpy(e->proto_shape_ids, proto_shape_ids,
+           sizeof(proto_shape_ids[0]) * depth);
+    e->prop_idx = prs - get_shape_prop(holder->shape);
+}
+
+/* cache the addition of the property 'atom' to 'p' if its previous
+   shape 'sh' was transformed into its current shape by the
+   addition */
+static void js_ic_add_put(JSRuntime *rt, JSFunctionBytecode *b,
+                          uint32_t pc_pos, JSObject *p, JSShape *sh,
+                          JSAtom atom)
+{
+    uint32_t proto_shape_ids[JS_IC_MAX_DEPTH];
+    JSInlineCacheEntry *e;
+    JSShape *new_sh = p->shape;
+    JSShapeProperty *prs, *prop, *new_prop;
+    JSObject *holder;
+    int depth, i;
+
+    /* a non hashed shape (e.g. after a property deletion) belongs to a
+       single object and must not be shared with the objects using the
+       cache */
+    if (new_sh == sh || !new_sh->is_hashed ||
+        __JS_AtomIsTaggedInt(atom) || new_sh->proto != sh->proto ||
+        new_sh->prop_count != sh->prop_count + 1)
+        return;
+    prop = get_shape_prop(sh);
+    new_prop = get_shape_prop(new_sh);
+    for(i = 0; i < sh->prop_count; i++) {
+        if (new_prop[i].atom != prop[i].atom ||
+            new_prop[i].flags != prop[i].flags)
+            return;
+    }
+    if (new_prop[i].atom != atom || new_prop[i].flags != JS_PROP_C_W_E)
+        return;
+    /* no prototype may define the property (it could be a setter or
+       a read-only property) */
+    depth = js_ic_get_protos(sh, atom, proto_shape_ids, &holder, &prs);
+    if (depth < 0 || prs)
+        return;
+    e = js_ic_new_entry(rt, b, pc_pos, sh->id);
+    if (!e)
+        return;
+    memcpy(e->proto_shape_ids, proto_shape_ids,
+           sizeof(proto_shape_ids[0]) * depth);
+    e->shape = js_dup_shape(sh);
+    e->new_shape = js_dup_shape(new_sh);
+}
+
+static void js_free_lazy_names(JSContext *ctx, JSFunctionDef *fd)
+{
+    int i;
+
+    for(i = 0; i < fd->lazy_name_count; i++)
+        JS_FreeAtom(ctx, fd->lazy_names[i]);
+    js_free(ctx, fd->lazy_names);
+    fd->lazy_names = NULL;
+    fd->lazy_name_count = 0;
+}
+
 static void js_free_function_def(JSContext *ctx, JSFunctionDef *fd)
 {
     int i;
@@ -33377,6 +37008,7 @@ static void js_free_function_def(JSContext *ctx, JSFunctionDef *fd)
     js_free(ctx, fd->cpool);
 
     JS_FreeAtom(ctx, fd->func_name);
+    js_free_lazy_names(ctx, fd);
 
     for(i = 0; i < fd->var_count; i++) {
         JS_FreeAtom(ctx, fd->vars[i].var_name);
@@ -34805,12 +38437,42 @@ static BOOL is_var_in_arg_scope(JSAtom var_name, JSVarKindEnum var_kind)
             var_kind == JS_VAR_FUNCTION_NAME);
 }
 
+/* return TRUE if the variable 'var_name' of an enclosing function can
+   be referenced from 's' */
+static BOOL is_enclosing_var_used(JSFunctionDef *s, JSAtom var_name)
+{
+    int lo, hi, mid;
+
+    if (!s->lazy_names)
+        return TRUE;
+    /* the variable objects of 'with' and sloppy mode eval are looked
+       up for every name */
+    if (var_name == JS_ATOM__with_ || var_name == JS_ATOM__var_ ||
+        var_name == JS_ATOM__arg_var_)
+        return TRUE;
+    lo = 0;
+    hi = s->lazy_name_count - 1;
+    while (lo <= hi) {
+        mid = (lo + hi) >> 1;
+        if (s->lazy_names[mid] == var_name)
+            return TRUE;
+        else if (s->lazy_names[mid] < var_name)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return FALSE;
+}
+
+static void add_enclosing_variables(JSContext *ctx, JSFunctionDef *s,
+                                    BOOL has_this_binding,
+                                    BOOL has_arguments_binding);
+
 static void add_eval_variables(JSContext *ctx, JSFunctionDef *s)
 {
-    JSFunctionDef *fd;
     JSVarDef *vd;
-    int i, scope_level, scope_idx;
-    BOOL has_arguments_binding, has_this_binding, is_arg_scope;
+    int i;
+    BOOL has_arguments_binding, has_this_binding;
 
     /* in non strict mode, variables are created in the caller's
        environment object */
@@ -34862,9 +38524,23 @@ static void add_eval_variables(JSContext *ctx, JSFunctionDef *s)
     }
 
     /* eval can use all the variables of the enclosing functions, so
-       they must be all put in the closure. The closure variables are
-       ordered by scope. It works only because no closure are created
-       before. */
+       they must be all put in the closure. */
+    add_enclosing_variables(ctx, s, has_this_binding, has_arguments_binding);
+}
+
+/* Add the variables of the enclosing functions to the closure of
+   's'. The closure variables are ordered by scope. It works only
+   because no closure are created before. With a lazy function, only
+   the variables it may reference are added. */
+static void add_enclosing_variables(JSContext *ctx, JSFunctionDef *s,
+                                    BOOL has_this_binding,
+                                    BOOL has_arguments_binding)
+{
+    JSFunctionDef *fd;
+    JSVarDef *vd;
+    int i, scope_level, scope_idx;
+    BOOL is_arg_scope;
+
     assert(s->is_eval || s->closure_var_count == 0);
 
     /* XXX: inefficient, but eval performance is less critical */
@@ -34892,16 +38568,20 @@ static void add_eval_variables(JSContext *ctx, JSFunctionDef *s)
             has_arguments_binding = TRUE;
         }
         /* add function name */
-        if (fd->is_func_expr && fd->func_name != JS_ATOM_NULL)
+        if (fd->is_func_expr && fd->func_name != JS_ATOM_NULL &&
+            is_enclosing_var_used(s, fd->func_name))
             add_func_var(ctx, fd, fd->func_name);
 
         /* add lexical variables */
         scope_idx = fd->scopes[scope_level].first;
         while (scope_idx >= 0) {
             vd = &fd->vars[scope_idx];
-            capture_var(fd, vd);
-            get_closure_var(ctx, s, fd, JS_CLOSURE_LOCAL, scope_idx,
-                            vd->var_name, vd->is_const, vd->is_lexical, vd->var_kind);
+            if (is_enclosing_var_used(s, vd->var_name)) {
+                capture_var(fd, vd);
+                get_closure_var(ctx, s, fd, JS_CLOSURE_LOCAL, scope_idx,
+                                vd->var_name, vd->is_const, vd->is_lexical,
+                                vd->var_kind);
+            }
             scope_idx = vd->scope_next;
         }
         is_arg_scope = (scope_idx == ARG_SCOPE_END);
@@ -34910,7 +38590,8 @@ static void add_eval_variables(JSContext *ctx, JSFunctionDef *s)
             /* XXX: propagate is_const and var_kind too ? */
             for(i = 0; i < fd->arg_count; i++) {
                 vd = &fd->args[i];
-                if (vd->var_name != JS_ATOM_NULL) {
+                if (vd->var_name != JS_ATOM_NULL &&
+                    is_enclosing_var_used(s, vd->var_name)) {
                     capture_var(fd, vd);
                     get_closure_var(ctx, s, fd,
                                     JS_CLOSURE_ARG, i, vd->var_name, FALSE,
@@ -34922,7 +38603,8 @@ static void add_eval_variables(JSContext *ctx, JSFunctionDef *s)
                 /* do not close top level last result */
                 if (vd->scope_level == 0 &&
                     vd->var_name != JS_ATOM__ret_ &&
-                    vd->var_name != JS_ATOM_NULL) {
+                    vd->var_name != JS_ATOM_NULL &&
+                    is_enclosing_var_used(s, vd->var_name)) {
                     capture_var(fd, vd);
                     get_closure_var(ctx, s, fd,
                                     JS_CLOSURE_LOCAL, i, vd->var_name, FALSE,
@@ -34933,7 +38615,9 @@ static void add_eval_variables(JSContext *ctx, JSFunctionDef *s)
             for(i = 0; i < fd->var_count; i++) {
                 vd = &fd->vars[i];
                 /* do not close top level last result */
-                if (vd->scope_level == 0 && is_var_in_arg_scope(vd->var_name, vd->var_kind)) {
+                if (vd->scope_level == 0 &&
+                    is_var_in_arg_scope(vd->var_name, vd->var_kind) &&
+                    is_enclosing_var_used(s, vd->var_name)) {
                     capture_var(fd, vd);
                     get_closure_var(ctx, s, fd,
                                     JS_CLOSURE_LOCAL, i, vd->var_name, FALSE,
@@ -34951,7 +38635,8 @@ static void add_eval_variables(JSContext *ctx, JSFunctionDef *s)
                    definitions are kept. */
                 if (cv->closure_type != JS_CLOSURE_GLOBAL_REF &&
                     cv->closure_type != JS_CLOSURE_GLOBAL_DECL &&
-                    cv->closure_type != JS_CLOSURE_GLOBAL) {
+                    cv->closure_type != JS_CLOSURE_GLOBAL &&
+                    is_enclosing_var_used(s, cv->var_name)) {
                     get_closure_var(ctx, s, fd,
                                     JS_CLOSURE_REF,
                                     idx, cv->var_name, cv->is_const,
@@ -35815,6 +39500,16 @@ static void compute_pc2line_info(JSFunctionDef *s)
     }
 }
 
+#if SHORT_OPCODES
+/* return the variant with an 8 bit offset of a conditional jump or goto */
+static int short_jump_opcode(int op)
+{
+    if (op == OP_lt_if_false)
+        return OP_lt_if_false8;
+    return OP_if_false8 + (op - OP_if_false);
+}
+#endif
+
 static RelocEntry *add_reloc(JSContext *ctx, LabelSlot *ls, uint32_t addr, int size)
 {
     RelocEntry *re;
@@ -36210,6 +39905,28 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
             label = get_u32(bc_buf + pos + 1);
             goto has_label;
 
+        case OP_lt:
+            if (OPTIMIZE) {
+                /* transformation: lt if_false(l) -> lt_if_false(l)
+                   unless the if_false is simplified by the
+                   OP_if_false case below */
+                if (code_match(&cc, pos_next, OP_if_false, -1)) {
+                    int pos1 = cc.pos;
+                    int line1 = cc.line_num;
+                    label = cc.label;
+                    if (!code_has_label(&cc, pos1, label) &&
+                        !(code_match(&cc, pos1, OP_goto, -1) &&
+                          code_has_label(&cc, cc.pos, label))) {
+                        if (line1 >= 0) line_num = line1;
+                        pos_next = pos1;
+                        op = OP_lt_if_false;
+                        label = find_jump_target(s, label, &op1, NULL);
+                        goto has_label;
+                    }
+                }
+            }
+            goto no_change;
+
         case OP_if_true:
         case OP_if_false:
             label = get_u32(bc_buf + pos + 1);
@@ -36250,10 +39967,10 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
 
             if (ls->addr == -1) {
                 int diff = ls->pos2 - pos - 1;
-                if (diff < 128 && (op == OP_if_false || op == OP_if_true || op == OP_goto)) {
+                if (diff < 128 && (op == OP_if_false || op == OP_if_true || op == OP_goto || op == OP_lt_if_false)) {
                     jp->size = 1;
-                    jp->op = OP_if_false8 + (op - OP_if_false);
-                    dbuf_putc(&bc_out, OP_if_false8 + (op - OP_if_false));
+                    jp->op = short_jump_opcode(op);
+                    dbuf_putc(&bc_out, jp->op);
                     dbuf_putc(&bc_out, 0);
                     if (!add_reloc(ctx, ls, bc_out.size - 1, 1))
                         goto fail;
@@ -36270,10 +39987,10 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 }
             } else {
                 int diff = ls->addr - bc_out.size - 1;
-                if (diff == (int8_t)diff && (op == OP_if_false || op == OP_if_true || op == OP_goto)) {
+                if (diff == (int8_t)diff && (op == OP_if_false || op == OP_if_true || op == OP_goto || op == OP_lt_if_false)) {
                     jp->size = 1;
-                    jp->op = OP_if_false8 + (op - OP_if_false);
-                    dbuf_putc(&bc_out, OP_if_false8 + (op - OP_if_false));
+                    jp->op = short_jump_opcode(op);
+                    dbuf_putc(&bc_out, jp->op);
                     dbuf_putc(&bc_out, diff);
                     break;
                 }
@@ -36600,6 +40317,19 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                  */
                 int idx;
                 idx = get_u16(bc_buf + pos + 1);
+                /* transformation:
+                   get_loc(n) get_field2(x) -> get_loc_get_field2(x, n)
+                   (receiver and method load of obj.method(...))
+                 */
+                if (code_match(&cc, pos_next, OP_get_field2, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    add_pc2line_info(s, bc_out.size, line_num);
+                    dbuf_putc(&bc_out, OP_get_loc_get_field2);
+                    dbuf_put_u32(&bc_out, cc.atom);
+                    dbuf_put_u16(&bc_out, idx);
+                    pos_next = cc.pos;
+                    break;
+                }
                 if (idx >= 256)
                     goto no_change;
                 if (code_match(&cc, pos_next, M2(OP_post_dec, OP_post_inc), OP_put_loc, idx, OP_drop, -1) ||
@@ -36663,6 +40393,64 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 break;
             }
             goto no_change;
+        case OP_get_loc_check:
+            if (OPTIMIZE) {
+                /* transformation:
+                   get_loc_check(n) post_dec put_loc_check(n) drop -> dec_loc_check(n)
+                   get_loc_check(n) post_inc put_loc_check(n) drop -> inc_loc_check(n)
+                 */
+                int idx;
+                idx = get_u16(bc_buf + pos + 1);
+                if (code_match(&cc, pos_next, M2(OP_post_dec, OP_post_inc), OP_put_loc_check, idx, OP_drop, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    add_pc2line_info(s, bc_out.size, line_num);
+                    dbuf_putc(&bc_out, cc.op == OP_post_inc ? OP_inc_loc_check : OP_dec_loc_check);
+                    dbuf_put_u16(&bc_out, idx);
+                    pos_next = cc.pos;
+                    break;
+                }
+                /* transformation:
+                   get_loc_check(n) push_atom_value(x) add dup put_loc_check(n) drop -> push_atom_value(x) add_loc_check(n)
+                   get_loc_check(n) push_i32(x) add dup put_loc_check(n) drop -> push_i32(x) add_loc_check(n)
+                   get_loc_check(n) get_loc(x) add dup put_loc_check(n) drop -> get_loc(x) add_loc_check(n)
+                   get_loc_check(n) get_arg(x) add dup put_loc_check(n) drop -> get_arg(x) add_loc_check(n)
+                   get_loc_check(n) get_var_ref(x) add dup put_loc_check(n) drop -> get_var_ref(x) add_loc_check(n)
+                   The pushed value cannot throw, so the variable is still
+                   checked before any side effect.
+                 */
+                if (code_match(&cc, pos_next, OP_push_atom_value, OP_add, OP_dup, OP_put_loc_check, idx, OP_drop, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    add_pc2line_info(s, bc_out.size, line_num);
+#if SHORT_OPCODES
+                    if (cc.atom == JS_ATOM_empty_string) {
+                        JS_FreeAtom(ctx, cc.atom);
+                        dbuf_putc(&bc_out, OP_push_empty_string);
+                    } else
+#endif
+                    {
+                        dbuf_putc(&bc_out, OP_push_atom_value);
+                        dbuf_put_u32(&bc_out, cc.atom);
+                    }
+                    goto add_loc_check;
+                }
+                if (code_match(&cc, pos_next, OP_push_i32, OP_add, OP_dup, OP_put_loc_check, idx, OP_drop, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    add_pc2line_info(s, bc_out.size, line_num);
+                    push_short_int(&bc_out, cc.label);
+                    goto add_loc_check;
+                }
+                if (code_match(&cc, pos_next, M3(OP_get_loc, OP_get_arg, OP_get_var_ref), -1, OP_add, OP_dup, OP_put_loc_check, idx, OP_drop, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    add_pc2line_info(s, bc_out.size, line_num);
+                    put_short_code(&bc_out, cc.op, cc.idx);
+                add_loc_check:
+                    dbuf_putc(&bc_out, OP_add_loc_check);
+                    dbuf_put_u16(&bc_out, idx);
+                    pos_next = cc.pos;
+                    break;
+                }
+            }
+            goto no_change;
 #if SHORT_OPCODES
         case OP_get_arg:
         case OP_get_var_ref:
@@ -36811,6 +40599,7 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
             case OP_if_false:
             case OP_if_true:
             case OP_goto:
+            case OP_lt_if_false:
                 pos = jp->pos;
                 diff = s->label_slots[jp->label].addr - pos;
                 if (diff >= -128 && diff <= 127 + delta) {
@@ -36819,7 +40608,7 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                     if (op == OP_goto16) {
                         bc_out.buf[pos - 1] = jp->op = OP_goto8;
                     } else {
-                        bc_out.buf[pos - 1] = jp->op = OP_if_false8 + (op - OP_if_false);
+                        bc_out.buf[pos - 1] = jp->op = short_jump_opcode(op);
                     }
                     goto shrink;
                 } else
@@ -37052,8 +40841,14 @@ static __exception int compute_stack_size(JSContext *ctx,
                 goto fail;
             break;
 #endif
+        case OP_lt_if_false8:
+            diff = (int8_t)bc_buf[pos + 1];
+            if (ss_check(ctx, s, pos + 1 + diff, op, stack_len, catch_pos))
+                goto fail;
+            break;
         case OP_if_true:
         case OP_if_false:
+        case OP_lt_if_false:
             diff = get_u32(bc_buf + pos + 1);
             if (ss_check(ctx, s, pos + 1 + diff, op, stack_len, catch_pos))
                 goto fail;
@@ -37261,6 +41056,9 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
        other variable lookup is done. */
     if (fd->has_eval_call)
         add_eval_variables(ctx, fd);
+    else if (fd->is_lazy)
+        add_enclosing_variables(ctx, fd, TRUE, TRUE);
+    js_free_lazy_names(ctx, fd);
 
     /* add the module global variables in the closure */
     if (fd->is_eval) {
@@ -37456,6 +41254,11 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     b->arguments_allowed = fd->arguments_allowed;
     b->is_direct_or_indirect_eval = (fd->eval_type == JS_EVAL_TYPE_DIRECT ||
                                      fd->eval_type == JS_EVAL_TYPE_INDIRECT);
+    if (fd->is_lazy) {
+        b->is_lazy = TRUE;
+        b->lazy_is_func_expr = fd->is_func_expr;
+        b->lazy_is_module = fd->lazy_is_module;
+    }
     b->realm = JS_DupContext(ctx);
 
     add_gc_object(ctx->rt, &b->header, JS_GC_OBJ_TYPE_FUNCTION_BYTECODE);
@@ -37504,6 +41307,8 @@ static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
         JSClosureVar *cv = &b->closure_var[i];
         JS_FreeAtomRT(rt, cv->var_name);
     }
+    if (b->ic)
+        js_ic_free(rt, b->ic);
     if (b->realm)
         JS_FreeContext(b->realm);
 
@@ -37516,7 +41321,7 @@ static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
 
     remove_gc_object(&b->header);
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && js_rc(b)->ref_count != 0) {
-        list_add_tail(&b->header.link, &rt->gc_zero_ref_count_list);
+        gc_add_zombie(rt, &b->header, JS_GC_OBJ_TYPE_ZOMBIE);
     } else {
         js_free_rt(rt, b);
     }
@@ -37693,6 +41498,161 @@ static JSFunctionDef *js_parse_function_class_fields_init(JSParseState *s)
     return fd;
 }
 
+static int lazy_name_cmp(const void *a, const void *b, void *opaque)
+{
+    JSAtom a1 = *(const JSAtom *)a;
+    JSAtom b1 = *(const JSAtom *)b;
+    return (a1 > b1) - (a1 < b1);
+}
+
+static int js_lazy_function_check(JSParseState *s, JSFunctionDef *fd,
+                                  const uint8_t *ptr);
+
+/* Scan the body of a function whose compilation is delayed to its
+   first call. Only the tokens are checked. The identifiers are
+   recorded so that the variables of the enclosing functions it may
+   reference are put in its closure. Return 0 if the body must be
+   parsed normally, otherwise set fd->is_lazy and stop on the closing
+   '}'. */
+static int js_parse_lazy_function_body(JSParseState *s, JSFunctionDef *fd)
+{
+    JSContext *ctx = s->ctx;
+    char state[256];
+    size_t level = 0;
+    JSParsePos pos;
+    int c, last_tok, tok_len, name_size, i, j;
+    BOOL use_all_names;
+
+    /* protect from underflow and mark the end of the body */
+    state[level++] = 0;
+
+    js_parse_get_pos(s, &pos);
+    name_size = 0;
+    use_all_names = fd->has_eval_call;
+    last_tok = 0;
+    for (;;) {
+        switch(s->token.val) {
+        case '(':
+        case '[':
+        case '{':
+            if (level >= sizeof(state))
+                goto fail;
+            state[level++] = s->token.val;
+            break;
+        case ')':
+            if (state[--level] != '(')
+                goto fail;
+            break;
+        case ']':
+            if (state[--level] != '[')
+                goto fail;
+            break;
+        case '}':
+            c = state[--level];
+            if (c == '`') {
+                /* continue the parsing of the template */
+                free_token(s, &s->token);
+                /* Resume TOK_TEMPLATE parsing (s->token.ptr is OK) */
+                s->got_lf = FALSE;
+                if (js_parse_template_part(s, s->buf_ptr))
+                    goto fail;
+                goto handle_template;
+            } else if (c == 0) {
+                goto done;
+            } else if (c != '{') {
+                goto fail;
+            }
+            break;
+        case TOK_TEMPLATE:
+        handle_template:
+            if (s->token.u.str.sep != '`') {
+                /* '${' inside the template : closing '}' and continue
+                   parsing the template */
+                if (level >= sizeof(state))
+                    goto fail;
+                state[level++] = '`';
+            }
+            break;
+        case TOK_EOF:
+            goto fail;
+        case TOK_DIV_ASSIGN:
+            tok_len = 2;
+            goto parse_regexp;
+        case '/':
+            tok_len = 1;
+        parse_regexp:
+            /* a division or a regexp: let the parser decide */
+            if (last_tok == ')' || last_tok == '}' || last_tok == TOK_TEMPLATE)
+                goto fail;
+            if (is_regexp_allowed(last_tok)) {
+                s->buf_ptr -= tok_len;
+                if (js_parse_regexp(s))
+                    goto fail;
+            }
+            break;
+        case TOK_PRIVATE_NAME:
+            /* the private names are not captured by name */
+            goto fail;
+        case TOK_IDENT:
+        case TOK_YIELD:
+        case TOK_AWAIT:
+            /* property names are not variable references */
+            if (last_tok == '.' || last_tok == TOK_QUESTION_MARK_DOT)
+                break;
+            if (s->token.u.ident.atom == JS_ATOM_eval)
+                use_all_names = TRUE;
+            if (js_resize_array(ctx, (void **)&fd->lazy_names,
+                                sizeof(fd->lazy_names[0]), &name_size,
+                                fd->lazy_name_count + 1))
+                goto fail;
+            fd->lazy_names[fd->lazy_name_count++] =
+                JS_DupAtom(ctx, s->token.u.ident.atom);
+            break;
+        }
+        /* last_tok is only used to recognize regexps */
+        if (s->token.val == TOK_IDENT &&
+            (token_is_pseudo_keyword(s, JS_ATOM_of) ||
+             token_is_pseudo_keyword(s, JS_ATOM_yield))) {
+            last_tok = TOK_OF;
+        } else {
+            last_tok = s->token.val;
+        }
+        if (next_token(s))
+            goto fail;
+    }
+ done:
+    if (use_all_names) {
+        js_free_lazy_names(ctx, fd);
+    } else if (fd->lazy_name_count == 0) {
+        /* an empty table means that no enclosing variable is used */
+        js_free_lazy_names(ctx, fd);
+        fd->lazy_names = js_malloc(ctx, sizeof(fd->lazy_names[0]));
+        if (!fd->lazy_names)
+            return -1;
+    } else {
+        rqsort(fd->lazy_names, fd->lazy_name_count,
+               sizeof(fd->lazy_names[0]), lazy_name_cmp, NULL);
+        for(i = j = 1; i < fd->lazy_name_count; i++) {
+            if (fd->lazy_names[i] == fd->lazy_names[j - 1])
+                JS_FreeAtom(ctx, fd->lazy_names[i]);
+            else
+                fd->lazy_names[j++] = fd->lazy_names[i];
+        }
+        fd->lazy_name_count = j;
+    }
+    /* the last constant pool entry receives the compiled function */
+    if (cpool_add(s, JS_UNDEFINED) < 0)
+        return -1;
+    fd->is_lazy = TRUE;
+    fd->lazy_is_module = s->is_module;
+    return 0;
+ fail:
+    /* the tokenizer errors are reported by the normal parsing */
+    JS_FreeValue(ctx, JS_GetException(ctx));
+    js_free_lazy_names(ctx, fd);
+    return js_parse_seek_token(s, &pos);
+}
+
 /* func_name must be JS_ATOM_NULL for JS_PARSE_FUNC_STATEMENT and
    JS_PARSE_FUNC_EXPR, JS_PARSE_FUNC_ARROW and JS_PARSE_FUNC_VAR */
 static __exception int js_parse_function_decl2(JSParseState *s,
@@ -38123,10 +42083,26 @@ static __exception int js_parse_function_decl2(JSParseState *s,
     if (js_parse_function_check_names(s, fd, func_name))
         goto fail;
 
-    while (s->token.val != '}') {
-        if (js_parse_source_element(s))
+    /* the body of a nested function is only compiled at its first
+       call. The functions defined in the parameters would be compiled
+       twice, so they are excluded. */
+    if (s->lazy_functions && !fd->strip_source &&
+        !fd->parent->is_lazy_wrapper &&
+        (func_type == JS_PARSE_FUNC_STATEMENT ||
+         func_type == JS_PARSE_FUNC_VAR ||
+         func_type == JS_PARSE_FUNC_EXPR) &&
+        func_name != JS_ATOM_yield && func_name != JS_ATOM_await &&
+        list_empty(&fd->child_list)) {
+        if (js_parse_lazy_function_body(s, fd))
             goto fail;
     }
+
+    if (!fd->is_lazy) {
+        while (s->token.val != '}') {
+            if (js_parse_source_element(s))
+                goto fail;
+        }
+    }
     if (!fd->strip_source) {
         /* save the function source code */
         fd->source_len = s->buf_ptr - ptr;
@@ -38134,6 +42110,10 @@ static __exception int js_parse_function_decl2(JSParseState *s,
         if (!fd->source)
             goto fail;
     }
+    if (fd->is_lazy && !s->lazy_checked) {
+        if (js_lazy_function_check(s, fd, ptr))
+            goto fail;
+    }
 
     if (next_token(s)) {
         /* consume the '}' */
@@ -38523,6 +42503,7 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
     }
     s->is_module = (m != NULL);
     s->allow_html_comments = !s->is_module;
+    s->lazy_functions = ctx->rt->lazy_functions;
 
     push_scope(s); /* body scope */
     fd->body_scope = fd->scope_level;
@@ -38568,6 +42549,213 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
     return JS_EXCEPTION;
 }
 
+/* Prepare the parsing of the source of a lazy function. It is parsed
+   as the only child of a function acting as a direct eval. 'line_num'
+   and 'col_num' (0 based) are the position of the source in its file. */
+static JSFunctionDef *js_lazy_parse_init(JSContext *ctx, JSParseState *s,
+                                         const char *source, size_t source_len,
+                                         const char *filename,
+                                         int line_num, int col_num,
+                                         BOOL is_module, int js_mode)
+{
+    JSFunctionDef *fd;
+
+    js_parse_init(ctx, s, source, source_len, filename);
+    /* keep the line and column numbers of the original source */
+    s->get_line_col_cache.line_num = line_num;
+    s->get_line_col_cache.col_num = col_num;
+    s->get_line_col_cache.first_col_num = col_num;
+    s->is_module = is_module;
+    s->allow_html_comments = !s->is_module;
+    s->lazy_functions = TRUE;
+    /* the whole source was checked when the lazy function was defined */
+    s->lazy_checked = TRUE;
+
+    fd = js_new_function_def(ctx, NULL, TRUE, FALSE, filename,
+                             s->buf_start, &s->get_line_col_cache);
+    if (!fd)
+        return NULL;
+    s->cur_func = fd;
+    fd->eval_type = JS_EVAL_TYPE_DIRECT;
+    fd->is_lazy_wrapper = TRUE;
+    fd->js_mode = js_mode;
+    push_scope(s); /* body scope */
+    fd->body_scope = fd->scope_level;
+    return fd;
+}
+
+static int js_lazy_parse_function(JSParseState *s, JSFunctionDef **pfd)
+{
+    if (next_token(s))
+        return -1;
+    if (js_parse_function_decl2(s, JS_PARSE_FUNC_EXPR, JS_FUNC_NORMAL,
+                                JS_ATOM_NULL, s->token.ptr,
+                                JS_PARSE_EXPORT_NONE, pfd))
+        return -1;
+    if (s->token.val != TOK_EOF)
+        return js_parse_error(s, "unexpected token after the function body");
+    return 0;
+}
+
+/* The body of the lazy function 'fd' was only scanned at the token
+   level: parse its source, including its nested functions, and discard
+   the result so that the syntax errors are reported where the function
+   is defined and not at its first call. */
+static int js_lazy_function_check(JSParseState *s, JSFunctionDef *fd,
+                                  const uint8_t *ptr)
+{
+    JSContext *ctx = s->ctx;
+    JSParseState s1;
+    JSFunctionDef *fd1, *fd2;
+    int line_num, col_num, ret;
+
+    line_num = get_line_col_cached(&s->get_line_col_cache, &col_num, ptr);
+    fd1 = js_lazy_parse_init(ctx, &s1, fd->source, fd->source_len,
+                             s->filename, line_num, col_num,
+                             s->is_module, fd->js_mode & JS_MODE_STRICT);
+    if (!fd1)
+        return -1;
+    /* a single pass over the source */
+    s1.lazy_functions = FALSE;
+    ret = js_lazy_parse_function(&s1, &fd2);
+    free_token(&s1, &s1.token);
+    js_free_function_def(ctx, fd1);
+    return ret;
+}
+
+/* Compile the body of the lazy function 'b'. The function is parsed
+   again from its source as if it was defined in a direct eval whose
+   closure variables are the ones of 'b'. */
+static JSValue js_lazy_function_create(JSContext *ctx, JSFunctionBytecode *b)
+{
+    JSParseState s1, *s = &s1;
+    JSFunctionDef *fd, *fd1;
+    JSFunctionBytecode *b1;
+    JSValue func_obj, ret_val;
+    const char *filename;
+    int i, idx, line_num, col_num;
+
+    filename = JS_AtomToCString(ctx, b->debug.filename);
+    if (!filename)
+        return JS_EXCEPTION;
+    line_num = find_line_num(ctx, b, -1, &col_num);
+    fd = js_lazy_parse_init(ctx, s, b->debug.source, b->debug.source_len,
+                            filename, line_num - 1, col_num - 1,
+                            b->lazy_is_module, b->js_mode & JS_MODE_STRICT);
+    if (!fd)
+        goto fail1;
+    if (b->closure_var_count) {
+        fd->closure_var = js_malloc(ctx, sizeof(fd->closure_var[0]) *
+                                    b->closure_var_count);
+        if (!fd->closure_var)
+            goto fail;
+        fd->closure_var_size = b->closure_var_count;
+        for(i = 0; i < b->closure_var_count; i++) {
+            JSClosureVar *cv0 = &b->closure_var[i];
+            JSClosureVar *cv = &fd->closure_var[fd->closure_var_count++];
+            *cv = *cv0;
+            if (cv0->closure_type == JS_CLOSURE_GLOBAL_REF ||
+                cv0->closure_type == JS_CLOSURE_GLOBAL_DECL ||
+                cv0->closure_type == JS_CLOSURE_GLOBAL)
+                cv->closure_type = JS_CLOSURE_GLOBAL;
+            else
+                cv->closure_type = JS_CLOSURE_REF;
+            cv->var_idx = i;
+            cv->var_name = JS_DupAtom(ctx, cv0->var_name);
+        }
+    }
+    if (js_lazy_parse_function(s, &fd1))
+        goto fail;
+    /* a function declaration does not bind its own name */
+    fd1->is_func_expr = b->lazy_is_func_expr;
+    idx = fd1->parent_cpool_idx;
+    emit_op(s, OP_return);
+
+    ret_val = js_create_function(ctx, fd);
+    if (JS_IsException(ret_val))
+        goto fail1;
+    b1 = JS_VALUE_GET_PTR(ret_val);
+    func_obj = JS_DupValue(ctx, b1->cpool[idx]);
+    JS_FreeValue(ctx, ret_val);
+    JS_FreeCString(ctx, filename);
+
+    /* the global variables are resolved when the closure is created */
+    b1 = JS_VALUE_GET_PTR(func_obj);
+    for(i = 0; i < b1->closure_var_count; i++) {
+        JSClosureVar *cv = &b1->closure_var[i];
+        if (cv->closure_type == JS_CLOSURE_GLOBAL_REF) {
+            cv->closure_type = JS_CLOSURE_GLOBAL;
+            cv->var_idx = 0;
+        } else {
+            assert(cv->closure_type == JS_CLOSURE_REF);
+        }
+    }
+    return func_obj;
+ fail:
+    free_token(s, &s->token);
+    js_free_function_def(ctx, fd);
+ fail1:
+    JS_FreeCString(ctx, filename);
+    return JS_EXCEPTION;
+}
+
+/* Called at the first call of the function object 'p' whose bytecode
+   is lazy. The compiled function is shared by all the function objects
+   created from the same definition. */
+static int js_lazy_function_compile(JSContext *ctx, JSObject *p)
+{
+    JSFunctionBytecode *b, *b1;
+    JSVarRef **var_refs;
+    JSValue func_val;
+    int i;
+
+    b = p->u.func.function_bytecode;
+    ctx = b->realm;
+    func_val = b->cpool[b->cpool_count - 1];
+    if (JS_IsUndefined(func_val)) {
+        func_val = js_lazy_function_create(ctx, b);
+        if (JS_IsException(func_val))
+            return -1;
+        b->cpool[b->cpool_count - 1] = func_val;
+    }
+    b1 = JS_VALUE_GET_PTR(func_val);
+
+    var_refs = NULL;
+    if (b1->closure_var_count) {
+        var_refs = js_mallocz(ctx, sizeof(var_refs[0]) * b1->closure_var_count);
+        if (!var_refs)
+            return -1;
+        for(i = 0; i < b1->closure_var_count; i++) {
+            JSClosureVar *cv = &b1->closure_var[i];
+            JSVarRef *var_ref;
+            if (cv->closure_type == JS_CLOSURE_GLOBAL) {
+                var_ref = js_closure_global_var(ctx, cv);
+                if (!var_ref)
+                    goto fail;
+            } else {
+                var_ref = p->u.func.var_refs[cv->var_idx];
+                js_rc(var_ref)->ref_count++;
+            }
+            var_refs[i] = var_ref;
+        }
+    }
+
+    if (p->u.func.var_refs) {
+        for(i = 0; i < b->closure_var_count; i++)
+            free_var_ref(ctx->rt, p->u.func.var_refs[i]);
+        js_free(ctx, p->u.func.var_refs);
+    }
+    p->u.func.var_refs = var_refs;
+    p->u.func.function_bytecode = JS_VALUE_GET_PTR(JS_DupValue(ctx, func_val));
+    JS_FreeValue(ctx, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, b));
+    return 0;
+ fail:
+    for(i = 0; i < b1->closure_var_count; i++)
+        free_var_ref(ctx->rt, var_refs[i]);
+    js_free(ctx, var_refs);
+    return -1;
+}
+
 /* the indirection is needed to make 'eval' optional */
 static JSValue JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
                                const char *input, size_t input_len,
@@ -38919,7 +43107,7 @@ static const char *JS_NameForClassId(int obj_class)
     }
 }
 
-#define BC_BASE_VERSION 7
+#define BC_BASE_VERSION 9
 #define BC_BE_VERSION 0x40
 #ifdef WORDS_BIGENDIAN
 #define BC_VERSION (BC_BASE_VERSION | BC_BE_VERSION)
@@ -39139,6 +43327,23 @@ static void bc_byte_swap(uint8_t *bc_buf, int bc_len)
     }
 }
 
+/* return the generic opcode of a quickened opcode */
+static int js_unquicken_opcode(int op)
+{
+    switch(op) {
+    case OP_add_float64:
+        return OP_add;
+    case OP_sub_float64:
+        return OP_sub;
+    case OP_mul_float64:
+        return OP_mul;
+    case OP_div_float64:
+        return OP_div;
+    default:
+        return op;
+    }
+}
+
 static int JS_WriteFunctionBytecode(BCWriterState *s,
                                     const uint8_t *bc_buf1, int bc_len)
 {
@@ -39154,7 +43359,8 @@ static int JS_WriteFunctionBytecode(BCWriterState *s,
 
     pos = 0;
     while (pos < bc_len) {
-        op = bc_buf[pos];
+        op = js_unquicken_opcode(bc_buf[pos]);
+        bc_buf[pos] = op;
         len = short_opcode_info(op).size;
         switch(short_opcode_info(op).fmt) {
         case OP_FMT_atom:
@@ -39267,6 +43473,9 @@ static int JS_WriteFunctionTag(BCWriterState *s, JSValueConst obj)
     bc_set_flags(&flags, &idx, b->arguments_allowed, 1);
     bc_set_flags(&flags, &idx, b->has_debug, 1);
     bc_set_flags(&flags, &idx, b->is_direct_or_indirect_eval, 1);
+    bc_set_flags(&flags, &idx, b->is_lazy, 1);
+    bc_set_flags(&flags, &idx, b->lazy_is_func_expr, 1);
+    bc_set_flags(&flags, &idx, b->lazy_is_module, 1);
     assert(idx <= 16);
     bc_put_u16(s, flags);
     bc_put_u8(s, b->js_mode);
@@ -39450,7 +43659,7 @@ static int JS_WriteArray(BCWriterState *s, JSValueConst obj)
     bc_put_leb128(s, len);
     if (p->fast_array) {
         for(i = 0; i < p->u.array.count; i++) {
-            ret = JS_WriteObjectRec(s, p->u.array.u.values[i]);
+            ret = JS_WriteObjectRec(s, js_fast_array_peek(p, i));
             if (ret)
                 goto fail;
         }
@@ -39909,6 +44118,34 @@ uint8_t *JS_WriteObject(JSContext *ctx, size_t *psize, JSValueConst obj,
     return JS_WriteObject2(ctx, psize, obj, flags, NULL, NULL);
 }
 
+uint32_t JS_GetBytecodeVersion(void)
+{
+    return BC_VERSION;
+}
+
+/* only depends on the sources and the JSValue layout so that the
+   builds are reproducible */
+const char *JS_GetBuildId(void)
+{
+    return
+#ifdef CONFIG_VERSION
+        CONFIG_VERSION " "
+#endif
+        "bc" stringify(BC_BASE_VERSION)
+#ifdef WORDS_BIGENDIAN
+        " big-endian"
+#endif
+#ifdef JS_NAN_BOXING
+        " nan-boxing"
+#endif
+#ifdef JS_PTR64
+        " 64-bit"
+#else
+        " 32-bit"
+#endif
+        ;
+}
+
 typedef struct BCReaderState {
     JSContext *ctx;
     const uint8_t *buf_start, *ptr, *buf_end;
@@ -39919,6 +44156,8 @@ typedef struct BCReaderState {
     BOOL allow_sab : 8;
     BOOL allow_bytecode : 8;
     BOOL is_rom_data : 8;
+    BOOL in_place : 8; /* reference the bytecode in place and relocate its
+                          atoms in the input buffer */
     BOOL allow_reference : 8;
     BOOL serialize_errors : 8;
     /* object references */
@@ -40173,7 +44412,7 @@ static int JS_ReadFunctionBytecode(BCReaderState *s, JSFunctionBytecode *b,
     JSAtom atom;
     uint32_t idx;
 
-    if (s->is_rom_data) {
+    if (b->read_only_bytecode) {
         /* directly use the input buffer */
         if (unlikely(s->buf_end - s->ptr < bc_len))
             return bc_read_error_end(s);
@@ -40322,7 +44561,12 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
     bc.arguments_allowed = bc_get_flags(v16, &idx, 1);
     bc.has_debug = bc_get_flags(v16, &idx, 1);
     bc.is_direct_or_indirect_eval = bc_get_flags(v16, &idx, 1);
-    bc.read_only_bytecode = s->is_rom_data;
+    bc.is_lazy = bc_get_flags(v16, &idx, 1);
+    bc.lazy_is_func_expr = bc_get_flags(v16, &idx, 1);
+    bc.lazy_is_module = bc_get_flags(v16, &idx, 1);
+    bc.read_only_bytecode = s->is_rom_data || s->in_place;
+    if (bc.read_only_bytecode)
+        bc.quicken_misses = JS_QUICKEN_MAX_MISSES;
     if (bc_get_u8(s, &v8))
         goto fail;
     bc.js_mode = v8;
@@ -40470,7 +44714,8 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
             goto fail;
         if (b->debug.source_len) {
             bc_read_trace(s, "source: %d bytes\n", b->debug.source_len);
-            b->debug.source = js_mallocz(ctx, b->debug.source_len);
+            /* zero terminated as the parser expects it (lazy functions) */
+            b->debug.source = js_mallocz(ctx, b->debug.source_len + 1);
             if (!b->debug.source)
                 goto fail;
             if (bc_get_buf(s, (uint8_t *)b->debug.source, b->debug.source_len))
@@ -40961,8 +45206,7 @@ static JSValue JS_ReadDate(BCReaderState *s)
         JS_ThrowTypeError(ctx, "<internal>/quickjs.c", __LINE__, "Number tag expected for date");
         goto fail;
     }
-    obj = JS_NewObjectProtoClass(ctx, ctx->class_proto[JS_CLASS_DATE],
-                                 JS_CLASS_DATE);
+    obj = JS_NewObjectClass(ctx, JS_CLASS_DATE);
     if (JS_IsException(obj))
         goto fail;
     if (BC_add_object_ref(s, obj))
@@ -41182,6 +45426,7 @@ JSValue JS_ReadObject(JSContext *ctx, const uint8_t *buf, size_t buf_len,
     s->ptr = buf;
     s->allow_bytecode = ((flags & JS_READ_OBJ_BYTECODE) != 0);
     s->is_rom_data = ((flags & JS_READ_OBJ_ROM_DATA) != 0);
+    s->in_place = s->is_rom_data && ((flags & JS_READ_OBJ_IN_PLACE) != 0);
     s->allow_sab = ((flags & JS_READ_OBJ_SAB) != 0);
     s->allow_reference = ((flags & JS_READ_OBJ_REFERENCE) != 0);
     s->serialize_errors = ((flags & JS_READ_OBJ_SERIALIZE_ERRORS) != 0);
@@ -41496,6 +45741,7 @@ int JS_SetConstructor(JSContext *ctx, JSValueConst func_obj,
 #define JS_NEW_CTOR_PROTO_CLASS (1 << 1) /* the prototype class is 'class_id' instead of JS_CLASS_OBJECT */
 #define JS_NEW_CTOR_PROTO_EXIST (1 << 2) /* the prototype is already defined */
 #define JS_NEW_CTOR_READONLY    (1 << 3) /* read-only constructor field */
+#define JS_NEW_CTOR_LAZY_GLOBAL (1 << 4) /* the global binding is stored in lazy_intrinsic_globals */
 
 /* Return the constructor and. Define it as a global variable unless
    JS_NEW_CTOR_NO_GLOBAL is set. The new class inherit from
@@ -41553,7 +45799,12 @@ static JSValue JS_NewCConstructor(JSContext *ctx, int class_id, const char *name
     if (JS_SetPropertyFunctionList(ctx, ctor, ctor_fields, n_ctor_fields))
         goto fail;
     if (!(flags & JS_NEW_CTOR_NO_GLOBAL)) {
-        if (JS_DefinePropertyValueStr(ctx, ctx->global_obj, name,
+        JSValueConst global_obj;
+        if (flags & JS_NEW_CTOR_LAZY_GLOBAL)
+            global_obj = ctx->lazy_intrinsic_globals;
+        else
+            global_obj = ctx->global_obj;
+        if (JS_DefinePropertyValueStr(ctx, global_obj, name,
                                       JS_DupValue(ctx, ctor),
                                       JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE) < 0)
             goto fail;
@@ -42954,7 +47205,7 @@ static JSValue *build_arg_list(JSContext *ctx, uint32_t *plen,
             }
         } else {
             for(i = 0; i < len; i++) {
-                tab[i] = JS_DupValue(ctx, p->u.array.u.values[i]);
+                tab[i] = JS_DupValue(ctx, js_fast_array_peek(p, i));
             }
         }
     } else {
@@ -43464,16 +47715,18 @@ static int JS_CopySubArray(JSContext *ctx,
             if (dir < 0) {
                 l = min_int64(l, from + 1);
                 l = min_int64(l, to + 1);
+                /* js_fast_array_set() cannot fail because the values
+                   are already in the array */
                 for(j = 0; j < l; j++) {
-                    set_value(ctx, &p->u.array.u.values[to - j],
-                              JS_DupValue(ctx, p->u.array.u.values[from - j]));
+                    js_fast_array_set(ctx, p, to - j,
+                                      JS_DupValue(ctx, js_fast_array_peek(p, from - j)));
                 }
             } else {
                 l = min_int64(l, len - from);
                 l = min_int64(l, len - to);
                 for(j = 0; j < l; j++) {
-                    set_value(ctx, &p->u.array.u.values[to + j],
-                              JS_DupValue(ctx, p->u.array.u.values[from + j]));
+                    js_fast_array_set(ctx, p, to + j,
+                                      JS_DupValue(ctx, js_fast_array_peek(p, from + j)));
                 }
             }
             i += l;
@@ -43507,6 +47760,8 @@ static JSValue js_array_constructor(JSContext *ctx, JSValueConst new_target,
     obj = js_create_from_ctor(ctx, new_target, JS_CLASS_ARRAY);
     if (JS_IsException(obj))
         return obj;
+    /* the array is empty: start with unboxed integers */
+    JS_VALUE_GET_OBJ(obj)->array_kind = JS_ARRAY_KIND_INT32;
     if (argc == 1 && JS_IsNumber(argv[0])) {
         uint32_t len;
         if (JS_ToArrayLengthFree(ctx, &len, JS_DupValue(ctx, argv[0]), TRUE))
@@ -43789,8 +48044,7 @@ static JSValue js_array_at(JSContext *ctx, JSValueConst this_val,
 {
     JSValue obj, ret;
     int64_t len, idx;
-    JSValue *arrp;
-    uint32_t count;
+    JSObject *p;
 
     obj = JS_ToObject(ctx, this_val);
     if (js_get_length64(ctx, &len, obj))
@@ -43803,8 +48057,9 @@ static JSValue js_array_at(JSContext *ctx, JSValueConst this_val,
         idx = len + idx;
     if (idx < 0 || idx >= len) {
         ret = JS_UNDEFINED;
-    } else if (js_get_fast_array(ctx, obj, &arrp, &count) && idx < count) {
-        ret = JS_DupValue(ctx, arrp[idx]);
+    } else if ((p = js_get_fast_array_obj(obj)) != NULL &&
+               idx < p->u.array.count) {
+        ret = JS_DupValue(ctx, js_fast_array_peek(p, idx));
     } else {
         int present = JS_TryGetPropertyInt64(ctx, obj, idx, &ret);
         if (present < 0)
@@ -43822,10 +48077,9 @@ static JSValue js_array_at(JSContext *ctx, JSValueConst this_val,
 static JSValue js_array_with(JSContext *ctx, JSValueConst this_val,
                              int argc, JSValueConst *argv)
 {
-    JSValue arr, obj, ret, *arrp, *pval;
-    JSObject *p;
+    JSValue arr, obj, ret, *pval;
+    JSObject *p, *p1;
     int64_t i, len, idx;
-    uint32_t count32;
 
     ret = JS_EXCEPTION;
     arr = JS_UNDEFINED;
@@ -43844,20 +48098,25 @@ static JSValue js_array_with(JSContext *ctx, JSValueConst this_val,
         goto exception;
     }
 
-    arr = js_allocate_fast_array(ctx, len);
-    if (JS_IsException(arr))
-        goto exception;
-
-    p = JS_VALUE_GET_OBJ(arr);
-    i = 0;
-    pval = p->u.array.u.values;
-    if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
-        for (; i < idx; i++, pval++)
-            *pval = JS_DupValue(ctx, arrp[i]);
-        *pval = JS_DupValue(ctx, argv[1]);
-        for (i++, pval++; i < len; i++, pval++)
-            *pval = JS_DupValue(ctx, arrp[i]);
+    p1 = js_get_fast_array_obj(obj);
+    if (p1 && p1->u.array.count == len) {
+        /* the unboxed elements stay unboxed if 'value' allows it */
+        arr = js_allocate_fast_array_kind(ctx, len,
+                                          js_array_kind_union(p1->array_kind,
+                                                              js_array_kind_of_values(1, &argv[1])));
+        if (JS_IsException(arr))
+            goto exception;
+        p = JS_VALUE_GET_OBJ(arr);
+        js_fast_array_copy(ctx, p, 0, p1, 0, idx);
+        js_fast_array_store(p, idx, JS_DupValue(ctx, argv[1]));
+        js_fast_array_copy(ctx, p, idx + 1, p1, idx + 1, len - idx - 1);
     } else {
+        arr = js_allocate_fast_array(ctx, len);
+        if (JS_IsException(arr))
+            goto exception;
+        p = JS_VALUE_GET_OBJ(arr);
+        i = 0;
+        pval = p->u.array.u.values;
         for (; i < idx; i++, pval++)
             if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
                 goto exception;
@@ -44246,8 +48505,7 @@ static JSValue js_array_includes(JSContext *ctx, JSValueConst this_val,
 {
     JSValue obj, val;
     int64_t len, n;
-    JSValue *arrp;
-    uint32_t count;
+    JSObject *p;
     int res;
 
     obj = JS_ToObject(ctx, this_val);
@@ -44261,9 +48519,10 @@ static JSValue js_array_includes(JSContext *ctx, JSValueConst this_val,
             if (JS_ToInt64Clamp(ctx, &n, argv[1], 0, len, len))
                 goto exception;
         }
-        if (js_get_fast_array(ctx, obj, &arrp, &count)) {
-            for (; n < count; n++) {
-                if (js_strict_eq2(ctx, argv[0], arrp[n],
+        p = js_get_fast_array_obj(obj);
+        if (p) {
+            for (; n < p->u.array.count; n++) {
+                if (js_strict_eq2(ctx, argv[0], js_fast_array_peek(p, n),
                                   JS_EQ_SAME_VALUE_ZERO)) {
                     res = TRUE;
                     goto done;
@@ -44297,8 +48556,7 @@ static JSValue js_array_indexOf(JSContext *ctx, JSValueConst this_val,
 {
     JSValue obj, val;
     int64_t len, n, res;
-    JSValue *arrp;
-    uint32_t count;
+    JSObject *p;
 
     obj = JS_ToObject(ctx, this_val);
     if (js_get_length64(ctx, &len, obj))
@@ -44311,9 +48569,11 @@ static JSValue js_array_indexOf(JSContext *ctx, JSValueConst this_val,
             if (JS_ToInt64Clamp(ctx, &n, argv[1], 0, len, len))
                 goto exception;
         }
-        if (js_get_fast_array(ctx, obj, &arrp, &count)) {
-            for (; n < count; n++) {
-                if (js_strict_eq2(ctx, argv[0], arrp[n], JS_EQ_STRICT)) {
+        p = js_get_fast_array_obj(obj);
+        if (p) {
+            for (; n < p->u.array.count; n++) {
+                if (js_strict_eq2(ctx, argv[0], js_fast_array_peek(p, n),
+                                  JS_EQ_STRICT)) {
                     res = n;
                     goto done;
                 }
@@ -44494,8 +48754,10 @@ static JSValue js_array_join(JSContext *ctx, JSValueConst this_val,
     JSValue obj, sep = JS_UNDEFINED, el;
     StringBuffer b_s, *b = &b_s;
     JSString *p = NULL;
-    int64_t i, n;
+    JSObject *arr;
+    int64_t i, n, size;
     int c;
+    BOOL all_strings;
 
     obj = JS_ToObject(ctx, this_val);
     if (js_get_length64(ctx, &n, obj))
@@ -44512,7 +48774,26 @@ static JSValue js_array_join(JSContext *ctx, JSValueConst this_val,
         else
             c = -1;
     }
-    string_buffer_init(ctx, b, 0);
+
+    /* reserve the final size from the length of the string elements.
+       If all the elements of a fast array are strings, no user code can
+       be called so they are read directly. */
+    size = 0;
+    all_strings = FALSE;
+    arr = js_get_fast_array_obj(obj);
+    if (!toLocaleString && arr && arr->u.array.count == n && n > 0) {
+        size = (n - 1) * (c >= 0 ? 1 : p->len);
+        all_strings = TRUE;
+        for(i = 0; i < n; i++) {
+            el = js_fast_array_peek(arr, i);
+            if (JS_VALUE_GET_TAG(el) == JS_TAG_STRING ||
+                JS_VALUE_GET_TAG(el) == JS_TAG_STRING_ROPE)
+                size += string_rope_get_len(el);
+            else
+                all_strings = FALSE;
+        }
+    }
+    string_buffer_init(ctx, b, min_int64(size, JS_STRING_LEN_MAX));
 
     for(i = 0; i < n; i++) {
         if (i > 0) {
@@ -44522,6 +48803,10 @@ static JSValue js_array_join(JSContext *ctx, JSValueConst this_val,
                 string_buffer_concat(b, p, 0, p->len);
             }
         }
+        if (all_strings) {
+            string_buffer_concat_value(b, js_fast_array_peek(arr, i));
+            continue;
+        }
         el = JS_GetPropertyUint32(ctx, obj, i);
         if (JS_IsException(el))
             goto fail;
@@ -44550,7 +48835,7 @@ static JSValue js_array_pop(JSContext *ctx, JSValueConst this_val,
 {
     JSValue obj, res = JS_UNDEFINED;
     int64_t len, newLen;
-    JSValue *arrp;
+    JSObject *p;
     uint32_t count32;
 
     obj = JS_ToObject(ctx, this_val);
@@ -44560,14 +48845,19 @@ static JSValue js_array_pop(JSContext *ctx, JSValueConst this_val,
     if (len > 0) {
         newLen = len - 1;
         /* Special case fast arrays */
-        if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
-            JSObject *p = JS_VALUE_GET_OBJ(obj);
+        p = js_get_fast_array_obj(obj);
+        if (p && p->u.array.count == len) {
+            /* the removed element is owned by 'res' */
+            count32 = p->u.array.count;
             if (shift) {
-                res = arrp[0];
-                memmove(arrp, arrp + 1, (count32 - 1) * sizeof(*arrp));
+                size_t elem_size = js_array_kind_size[p->array_kind];
+                res = js_fast_array_peek(p, 0);
+                memmove(p->u.array.u.uint8_ptr,
+                        p->u.array.u.uint8_ptr + elem_size,
+                        (count32 - 1) * elem_size);
                 p->u.array.count--;
             } else {
-                res = arrp[count32 - 1];
+                res = js_fast_array_peek(p, count32 - 1);
                 p->u.array.count--;
             }
         } else {
@@ -44616,12 +48906,17 @@ static JSValue js_array_push(JSContext *ctx, JSValueConst this_val,
             uint32_t new_len;
             new_len = p->u.array.count + argc;
             if (likely(new_len <= INT32_MAX)) {
+                for(i = 0; i < argc; i++) {
+                    if (unlikely(!js_array_kind_accepts(p, argv[i])) &&
+                        js_array_widen_kind(ctx, p, argv[i]))
+                        return JS_ThrowOutOfMemory(ctx);
+                }
                 if (unlikely(new_len > p->u.array.u1.size)) {
                     if (expand_fast_array(ctx, p, new_len))
                         return JS_EXCEPTION;
                 }
                 for(i = 0; i < argc; i++)
-                    p->u.array.u.values[p->u.array.count + i] = JS_DupValue(ctx, argv[i]);
+                    js_fast_array_store(p, p->u.array.count + i, JS_DupValue(ctx, argv[i]));
                 p->prop[0].u.value = JS_NewInt32(ctx, new_len);
                 p->u.array.count = new_len;
                 return JS_NewInt32(ctx, new_len);
@@ -44658,14 +48953,54 @@ static JSValue js_array_push(JSContext *ctx, JSValueConst this_val,
     return JS_EXCEPTION;
 }
 
+/* reverse the elements of a fast array in place */
+static void js_fast_array_reverse(JSObject *p)
+{
+    uint32_t l, h;
+
+    if (p->u.array.count <= 1)
+        return;
+    switch(p->array_kind) {
+    case JS_ARRAY_KIND_VALUE:
+        {
+            JSValue *tab = p->u.array.u.values, tmp;
+            for (l = 0, h = p->u.array.count - 1; l < h; l++, h--) {
+                tmp = tab[l];
+                tab[l] = tab[h];
+                tab[h] = tmp;
+            }
+        }
+        break;
+    case JS_ARRAY_KIND_INT32:
+        {
+            int32_t *tab = p->u.array.u.int32_ptr, tmp;
+            for (l = 0, h = p->u.array.count - 1; l < h; l++, h--) {
+                tmp = tab[l];
+                tab[l] = tab[h];
+                tab[h] = tmp;
+            }
+        }
+        break;
+    default:
+        {
+            double *tab = p->u.array.u.double_ptr, tmp;
+            for (l = 0, h = p->u.array.count - 1; l < h; l++, h--) {
+                tmp = tab[l];
+                tab[l] = tab[h];
+                tab[h] = tmp;
+            }
+        }
+        break;
+    }
+}
+
 static JSValue js_array_reverse(JSContext *ctx, JSValueConst this_val,
                                 int argc, JSValueConst *argv)
 {
     JSValue obj, lval, hval;
-    JSValue *arrp;
+    JSObject *p;
     int64_t len, l, h;
     int l_present, h_present;
-    uint32_t count32;
 
     lval = JS_UNDEFINED;
     obj = JS_ToObject(ctx, this_val);
@@ -44673,16 +49008,9 @@ static JSValue js_array_reverse(JSContext *ctx, JSValueConst this_val,
         goto exception;
 
     /* Special case fast arrays */
-    if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
-        uint32_t ll, hh;
-
-        if (count32 > 1) {
-            for (ll = 0, hh = count32 - 1; ll < hh; ll++, hh--) {
-                lval = arrp[ll];
-                arrp[ll] = arrp[hh];
-                arrp[hh] = lval;
-            }
-        }
+    p = js_get_fast_array_obj(obj);
+    if (p && p->u.array.count == len) {
+        js_fast_array_reverse(p);
         return obj;
     }
 
@@ -44734,10 +49062,9 @@ static JSValue js_array_reverse(JSContext *ctx, JSValueConst this_val,
 static JSValue js_array_toReversed(JSContext *ctx, JSValueConst this_val,
                                    int argc, JSValueConst *argv)
 {
-    JSValue arr, obj, ret, *arrp, *pval;
-    JSObject *p;
+    JSValue arr, obj, ret, *pval;
+    JSObject *p, *p1;
     int64_t i, len;
-    uint32_t count32;
 
     ret = JS_EXCEPTION;
     arr = JS_UNDEFINED;
@@ -44745,24 +49072,23 @@ static JSValue js_array_toReversed(JSContext *ctx, JSValueConst this_val,
     if (js_get_length64(ctx, &len, obj))
         goto exception;
 
-    arr = js_allocate_fast_array(ctx, len);
-    if (JS_IsException(arr))
-        goto exception;
-
-    if (len > 0) {
+    p1 = js_get_fast_array_obj(obj);
+    if (p1 && p1->u.array.count == len) {
+        arr = js_allocate_fast_array_kind(ctx, len, p1->array_kind);
+        if (JS_IsException(arr))
+            goto exception;
+        js_fast_array_copy(ctx, JS_VALUE_GET_OBJ(arr), 0, p1, 0, len);
+        js_fast_array_reverse(JS_VALUE_GET_OBJ(arr));
+    } else {
+        arr = js_allocate_fast_array(ctx, len);
+        if (JS_IsException(arr))
+            goto exception;
         p = JS_VALUE_GET_OBJ(arr);
-
-        i = len - 1;
         pval = p->u.array.u.values;
-        if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
-            for (; i >= 0; i--, pval++)
-                *pval = JS_DupValue(ctx, arrp[i]);
-        } else {
-            // Query order is observable; test262 expects descending order.
-            for (; i >= 0; i--, pval++) {
-                if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
-                    goto exception;
-            }
+        // Query order is observable; test262 expects descending order.
+        for (i = len - 1; i >= 0; i--, pval++) {
+            if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
+                goto exception;
         }
     }
 
@@ -44781,8 +49107,7 @@ static JSValue js_array_slice(JSContext *ctx, JSValueConst this_val,
     JSValue obj, arr, val, ctor;
     int64_t len, start, k, final, n, count;
     int kPresent;
-    JSValue *arrp;
-    uint32_t count32;
+    JSObject *p;
 
     arr = JS_UNDEFINED;
     obj = JS_ToObject(ctx, this_val);
@@ -44804,11 +49129,12 @@ static JSValue js_array_slice(JSContext *ctx, JSValueConst this_val,
         goto exception;
 
     final = start + count;
-    if (JS_IsUndefined(ctor) &&
-        js_get_fast_array(ctx, obj, &arrp, &count32) &&
-        final <= count32) {
-        /* fast case */
-        arr = js_create_array(ctx, count, (JSValueConst *)arrp + start);
+    p = js_get_fast_array_obj(obj);
+    if (JS_IsUndefined(ctor) && p && final <= p->u.array.count) {
+        /* fast case: the elements keep their kind */
+        arr = js_allocate_fast_array_kind(ctx, count, p->array_kind);
+        if (!JS_IsException(arr))
+            js_fast_array_copy(ctx, JS_VALUE_GET_OBJ(arr), 0, p, start, count);
     } else {
         arr = JS_ArrayCreateFromCtor(ctx, ctor, count);
         JS_FreeValue(ctx, ctor);
@@ -44884,39 +49210,51 @@ static JSValue js_array_splice(JSContext *ctx, JSValueConst this_val,
         p->fast_array &&
         final <= p->u.array.count &&
         (get_shape_prop(p->shape)->flags & JS_PROP_WRITABLE) && /* writable array length */
-        can_extend_fast_array(p)) {
+        can_extend_fast_array(p) &&
+        js_array_widen_kind_for_values(ctx, p, item_count, argv + 2) == 0) {
         uint32_t count32 = p->u.array.count;
-        JSValue *arrp = p->u.array.u.values;
+        size_t elem_size = js_array_kind_size[p->array_kind];
+        uint8_t *tab;
 
-        /* fast case */
-        arr = js_create_array(ctx, del_count, (JSValueConst *)arrp + start);
+        /* fast case: the elements keep their kind */
+        arr = js_allocate_fast_array_kind(ctx, del_count, p->array_kind);
         if (JS_IsException(arr))
             goto exception;
+        js_fast_array_copy(ctx, JS_VALUE_GET_OBJ(arr), 0, p, start, del_count);
 
         if (item_count != del_count) {
             /* resize */
             uint32_t new_count32;
             new_count32 = count32 + item_count - del_count;
             if (del_count > item_count) {
-                for(i = 0; i < del_count - item_count; i++)
-                    JS_FreeValue(ctx, arrp[start + item_count + i]);
-                memmove(arrp + start + item_count, arrp + final,
-                        (count32 - final) * sizeof(arrp[0]));
+                if (p->array_kind == JS_ARRAY_KIND_VALUE) {
+                    for(i = 0; i < del_count - item_count; i++)
+                        JS_FreeValue(ctx, p->u.array.u.values[start + item_count + i]);
+                }
             } else {
                 if (unlikely(new_count32 > p->u.array.u1.size)) {
                     if (expand_fast_array(ctx, p, new_count32))
                         goto exception;
-                    arrp = p->u.array.u.values;
                 }
-                memmove(arrp + start + item_count, arrp + final,
-                        (count32 - final) * sizeof(arrp[0]));
-                for(i = 0; i < item_count - del_count; i++)
-                    arrp[start + del_count + i] = JS_UNDEFINED;
+            }
+            tab = p->u.array.u.uint8_ptr;
+            memmove(tab + (start + item_count) * elem_size,
+                    tab + final * elem_size,
+                    (count32 - final) * elem_size);
+            if (p->array_kind == JS_ARRAY_KIND_VALUE) {
+                for(i = del_count; i < item_count; i++)
+                    p->u.array.u.values[start + i] = JS_UNDEFINED;
             }
             p->u.array.count = new_count32;
         }
-        for(i = 0; i < item_count; i++)
-            set_value(ctx, &arrp[start + i], JS_DupValue(ctx, argv[i + 2]));
+        if (p->array_kind == JS_ARRAY_KIND_VALUE) {
+            for(i = 0; i < item_count; i++)
+                set_value(ctx, &p->u.array.u.values[start + i],
+                          JS_DupValue(ctx, argv[i + 2]));
+        } else {
+            for(i = 0; i < item_count; i++)
+                js_fast_array_store(p, start + i, argv[i + 2]);
+        }
     } else {
         arr = JS_ArrayCreateFromCtor(ctx, ctor, del_count);
         JS_FreeValue(ctx, ctor);
@@ -44966,10 +49304,9 @@ static JSValue js_array_splice(JSContext *ctx, JSValueConst this_val,
 static JSValue js_array_toSpliced(JSContext *ctx, JSValueConst this_val,
                                   int argc, JSValueConst *argv)
 {
-    JSValue arr, obj, ret, *arrp, *pval, *last;
-    JSObject *p;
+    JSValue arr, obj, ret, *pval, *last;
+    JSObject *p, *p1;
     int64_t i, j, len, newlen, start, add, del;
-    uint32_t count32;
 
     pval = NULL;
     last = NULL;
@@ -45002,6 +49339,23 @@ static JSValue js_array_toSpliced(JSContext *ctx, JSValueConst this_val,
         goto exception;
     }
 
+    p1 = js_get_fast_array_obj(obj);
+    if (p1 && p1->u.array.count == len) {
+        /* the unboxed elements stay unboxed if the new items allow it */
+        arr = js_allocate_fast_array_kind(ctx, newlen,
+                                          js_array_kind_union(p1->array_kind,
+                                                              js_array_kind_of_values(add, argv + 2)));
+        if (JS_IsException(arr))
+            goto exception;
+        p = JS_VALUE_GET_OBJ(arr);
+        js_fast_array_copy(ctx, p, 0, p1, 0, start);
+        for (j = 0; j < add; j++)
+            js_fast_array_store(p, start + j, JS_DupValue(ctx, argv[2 + j]));
+        js_fast_array_copy(ctx, p, start + add, p1, start + del,
+                           len - start - del);
+        goto done;
+    }
+
     arr = js_allocate_fast_array(ctx, newlen);
     if (JS_IsException(arr))
         goto exception;
@@ -45013,23 +49367,14 @@ static JSValue js_array_toSpliced(JSContext *ctx, JSValueConst this_val,
     pval = &p->u.array.u.values[0];
     last = &p->u.array.u.values[newlen];
 
-    if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
-        for (i = 0; i < start; i++, pval++)
-            *pval = JS_DupValue(ctx, arrp[i]);
-        for (j = 0; j < add; j++, pval++)
-            *pval = JS_DupValue(ctx, argv[2 + j]);
-        for (i += del; i < len; i++, pval++)
-            *pval = JS_DupValue(ctx, arrp[i]);
-    } else {
-        for (i = 0; i < start; i++, pval++)
-            if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
-                goto exception;
-        for (j = 0; j < add; j++, pval++)
-            *pval = JS_DupValue(ctx, argv[2 + j]);
-        for (i += del; i < len; i++, pval++)
-            if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
-                goto exception;
-    }
+    for (i = 0; i < start; i++, pval++)
+        if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
+            goto exception;
+    for (j = 0; j < add; j++, pval++)
+        *pval = JS_DupValue(ctx, argv[2 + j]);
+    for (i += del; i < len; i++, pval++)
+        if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
+            goto exception;
 
     assert(pval == last);
 
@@ -45357,10 +49702,9 @@ fail:
 static JSValue js_array_toSorted(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv)
 {
-    JSValue arr, obj, ret, *arrp, *pval;
-    JSObject *p;
+    JSValue arr, obj, ret, *pval;
+    JSObject *p, *p1;
     int64_t i, len;
-    uint32_t count32;
     int ok;
 
     ok = JS_IsUndefined(argv[0]) || JS_IsFunction(ctx, argv[0]);
@@ -45373,22 +49717,21 @@ static JSValue js_array_toSorted(JSContext *ctx, JSValueConst this_val,
     if (js_get_length64(ctx, &len, obj))
         goto exception;
 
-    arr = js_allocate_fast_array(ctx, len);
-    if (JS_IsException(arr))
-        goto exception;
-
-    if (len > 0) {
+    p1 = js_get_fast_array_obj(obj);
+    if (p1 && p1->u.array.count == len) {
+        arr = js_allocate_fast_array_kind(ctx, len, p1->array_kind);
+        if (JS_IsException(arr))
+            goto exception;
+        js_fast_array_copy(ctx, JS_VALUE_GET_OBJ(arr), 0, p1, 0, len);
+    } else {
+        arr = js_allocate_fast_array(ctx, len);
+        if (JS_IsException(arr))
+            goto exception;
         p = JS_VALUE_GET_OBJ(arr);
-        i = 0;
         pval = p->u.array.u.values;
-        if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
-            for (; i < len; i++, pval++)
-                *pval = JS_DupValue(ctx, arrp[i]);
-        } else {
-            for (; i < len; i++, pval++) {
-                if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
-                    goto exception;
-            }
+        for (i = 0; i < len; i++, pval++) {
+            if (-1 == JS_TryGetPropertyInt64(ctx, obj, i, pval))
+                goto exception;
         }
     }
 
@@ -47434,27 +51777,173 @@ static JSValue js_string_at(JSContext *ctx, JSValueConst this_val,
     return ret;
 }
 
+/* Note: also used for the template literals. Short results are built
+   in a single buffer of the final size. Longer ones are concatenated
+   with ropes so that building a large string incrementally does not
+   copy it each time. */
 static JSValue js_string_concat(JSContext *ctx, JSValueConst this_val,
                                 int argc, JSValueConst *argv)
 {
-    JSValue r;
+    StringBuffer b_s, *b = &b_s;
+    JSValue r, *tab;
+    int64_t len;
     int i;
 
-    /* XXX: Use more efficient method */
-    /* XXX: This method is OK if r has a single refcount */
-    /* XXX: should use string_buffer? */
-    r = JS_ToStringCheckObject(ctx, this_val);
+    if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING_ROPE)
+        r = JS_DupValue(ctx, this_val);
+    else
+        r = JS_ToStringCheckObject(ctx, this_val);
+    if (JS_IsException(r) || argc == 0)
+        return r;
+
+    if (js_check_stack_overflow(ctx->rt, sizeof(tab[0]) * (argc + 1))) {
+        JS_FreeValue(ctx, r);
+        return JS_ThrowStackOverflow(ctx);
+    }
+    tab = alloca(sizeof(tab[0]) * (argc + 1));
+    tab[0] = r;
+    len = string_rope_get_len(r);
     for (i = 0; i < argc; i++) {
-        if (JS_IsException(r))
-            break;
-        r = JS_ConcatString(ctx, r, JS_DupValue(ctx, argv[i]));
+        if (JS_VALUE_GET_TAG(argv[i]) == JS_TAG_STRING_ROPE)
+            r = JS_DupValue(ctx, argv[i]);
+        else
+            r = JS_ToString(ctx, argv[i]);
+        if (JS_IsException(r)) {
+            while (i >= 0)
+                JS_FreeValue(ctx, tab[i--]);
+            return JS_EXCEPTION;
+        }
+        tab[i + 1] = r;
+        len += string_rope_get_len(r);
+    }
+
+    if (len <= JS_STRING_ROPE_SHORT2_LEN) {
+        string_buffer_init(ctx, b, len);
+        for (i = 0; i <= argc; i++) {
+            string_buffer_concat_value(b, tab[i]);
+            JS_FreeValue(ctx, tab[i]);
+        }
+        return string_buffer_end(b);
+    } else {
+        r = tab[0];
+        for (i = 1; i <= argc; i++) {
+            r = JS_ConcatString(ctx, r, tab[i]);
+            if (JS_IsException(r)) {
+                while (++i <= argc)
+                    JS_FreeValue(ctx, tab[i]);
+                break;
+            }
+        }
+        return r;
+    }
+}
+
+/* Vector helpers for the string functions. js_vec_mask()
+   returns a mask with (1 << JS_VEC_MASK_SHIFT) bits set for each byte
+   which compared equal. JS_VEC_LANE8_BITS and JS_VEC_LANE16_BITS keep
+   one bit per 8 bit or 16 bit lane. js_vec_gt8() is a signed
+   comparison. */
+#if defined(__AVX2__)
+#define JS_VEC_SIZE 32
+#define JS_VEC_MASK_SHIFT 0
+#define JS_VEC_LANE8_BITS  UINT64_C(0x00000000ffffffff)
+#define JS_VEC_LANE16_BITS UINT64_C(0x0000000055555555)
+typedef __m256i JSVec;
+static inline JSVec js_vec_load(const void *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void js_vec_store(void *p, JSVec a) { _mm256_storeu_si256((__m256i *)p, a); }
+static inline JSVec js_vec_splat8(int c) { return _mm256_set1_epi8((char)c); }
+static inline JSVec js_vec_splat16(int c) { return _mm256_set1_epi16((short)c); }
+static inline JSVec js_vec_eq8(JSVec a, JSVec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline JSVec js_vec_eq16(JSVec a, JSVec b) { return _mm256_cmpeq_epi16(a, b); }
+static inline JSVec js_vec_gt8(JSVec a, JSVec b) { return _mm256_cmpgt_epi8(a, b); }
+static inline JSVec js_vec_and(JSVec a, JSVec b) { return _mm256_and_si256(a, b); }
+static inline JSVec js_vec_xor(JSVec a, JSVec b) { return _mm256_xor_si256(a, b); }
+static inline uint64_t js_vec_mask(JSVec a) { return (uint32_t)_mm256_movemask_epi8(a); }
+#elif defined(__SSE2__)
+#define JS_VEC_SIZE 16
+#define JS_VEC_MASK_SHIFT 0
+#define JS_VEC_LANE8_BITS  UINT64_C(0x000000000000ffff)
+#define JS_VEC_LANE16_BITS UINT64_C(0x0000000000005555)
+typedef __m128i JSVec;
+static inline JSVec js_vec_load(const void *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void js_vec_store(void *p, JSVec a) { _mm_storeu_si128((__m128i *)p, a); }
+static inline JSVec js_vec_splat8(int c) { return _mm_set1_epi8((char)c); }
+static inline JSVec js_vec_splat16(int c) { return _mm_set1_epi16((short)c); }
+static inline JSVec js_vec_eq8(JSVec a, JSVec b) { return _mm_cmpeq_epi8(a, b); }
+static inline JSVec js_vec_eq16(JSVec a, JSVec b) { return _mm_cmpeq_epi16(a, b); }
+static inline JSVec js_vec_gt8(JSVec a, JSVec b) { return _mm_cmpgt_epi8(a, b); }
+static inline JSVec js_vec_and(JSVec a, JSVec b) { return _mm_and_si128(a, b); }
+static inline JSVec js_vec_xor(JSVec a, JSVec b) { return _mm_xor_si128(a, b); }
+static inline uint64_t js_vec_mask(JSVec a) { return (uint32_t)_mm_movemask_epi8(a); }
+#elif defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+#define JS_VEC_SIZE 16
+#define JS_VEC_MASK_SHIFT 2
+#define JS_VEC_LANE8_BITS  UINT64_C(0x1111111111111111)
+#define JS_VEC_LANE16_BITS UINT64_C(0x0101010101010101)
+typedef uint8x16_t JSVec;
+static inline JSVec js_vec_load(const void *p) { return vld1q_u8((const uint8_t *)p); }
+static inline void js_vec_store(void *p, JSVec a) { vst1q_u8((uint8_t *)p, a); }
+static inline JSVec js_vec_splat8(int c) { return vdupq_n_u8(c); }
+static inline JSVec js_vec_splat16(int c) { return vreinterpretq_u8_u16(vdupq_n_u16(c)); }
+static inline JSVec js_vec_eq8(JSVec a, JSVec b) { return vceqq_u8(a, b); }
+static inline JSVec js_vec_eq16(JSVec a, JSVec b)
+{
+    return vreinterpretq_u8_u16(vceqq_u16(vreinterpretq_u16_u8(a),
+                                          vreinterpretq_u16_u8(b)));
+}
+static inline JSVec js_vec_gt8(JSVec a, JSVec b)
+{
+    return vcgtq_s8(vreinterpretq_s8_u8(a), vreinterpretq_s8_u8(b));
+}
+static inline JSVec js_vec_and(JSVec a, JSVec b) { return vandq_u8(a, b); }
+static inline JSVec js_vec_xor(JSVec a, JSVec b) { return veorq_u8(a, b); }
+static inline uint64_t js_vec_mask(JSVec a)
+{
+    /* 4 bits per byte */
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(a), 4)), 0);
+}
+#endif
+
+#ifdef JS_VEC_SIZE
+/* return a mask with one bit per position i..i+n-1 (n = JS_VEC_SIZE
+   for 8 bit strings, JS_VEC_SIZE / 2 for 16 bit strings) where 'vc1'
+   matches and 'vc2' matches 'gap' characters further. */
+static inline uint64_t string_vec_match2(JSString *p, int i, int gap,
+                                         JSVec vc1, JSVec vc2)
+{
+    if (p->is_wide_char) {
+        const uint16_t *h = p->u.str16 + i;
+        return js_vec_mask(js_vec_and(js_vec_eq16(js_vec_load(h), vc1),
+                                      js_vec_eq16(js_vec_load(h + gap), vc2))) &
+            JS_VEC_LANE16_BITS;
+    } else {
+        const uint8_t *h = p->u.str8 + i;
+        return js_vec_mask(js_vec_and(js_vec_eq8(js_vec_load(h), vc1),
+                                      js_vec_eq8(js_vec_load(h + gap), vc2))) &
+            JS_VEC_LANE8_BITS;
     }
-    return r;
 }
 
+static inline JSVec string_vec_splat(JSString *p, int c)
+{
+    return p->is_wide_char ? js_vec_splat16(c) : js_vec_splat8(c);
+}
+#endif
+
 static int string_cmp(JSString *p1, JSString *p2, int x1, int x2, int len)
 {
     int i, c1, c2;
+    if (len <= 0)
+        return 0;
+    if (p1->is_wide_char == p2->is_wide_char) {
+        /* fast path for the equality test */
+        if (p1->is_wide_char) {
+            if (!memcmp(p1->u.str16 + x1, p2->u.str16 + x2, len * 2))
+                return 0;
+        } else {
+            return memcmp(p1->u.str8 + x1, p2->u.str8 + x2, len);
+        }
+    }
     for (i = 0; i < len; i++) {
         if ((c1 = string_get(p1, x1 + i)) != (c2 = string_get(p2, x2 + i)))
             return c1 - c2;
@@ -47467,33 +51956,220 @@ static int string_indexof_char(JSString *p, int c, int from)
     /* assuming 0 <= from <= p->len */
     int i, len = p->len;
     if (p->is_wide_char) {
-        for (i = from; i < len; i++) {
-            if (p->u.str16[i] == c)
+        const uint16_t *tab = p->u.str16;
+        i = from;
+#ifdef JS_VEC_SIZE
+        {
+            JSVec vc = js_vec_splat16(c);
+            uint64_t m;
+            for (; i + JS_VEC_SIZE / 2 <= len; i += JS_VEC_SIZE / 2) {
+                m = js_vec_mask(js_vec_eq16(js_vec_load(tab + i), vc));
+                if (m != 0)
+                    return i + (ctz64(m) >> (JS_VEC_MASK_SHIFT + 1));
+            }
+        }
+#endif
+        for (; i < len; i++) {
+            if (tab[i] == c)
                 return i;
         }
     } else {
-        if ((c & ~0xff) == 0) {
-            for (i = from; i < len; i++) {
-                if (p->u.str8[i] == (uint8_t)c)
-                    return i;
+        if ((c & ~0xff) == 0 && from < len) {
+            /* memchr() is vectorized by the C library */
+            const uint8_t *q = memchr(p->u.str8 + from, c, len - from);
+            if (q)
+                return q - p->u.str8;
+        }
+    }
+    return -1;
+}
+
+/* Two-way string matching (Crochemore-Perrin). It runs in linear time
+   and is used when the character filter of string_indexof() produces
+   too many false positives, e.g. with long repetitive needles. */
+static int string_indexof_twoway(JSString *p1, JSString *p2, int from)
+{
+    int len1 = p1->len, l = p2->len;
+    int ip, jp, k, p, p0, ms, mem, mem0, h, a, b;
+
+    /* critical factorization: maximal suffix for both orderings */
+    ip = -1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        a = string_get(p2, ip + k);
+        b = string_get(p2, jp + k);
+        if (a == b) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (a > b) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    ms = ip;
+    p0 = p;
+
+    ip = -1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        a = string_get(p2, ip + k);
+        b = string_get(p2, jp + k);
+        if (a == b) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
             }
+        } else if (a < b) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
         }
     }
+    if (ip > ms)
+        ms = ip;
+    else
+        p = p0;
+
+    if (string_cmp(p2, p2, 0, p, ms + 1)) {
+        /* not periodic */
+        mem0 = 0;
+        p = max_int(ms, l - ms - 1) + 1;
+    } else {
+        mem0 = l - p;
+    }
+
+    mem = 0;
+    for (h = from; h + l <= len1;) {
+        /* right half */
+        for (k = max_int(ms + 1, mem);
+             k < l && string_get(p2, k) == string_get(p1, h + k); k++)
+            continue;
+        if (k < l) {
+            h += k - ms;
+            mem = 0;
+            continue;
+        }
+        /* left half */
+        for (k = ms + 1; k > mem && string_get(p2, k - 1) == string_get(p1, h + k - 1); k--)
+            continue;
+        if (k <= mem)
+            return h;
+        h += p;
+        mem = mem0;
+    }
     return -1;
 }
 
+/* above this number of false positives (scaled by the scanned length),
+   string_indexof() switches to the two-way algorithm */
+#define STRING_INDEXOF_MAX_MISSES 64
+
 static int string_indexof(JSString *p1, JSString *p2, int from)
 {
     /* assuming 0 <= from <= p1->len */
-    int c, i, j, len1 = p1->len, len2 = p2->len;
+    int c1, c2, i, last, misses, len1 = p1->len, len2 = p2->len;
+
     if (len2 == 0)
         return from;
-    for (i = from, c = string_get(p2, 0); i + len2 <= len1; i = j + 1) {
-        j = string_indexof_char(p1, c, i);
-        if (j < 0 || j + len2 > len1)
-            break;
-        if (!string_cmp(p1, p2, j + 1, 1, len2 - 1))
-            return j;
+    last = len1 - len2; /* last candidate position */
+    if (from > last)
+        return -1;
+    c1 = string_get(p2, 0);
+    if (len2 == 1)
+        return string_indexof_char(p1, c1, from);
+    c2 = string_get(p2, len2 - 1);
+    if (!p1->is_wide_char && (c1 | c2) > 0xff)
+        return -1;
+
+    /* only the positions where the first and last characters match are
+       compared */
+    i = from;
+    misses = 0;
+#ifdef JS_VEC_SIZE
+    {
+        int n = JS_VEC_SIZE >> p1->is_wide_char;
+        int shift = JS_VEC_MASK_SHIFT + p1->is_wide_char;
+        JSVec vc1 = string_vec_splat(p1, c1);
+        JSVec vc2 = string_vec_splat(p1, c2);
+        uint64_t m;
+        int k;
+        for (; i + n - 1 <= last; i += n) {
+            m = string_vec_match2(p1, i, len2 - 1, vc1, vc2);
+            while (m != 0) {
+                k = i + (ctz64(m) >> shift);
+                if (!string_cmp(p1, p2, k + 1, 1, len2 - 2))
+                    return k;
+                if (++misses > STRING_INDEXOF_MAX_MISSES + ((k - from) >> 4))
+                    return string_indexof_twoway(p1, p2, k + 1);
+                m &= m - 1;
+            }
+        }
+    }
+#endif
+    for (; i <= last; i++) {
+        if (string_get(p1, i) == c1 && string_get(p1, i + len2 - 1) == c2) {
+            if (!string_cmp(p1, p2, i + 1, 1, len2 - 2))
+                return i;
+            if (++misses > STRING_INDEXOF_MAX_MISSES + ((i - from) >> 4))
+                return string_indexof_twoway(p1, p2, i + 1);
+        }
+    }
+    return -1;
+}
+
+/* return the last position <= from of p2 in p1 or -1 */
+static int string_lastindexof(JSString *p1, JSString *p2, int from)
+{
+    /* assuming 0 <= from <= p1->len - p2->len */
+    int c1, c2, i, len2 = p2->len;
+
+    if (len2 == 0)
+        return from;
+    c1 = string_get(p2, 0);
+    c2 = string_get(p2, len2 - 1);
+    if (!p1->is_wide_char && (c1 | c2) > 0xff)
+        return -1;
+
+    i = from;
+#ifdef JS_VEC_SIZE
+    {
+        int n = JS_VEC_SIZE >> p1->is_wide_char;
+        int shift = JS_VEC_MASK_SHIFT + p1->is_wide_char;
+        JSVec vc1 = string_vec_splat(p1, c1);
+        JSVec vc2 = string_vec_splat(p1, c2);
+        uint64_t m;
+        int k;
+        for (; i >= n - 1; i -= n) {
+            m = string_vec_match2(p1, i - (n - 1), len2 - 1, vc1, vc2);
+            while (m != 0) {
+                k = 63 - clz64(m);
+                m &= ~((uint64_t)1 << k);
+                k = i - (n - 1) + (k >> shift);
+                if (!string_cmp(p1, p2, k + 1, 1, len2 - 2))
+                    return k;
+            }
+        }
+    }
+#endif
+    for (; i >= 0; i--) {
+        if (string_get(p1, i) == c1 && string_get(p1, i + len2 - 1) == c2 &&
+            !string_cmp(p1, p2, i + 1, 1, len2 - 2))
+            return i;
     }
     return -1;
 }
@@ -47588,7 +52264,7 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv, int lastIndexOf)
 {
     JSValue str, v;
-    int i, len, v_len, pos, start, stop, ret, inc;
+    int len, v_len, pos, start, stop, ret, inc;
     JSString *p;
     JSString *p1;
 
@@ -47630,14 +52306,10 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
     }
     ret = -1;
     if (len >= v_len && inc * (stop - start) >= 0) {
-        for (i = start;; i += inc) {
-            if (!string_cmp(p, p1, i, 0, v_len)) {
-                ret = i;
-                break;
-            }
-            if (i == stop)
-                break;
-        }
+        if (lastIndexOf)
+            ret = string_lastindexof(p, p1, start);
+        else
+            ret = string_indexof(p, p1, start);
     }
     JS_FreeValue(ctx, str);
     JS_FreeValue(ctx, v);
@@ -47656,7 +52328,7 @@ static JSValue js_string_includes(JSContext *ctx, JSValueConst this_val,
                                   int argc, JSValueConst *argv, int magic)
 {
     JSValue str, v = JS_UNDEFINED;
-    int i, len, v_len, pos, start, stop, ret;
+    int len, v_len, pos, start, stop, ret;
     JSString *p;
     JSString *p1;
 
@@ -47696,14 +52368,10 @@ static JSValue js_string_includes(JSContext *ctx, JSValueConst this_val,
         start = stop = pos;
     }
     if (start >= 0 && start <= stop) {
-        for (i = start;; i++) {
-            if (!string_cmp(p, p1, i, 0, v_len)) {
-                ret = 1;
-                break;
-            }
-            if (i == stop)
-                break;
-        }
+        if (magic == 0)
+            ret = (string_indexof(p, p1, start) >= 0);
+        else
+            ret = !string_cmp(p, p1, start, 0, v_len);
     }
  done:
     JS_FreeValue(ctx, str);
@@ -47771,6 +52439,8 @@ static JSValue js_string_match(JSContext *ctx, JSValueConst this_val,
             return JS_CallFree(ctx, matcher, regexp, 1, &O);
         }
     }
+    if (js_init_lazy_intrinsic(ctx, JS_LAZY_INTRINSIC_REGEXP))
+        return JS_EXCEPTION;
     S = JS_ToString(ctx, O);
     if (JS_IsException(S))
         return JS_EXCEPTION;
@@ -48338,13 +53008,24 @@ static JSValue js_string_trim(JSContext *ctx, JSValueConst this_val,
     p = JS_VALUE_GET_STRING(str);
     a = 0;
     b = len = p->len;
-    if (magic & 1) {
-        while (a < len && lre_is_space(string_get(p, a)))
-            a++;
-    }
-    if (magic & 2) {
-        while (b > a && lre_is_space(string_get(p, b - 1)))
-            b--;
+    if (!p->is_wide_char) {
+        if (magic & 1) {
+            while (a < len && lre_is_space_byte(p->u.str8[a]))
+                a++;
+        }
+        if (magic & 2) {
+            while (b > a && lre_is_space_byte(p->u.str8[b - 1]))
+                b--;
+        }
+    } else {
+        if (magic & 1) {
+            while (a < len && lre_is_space(p->u.str16[a]))
+                a++;
+        }
+        if (magic & 2) {
+            while (b > a && lre_is_space(p->u.str16[b - 1]))
+                b--;
+        }
     }
     ret = js_sub_string(ctx, p, a, b);
     JS_FreeValue(ctx, str);
@@ -48404,12 +53085,81 @@ static BOOL test_final_sigma(JSString *p, int sigma_pos)
     return !lre_is_cased(c1);
 }
 
+/* return the length of the ASCII prefix of buf[0..len-1] */
+static int js_ascii_prefix_len(const uint8_t *buf, int len)
+{
+    int i = 0;
+#ifdef JS_VEC_SIZE
+    {
+        JSVec zero = js_vec_splat8(0);
+        uint64_t m;
+        for (; i + JS_VEC_SIZE <= len; i += JS_VEC_SIZE) {
+            m = js_vec_mask(js_vec_gt8(zero, js_vec_load(buf + i)));
+            if (m != 0)
+                return i + (ctz64(m) >> JS_VEC_MASK_SHIFT);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (buf[i] >= 0x80)
+            break;
+    }
+    return i;
+}
+
+/* return the position of the first ASCII letter of buf[0..len-1] which
+   changes when converted to lower (to_lower = TRUE) or upper case, or
+   len if none */
+static int js_ascii_case_find(const uint8_t *buf, int len, BOOL to_lower)
+{
+    int i = 0, first = to_lower ? 'A' : 'a';
+#ifdef JS_VEC_SIZE
+    {
+        JSVec vlo = js_vec_splat8(first - 1), vhi = js_vec_splat8(first + 26);
+        JSVec a;
+        uint64_t m;
+        for (; i + JS_VEC_SIZE <= len; i += JS_VEC_SIZE) {
+            a = js_vec_load(buf + i);
+            m = js_vec_mask(js_vec_and(js_vec_gt8(a, vlo), js_vec_gt8(vhi, a)));
+            if (m != 0)
+                return i + (ctz64(m) >> JS_VEC_MASK_SHIFT);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if ((unsigned)(buf[i] - first) < 26)
+            break;
+    }
+    return i;
+}
+
+/* convert the ASCII characters src[0..len-1] to lower or upper case */
+static void js_ascii_case_conv(uint8_t *dst, const uint8_t *src, int len,
+                               BOOL to_lower)
+{
+    int i = 0, first = to_lower ? 'A' : 'a';
+#ifdef JS_VEC_SIZE
+    {
+        JSVec vlo = js_vec_splat8(first - 1), vhi = js_vec_splat8(first + 26);
+        JSVec vbit = js_vec_splat8(0x20);
+        JSVec a, in;
+        for (; i + JS_VEC_SIZE <= len; i += JS_VEC_SIZE) {
+            a = js_vec_load(src + i);
+            in = js_vec_and(js_vec_gt8(a, vlo), js_vec_gt8(vhi, a));
+            js_vec_store(dst + i, js_vec_xor(a, js_vec_and(in, vbit)));
+        }
+    }
+#endif
+    for (; i < len; i++)
+        dst[i] = src[i] ^ (((unsigned)(src[i] - first) < 26) << 5);
+}
+
 static JSValue js_string_toLowerCase(JSContext *ctx, JSValueConst this_val,
                                      int argc, JSValueConst *argv, int to_lower)
 {
     JSValue val;
     StringBuffer b_s, *b = &b_s;
-    JSString *p;
+    JSString *p, *str;
     int i, c, j, l;
     uint32_t res[LRE_CC_RES_LEN_MAX];
 
@@ -48419,6 +53169,25 @@ static JSValue js_string_toLowerCase(JSContext *ctx, JSValueConst this_val,
     p = JS_VALUE_GET_STRING(val);
     if (p->len == 0)
         return val;
+    if (!p->is_wide_char &&
+        js_ascii_prefix_len(p->u.str8, p->len) == p->len) {
+        /* ASCII string: no special casing, the string is returned
+           unchanged if it has no letter to convert */
+        i = js_ascii_case_find(p->u.str8, p->len, to_lower);
+        if (i == p->len)
+            return val;
+        str = js_alloc_string(ctx, p->len, 0);
+        if (!str) {
+            JS_FreeValue(ctx, val);
+            return JS_EXCEPTION;
+        }
+        memcpy(str->u.str8, p->u.str8, i);
+        js_ascii_case_conv(str->u.str8 + i, p->u.str8 + i, p->len - i,
+                           to_lower);
+        str->u.str8[p->len] = '\0';
+        JS_FreeValue(ctx, val);
+        return JS_MKPTR(JS_TAG_STRING, str);
+    }
     if (string_buffer_init(ctx, b, p->len))
         goto fail;
     for(i = 0; i < p->len;) {
@@ -48516,6 +53285,7 @@ static JSValue js_string_normalize(JSContext *ctx, JSValueConst this_val,
     int is_compat, out_len;
     UnicodeNormalizationEnum n_type;
     JSValue val;
+    JSString *p1;
     uint32_t *out_buf;
 
     val = JS_ToStringCheckObject(ctx, this_val);
@@ -48552,6 +53322,12 @@ static JSValue js_string_normalize(JSContext *ctx, JSValueConst this_val,
         JS_FreeCString(ctx, form);
     }
 
+    /* ASCII strings are invariant in all the normalization forms */
+    p1 = JS_VALUE_GET_STRING(val);
+    if (!p1->is_wide_char &&
+        js_ascii_prefix_len(p1->u.str8, p1->len) == p1->len)
+        return val;
+
     out_len = js_string_normalize1(ctx, &out_buf, val, n_type);
     JS_FreeValue(ctx, val);
     if (out_len < 0)
@@ -49567,6 +54343,10 @@ static JSValue JS_NewRegexp(JSContext *ctx, JSValue pattern, JSValue bc)
         JS_ThrowTypeError(ctx, "<internal>/quickjs.c", __LINE__, "string expected");
         goto fail;
     }
+    if (unlikely(!ctx->regexp_shape)) {
+        if (js_init_lazy_intrinsic(ctx, JS_LAZY_INTRINSIC_REGEXP))
+            goto fail;
+    }
     props[0].u.value = JS_NewInt32(ctx, 0); /* lastIndex */
     obj = JS_NewObjectFromShape(ctx, js_dup_shape(ctx->regexp_shape), JS_CLASS_REGEXP, props);
     if (JS_IsException(obj))
@@ -51175,18 +55955,16 @@ void JS_AddIntrinsicRegExpCompiler(JSContext *ctx)
     ctx->compile_regexp = js_compile_regexp;
 }
 
-int JS_AddIntrinsicRegExp(JSContext *ctx)
+static int JS_InitIntrinsicRegExp(JSContext *ctx)
 {
     JSValue obj;
 
-    JS_AddIntrinsicRegExpCompiler(ctx);
-
     obj = JS_NewCConstructor(ctx, JS_CLASS_REGEXP, "RegExp",
                                     js_regexp_constructor, 2, JS_CFUNC_constructor_or_func, 0,
                                     JS_UNDEFINED,
                                     js_regexp_funcs, countof(js_regexp_funcs),
                                     js_regexp_proto_funcs, countof(js_regexp_proto_funcs),
-                                    0);
+                                    JS_NEW_CTOR_LAZY_GLOBAL);
     if (JS_IsException(obj))
         return -1;
     ctx->regexp_ctor = obj;
@@ -51226,6 +56004,12 @@ int JS_AddIntrinsicRegExp(JSContext *ctx)
     return 0;
 }
 
+int JS_AddIntrinsicRegExp(JSContext *ctx)
+{
+    JS_AddIntrinsicRegExpCompiler(ctx);
+    return js_add_lazy_intrinsic(ctx, JS_LAZY_INTRINSIC_REGEXP);
+}
+
 /* JSON */
 
 static int json_parse_expect(JSParseState *s, int tok)
@@ -53694,19 +58478,14 @@ static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
     s = js_mallocz(ctx, sizeof(*s));
     if (!s)
         goto fail;
-    init_list_head(&s->records);
+    init_list_head(&s->cursors);
     s->is_weak = is_weak;
     if (is_weak) {
         s->weakref_header.weakref_type = JS_WEAKREF_TYPE_MAP;
         list_add_tail(&s->weakref_header.link, &ctx->rt->weakref_list);
     }
     JS_SetOpaque(obj, s);
-    s->hash_bits = 1;
-    s->hash_size = 1U << s->hash_bits;
-    s->hash_table = js_mallocz(ctx, sizeof(s->hash_table[0]) * s->hash_size);
-    if (!s->hash_table)
-        goto fail;
-    s->record_count_threshold = 4;
+    /* the records and the hash table are allocated with the first record */
 
     arr = JS_UNDEFINED;
     if (argc > 0)
@@ -53802,6 +58581,22 @@ static JSValue map_normalize_key(JSContext *ctx, JSValue key)
 
 static JSValueConst map_normalize_key_const(JSContext *ctx, JSValueConst key)
 {
+    if (JS_VALUE_GET_TAG(key) == JS_TAG_STRING_ROPE) {
+        JSStringRope *r = JS_VALUE_GET_STRING_ROPE(key);
+        JSValue str;
+        /* the rope is linearized in place so that its hash can be cached
+           and the linear string is used as key */
+        str = js_linearize_string_rope(ctx, JS_DupValue(ctx, key));
+        if (JS_IsException(str)) {
+            /* not fatal: use the rope */
+            JS_FreeValue(ctx, JS_GetException(ctx));
+            return key;
+        }
+        JS_FreeValue(ctx, str);
+        if (JS_VALUE_GET_TAG(r->left) == JS_TAG_STRING)
+            return r->left;
+        return key;
+    }
     return (JSValueConst)map_normalize_key(ctx, (JSValue)key);
 }
 
@@ -53829,6 +58624,24 @@ static uint32_t map_hash_pointer(uintptr_t a, int hash_bits)
 #endif
 }
 
+/* Hash of the strings used as keys. It is the atom hash, so it is
+   directly available for atoms. For the other strings, it is cached in
+   the otherwise unused 'hash' field at the first lookup (0 = not
+   computed yet) so that repeated lookups with the same string do not
+   rehash it. */
+static uint32_t map_hash_string(JSString *p)
+{
+    uint32_t h;
+
+    if (p->atom_type == JS_ATOM_TYPE_STRING ||
+        (p->atom_type == 0 && p->hash != 0))
+        return p->hash;
+    h = hash_string(p, JS_ATOM_TYPE_STRING) & JS_ATOM_HASH_MASK;
+    if (p->atom_type == 0)
+        p->hash = h;
+    return h;
+}
+
 /* XXX: better hash ? */
 /* precondition: 1 <= hash_bits <= 32 */
 static uint32_t map_hash_key(JSValueConst key, int hash_bits)
@@ -53844,10 +58657,11 @@ static uint32_t map_hash_key(JSValueConst key, int hash_bits)
         h = map_hash32(JS_VALUE_GET_INT(key) ^ JS_TAG_BOOL, hash_bits);
         break;
     case JS_TAG_STRING:
-        h = map_hash32(hash_string(JS_VALUE_GET_STRING(key), 0) ^ JS_TAG_STRING, hash_bits);
+        h = map_hash32(map_hash_string(JS_VALUE_GET_STRING(key)) ^ JS_TAG_STRING, hash_bits);
         break;
     case JS_TAG_STRING_ROPE:
-        h = map_hash32(hash_string_rope(key, 0) ^ JS_TAG_STRING, hash_bits);
+        h = map_hash32((hash_string_rope(key, JS_ATOM_TYPE_STRING) &
+                        JS_ATOM_HASH_MASK) ^ JS_TAG_STRING, hash_bits);
         break;
     case JS_TAG_OBJECT:
     case JS_TAG_SYMBOL:
@@ -53892,10 +58706,16 @@ static JSMapRecord *map_find_record(JSContext *ctx, JSMapState *s,
                                     JSValueConst key)
 {
     JSMapRecord *mr;
-    uint32_t h;
-    h = map_hash_key(key, s->hash_bits);
-    for(mr = s->hash_table[h]; mr != NULL; mr = mr->hash_next) {
-        if (mr->empty || (s->is_weak && !js_weakref_is_live(mr->key))) {
+    uint32_t h, i;
+
+    if (!s->hash_table)
+        return NULL;
+    h = map_hash_key(key, 32);
+    for(i = s->hash_table[h >> (32 - s->hash_bits)]; i != MAP_RECORD_NONE;
+        i = mr->hash_next) {
+        mr = &s->records[i];
+        if (mr->hash != h || map_record_is_empty(mr) ||
+            (s->is_weak && !js_weakref_is_live(mr->key))) {
             /* cannot match */
         } else {
             if (js_same_value_zero(ctx, mr->key, key))
@@ -53905,139 +58725,133 @@ static JSMapRecord *map_find_record(JSContext *ctx, JSMapState *s,
     return NULL;
 }
 
-static void map_hash_resize(JSContext *ctx, JSMapState *s)
+/* Move the live records to a new array of 'new_size' records (a power
+   of two) and rebuild the hash table, which is stored in the same
+   allocation. The cursors are updated so that they point to the same
+   records. Return -1 if there is not enough memory. */
+static int map_rehash(JSRuntime *rt, JSMapState *s, uint32_t new_size)
 {
-    uint32_t new_hash_size, h;
+    JSMapRecord *new_records, *mr;
+    uint32_t *new_hash_table, new_hash_size, i, j, h;
     int new_hash_bits;
     struct list_head *el;
-    JSMapRecord *mr, **new_hash_table;
 
-    /* XXX: no reporting of memory allocation failure */
-    new_hash_bits = min_int(s->hash_bits + 1, 31);
+    new_hash_bits = ctz32(new_size) - 1;
     new_hash_size = 1U << new_hash_bits;
-    new_hash_table = js_realloc(ctx, s->hash_table,
-                                sizeof(new_hash_table[0]) * new_hash_size);
-    if (!new_hash_table)
-        return;
-
-    memset(new_hash_table, 0, sizeof(new_hash_table[0]) * new_hash_size);
+    new_records = js_malloc_rt(rt, sizeof(new_records[0]) * new_size +
+                               sizeof(new_hash_table[0]) * new_hash_size);
+    if (!new_records)
+        return -1;
+    new_hash_table = (uint32_t *)(new_records + new_size);
+    for(i = 0; i < new_hash_size; i++)
+        new_hash_table[i] = MAP_RECORD_NONE;
 
-    list_for_each(el, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (mr->empty || (s->is_weak && !js_weakref_is_live(mr->key))) {
-        } else {
-            h = map_hash_key(mr->key, new_hash_bits);
-            mr->hash_next = new_hash_table[h];
-            new_hash_table[h] = mr;
-        }
+    list_for_each(el, &s->cursors) {
+        JSMapCursor *c = list_entry(el, JSMapCursor, link);
+        j = 0;
+        for(i = 0; i < c->pos; i++)
+            j += !map_record_is_empty(&s->records[i]);
+        c->pos = j;
     }
+
+    j = 0;
+    for(i = 0; i < s->record_end; i++) {
+        mr = &s->records[i];
+        if (map_record_is_empty(mr))
+            continue;
+        h = mr->hash >> (32 - new_hash_bits);
+        new_records[j] = *mr;
+        new_records[j].hash_next = new_hash_table[h];
+        new_hash_table[h] = j;
+        j++;
+    }
+    js_free_rt(rt, s->records);
+    s->records = new_records;
+    s->record_end = j;
+    s->record_size = new_size;
     s->hash_table = new_hash_table;
     s->hash_bits = new_hash_bits;
     s->hash_size = new_hash_size;
-    s->record_count_threshold = new_hash_size * 2;
+    return 0;
 }
 
+/* the value of the new record is JS_UNDEFINED. The returned pointer is
+   only valid until the next record is added. */
 static JSMapRecord *map_add_record(JSContext *ctx, JSMapState *s,
                                    JSValueConst key)
 {
-    uint32_t h;
+    uint32_t h, new_size;
     JSMapRecord *mr;
 
-    mr = js_malloc(ctx, sizeof(*mr));
-    if (!mr)
-        return NULL;
-    mr->ref_count = 1;
-    mr->empty = FALSE;
+    if (s->record_end >= s->record_size) {
+        /* compact in place if at least half of the records are
+           deleted, otherwise grow */
+        if (s->record_size != 0 && s->record_count <= s->record_size / 2) {
+            new_size = s->record_size;
+        } else {
+            new_size = max_uint32(s->record_size * 2, MAP_MIN_RECORD_SIZE);
+            if (new_size > MAP_MAX_RECORD_SIZE) {
+                JS_ThrowRangeError(ctx, "<internal>/quickjs.c", __LINE__, "too many elements");
+                return NULL;
+            }
+        }
+        if (map_rehash(ctx->rt, s, new_size)) {
+            JS_ThrowOutOfMemory(ctx);
+            return NULL;
+        }
+    }
+    h = map_hash_key(key, 32);
+    mr = &s->records[s->record_end];
     if (s->is_weak) {
         mr->key = js_weakref_new(ctx, key);
     } else {
         mr->key = JS_DupValue(ctx, key);
     }
-    h = map_hash_key(key, s->hash_bits);
+    mr->value = JS_UNDEFINED;
+    mr->hash = h;
+    h >>= 32 - s->hash_bits;
     mr->hash_next = s->hash_table[h];
-    s->hash_table[h] = mr;
-    list_add_tail(&mr->link, &s->records);
+    s->hash_table[h] = s->record_end++;
     s->record_count++;
-    if (s->record_count >= s->record_count_threshold) {
-        map_hash_resize(ctx, s);
-    }
     return mr;
 }
 
 static JSMapRecord *set_add_record(JSContext *ctx, JSMapState *s,
                                    JSValueConst key)
 {
-    JSMapRecord *mr;
-    mr = map_add_record(ctx, s, key);
-    if (!mr)
-        return NULL;
-    mr->value = JS_UNDEFINED;
-    return mr;
+    return map_add_record(ctx, s, key);
 }
 
-/* warning: the record must be removed from the hash table before */
+/* the record is left in its hash chain until the next rehash */
 static void map_delete_record_internal(JSRuntime *rt, JSMapState *s, JSMapRecord *mr)
 {
-    if (mr->empty)
-        return;
+    JSValue key, value;
 
+    if (map_record_is_empty(mr))
+        return;
+    key = mr->key;
+    value = mr->value;
+    mr->key = JS_UNINITIALIZED;
+    mr->value = JS_UNDEFINED;
+    s->record_count--;
     if (s->is_weak) {
-        js_weakref_free(rt, mr->key);
+        js_weakref_free(rt, key);
     } else {
-        JS_FreeValueRT(rt, mr->key);
-    }
-    JS_FreeValueRT(rt, mr->value);
-    if (--mr->ref_count == 0) {
-        list_del(&mr->link);
-        js_free_rt(rt, mr);
-    } else {
-        /* keep a zombie record for iterators */
-        mr->empty = TRUE;
-        mr->key = JS_UNDEFINED;
-        mr->value = JS_UNDEFINED;
-    }
-    s->record_count--;
-}
-
-static void map_decref_record(JSRuntime *rt, JSMapRecord *mr)
-{
-    if (--mr->ref_count == 0) {
-        /* the record can be safely removed */
-        assert(mr->empty);
-        list_del(&mr->link);
-        js_free_rt(rt, mr);
+        JS_FreeValueRT(rt, key);
     }
+    JS_FreeValueRT(rt, value);
 }
 
 static void map_delete_weakrefs(JSRuntime *rt, JSWeakRefHeader *wh)
 {
     JSMapState *s = container_of(wh, JSMapState, weakref_header);
-    struct list_head *el, *el1;
-    JSMapRecord *mr1, **pmr;
-    uint32_t h;
-
-    list_for_each_safe(el, el1, &s->records) {
-        JSMapRecord *mr = list_entry(el, JSMapRecord, link);
-        if (!js_weakref_is_live(mr->key)) {
+    JSMapRecord *mr;
+    uint32_t i;
 
-            /* even if key is not live it can be hashed as a pointer */
-            h = map_hash_key(mr->key, s->hash_bits);
-            pmr = &s->hash_table[h];
-            for(;;) {
-                mr1 = *pmr;
-                /* the entry may already be removed from the hash
-                   table if the map was resized */
-                if (mr1 == NULL)
-                    goto done;
-                if (mr1 == mr)
-                    break;
-                pmr = &mr1->hash_next;
-            }
-            /* remove from the hash table */
-            *pmr = mr1->hash_next;
-        done:
+    for(i = 0; i < s->record_end; i++) {
+        mr = &s->records[i];
+        if (!map_record_is_empty(mr) && !js_weakref_is_live(mr->key))
             map_delete_record_internal(rt, s, mr);
-        }
     }
 }
 
@@ -54089,31 +58903,19 @@ static JSValue js_map_get(JSContext *ctx, JSValueConst this_val,
 /* return JS_TRUE or JS_FALSE */
 static JSValue map_delete_record(JSContext *ctx, JSMapState *s, JSValueConst key)
 {
-    JSMapRecord *mr, **pmr;
-    uint32_t h;
+    JSMapRecord *mr;
 
     key = map_normalize_key_const(ctx, key);
-
-
-    h = map_hash_key(key, s->hash_bits);
-    pmr = &s->hash_table[h];
-    for(;;) {
-        mr = *pmr;
-        if (mr == NULL)
-            return JS_FALSE;
-        if (mr->empty || (s->is_weak && !js_weakref_is_live(mr->key))) {
-            /* not valid */
-        } else {
-            if (js_same_value_zero(ctx, mr->key, key))
-                break;
-        }
-        pmr = &mr->hash_next;
-    }
-
-    /* remove from the hash table */
-    *pmr = mr->hash_next;
-
+    mr = map_find_record(ctx, s, key);
+    if (!mr)
+        return JS_FALSE;
     map_delete_record_internal(ctx->rt, s, mr);
+    /* shrink the records when most of them are deleted. Nothing
+       is lost if there is not enough memory. */
+    if (s->record_size > MAP_MIN_RECORD_SIZE &&
+        s->record_count < s->record_size / 8) {
+        map_rehash(ctx->rt, s, s->record_size / 2);
+    }
     return JS_TRUE;
 }
 
@@ -54181,18 +58983,25 @@ static JSValue js_map_clear(JSContext *ctx, JSValueConst this_val,
                             int argc, JSValueConst *argv, int magic)
 {
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
-    struct list_head *el, *el1;
-    JSMapRecord *mr;
+    struct list_head *el;
+    uint32_t i;
 
     if (!s)
         return JS_EXCEPTION;
 
-    /* remove from the hash table */
-    memset(s->hash_table, 0, sizeof(s->hash_table[0]) * s->hash_size);
-
-    list_for_each_safe(el, el1, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        map_delete_record_internal(ctx->rt, s, mr);
+    for(i = 0; i < s->record_end; i++)
+        map_delete_record_internal(ctx->rt, s, &s->records[i]);
+    js_free(ctx, s->records);
+    s->records = NULL;
+    s->record_end = 0;
+    s->record_size = 0;
+    s->hash_table = NULL;
+    s->hash_bits = 0;
+    s->hash_size = 0;
+    /* the iterators continue with the records added after clear() */
+    list_for_each(el, &s->cursors) {
+        JSMapCursor *c = list_entry(el, JSMapCursor, link);
+        c->pos = 0;
     }
     return JS_UNDEFINED;
 }
@@ -54212,7 +59021,7 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
     JSValueConst func, this_arg;
     JSValue ret, args[3];
-    struct list_head *el;
+    JSMapCursor cur;
     JSMapRecord *mr;
 
     if (!s)
@@ -54229,33 +59038,32 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
             return JS_ThrowTypeError(ctx, "<internal>/quickjs.c", __LINE__, "first argument passed to Set.prototype.forEach wasn't a function");
         }
     }
-    /* Note: the list can be modified while traversing it, but the
-       current element is locked */
-    el = s->records.next;
-    while (el != &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty) {
-            mr->ref_count++;
-            /* must duplicate in case the record is deleted */
-            args[1] = JS_DupValue(ctx, mr->key);
-            if (magic)
-                args[0] = args[1];
-            else
-                args[0] = JS_DupValue(ctx, mr->value);
-            args[2] = (JSValue)this_val;
-            ret = JS_Call(ctx, func, this_arg, 3, (JSValueConst *)args);
-            JS_FreeValue(ctx, args[0]);
-            if (!magic)
-                JS_FreeValue(ctx, args[1]);
-            el = el->next;
-            map_decref_record(ctx->rt, mr);
-            if (JS_IsException(ret))
-                return ret;
-            JS_FreeValue(ctx, ret);
-        } else {
-            el = el->next;
+    /* Note: the map can be modified by the callback. The cursor is
+       updated if the records are moved. */
+    cur.pos = 0;
+    list_add_tail(&cur.link, &s->cursors);
+    while (cur.pos < s->record_end) {
+        mr = &s->records[cur.pos++];
+        if (map_record_is_empty(mr))
+            continue;
+        /* must duplicate in case the record is deleted */
+        args[1] = JS_DupValue(ctx, mr->key);
+        if (magic)
+            args[0] = args[1];
+        else
+            args[0] = JS_DupValue(ctx, mr->value);
+        args[2] = (JSValue)this_val;
+        ret = JS_Call(ctx, func, this_arg, 3, (JSValueConst *)args);
+        JS_FreeValue(ctx, args[0]);
+        if (!magic)
+            JS_FreeValue(ctx, args[1]);
+        if (JS_IsException(ret)) {
+            list_del(&cur.link);
+            return ret;
         }
+        JS_FreeValue(ctx, ret);
     }
+    list_del(&cur.link);
     return JS_UNDEFINED;
 }
 
@@ -54380,26 +59188,26 @@ static void js_map_finalizer(JSRuntime *rt, JSValue val)
 {
     JSObject *p;
     JSMapState *s;
-    struct list_head *el, *el1;
     JSMapRecord *mr;
+    uint32_t i;
 
     p = JS_VALUE_GET_OBJ(val);
     s = p->u.map_state;
     if (s) {
         /* if the object is deleted we are sure that no iterator is
-           using it */
-        list_for_each_safe(el, el1, &s->records) {
-            mr = list_entry(el, JSMapRecord, link);
-            if (!mr->empty) {
+           using it. The cursor list is not accessed because the
+           iterators may already be freed during the GC sweep phase. */
+        for(i = 0; i < s->record_end; i++) {
+            mr = &s->records[i];
+            if (!map_record_is_empty(mr)) {
                 if (s->is_weak)
                     js_weakref_free(rt, mr->key);
                 else
                     JS_FreeValueRT(rt, mr->key);
                 JS_FreeValueRT(rt, mr->value);
             }
-            js_free_rt(rt, mr);
         }
-        js_free_rt(rt, s->hash_table);
+        js_free_rt(rt, s->records);
         if (s->is_weak) {
             list_del(&s->weakref_header.link);
         }
@@ -54411,13 +59219,13 @@ static void js_map_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
 {
     JSObject *p = JS_VALUE_GET_OBJ(val);
     JSMapState *s;
-    struct list_head *el;
     JSMapRecord *mr;
+    uint32_t i;
 
     s = p->u.map_state;
     if (s) {
-        list_for_each(el, &s->records) {
-            mr = list_entry(el, JSMapRecord, link);
+        for(i = 0; i < s->record_end; i++) {
+            mr = &s->records[i];
             if (!s->is_weak)
                 JS_MarkValue(rt, mr->key, mark_func);
             JS_MarkValue(rt, mr->value, mark_func);
@@ -54430,7 +59238,8 @@ static void js_map_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
 typedef struct JSMapIteratorData {
     JSValue obj;
     JSIteratorKindEnum kind;
-    JSMapRecord *cur_record;
+    JSMapCursor cursor; /* in the cursor list of the map while 'obj'
+                           is defined */
 } JSMapIteratorData;
 
 static void js_map_iterator_finalizer(JSRuntime *rt, JSValue val)
@@ -54443,8 +59252,8 @@ static void js_map_iterator_finalizer(JSRuntime *rt, JSValue val)
     if (it) {
         /* During the GC sweep phase the Map finalizer may be
            called before the Map iterator finalizer */
-        if (JS_IsLiveObject(rt, it->obj) && it->cur_record) {
-            map_decref_record(rt, it->cur_record);
+        if (JS_IsLiveObject(rt, it->obj)) {
+            list_del(&it->cursor.link);
         }
         JS_FreeValueRT(rt, it->obj);
         js_free_rt(rt, it);
@@ -54458,7 +59267,6 @@ static void js_map_iterator_mark(JSRuntime *rt, JSValueConst val,
     JSMapIteratorData *it;
     it = p->u.map_iterator_data;
     if (it) {
-        /* the record is already marked by the object */
         JS_MarkValue(rt, it->obj, mark_func);
     }
 }
@@ -54486,7 +59294,8 @@ static JSValue js_create_map_iterator(JSContext *ctx, JSValueConst this_val,
     }
     it->obj = JS_DupValue(ctx, this_val);
     it->kind = kind;
-    it->cur_record = NULL;
+    it->cursor.pos = 0;
+    list_add_tail(&it->cursor.link, &s->cursors);
     JS_SetOpaque(enum_obj, it);
     return enum_obj;
  fail:
@@ -54500,7 +59309,6 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
     JSMapIteratorData *it;
     JSMapState *s;
     JSMapRecord *mr;
-    struct list_head *el;
 
     it = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP_ITERATOR + magic);
     if (!it) {
@@ -54511,17 +59319,10 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
         goto done;
     s = JS_GetOpaque(it->obj, JS_CLASS_MAP + magic);
     assert(s != NULL);
-    if (!it->cur_record) {
-        el = s->records.next;
-    } else {
-        mr = it->cur_record;
-        el = mr->link.next;
-        map_decref_record(ctx->rt, mr); /* the record can be freed here */
-    }
     for(;;) {
-        if (el == &s->records) {
+        if (it->cursor.pos >= s->record_end) {
             /* no more record  */
-            it->cur_record = NULL;
+            list_del(&it->cursor.link);
             JS_FreeValue(ctx, it->obj);
             it->obj = JS_UNDEFINED;
         done:
@@ -54529,16 +59330,10 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
             *pdone = TRUE;
             return JS_UNDEFINED;
         }
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty)
+        mr = &s->records[it->cursor.pos++];
+        if (!map_record_is_empty(mr))
             break;
-        /* get the next record */
-        el = mr->link.next;
     }
-
-    /* lock the record so that it won't be freed */
-    mr->ref_count++;
-    it->cur_record = mr;
     *pdone = FALSE;
 
     if (it->kind == JS_ITERATOR_KIND_KEY) {
@@ -54635,8 +59430,7 @@ static JSValue js_copy_set(JSContext *ctx, JSValueConst this_val)
 {
     JSValue newset;
     JSMapState *s, *t;
-    struct list_head *el;
-    JSMapRecord *mr;
+    uint32_t i;
 
     s = JS_GetOpaque2(ctx, this_val, JS_CLASS_SET);
     if (!s)
@@ -54649,11 +59443,10 @@ static JSValue js_copy_set(JSContext *ctx, JSValueConst this_val)
 
     // can't clone this_val using js_map_constructor(),
     // test262 mandates we don't call the .add method
-    list_for_each(el, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (mr->empty)
+    for(i = 0; i < s->record_end; i++) {
+        if (map_record_is_empty(&s->records[i]))
             continue;
-        if (!set_add_record(ctx, t, mr->key))
+        if (!set_add_record(ctx, t, s->records[i].key))
             goto exception;
     }
     return newset;
@@ -55204,7 +59997,7 @@ static const uint8_t js_map_proto_funcs_count[6] = {
     countof(js_set_iterator_proto_funcs),
 };
 
-int JS_AddIntrinsicMapSet(JSContext *ctx)
+static int JS_InitIntrinsicMapSet(JSContext *ctx)
 {
     int i;
     JSValue obj1;
@@ -55220,7 +60013,7 @@ int JS_AddIntrinsicMapSet(JSContext *ctx)
                                   JS_UNDEFINED,
                                   js_map_funcs, i < 2 ? countof(js_map_funcs) : 0,
                                   js_map_proto_funcs_ptr[i], js_map_proto_funcs_count[i],
-                                  0);
+                                  JS_NEW_CTOR_LAZY_GLOBAL);
         if (JS_IsException(obj1))
             return -1;
         JS_FreeValue(ctx, obj1);
@@ -55237,6 +60030,11 @@ int JS_AddIntrinsicMapSet(JSContext *ctx)
     return 0;
 }
 
+int JS_AddIntrinsicMapSet(JSContext *ctx)
+{
+    return js_add_lazy_intrinsic(ctx, JS_LAZY_INTRINSIC_MAP_SET);
+}
+
 /* Generator */
 static const JSCFunctionListEntry js_generator_function_proto_funcs[] = {
     JS_PROP_STRING_DEF("[Symbol.toStringTag]", "GeneratorFunction", JS_PROP_CONFIGURABLE),
@@ -58141,7 +62939,7 @@ JSValue JS_NewDate(JSContext *ctx, double epoch_ms)
     return obj;
 }
 
-int JS_AddIntrinsicDate(JSContext *ctx)
+static int JS_InitIntrinsicDate(JSContext *ctx)
 {
     JSValue obj;
 
@@ -58151,13 +62949,18 @@ int JS_AddIntrinsicDate(JSContext *ctx)
                                     JS_UNDEFINED,
                                     js_date_funcs, countof(js_date_funcs),
                                     js_date_proto_funcs, countof(js_date_proto_funcs),
-                                    0);
+                                    JS_NEW_CTOR_LAZY_GLOBAL);
     if (JS_IsException(obj))
         return -1;
     JS_FreeValue(ctx, obj);
     return 0;
 }
 
+int JS_AddIntrinsicDate(JSContext *ctx)
+{
+    return js_add_lazy_intrinsic(ctx, JS_LAZY_INTRINSIC_DATE);
+}
+
 /* eval */
 
 int JS_AddIntrinsicEval(JSContext *ctx)
@@ -63028,7 +67831,7 @@ static int JS_AddIntrinsicAtomics(JSContext *ctx)
 
 #endif /* CONFIG_ATOMICS */
 
-int JS_AddIntrinsicTypedArrays(JSContext *ctx)
+static int JS_InitIntrinsicTypedArrays(JSContext *ctx)
 {
     JSValue typed_array_base_func, typed_array_base_proto, obj;
     int i, ret;
@@ -63038,7 +67841,7 @@ int JS_AddIntrinsicTypedArrays(JSContext *ctx)
                                     JS_UNDEFINED,
                                     js_array_buffer_funcs, countof(js_array_buffer_funcs),
                                     js_array_buffer_proto_funcs, countof(js_array_buffer_proto_funcs),
-                                    0);
+                                    JS_NEW_CTOR_LAZY_GLOBAL);
     if (JS_IsException(obj))
         return -1;
     JS_FreeValue(ctx, obj);
@@ -63048,7 +67851,7 @@ int JS_AddIntrinsicTypedArrays(JSContext *ctx)
                                     JS_UNDEFINED,
                                     js_shared_array_buffer_funcs, countof(js_shared_array_buffer_funcs),
                                     js_shared_array_buffer_proto_funcs, countof(js_shared_array_buffer_proto_funcs),
-                                    0);
+                                    JS_NEW_CTOR_LAZY_GLOBAL);
     if (JS_IsException(obj))
         return -1;
     JS_FreeValue(ctx, obj);
@@ -63064,8 +67867,10 @@ int JS_AddIntrinsicTypedArrays(JSContext *ctx)
     if (JS_IsException(typed_array_base_func))
         return -1;
 
-    /* TypedArray.prototype.toString must be the same object as Array.prototype.toString */
-    obj = JS_GetProperty(ctx, ctx->class_proto[JS_CLASS_ARRAY], JS_ATOM_toString);
+    /* TypedArray.prototype.toString must be the same object as
+       Array.prototype.toString: it was saved by JS_AddIntrinsicTypedArrays()
+       in case Array.prototype was modified since */
+    obj = JS_GetProperty(ctx, ctx->lazy_intrinsic_globals, JS_ATOM_toString);
     if (JS_IsException(obj))
         goto fail;
     /* XXX: should use alias method in JSCFunctionListEntry */ //@@@
@@ -63092,7 +67897,7 @@ int JS_AddIntrinsicTypedArrays(JSContext *ctx)
                                      typed_array_base_func,
                                      js_uint8array_funcs, countof(js_uint8array_funcs),
                                      js_uint8array_proto_funcs, countof(js_uint8array_proto_funcs),
-                                     0);
+                                     JS_NEW_CTOR_LAZY_GLOBAL);
         } else {
             const JSCFunctionListEntry *bpe = js_typed_array_funcs + typed_array_size_log2(i);
             obj = JS_NewCConstructor(ctx, i, name,
@@ -63100,7 +67905,7 @@ int JS_AddIntrinsicTypedArrays(JSContext *ctx)
                                      typed_array_base_func,
                                      bpe, 1,
                                      bpe, 1,
-                                     0);
+                                     JS_NEW_CTOR_LAZY_GLOBAL);
         }
         if (JS_IsException(obj)) {
         fail:
@@ -63117,10 +67922,25 @@ int JS_AddIntrinsicTypedArrays(JSContext *ctx)
                                     JS_UNDEFINED,
                                     NULL, 0,
                                     js_dataview_proto_funcs, countof(js_dataview_proto_funcs),
-                                    0);
+                                    JS_NEW_CTOR_LAZY_GLOBAL);
     if (JS_IsException(obj))
         return -1;
     JS_FreeValue(ctx, obj);
+    return 0;
+}
+
+int JS_AddIntrinsicTypedArrays(JSContext *ctx)
+{
+    JSValue obj;
+
+    if (js_add_lazy_intrinsic(ctx, JS_LAZY_INTRINSIC_TYPED_ARRAYS))
+        return -1;
+    obj = JS_GetProperty(ctx, ctx->class_proto[JS_CLASS_ARRAY], JS_ATOM_toString);
+    if (JS_IsException(obj))
+        return -1;
+    if (JS_DefinePropertyValue(ctx, ctx->lazy_intrinsic_globals, JS_ATOM_toString,
+                               obj, 0) < 0)
+        return -1;
 
     /* Atomics */
 #ifdef CONFIG_ATOMICS
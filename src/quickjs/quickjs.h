@@ -60,11 +60,15 @@ typedef uint32_t JSAtom;
 #define JS_PTR64_DEF(a)
 #endif
 
-#ifndef JS_PTR64
+/* NaN boxing is always used on 32 bit hosts. On 64 bit hosts it can
+   be selected with CONFIG_NAN_BOXING: JSValue is then 8 bytes instead
+   of 16, which requires heap pointers to fit in 48 bits. The runtime
+   allocator treats the memory above this limit as unavailable. */
+#if !defined(JS_PTR64) || defined(CONFIG_NAN_BOXING)
 #define JS_NAN_BOXING
 #endif
 
-#if defined(__SIZEOF_INT128__) && (INTPTR_MAX >= INT64_MAX)
+#if defined(__SIZEOF_INT128__) && (INTPTR_MAX >= INT64_MAX) && !defined(JS_NAN_BOXING)
 #define JS_LIMB_BITS 64
 #else
 #define JS_LIMB_BITS 32
@@ -217,16 +221,31 @@ typedef uint64_t JSValue;
 
 #define JSValueConst JSValue
 
-#define JS_VALUE_GET_TAG(v) (int)((v) >> 32)
+#ifdef JS_PTR64
+/* The tag is stored in the top 17 bits. Non float tags are encoded
+   as negative NaNs. Pointers must be below 2^48 and at least 2 byte
+   aligned: they are stored shifted right by one bit. */
+#define JS_NAN_BOXING_TAG_SHIFT 47
+
+#define JS_VALUE_GET_PTR(v) (void *)(intptr_t)(((v) << 17) >> 16)
+#define JS_MKPTR(tag, ptr) (((uint64_t)(tag) << JS_NAN_BOXING_TAG_SHIFT) | ((uintptr_t)(ptr) >> 1))
+
+#define JS_FLOAT64_TAG_ADDEND (0x1ffff - JS_TAG_FLOAT64 + 1) /* negative NaN encoding */
+#else
+#define JS_NAN_BOXING_TAG_SHIFT 32
+
+#define JS_VALUE_GET_PTR(v) (void *)(intptr_t)(v)
+#define JS_MKPTR(tag, ptr) (((uint64_t)(tag) << JS_NAN_BOXING_TAG_SHIFT) | (uintptr_t)(ptr))
+
+#define JS_FLOAT64_TAG_ADDEND (0x7ff80000 - JS_TAG_FIRST + 1) /* quiet NaN encoding */
+#endif
+
+#define JS_VALUE_GET_TAG(v) (int)((int64_t)(v) >> JS_NAN_BOXING_TAG_SHIFT)
 #define JS_VALUE_GET_INT(v) (int)(v)
 #define JS_VALUE_GET_BOOL(v) (int)(v)
 #define JS_VALUE_GET_SHORT_BIG_INT(v) (int)(v)
-#define JS_VALUE_GET_PTR(v) (void *)(intptr_t)(v)
 
-#define JS_MKVAL(tag, val) (((uint64_t)(tag) << 32) | (uint32_t)(val))
-#define JS_MKPTR(tag, ptr) (((uint64_t)(tag) << 32) | (uintptr_t)(ptr))
-
-#define JS_FLOAT64_TAG_ADDEND (0x7ff80000 - JS_TAG_FIRST + 1) /* quiet NaN encoding */
+#define JS_MKVAL(tag, val) (((uint64_t)(tag) << JS_NAN_BOXING_TAG_SHIFT) | (uint32_t)(val))
 
 static inline double JS_VALUE_GET_FLOAT64(JSValue v)
 {
@@ -235,11 +254,11 @@ static inline double JS_VALUE_GET_FLOAT64(JSValue v)
         double d;
     } u;
     u.v = v;
-    u.v += (uint64_t)JS_FLOAT64_TAG_ADDEND << 32;
+    u.v += (uint64_t)JS_FLOAT64_TAG_ADDEND << JS_NAN_BOXING_TAG_SHIFT;
     return u.d;
 }
 
-#define JS_NAN (0x7ff8000000000000 - ((uint64_t)JS_FLOAT64_TAG_ADDEND << 32))
+#define JS_NAN (0x7ff8000000000000 - ((uint64_t)JS_FLOAT64_TAG_ADDEND << JS_NAN_BOXING_TAG_SHIFT))
 
 static inline JSValue __JS_NewFloat64(JSContext *ctx, double d)
 {
@@ -253,7 +272,7 @@ static inline JSValue __JS_NewFloat64(JSContext *ctx, double d)
     if (js_unlikely((u.u64 & 0x7fffffffffffffff) > 0x7ff0000000000000))
         v = JS_NAN;
     else
-        v = u.u64 - ((uint64_t)JS_FLOAT64_TAG_ADDEND << 32);
+        v = u.u64 - ((uint64_t)JS_FLOAT64_TAG_ADDEND << JS_NAN_BOXING_TAG_SHIFT);
     return v;
 }
 
@@ -274,7 +293,7 @@ static inline JS_BOOL JS_VALUE_IS_NAN(JSValue v)
 {
     uint32_t tag;
     tag = JS_VALUE_GET_TAG(v);
-    return tag == (JS_NAN >> 32);
+    return tag == (uint32_t)JS_VALUE_GET_TAG(JS_NAN);
 }
 
 static inline JSValue __JS_NewShortBigInt(JSContext *ctx, int32_t d)
@@ -442,6 +461,13 @@ JSRuntime *JS_NewRuntime(void);
 void JS_SetRuntimeInfo(JSRuntime *rt, const char *info);
 void JS_SetMemoryLimit(JSRuntime *rt, size_t limit);
 void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold);
+/* When enabled, JS_FreeRuntime() does not free the objects one by
+   one: only the finalizers of the classes defined with JS_NewClass()
+   and of the ArrayBuffers whose data is owned by the host or shared
+   are called, then all the runtime memory is released at once. The
+   contexts released by JS_FreeContext() are kept until
+   JS_FreeRuntime(), so it is intended for short-lived runtimes. */
+void JS_SetFastTeardown(JSRuntime *rt, JS_BOOL enable);
 /* use 0 to disable maximum stack size check */
 void JS_SetMaxStackSize(JSRuntime *rt, size_t stack_size);
 /* should be called when changing thread to update the stack top value
@@ -462,6 +488,12 @@ void JS_MarkValue(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func);
    reference. Passing NULL is a no-op. */
 void JS_MarkContext(JSRuntime *rt, JSContext *ctx, JS_MarkFunc *mark_func);
 void JS_RunGC(JSRuntime *rt);
+/* Run a slice of incremental cycle collection lasting about
+   'budget_us' microseconds. The cycles among old objects are looked
+   for by small groups of objects, so the slices can be interleaved
+   with the execution. Return TRUE if more slices are needed to finish
+   the current round. */
+JS_BOOL JS_RunGCStep(JSRuntime *rt, int64_t budget_us);
 JS_BOOL JS_IsLiveObject(JSRuntime *rt, JSValueConst obj);
 
 JSContext *JS_NewContext(JSRuntime *rt);
@@ -487,7 +519,8 @@ void JS_SetClassProto(JSContext *ctx, JSClassID class_id, JSValue obj);
 JSValue JS_GetClassProto(JSContext *ctx, JSClassID class_id);
 
 /* the following functions are used to select the intrinsic object to
-   save memory */
+   save memory. Date, RegExp, Map/Set and the typed arrays are only
+   created when first used. */
 JSContext *JS_NewContextRaw(JSRuntime *rt);
 int JS_AddIntrinsicBaseObjects(JSContext *ctx);
 int JS_AddIntrinsicDate(JSContext *ctx);
@@ -539,6 +572,68 @@ typedef struct JSMemoryUsage {
 void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s);
 void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt);
 
+/* small block allocator statistics for one block size */
+typedef struct JSMallocArenaStats {
+    int64_t block_size;
+    int64_t arena_count; /* allocated arenas, including the empty ones */
+    int64_t empty_arena_count; /* arenas kept for reuse without any used block */
+    int64_t block_count; /* blocks in the arenas */
+    int64_t used_block_count;
+} JSMallocArenaStats;
+
+/* Fill 'stats' with at most 'stats_count' entries, one per block size.
+   Return the number of block sizes of the allocator (0 if the small
+   block allocator is not used). */
+int JS_GetMallocArenaStats(JSRuntime *rt, JSMallocArenaStats *stats,
+                           int stats_count);
+
+/* Opcode execution statistics of the runtime, only collected when the
+   engine is built with CONFIG_OPCODE_STATS. Return an object with the
+   number of executions of each opcode ("opcodes": { name: count }) and
+   of each pair of consecutive opcodes ("pairs": { prev: { name: count } }),
+   or JS_NULL if the statistics are not collected. They are also written
+   as one line of JSON by JS_FreeRuntime() to the file named by the
+   QUICKJS_OPCODE_STATS environment variable (stderr if not set). */
+JSValue JS_GetOpcodeStats(JSContext *ctx);
+void JS_ResetOpcodeStats(JSRuntime *rt);
+
+/* Sampling CPU profiler. The stack is sampled every 'interval'
+   microseconds of CPU time (JS_CPU_PROFILE_DEFAULT_INTERVAL if <= 0)
+   when the interrupt handler is polled. A running profile is discarded.
+   Return -1 if out of memory. */
+#define JS_CPU_PROFILE_DEFAULT_INTERVAL 1000
+int JS_StartCPUProfile(JSRuntime *rt, int interval);
+/* Chrome DevTools JSON format (.cpuprofile) */
+#define JS_CPU_PROFILE_FORMAT_CPUPROFILE 0
+/* collapsed stacks: one line per stack with the number of samples, as
+   used by flame graph tools */
+#define JS_CPU_PROFILE_FORMAT_COLLAPSED  1
+/* Stop the profiler and return the profile as a string in the given
+   format, or JS_NULL if the profiler is not running. */
+JSValue JS_StopCPUProfile(JSContext *ctx, int format);
+
+/* Allocation sampling: the stack is sampled after every 'interval'
+   bytes allocated on average (JS_HEAP_SAMPLING_DEFAULT_INTERVAL if
+   <= 0). Each sample stands for the bytes allocated since the previous
+   one, freed or not. A running sampling is discarded. Return -1 if out
+   of memory. */
+#define JS_HEAP_SAMPLING_DEFAULT_INTERVAL (32 * 1024)
+int JS_StartHeapSampling(JSRuntime *rt, int interval);
+/* Chrome DevTools JSON format (.heapprofile) */
+#define JS_HEAP_SAMPLING_FORMAT_HEAPPROFILE 0
+/* collapsed stacks with the number of allocated bytes */
+#define JS_HEAP_SAMPLING_FORMAT_COLLAPSED   1
+/* Stop the sampling and return the profile as a string in the given
+   format, or JS_NULL if the sampling is not running. */
+JSValue JS_StopHeapSampling(JSContext *ctx, int format);
+
+/* Run the garbage collector and write a snapshot of the heap in the
+   Chrome DevTools JSON format (.heapsnapshot) with 'write_func'. Return
+   -1 with an exception if out of memory. */
+int JS_WriteHeapSnapshot(JSContext *ctx,
+                         void (*write_func)(void *opaque, const char *buf, size_t len),
+                         void *opaque);
+
 /* atom support */
 #define JS_ATOM_NULL 0
 
@@ -998,6 +1093,16 @@ int JS_DefinePropertyValueStr(JSContext *ctx, JSValueConst this_obj,
 int JS_DefinePropertyGetSet(JSContext *ctx, JSValueConst this_obj,
                             JSAtom prop, JSValue getter, JSValue setter,
                             int flags);
+/* Define a data property whose value is computed by 'func' the first time
+   the property is accessed (like the lazily created builtins). 'func' is
+   called in the context which defined the property and must not modify
+   the properties of 'this_obj'. If it throws, the property is left
+   undefined. */
+typedef JSValue JSAutoInitPropertyFunc(JSContext *ctx, JSValueConst this_obj,
+                                       JSAtom prop);
+int JS_DefinePropertyAutoInit(JSContext *ctx, JSValueConst this_obj,
+                              JSAtom prop, JSAutoInitPropertyFunc *func,
+                              int flags);
 void JS_SetOpaque(JSValue obj, void *opaque);
 void *JS_GetOpaque(JSValueConst obj, JSClassID class_id);
 void *JS_GetOpaque2(JSContext *ctx, JSValueConst obj, JSClassID class_id);
@@ -1076,6 +1181,11 @@ void JS_SetCanBlock(JSRuntime *rt, JS_BOOL can_block);
 #define JS_STRIP_DEBUG  (1 << 1) /* strip all debug info including source code */
 void JS_SetStripInfo(JSRuntime *rt, int flags);
 int JS_GetStripInfo(JSRuntime *rt);
+/* if enabled, the body of the nested functions is only checked when
+   the enclosing code is compiled and it is compiled at the first
+   call. It has no effect if the source code is stripped. */
+void JS_SetLazyFunctions(JSRuntime *rt, JS_BOOL enabled);
+JS_BOOL JS_GetLazyFunctions(JSRuntime *rt);
 
 /* set the [IsHTMLDDA] internal slot */
 void JS_SetIsHTMLDDA(JSContext *ctx, JSValueConst obj);
@@ -1201,6 +1311,12 @@ uint8_t *JS_WriteObject(JSContext *ctx, size_t *psize, JSValueConst obj,
                         int flags);
 uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
                          int flags, uint8_t ***psab_tab, size_t *psab_tab_len);
+/* version of the bytecode format written with JS_WRITE_OBJ_BYTECODE */
+uint32_t JS_GetBytecodeVersion(void);
+/* string identifying the engine version, the bytecode version and the
+   JSValue layout. Bytecode cached on disk should only be reused by an
+   engine with the same id. */
+const char *JS_GetBuildId(void);
 
 #define JS_READ_OBJ_BYTECODE  (1 << 0) /* allow function/module */
 #define JS_READ_OBJ_ROM_DATA  (1 << 1) /* avoid duplicating 'buf' data */
@@ -1210,6 +1326,10 @@ uint8_t *JS_WriteObject2(JSContext *ctx, size_t *psize, JSValueConst obj,
                                                  and reify as real Error
                                                  instances of the matching
                                                  builtin class */
+#define JS_READ_OBJ_IN_PLACE  (1 << 5) /* with JS_READ_OBJ_ROM_DATA: 'buf'
+                                          is writable and its atoms are
+                                          relocated in place when needed,
+                                          so it can only be read once */
 JSValue JS_ReadObject(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                       int flags);
 /* instantiate and evaluate a bytecode function. Only used when
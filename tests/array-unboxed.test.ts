@@ -0,0 +1,123 @@
+import { test, expect } from "vitest";
+import { spawn } from "first-base";
+import { binDir } from "./_utils";
+
+const show = `
+  const show = (label, v) => console.log(label, JSON.stringify(v, (k, x) => Object.is(x, -0) ? "-0" : Number.isNaN(x) ? "NaN" : x === undefined ? "undefined" : x));
+`;
+
+test("unboxed numeric arrays - copies keep -0 and NaN", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    show +
+      `
+      const ints = [1, 2, 3, 4, 5];
+      const floats = [1.5, -0, NaN, 4.25];
+      show("with", [ints.with(1, 20), ints.with(1, 0.5), ints.with(0, -0), ints.with(2, "x")]);
+      show("reverse", [1, 2, 3].reverse());
+      show("reverse", [1.5, -0, NaN].reverse());
+      show("toReversed", floats.toReversed());
+      show("slice", floats.slice(1, 3));
+      show("toSpliced", ints.toSpliced(1, 2, 7.5, -0));
+      show("toSpliced", ints.toSpliced(1, 0, "a"));
+      show("toSorted", [3, -0, 0, NaN, 1.5, 2].toSorted());
+      const sp = [1, 2, 3, 4, 5];
+      show("splice", sp.splice(1, 2, 9.5));
+      show("splice", sp);
+      console.log(Object.is(floats.toSorted()[0], -0), floats.toReversed().includes(NaN), floats.slice().indexOf(0));
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "with [[1,20,3,4,5],[1,0.5,3,4,5],["-0",2,3,4,5],[1,2,"x",4,5]]
+    reverse [3,2,1]
+    reverse ["NaN","-0",1.5]
+    toReversed [4.25,"NaN","-0",1.5]
+    slice ["-0","NaN"]
+    toSpliced [1,7.5,"-0",4,5]
+    toSpliced [1,"a",2,3,4,5]
+    toSorted ["-0",0,1.5,2,3,"NaN"]
+    splice [2,3]
+    splice [1,9.5,4,5]
+    true true 1
+    ",
+    }
+  `);
+});
+
+test("unboxed numeric arrays - holes", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    show +
+      `
+      const holes = [1, , 3.5];
+      show("toReversed", holes.toReversed());
+      show("with", holes.with(0, 2));
+      show("toSorted", holes.toSorted());
+      show("toSpliced", holes.toSpliced(0, 1));
+      const sliced = holes.slice();
+      show("slice", sliced);
+      console.log(1 in sliced, 1 in holes.toReversed());
+      show("reverse", holes.reverse());
+      console.log(1 in holes);
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "toReversed [3.5,"undefined",1]
+    with [2,"undefined",3.5]
+    toSorted [1,3.5,"undefined"]
+    toSpliced ["undefined",3.5]
+    slice [1,"undefined",3.5]
+    false true
+    reverse [3.5,"undefined",1]
+    false
+    ",
+    }
+  `);
+});
+
+test("unboxed numeric arrays - copies convert back to generic storage", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    show +
+      `
+      const a = [1, 2, 3].toReversed();
+      a.push("four");
+      a[0] = { o: 1 };
+      show("toReversed", a);
+      const b = [0.5, 1.5].slice();
+      b[4] = null;
+      show("slice", b);
+      const c = [1, 2, 3].toSorted();
+      c[1] = 2.5;
+      c.splice(0, 1, "x");
+      show("toSorted", c);
+      const d = [1, 2, 3].with(0, 0.5);
+      d.unshift(undefined);
+      d.length = 6;
+      show("with", d);
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "toReversed [{"o":1},2,1,"four"]
+    slice [0.5,1.5,"undefined","undefined",null]
+    toSorted ["x",2.5,3]
+    with ["undefined",0.5,2,3,"undefined","undefined"]
+    ",
+    }
+  `);
+});
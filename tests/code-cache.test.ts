@@ -0,0 +1,82 @@
+import { test, beforeEach, expect } from "vitest";
+import fs from "fs";
+import path from "path";
+import { rm, mkdir } from "shelljs";
+import { spawn } from "first-base";
+import { binDir, rootDir } from "./_utils";
+
+const workdir = rootDir("build/tests/code-cache");
+const cacheDir = path.join(workdir, "cache");
+
+beforeEach(() => {
+  rm("-rf", workdir);
+  mkdir("-p", workdir);
+  fs.writeFileSync(
+    path.join(workdir, "main.js"),
+    `import { greet } from "./dep.js"; console.log(greet("world"));`
+  );
+});
+
+async function runMain(args: Array<string>, env?: { [key: string]: string }) {
+  const run = spawn(binDir("qjs"), [...args, path.join(workdir, "main.js")], {
+    env: { ...process.env, ...env },
+  });
+  await run.completion;
+  return run.cleanResult();
+}
+
+test("qjs --code-cache - reuses bytecode until the module changes", async () => {
+  fs.writeFileSync(
+    path.join(workdir, "dep.js"),
+    `export function greet(name) { return "hello " + name; }`
+  );
+
+  expect((await runMain(["--code-cache", cacheDir])).stdout).toBe(
+    "hello world\n"
+  );
+  const entries = fs.readdirSync(cacheDir);
+  expect(entries).toHaveLength(1);
+  expect(entries[0]).toMatch(/^[0-9a-f]{16}\.qjbc$/);
+
+  // served from the cache
+  expect((await runMain(["--code-cache", cacheDir])).stdout).toBe(
+    "hello world\n"
+  );
+
+  // a changed source invalidates the entry
+  fs.writeFileSync(
+    path.join(workdir, "dep.js"),
+    `export function greet(name) { return "goodbye " + name; }`
+  );
+  expect((await runMain(["--code-cache", cacheDir])).stdout).toBe(
+    "goodbye world\n"
+  );
+  expect(fs.readdirSync(cacheDir)).toEqual(entries);
+
+  // a corrupted entry is ignored and rewritten
+  fs.writeFileSync(path.join(cacheDir, entries[0]), "garbage");
+  expect(await runMain(["--code-cache", cacheDir])).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "goodbye world
+    ",
+    }
+  `);
+  expect(fs.readFileSync(path.join(cacheDir, entries[0]), "utf-8")).not.toBe(
+    "garbage"
+  );
+});
+
+test("QUICKJS_CODE_CACHE enables the code cache", async () => {
+  fs.writeFileSync(
+    path.join(workdir, "dep.js"),
+    `export function greet(name) { return "hi " + name; }`
+  );
+
+  expect((await runMain([], { QUICKJS_CODE_CACHE: cacheDir })).stdout).toBe(
+    "hi world\n"
+  );
+  expect(fs.readdirSync(cacheDir)).toHaveLength(1);
+});
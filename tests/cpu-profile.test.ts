@@ -0,0 +1,125 @@
+import { test, beforeEach, expect } from "vitest";
+import fs from "fs";
+import path from "path";
+import { rm, mkdir } from "shelljs";
+import { spawn } from "first-base";
+import { binDir, rootDir } from "./_utils";
+
+const workdir = rootDir("build/tests/cpu-profile");
+
+beforeEach(() => {
+  rm("-rf", workdir);
+  mkdir("-p", workdir);
+});
+
+const busyLoop = `
+  function hot() {
+    let s = 0;
+    for (let i = 0; i < 5e6; i++) {
+      s += i % 7;
+    }
+    return s;
+  }
+  hot();
+`;
+
+test("engine.startCPUProfile/stopCPUProfile - collapsed stacks", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-m",
+    "-e",
+    `
+      import { startCPUProfile, stopCPUProfile } from "quickjs:engine";
+      startCPUProfile(100);
+      ${busyLoop}
+      const lines = stopCPUProfile("collapsed").trim().split("\\n");
+      console.log(
+        "well formed:",
+        lines.every((line) => /^.+ [0-9]+$/.test(line))
+      );
+      console.log(
+        "hot sampled:",
+        lines.some((line) => /;hot \\([^)]*\\) [0-9]+$/.test(line))
+      );
+      console.log("stopped:", stopCPUProfile());
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "well formed: true
+    hot sampled: true
+    stopped: null
+    ",
+    }
+  `);
+});
+
+test("engine.stopCPUProfile - rejects unknown formats", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-m",
+    "-e",
+    `
+      import { startCPUProfile, stopCPUProfile } from "quickjs:engine";
+      startCPUProfile();
+      try {
+        stopCPUProfile("pprof");
+      } catch (err) {
+        console.log(err.name, err.message);
+      }
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "TypeError stopCPUProfile: format must be "cpuprofile" or "collapsed"
+    ",
+    }
+  `);
+});
+
+test("qjs --cpu-prof writes a Chrome .cpuprofile", async () => {
+  const script = path.join(workdir, "busy.js");
+  const profile = path.join(workdir, "out.cpuprofile");
+  fs.writeFileSync(script, busyLoop);
+
+  const run = spawn(binDir("qjs"), [
+    "--cpu-prof",
+    profile,
+    "--cpu-prof-interval",
+    "100",
+    script,
+  ]);
+  await run.completion;
+  expect(run.cleanResult().code).toBe(0);
+
+  const data = JSON.parse(fs.readFileSync(profile, "utf-8"));
+  const ids = new Set(data.nodes.map((node: any) => node.id));
+  expect(data.nodes[0].callFrame.functionName).toBe("(root)");
+  expect(data.samples.length).toBe(data.timeDeltas.length);
+  expect(data.samples.every((id: number) => ids.has(id))).toBe(true);
+  expect(data.endTime).toBeGreaterThanOrEqual(data.startTime);
+
+  const hot = data.nodes.find((node: any) => node.callFrame.functionName === "hot");
+  expect(hot.callFrame.url).toBe(script);
+  expect(hot.callFrame.lineNumber).toBe(1);
+  expect(hot.hitCount).toBeGreaterThan(0);
+});
+
+test("qjs --cpu-prof writes collapsed stacks for other file names", async () => {
+  const script = path.join(workdir, "busy.js");
+  const profile = path.join(workdir, "out.folded");
+  fs.writeFileSync(script, busyLoop);
+
+  const run = spawn(binDir("qjs"), ["--cpu-prof", profile, script]);
+  await run.completion;
+  expect(run.cleanResult().code).toBe(0);
+
+  const lines = fs.readFileSync(profile, "utf-8").trim().split("\n");
+  expect(lines.some((line) => line.includes(";hot ("))).toBe(true);
+});
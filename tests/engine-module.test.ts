@@ -271,6 +271,74 @@ test("engine.gc - runs without error", async () => {
   `);
 });
 
+test("engine.getMallocArenaStats - arenas are released after gc", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-m",
+    "-e",
+    `
+      import { gc, getMallocArenaStats } from "quickjs:engine";
+      const total = (stats) =>
+        stats.reduce((sum, st) => sum + st.arenaCount, 0);
+
+      let objs = [];
+      for (let i = 0; i < 100000; i++) {
+        objs.push({ i });
+      }
+      const before = getMallocArenaStats();
+      objs = null;
+      gc();
+      const after = getMallocArenaStats();
+
+      console.log("size classes:", before.length === after.length);
+      console.log("arenas released:", total(after) < total(before));
+      console.log(
+        "consistent:",
+        after.every(
+          (st) =>
+            st.usedBlockCount <= st.blockCount &&
+            st.emptyArenaCount <= st.arenaCount &&
+            st.fragmentation >= 0 &&
+            st.fragmentation <= 1
+        )
+      );
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "size classes: true
+    arenas released: true
+    consistent: true
+    ",
+    }
+  `);
+});
+
+test("engine.getOpcodeStats - null unless built with CONFIG_OPCODE_STATS", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-m",
+    "-e",
+    `
+      import { getOpcodeStats, resetOpcodeStats } from "quickjs:engine";
+      resetOpcodeStats();
+      console.log(getOpcodeStats());
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "null
+    ",
+    }
+  `);
+});
+
 // =========== ModuleDelegate.resolve ===========
 
 test("engine.ModuleDelegate.resolve - custom resolution", async () => {
@@ -0,0 +1,93 @@
+import { test, beforeAll, afterAll, expect } from "vitest";
+import { spawn } from "first-base";
+import { binDir, testsWorkDir } from "./_utils";
+import fs from "fs";
+
+const workDir = testsWorkDir.concat("fast-teardown");
+
+beforeAll(() => {
+  fs.rmSync(workDir(), { recursive: true, force: true });
+  fs.mkdirSync(workDir(), { recursive: true });
+});
+
+afterAll(() => {
+  fs.rmSync(workDir(), { recursive: true, force: true });
+});
+
+test("qjs exits cleanly with live objects and cycles", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      const a = {};
+      const b = { a };
+      a.b = b;
+      globalThis.keep = [
+        a,
+        new Map([[a, b]]),
+        new Uint8Array(1 << 20),
+        Promise.resolve(1),
+        new WeakRef(a),
+      ];
+      setTimeout(() => console.log("timer"), 0);
+      console.log("done");
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "done
+    timer
+    ",
+    }
+  `);
+});
+
+test("host finalizers still run: an unclosed FILE is flushed", async () => {
+  const testFile = workDir("unclosed.txt");
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      const std = require("quickjs:std");
+      const f = std.open(${JSON.stringify(testFile)}, "w");
+      f.puts("written before exit");
+      globalThis.f = f;
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "",
+    }
+  `);
+  expect(fs.readFileSync(testFile, "utf-8")).toBe("written before exit");
+});
+
+test("quickjs-run exits cleanly with live objects", async () => {
+  const testFile = workDir("live-objects.js");
+  fs.writeFileSync(
+    testFile,
+    `
+      const a = {};
+      a.self = a;
+      globalThis.keep = [a, new Set([a]), "x".repeat(10000)];
+      console.log("done");
+    `,
+  );
+  const run = spawn(binDir("quickjs-run"), [testFile]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "done
+    ",
+    }
+  `);
+});
@@ -0,0 +1,4 @@
+function step(x, y) { return x * 0.5 + y / 3 - 0.25; }
+let s = 0;
+for (let i = 0; i < 10000; i++) s = step(s, i);
+console.log(s.toFixed(6), step(1, 2), step("4", 3), step(0.5, 1.5));
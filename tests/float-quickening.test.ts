@@ -0,0 +1,137 @@
+import { test, beforeEach, expect } from "vitest";
+import fs from "fs";
+import path from "path";
+import { cp, rm, mkdir } from "shelljs";
+import { spawn } from "first-base";
+import { binDir, rootDir } from "./_utils";
+
+const workdir = rootDir("build/tests/float-quickening");
+
+beforeEach(() => {
+  rm("-rf", workdir);
+  mkdir("-p", workdir);
+});
+
+test("float64 quickening - int to float transition", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      function add(a, b) { return a + b; }
+      function sub(a, b) { return a - b; }
+      function mul(a, b) { return a * b; }
+      function div(a, b) { return a / b; }
+      const out = [];
+      for (const [a, b] of [[1, 2], [0x7fffffff, 1], [1.5, 2], [3, 0.25], [-0, 0], [0, -0], [1, 0], [-1, 0], [NaN, 1], [2 ** 53, 1.5]]) {
+        out.push([a, b, add(a, b), sub(a, b), mul(a, b), div(a, b)].map((x) => Object.is(x, -0) ? "-0" : String(x)).join(" "));
+      }
+      console.log(out.join("\\n"));
+      let s = 0;
+      for (let i = 0; i < 1000; i++) s = s * 0.5 + i / 4;
+      console.log(s);
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "1 2 3 -1 2 0.5
+    2147483647 1 2147483648 2147483646 2147483647 2147483647
+    1.5 2 3.5 -0.5 3 0.75
+    3 0.25 3.25 2.75 0.75 12
+    -0 0 0 -0 -0 NaN
+    0 -0 0 0 -0 NaN
+    1 0 1 1 0 Infinity
+    -1 0 -1 -1 -0 -Infinity
+    NaN 1 NaN NaN NaN NaN
+    9007199254740992 1.5 9007199254740994 9007199254740990 13510798882111488 6004799503160661
+    499
+    ",
+    }
+  `);
+});
+
+test("float64 quickening - deopt back to the generic opcodes", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      function add(a, b) { return a + b; }
+      function mul(a, b) { return a * b; }
+      for (let i = 0; i < 100; i++) { add(1.5, i); mul(i, 0.5); }
+      const log = [];
+      const obj = { valueOf() { log.push("valueOf"); return 2.5; } };
+      console.log(add(1.5, "x"), add("y", 0.5), add(1.5, 2n === 2n), add(0.5, undefined), add(0.5, null));
+      console.log(add(1.5, obj), mul(obj, 0.5), log.join(","));
+      try { add(1.5, 1n); } catch (e) { console.log(e.name); }
+      try { mul(2n, 0.5); } catch (e) { console.log(e.name); }
+      console.log(add(1.5, 2.25), mul(3, 0.5), add(2n, 3n), mul(2n, 3n));
+      // the sites alternate between the types past the miss limit
+      let r = [];
+      for (let i = 0; i < 40; i++) r.push(add(i % 2 ? 0.5 : "s", i));
+      console.log(r.slice(-4).join(" "), add(0.25, 0.5));
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "1.5x y0.5 2.5 NaN 0.5
+    4 1.25 valueOf,valueOf
+    TypeError
+    TypeError
+    3.75 1.5 5n 6n
+    s36 37.5 s38 39.5 0.75
+    ",
+    }
+  `);
+});
+
+// The bytecode appended to qjsbootstrap-bytecode is read-only: its
+// arithmetic opcodes must run without being rewritten.
+test("float64 quickening - read-only bytecode", async () => {
+  const bytecodePath = path.join(workdir, "float-arith.bin");
+
+  const compile = spawn(
+    binDir("qjs"),
+    [
+      "-e",
+      `
+        const std = require("quickjs:std");
+        const bytecode = require("quickjs:bytecode");
+        const compiled = bytecode.fromFile("tests/fixtures/float-arith.js");
+        const outFile = std.open(${JSON.stringify(bytecodePath)}, "wb");
+        outFile.write(compiled, 0, compiled.byteLength);
+        outFile.close();
+      `,
+    ],
+    { cwd: rootDir() }
+  );
+  await compile.completion;
+  expect(compile.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "",
+    }
+  `);
+
+  const prog = path.join(workdir, "myprog");
+  cp(binDir("qjsbootstrap-bytecode"), prog);
+  fs.appendFileSync(prog, fs.readFileSync(bytecodePath));
+
+  const run = spawn(prog, { argv0: "myprog" });
+  await run.completion;
+  expect(run.result).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "6664.833333 0.9166666666666665 2.75 0.5
+    ",
+    }
+  `);
+});
@@ -0,0 +1,140 @@
+import { test, expect } from "vitest";
+import { spawn } from "first-base";
+import { binDir } from "./_utils";
+
+test("fused opcodes - get_loc_check superinstructions keep the TDZ check", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      function tdz(f) {
+        try {
+          f();
+          console.log("no error");
+        } catch (e) {
+          console.log(e.constructor.name + ": " + e.message);
+        }
+      }
+      tdz(() => { { f(); let i = 0; function f() { i++; } } });
+      tdz(() => { { f(); let i = 0; function f() { i--; } } });
+      tdz(() => { { f(); let i = 0; function f() { i += 2; } } });
+      tdz(() => { { f(); let o = {}; function f() { return o.x; } } });
+      tdz(() => { let n = 0; { n++; n += 2; } });
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "ReferenceError: i is not initialized
+    ReferenceError: i is not initialized
+    ReferenceError: i is not initialized
+    ReferenceError: o is not initialized
+    no error
+    ",
+    }
+  `);
+});
+
+test("fused opcodes - add_loc int overflow and non-int operands", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      function f(a, b) { let x = a; x += b; return x; }
+      console.log(f(2147483647, 1), f(-2147483648, -1), f(1, 2));
+      console.log(f("a", 1), f(1, "a"), f(1.5, 1), typeof f(1n, 2n));
+      function g() { let s = 0; for (let i = 0; i < 3; i++) s += 1073741824; return s; }
+      console.log(g());
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "2147483648 -2147483649 3
+    a1 1a 2.5 bigint
+    3221225472
+    ",
+    }
+  `);
+});
+
+test("fused opcodes - lt_if_false calls valueOf once, in order", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      const log = [];
+      const obj = (name, v) => ({ valueOf() { log.push(name); return v; } });
+      function cmp(a, b) { if (a < b) return "lt"; return "ge"; }
+      console.log(cmp(obj("a", 1), obj("b", 2)), cmp(obj("c", 2), obj("d", 1)), log.join(","));
+      console.log(cmp(NaN, 1), cmp(1, NaN), cmp("a", "b"), cmp(undefined, 1));
+      function loop(limit) { let n = 0; for (let i = 0; i < limit; i++) n++; return n; }
+      let calls = 0;
+      console.log(loop({ valueOf() { calls++; return 3; } }), calls);
+      try {
+        cmp({ valueOf() { throw new Error("boom"); } }, 1);
+      } catch (e) {
+        console.log(e.message);
+      }
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "lt ge a,b,c,d
+    ge ge lt ge
+    3 4
+    boom
+    ",
+    }
+  `);
+});
+
+test("fused opcodes - get_loc_get_field2 method calls on locals", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      function call(o) { return o.m(1); }
+      console.log(call({ m(x) { return x + 1; } }), call({ get m() { return () => "getter"; } }));
+      function prim(s) { return s.toUpperCase(); }
+      console.log(prim("abc"), (function (n) { return n.toFixed(2); })(1.5));
+      for (const arg of [{ get m() { throw new Error("getter threw"); } }, undefined, {}]) {
+        try {
+          call(arg);
+        } catch (e) {
+          console.log(e.constructor.name + ": " + e.message);
+        }
+      }
+      function poly(arr) {
+        const r = [];
+        for (const o of arr) {
+          let x = o;
+          r.push(x.v);
+        }
+        return r.join(",");
+      }
+      console.log(poly([{ v: 1 }, { a: 0, v: 2 }, Object.create({ v: 3 }), [4], { v: 5 }]));
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "2 getter
+    ABC 1.50
+    Error: getter threw
+    TypeError: cannot read property 'm' of undefined
+    TypeError: not a function
+    1,2,3,,5
+    ",
+    }
+  `);
+});
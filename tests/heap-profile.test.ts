@@ -0,0 +1,142 @@
+import { test, beforeEach, expect } from "vitest";
+import fs from "fs";
+import path from "path";
+import { rm, mkdir } from "shelljs";
+import { spawn } from "first-base";
+import { binDir, rootDir } from "./_utils";
+
+const workdir = rootDir("build/tests/heap-profile");
+
+beforeEach(() => {
+  rm("-rf", workdir);
+  mkdir("-p", workdir);
+});
+
+test("engine.startHeapSampling/stopHeapSampling - heapprofile", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-m",
+    "-e",
+    `
+      import { startHeapSampling, stopHeapSampling } from "quickjs:engine";
+      const kept = [];
+      function allocate() {
+        for (let i = 0; i < 10000; i++) {
+          kept.push({ i });
+        }
+      }
+      startHeapSampling(1024);
+      allocate();
+      const profile = JSON.parse(stopHeapSampling());
+      const ids = new Set();
+      let found = false;
+      (function walk(node) {
+        ids.add(node.id);
+        if (node.callFrame.functionName === "allocate") found = true;
+        node.children.forEach(walk);
+      })(profile.head);
+      console.log("allocate sampled:", found);
+      console.log(
+        "samples:",
+        profile.samples.length > 0 &&
+          profile.samples.every((s) => ids.has(s.nodeId) && s.size > 0)
+      );
+      console.log("stopped:", stopHeapSampling());
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "allocate sampled: true
+    samples: true
+    stopped: null
+    ",
+    }
+  `);
+});
+
+test("engine.stopHeapSampling - rejects unknown formats", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-m",
+    "-e",
+    `
+      import { startHeapSampling, stopHeapSampling } from "quickjs:engine";
+      startHeapSampling();
+      try {
+        stopHeapSampling("pprof");
+      } catch (err) {
+        console.log(err.name, err.message);
+      }
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "TypeError stopHeapSampling: format must be "heapprofile" or "collapsed"
+    ",
+    }
+  `);
+});
+
+test("engine.writeHeapSnapshot writes a Chrome .heapsnapshot", async () => {
+  const snapshot = path.join(workdir, "out.heapsnapshot");
+  const run = spawn(binDir("qjs"), [
+    "-m",
+    "-e",
+    `
+      import { writeHeapSnapshot } from "quickjs:engine";
+      class Retained {
+        constructor() {
+          this.payload = "payload-" + Math.random();
+        }
+      }
+      globalThis.retained = new Retained();
+      writeHeapSnapshot(${JSON.stringify(snapshot)});
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult().code).toBe(0);
+
+  const data = JSON.parse(fs.readFileSync(snapshot, "utf-8"));
+  const meta = data.snapshot.meta;
+  const nodeFieldCount = meta.node_fields.length;
+  const edgeFieldCount = meta.edge_fields.length;
+  expect(data.nodes.length).toBe(data.snapshot.node_count * nodeFieldCount);
+  expect(data.edges.length).toBe(data.snapshot.edge_count * edgeFieldCount);
+
+  // every edge points to the start of a node, and the edge counts of the
+  // nodes add up to the number of edges
+  let edgeSum = 0;
+  for (let i = 0; i < data.nodes.length; i += nodeFieldCount) {
+    edgeSum += data.nodes[i + meta.node_fields.indexOf("edge_count")];
+  }
+  expect(edgeSum).toBe(data.snapshot.edge_count);
+  const toNode = meta.edge_fields.indexOf("to_node");
+  for (let i = 0; i < data.edges.length; i += edgeFieldCount) {
+    expect(data.edges[i + toNode] % nodeFieldCount).toBe(0);
+    expect(data.edges[i + toNode]).toBeLessThan(data.nodes.length);
+  }
+
+  // the instance is named after its class and its property is an edge
+  const nodeTypes = meta.node_types[0];
+  const nodes = [];
+  for (let i = 0; i < data.nodes.length; i += nodeFieldCount) {
+    nodes.push({
+      type: nodeTypes[data.nodes[i]],
+      name: data.strings[data.nodes[i + 1]],
+    });
+  }
+  expect(nodes[0].type).toBe("synthetic");
+  expect(nodes.some((n) => n.type === "object" && n.name === "Retained")).toBe(
+    true
+  );
+  expect(
+    nodes.some((n) => n.type === "string" && n.name.startsWith("payload-"))
+  ).toBe(true);
+  expect(data.strings).toContain("payload");
+});
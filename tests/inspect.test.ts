@@ -30,3 +30,36 @@ test("inspect", async () => {
     }
   `);
 });
+
+test("inspect - global is created on first use", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-m",
+    "-e",
+    `
+      import { Context } from "quickjs:context";
+      const desc = Object.getOwnPropertyDescriptor(globalThis, "inspect");
+      console.log(typeof desc.value, desc.writable, desc.enumerable, desc.configurable);
+      const ctx = new Context();
+      console.log(ctx.globalThis.inspect([1, "two"]));
+      console.log(ctx.globalThis.inspect === inspect);
+      globalThis.inspect = "replaced";
+      console.log(inspect);
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "function true true true
+    Array [
+    	1
+    	"two"
+    ]
+    false
+    replaced
+    ",
+    }
+  `);
+});
@@ -0,0 +1,105 @@
+import { test, expect } from "vitest";
+import { spawn } from "first-base";
+import { binDir } from "./_utils";
+
+test("qjs --lazy-functions - closures behave as with a full parse", async () => {
+  const run = spawn(binDir("qjs"), [
+    "--lazy-functions",
+    "-e",
+    `
+      let counter = 0;
+      function makeAdder(n) {
+        let total = n;
+        return function add(x) {
+          counter++;
+          total += x;
+          return total;
+        };
+      }
+      const add = makeAdder(10);
+      add(1);
+      console.log(add(2), counter);
+
+      function* gen(n) {
+        for (let i = 0; i < n; i++) yield i * 2;
+      }
+      console.log([...gen(3)].join(","));
+
+      function withEval(a) {
+        return eval("a + 1");
+      }
+      console.log(withEval(41));
+
+      async function later(v) {
+        return (await v) + 1;
+      }
+      later(Promise.resolve(1)).then((v) => console.log("async", v));
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "13 2
+    0,2,4
+    42
+    async 2
+    ",
+    }
+  `);
+});
+
+test("qjs --lazy-functions - syntax errors are reported before running", async () => {
+  const run = spawn(binDir("qjs"), [
+    "--lazy-functions",
+    "-e",
+    `
+      console.log("ran");
+      function broken() {
+        return 1 +;
+      }
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 1,
+      "error": null,
+      "stderr": "SyntaxError: unexpected token in expression: ';'
+        at <cmdline>
+
+    ",
+      "stdout": "",
+    }
+  `);
+});
+
+test("qjs --lazy-functions - early errors in nested bodies are reported before running", async () => {
+  const run = spawn(binDir("qjs"), [
+    "--lazy-functions",
+    "-e",
+    `
+      console.log("ran");
+      function outer() {
+        function inner() {
+          let x;
+          let x;
+        }
+      }
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 1,
+      "error": null,
+      "stderr": "SyntaxError: invalid redefinition of lexical identifier
+        at <cmdline>
+
+    ",
+      "stdout": "",
+    }
+  `);
+});
@@ -1063,3 +1063,43 @@ test("quickjs:context - deeply-nested contexts", async () => {
     }
   `);
 });
+
+test("quickjs:context - builtins are created on first use", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      import { Context } from "quickjs:context";
+      const ctx = new Context();
+      const checks = [
+        ctx.eval("/b+/.exec('abbc')[0]"),
+        ctx.eval("Object.getPrototypeOf(/x/) === RegExp.prototype"),
+        ctx.eval("'abc'.search('c')"),
+        ctx.eval(
+          "const toString = Array.prototype.toString;" +
+          "Array.prototype.toString = () => 'patched';" +
+          "const buf = new Uint8Array([1, 2]).buffer;" +
+          "Array.prototype.toString = toString;" +
+          "buf.constructor === ArrayBuffer && Object.getPrototypeOf(Uint8Array).prototype.toString === toString"
+        ),
+        ctx.eval("Object.getPrototypeOf(new Map().keys()) === Object.getPrototypeOf(new Map([[1, 2]]).entries())"),
+        ctx.eval("new Date(0).toISOString()"),
+        ctx.eval("Object.getOwnPropertyNames(globalThis).includes('WeakSet')"),
+      ];
+      console.log(checks.join(" "));
+
+      const u8 = ctx.eval("new Uint8Array(1)");
+      console.log(u8 instanceof Uint8Array, Object.getPrototypeOf(u8) === ctx.globalThis.Uint8Array.prototype);
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "bb true 2 true true 1970-01-01T00:00:00.000Z true
+    false true
+    ",
+    }
+  `);
+});
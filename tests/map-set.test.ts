@@ -0,0 +1,88 @@
+import { test, expect } from "vitest";
+import { spawn } from "first-base";
+import { binDir } from "./_utils";
+
+test("Map and Set - string keys built in different ways", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      const m = new Map([["abc", 1]]);
+      let k = "ab";
+      k += "c";
+      console.log(m.get(k), m.get("ab" + "c"), m.has(k));
+
+      const url = "https://example.com/" + "path/".repeat(200);
+      m.set(url, 2);
+      console.log(m.get("https://example.com/" + "path/".repeat(200)), m.get(url + "x"));
+
+      let s = "x".repeat(10);
+      m.set(s, 3);
+      s += "y";
+      console.log(m.get(s), m.get("x".repeat(10)), new Set([s]).has("x".repeat(10) + "y"));
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "1 1 true
+    2 undefined
+    undefined 3 true
+    ",
+    }
+  `);
+});
+
+test("Map and Set - iteration while entries are added, deleted and compacted", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      const m = new Map();
+      for (let i = 0; i < 10; i++) m.set(i, i);
+      const seen = [];
+      m.forEach((v, k) => {
+        seen.push(k);
+        if (k === 2) m.delete(5);
+        if (k === 3) m.delete(3);
+        if (k < 2) m.set(100 + k, 0);
+      });
+      console.log(seen.join(), m.size);
+
+      const s = new Set([1, 2, 3]);
+      const order = [];
+      for (const x of s) {
+        order.push(x);
+        if (x === 1) {
+          s.clear();
+          s.add(7);
+          s.add(8);
+        }
+      }
+      console.log(order.join(), s.size);
+
+      const big = new Map();
+      for (let i = 0; i < 1000; i++) big.set(i, i);
+      const it = big.keys();
+      it.next();
+      it.next();
+      for (let i = 0; i < 998; i++) big.delete(i);
+      for (let i = 0; i < 2000; i++) big.set("k" + i, i);
+      const rest = [...it];
+      console.log(rest.length, rest.slice(0, 3).join(), big.size, big.get("k1999"));
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "0,1,2,3,4,6,7,8,9,100,101 10
+    1,7,8 2
+    2002 998,999,k0 2002 1999
+    ",
+    }
+  `);
+});
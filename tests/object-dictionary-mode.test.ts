@@ -0,0 +1,63 @@
+import { test, expect } from "vitest";
+import { spawn } from "first-base";
+import { binDir } from "./_utils";
+
+test("objects with many properties keep working after switching to dictionary mode", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      const o = {};
+      for (let i = 0; i < 64; i++) o["k" + i] = i;
+      o.extra = 1;
+      o.more = 2;
+      console.log(Object.keys(o).length, o.k0, o.k63, o.extra, o.more);
+
+      for (let j = 0; j < 3; j++) {
+        const p = {};
+        for (let i = 0; i < 70; i++) p["k" + i] = i;
+        p.extra = j;
+        delete p.k1;
+        console.log(Object.keys(p).length, p.k69, p.extra, "k1" in p);
+      }
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "66 0 63 1 2
+    70 69 0 false
+    70 69 1 false
+    70 69 2 false
+    ",
+    }
+  `);
+});
+
+test("objects with many properties added in the same order share their shapes", async () => {
+  const run = spawn(binDir("qjs"), [
+    "--dump",
+    "-e",
+    `
+      globalThis.records = [];
+      for (let j = 0; j < 1000; j++) {
+        const o = {};
+        for (let i = 0; i < 70; i++) o["k" + i] = j;
+        records.push(o);
+      }
+      console.log(records[999].k69, Object.keys(records[0]).length);
+    `,
+  ]);
+  await run.completion;
+  const result = run.cleanResult();
+  expect(result.code).toBe(0);
+  expect(result.stdout).toMatch(/^999 70\n/);
+
+  // "shapes <count> <size>" line of the memory usage dump: one shape
+  // per property count, not one per object
+  const match = result.stdout.match(/^\s*shapes\s+(\d+)/m);
+  expect(match).not.toBeNull();
+  expect(Number(match?.[1])).toBeLessThan(200);
+});
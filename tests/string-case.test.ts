@@ -0,0 +1,29 @@
+import { test, expect } from "vitest";
+import { spawn } from "first-base";
+import { binDir } from "./_utils";
+
+test("String.prototype case conversion, trim and normalize - ASCII and non-ASCII strings", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      const header = "Content-Type: Application/JSON; Charset=UTF-8".repeat(3);
+      console.log(header.toLowerCase().slice(0, 45), header.toUpperCase().length);
+      console.log("already lower".toLowerCase(), "ÉCOLE Straße".toLowerCase(), "straße".toUpperCase());
+      console.log("[" + " \\t trim me\\n ".trim() + "]", "\\u00a0x\\u3000".trim().length);
+      console.log("abc".normalize("NFD"), "e\\u0301".normalize() === "\\u00e9");
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "content-type: application/json; charset=utf-8 135
+    already lower école straße STRASSE
+    [trim me] 1
+    abc true
+    ",
+    }
+  `);
+});
@@ -0,0 +1,43 @@
+import { test, expect } from "vitest";
+import { spawn } from "first-base";
+import { binDir } from "./_utils";
+
+test("String concatenation, template literals and Array.prototype.join", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      let html = "";
+      for (let i = 0; i < 2000; i++) html = \`\${html}<li>\${i}</li>\`;
+      console.log(html.length, html[12345], html.slice(-12));
+
+      const order = [];
+      const obj = (v) => ({ toString() { order.push(v); return v; } });
+      console.log("a".concat(obj("b"), 1, null, obj("c")), order.join(","));
+
+      const parts = ["x".repeat(600), "€", "y", html];
+      console.log(parts.join("|").length, [1, , null, "a", parts[1]].join("-"));
+
+      console.log("".concat(...Array(65000).fill("ab")).length);
+      const mb = "x".repeat(1 << 20);
+      try {
+        mb.concat(...Array(1100).fill(mb));
+      } catch (e) {
+        console.log(e.name, e.message);
+      }
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "24890 < li>1999</li>
+    ab1nullc b,c
+    25495 1---a-€
+    130000
+    InternalError string too long
+    ",
+    }
+  `);
+});
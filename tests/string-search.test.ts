@@ -0,0 +1,43 @@
+import { test, expect } from "vitest";
+import { spawn } from "first-base";
+import { binDir } from "./_utils";
+
+test("String.prototype.indexOf/lastIndexOf/includes - substring search", async () => {
+  const run = spawn(binDir("qjs"), [
+    "-e",
+    `
+      const text = "the quick brown fox jumps over the lazy dog. ".repeat(20);
+      console.log(text.indexOf("lazy"), text.indexOf("lazy", 40), text.lastIndexOf("the"), text.lastIndexOf("the", 900));
+      console.log(text.includes("dog. the"), text.includes("cat"), text.indexOf(""), text.lastIndexOf("", 3));
+
+      const wide = "€ " + text;
+      console.log(wide.indexOf("fox"), wide.lastIndexOf("fox"), wide.indexOf("€", 1), text.indexOf("€"));
+      console.log(text.indexOf("€fox".slice(1)), wide.lastIndexOf("€fox".slice(1), 100));
+
+      // long periodic needles take the linear time path
+      const hay = "a".repeat(100000);
+      console.log(hay.indexOf("a".repeat(500) + "b"), (hay + "b").indexOf("a".repeat(500) + "b"));
+      console.log(hay.split("a".repeat(30000)).length, hay.replaceAll("aaaa", "").length);
+
+      // the first and last characters match everywhere: two-way search
+      const needle = "a".repeat(500) + "b" + "a";
+      console.log(hay.indexOf(needle), (hay + "ba").indexOf(needle), (hay.slice(50000) + "ba" + hay.slice(50000)).indexOf(needle, 100), hay.includes(needle));
+    `,
+  ]);
+  await run.completion;
+  expect(run.cleanResult()).toMatchInlineSnapshot(`
+    {
+      "code": 0,
+      "error": null,
+      "stderr": "",
+      "stdout": "35 80 886 886
+    true false 0 3
+    18 873 -1 -1
+    16 63
+    -1 99500
+    4 0
+    -1 99500 49500 false
+    ",
+    }
+  `);
+});